@@ -0,0 +1,356 @@
+/**
+ * Copyright (C) 2011 Anders Sundman <anders@4zm.org>
+ *
+ * This file is part of mfterm.
+ *
+ * mfterm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * mfterm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with mfterm.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <pthread.h>
+#include "crypto1.h"
+#include "parallel.h"
+#include "crack.h"
+#include "bruteforce.h"
+
+/**
+ * The checkpoint is a text file:
+ *
+ *   # mfterm brute force checkpoint
+ *   pattern a0a1a2??????
+ *   auth 01020304 4d2f1a03 15d4ff0d 654cb922
+ *   auth 01020304 8e1c73a0 2f7a1b44 0a9b3cd1 77e01f2a
+ *   done 68719476736
+ *   hit a0a1a2b3c4d5
+ *
+ * One auth line per authentication (uid nt {nr} {ar} [{at}]) and one
+ * hit line per key found so far. The checkpoint is only resumed by a
+ * search with the same pattern and authentications.
+ */
+
+// The keys handed to a thread at a time, and the keys run through the
+// batch function at a time
+#define BF_CHUNK (1 << 20)
+#define BF_BATCH (16 * CRYPTO1_BATCH_MAX)
+
+// A key is taken as certain if the authentications check this many
+// bits more than the pattern leaves unknown
+#define BF_MARGIN 16
+
+// The state of a search, shared by the threads
+typedef struct {
+  bruteforce_t* bf;
+  uint32_t ks2;          // The keystream of the first reader answer
+  uint64_t keys;         // The keys of the pattern
+  uint64_t offset;       // The keys done before this run
+  bool certain;
+  pthread_mutex_t mutex;
+  parallel_progress_t progress;
+} bf_run_t;
+
+static int bf_bits(uint64_t mask) {
+  int bits = 0;
+  for (; mask; mask &= mask - 1)
+    ++bits;
+  return bits;
+}
+
+// Spread the bits of n over the set bits of mask, lowest first
+static uint64_t bf_deposit(uint64_t n, uint64_t mask) {
+  uint64_t x = 0;
+  for (uint64_t bit = 1; mask; bit <<= 1) {
+    uint64_t low = mask & (~mask + 1);
+    if (n & bit)
+      x |= low;
+    mask ^= low;
+  }
+  return x;
+}
+
+static const char* bf_sprint_pattern(uint64_t value, uint64_t mask) {
+  static char str[13];
+  for (int i = 0; i < 12; ++i) {
+    int shift = 44 - 4 * i;
+    if ((mask >> shift) & 0xf)
+      str[i] = '?';
+    else
+      str[i] = "0123456789abcdef"[(value >> shift) & 0xf];
+  }
+  str[12] = '\0';
+  return str;
+}
+
+int bruteforce_pattern(const char* str, uint64_t* value, uint64_t* mask) {
+  if (strlen(str) != 12) {
+    printf("Invalid key pattern (12 hex digits or ?): %s\n", str);
+    return -1;
+  }
+
+  *value = 0;
+  *mask = 0;
+  for (int i = 0; i < 12; ++i) {
+    *value <<= 4;
+    *mask <<= 4;
+    if (str[i] == '?')
+      *mask |= 0xf;
+    else if (isdigit((unsigned char)str[i]))
+      *value |= (uint64_t)(str[i] - '0');
+    else if (isxdigit((unsigned char)str[i]))
+      *value |= (uint64_t)(tolower((unsigned char)str[i]) - 'a' + 10);
+    else {
+      printf("Invalid key pattern (12 hex digits or ?): %s\n", str);
+      return -1;
+    }
+  }
+
+  if (bf_bits(*mask) > BRUTEFORCE_MAX_BITS) {
+    printf("Too many unknown nibbles (at most %d): %s\n",
+           BRUTEFORCE_MAX_BITS / 4, str);
+    return -1;
+  }
+  return 0;
+}
+
+const char* bruteforce_file_name(uint32_t uid, size_t sector,
+                                 mf_key_type_t key_type) {
+  static char fn[64];
+  snprintf(fn, sizeof(fn), "mfterm-%08x-%02zx%c.bf", (unsigned int)uid,
+           sector, key_type == MF_KEY_A ? 'A' : 'B');
+  return fn;
+}
+
+static bool bf_same_auth(const crack_auth_t* a, const crack_auth_t* b) {
+  return a->uid == b->uid && a->nt == b->nt && a->nr_enc == b->nr_enc &&
+    a->ar_enc == b->ar_enc && a->has_at == b->has_at &&
+    (!a->has_at || a->at_enc == b->at_enc);
+}
+
+// Set the progress of the search from its checkpoint, if there is one
+// for the same search
+static void bf_load(bruteforce_t* bf) {
+  const char* fn = bruteforce_file_name(bf->auths[0].uid, bf->sector,
+                                        bf->key_type);
+  FILE* bf_file = fopen(fn, "r");
+  if (bf_file == NULL)
+    return;
+
+  char line[128];
+  char pattern[16] = "";
+  size_t count = 0;
+  unsigned long long done = 0;
+  uint64_t hits[CRACK_MAX_HITS];
+  size_t hit_count = 0;
+  bool same = true;
+  while (same && fgets(line, sizeof(line), bf_file)) {
+    unsigned int w[5];
+    unsigned long long key;
+    if (line[0] == '#')
+      continue;
+    if (sscanf(line, "pattern %15s", pattern) == 1 ||
+        sscanf(line, "done %llu", &done) == 1)
+      continue;
+    if (sscanf(line, "hit %llx", &key) == 1) {
+      if (hit_count < CRACK_MAX_HITS)
+        hits[hit_count++] = key;
+      continue;
+    }
+
+    int n = sscanf(line, "auth %x %x %x %x %x",
+                   &w[0], &w[1], &w[2], &w[3], &w[4]);
+    if (n < 4 || count == bf->count) {
+      same = false;
+      break;
+    }
+    crack_auth_t auth = { w[0], w[1], w[2], w[3], n == 5 ? w[4] : 0, n == 5 };
+    same = bf_same_auth(&auth, &bf->auths[count++]);
+  }
+  fclose(bf_file);
+
+  if (same && count == bf->count &&
+      strcmp(pattern, bf_sprint_pattern(bf->value, bf->mask)) == 0) {
+    bf->done = done;
+    memcpy(bf->hits, hits, hit_count * sizeof(uint64_t));
+    bf->hit_count = hit_count;
+  }
+  else
+    printf("Ignoring the checkpoint of another search: %s\n", fn);
+}
+
+static int bf_save(const bruteforce_t* bf) {
+  const char* fn = bruteforce_file_name(bf->auths[0].uid, bf->sector,
+                                        bf->key_type);
+  char tmp_fn[72];
+  snprintf(tmp_fn, sizeof(tmp_fn), "%s.tmp", fn);
+
+  FILE* bf_file = fopen(tmp_fn, "w");
+  if (bf_file == NULL) {
+    printf("Could not open file: %s\n", tmp_fn);
+    return 1;
+  }
+
+  fprintf(bf_file, "# mfterm brute force checkpoint\n");
+  fprintf(bf_file, "pattern %s\n", bf_sprint_pattern(bf->value, bf->mask));
+  for (size_t i = 0; i < bf->count; ++i) {
+    const crack_auth_t* auth = &bf->auths[i];
+    fprintf(bf_file, "auth %08x %08x %08x %08x", (unsigned int)auth->uid,
+            (unsigned int)auth->nt, (unsigned int)auth->nr_enc,
+            (unsigned int)auth->ar_enc);
+    if (auth->has_at)
+      fprintf(bf_file, " %08x", (unsigned int)auth->at_enc);
+    fprintf(bf_file, "\n");
+  }
+  fprintf(bf_file, "done %llu\n", (unsigned long long)bf->done);
+  for (size_t i = 0; i < bf->hit_count; ++i)
+    fprintf(bf_file, "hit %012llx\n", (unsigned long long)bf->hits[i]);
+
+  if (fclose(bf_file) != 0 || rename(tmp_fn, fn) != 0) {
+    printf("Could not write checkpoint: %s\n", fn);
+    remove(tmp_fn);
+    return 1;
+  }
+  return 0;
+}
+
+// Print the progress and save the checkpoint, when it's time
+static void bf_progress(bf_run_t* run, bool force) {
+  if (parallel_progress_print_due(&run->progress, force)) {
+    double part = (double)run->progress.done / (double)run->keys;
+    double rate = (double)(run->progress.done - run->offset) /
+      (parallel_time() - run->progress.start);
+    double left = rate > 0 ?
+      (double)(run->keys - run->progress.done) / rate : 0;
+    unsigned long s = (unsigned long)left;
+    printf("Searched %5.1f%% of 2^%d keys, %.1f Mkeys/s, "
+           "%lu:%02lu:%02lu left\n",
+           100.0 * part, bf_bits(run->bf->mask), rate / 1e6,
+           s / 3600, s / 60 % 60, s % 60);
+  }
+  if (parallel_progress_save_due(&run->progress, force)) {
+    run->bf->done = run->progress.done;
+    bf_save(run->bf);
+  }
+}
+
+// Add a key to the hits, unless it's there already (a resumed search
+// can find a hit of the checkpoint again)
+static void bf_hit(bruteforce_t* bf, uint64_t key) {
+  for (size_t i = 0; i < bf->hit_count; ++i)
+    if (bf->hits[i] == key)
+      return;
+  if (bf->hit_count < CRACK_MAX_HITS)
+    bf->hits[bf->hit_count++] = key;
+}
+
+static bool bf_chunk(size_t begin, size_t end, void* arg) {
+  bf_run_t* run = (bf_run_t*)arg;
+  bruteforce_t* bf = run->bf;
+  const crack_auth_t* auth = &bf->auths[0];
+  uint64_t first = run->offset + begin, last = run->offset + end;
+  uint64_t keys[BF_BATCH];
+  uint64_t hits[BF_BATCH];
+  bool found = false;
+
+  // The unknown bits count up under the mask: set the others, add one
+  uint64_t unknown = bf_deposit(first, bf->mask);
+  for (uint64_t i = first; i < last; ) {
+    size_t n = last - i < BF_BATCH ? (size_t)(last - i) : BF_BATCH;
+    for (size_t k = 0; k < n; ++k) {
+      keys[k] = bf->value | unknown;
+      unknown = ((unknown | ~bf->mask) + 1) & bf->mask;
+    }
+    i += n;
+
+    size_t count = crypto1_batch_check(keys, n, auth->uid ^ auth->nt,
+                                       auth->nr_enc, run->ks2, hits);
+    for (size_t h = 0; h < count; ++h) {
+      size_t a = 0;
+      while (a < bf->count && crack_check_key(&bf->auths[a], hits[h]))
+        ++a;
+      if (a < bf->count)
+        continue;
+      pthread_mutex_lock(&run->mutex);
+      bf_hit(run->bf, hits[h]);
+      pthread_mutex_unlock(&run->mutex);
+      found = run->certain;
+    }
+  }
+
+  pthread_mutex_lock(&run->mutex);
+  parallel_progress_add(&run->progress, first, last);
+  bf_progress(run, false);
+  pthread_mutex_unlock(&run->mutex);
+
+  return !found;
+}
+
+int bruteforce_search(bruteforce_t* bf, uint64_t* hits) {
+
+  if (bf->count == 0) {
+    printf("An authentication is needed.\n");
+    return -1;
+  }
+
+  bf_run_t run;
+  run.bf = bf;
+  run.keys = (uint64_t)1 << bf_bits(bf->mask);
+  run.ks2 = bf->auths[0].ar_enc ^ prng_successor(bf->auths[0].nt, 64);
+
+  // Each reader or tag answer checks 32 bits of the key
+  int checked = 0;
+  for (size_t i = 0; i < bf->count; ++i)
+    checked += bf->auths[i].has_at ? 64 : 32;
+  run.certain = checked >= bf_bits(bf->mask) + BF_MARGIN;
+  if (checked <= bf_bits(bf->mask))
+    printf("About 2^%d wrong keys fit the authentications; "
+           "give more of them or the tag answer.\n",
+           bf_bits(bf->mask) - checked);
+
+  bf->done = 0;
+  bf->hit_count = 0;
+  bf_load(bf);
+  run.offset = bf->done < run.keys ? bf->done : run.keys;
+  parallel_progress_init(&run.progress, run.offset);
+  pthread_mutex_init(&run.mutex, NULL);
+
+  printf("Searching 2^%d keys (%s) on %zu threads, %s.\n",
+         bf_bits(bf->mask), bf_sprint_pattern(bf->value, bf->mask),
+         parallel_threads(), crypto1_batch_name());
+  if (run.offset)
+    printf("Resuming at %.1f%%.\n",
+           100.0 * (double)run.offset / (double)run.keys);
+  for (size_t i = 0; i < bf->hit_count; ++i)
+    printf("Found before: %012llx\n", (unsigned long long)bf->hits[i]);
+
+  // A certain key in the checkpoint ends the search right away
+  int res = run.certain && bf->hit_count ? 0 :
+    parallel_for((size_t)(run.keys - run.offset), BF_CHUNK, bf_chunk, &run);
+
+  pthread_mutex_lock(&run.mutex);
+  bf_progress(&run, true);
+  pthread_mutex_unlock(&run.mutex);
+  if (res == 0 || (run.certain && bf->hit_count))
+    remove(bruteforce_file_name(bf->auths[0].uid, bf->sector,
+                                bf->key_type));
+  pthread_mutex_destroy(&run.mutex);
+
+  memcpy(hits, bf->hits, bf->hit_count * sizeof(uint64_t));
+  if (bf->hit_count)
+    return (int)bf->hit_count;
+  return res == 0 ? 0 : -1;
+}
@@ -0,0 +1,78 @@
+#ifndef BRUTEFORCE__H
+#define BRUTEFORCE__H
+
+/**
+ * Copyright (C) 2011 Anders Sundman <anders@4zm.org>
+ *
+ * This file is part of mfterm.
+ *
+ * mfterm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * mfterm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with mfterm.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "tag.h"
+#include "crack.h"
+
+/**
+ * Search all keys that fit a pattern, e.g. a0a1a2??????, against
+ * recorded authentications. Part of a key is often known (a vendor
+ * prefix, bytes shared with the other sectors), so only the unknown
+ * nibbles are searched, with the batch Crypto1 on all cores.
+ */
+
+// The most unknown bits of a pattern (10 nibbles)
+#define BRUTEFORCE_MAX_BITS 40
+
+/**
+ * A search and its progress. This is also the checkpoint; saved, the
+ * search can continue after an interruption.
+ */
+typedef struct {
+  size_t sector;
+  mf_key_type_t key_type;
+  uint64_t value;    // The known bits of the key
+  uint64_t mask;     // The unknown bits
+  crack_auth_t auths[CRACK_MAX_AUTHS];
+  size_t count;
+  uint64_t done;     // The keys searched, in order
+  uint64_t hits[CRACK_MAX_HITS];  // The keys found so far
+  size_t hit_count;
+} bruteforce_t;
+
+/**
+ * Parse a key pattern: 12 hex digits, with a ? for each unknown
+ * nibble. Print an error and return -1 if it isn't valid or has more
+ * than BRUTEFORCE_MAX_BITS unknown bits.
+ */
+int bruteforce_pattern(const char* str, uint64_t* value, uint64_t* mask);
+
+// Return the name of the checkpoint file: mfterm-<uid>-<sector><A|B>.bf
+const char* bruteforce_file_name(uint32_t uid, size_t sector,
+                                 mf_key_type_t key_type);
+
+/**
+ * Search the keys of the pattern on all cores. A checkpoint of the
+ * same search (pattern and authentications) in the current directory
+ * is resumed, with the keys it had found. The progress and an estimate of the time left are
+ * printed as the search goes on, and the checkpoint is saved now and
+ * then; it is removed when the search completes. The search stops at
+ * the first key once the authentications leave no doubt. Return the
+ * number of keys found (in hits, room for CRACK_MAX_HITS), or -1 if
+ * cancelled or on error.
+ */
+int bruteforce_search(bruteforce_t* bf, uint64_t* hits);
+
+#endif
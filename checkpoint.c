@@ -0,0 +1,153 @@
+/**
+ * Copyright (C) 2011 Anders Sundman <anders@4zm.org>
+ *
+ * This file is part of mfterm.
+ *
+ * mfterm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mfterm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mfterm.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "tag.h"
+#include "checkpoint.h"
+
+/**
+ * The checkpoint is a small text file:
+ *
+ *   # mfterm dict attack checkpoint
+ *   uid 0a1b2c3d
+ *   dict 8c2b4f11
+ *   00 A 12 -
+ *   00 B 37 a0a1a2a3a4a5
+ *   ...
+ *
+ * One line per sector and key type with the next dictionary index to
+ * try and the key found ('-' if it hasn't been found yet).
+ */
+
+static const char* sprint_uid(const uint8_t* uid, size_t uid_len) {
+  static char str_buff[21];
+  if (uid_len > 10)
+    uid_len = 10;
+  str_buff[0] = '\0';
+  for (size_t i = 0; i < uid_len; ++i)
+    sprintf(str_buff + 2 * i, "%02x", (unsigned int)uid[i]);
+  return str_buff;
+}
+
+const char* checkpoint_file_name(const uint8_t* uid, size_t uid_len,
+                                 uint32_t dict_hash) {
+  static char fn[64];
+  snprintf(fn, sizeof(fn), "mfterm-%s-%08x.chk",
+           sprint_uid(uid, uid_len), (unsigned int)dict_hash);
+  return fn;
+}
+
+void checkpoint_init(dict_checkpoint_t* cp,
+                     const uint8_t* uid, size_t uid_len,
+                     uint32_t dict_hash) {
+  memset(cp, 0, sizeof(dict_checkpoint_t));
+  if (uid_len > sizeof(cp->uid))
+    uid_len = sizeof(cp->uid);
+  memcpy(cp->uid, uid, uid_len);
+  cp->uid_len = uid_len;
+  cp->dict_hash = dict_hash;
+}
+
+int checkpoint_load(dict_checkpoint_t* cp,
+                    const uint8_t* uid, size_t uid_len,
+                    uint32_t dict_hash) {
+
+  const char* fn = checkpoint_file_name(uid, uid_len, dict_hash);
+  FILE* cp_file = fopen(fn, "r");
+  if (cp_file == NULL)
+    return 1;
+
+  checkpoint_init(cp, uid, uid_len, dict_hash);
+
+  char line[128];
+  int res = 0;
+  while (fgets(line, sizeof(line), cp_file)) {
+    unsigned int sector;
+    char type;
+    size_t pos;
+    char key_str[16];
+
+    // Comments and the header lines; the file name already tells uid and dict
+    if (line[0] == '#' || strncmp(line, "uid ", 4) == 0 ||
+        strncmp(line, "dict ", 5) == 0)
+      continue;
+
+    if (sscanf(line, "%x %c %zu %15s", &sector, &type, &pos, key_str) != 4 ||
+        sector >= CHECKPOINT_MAX_SECTORS || (type != 'A' && type != 'B')) {
+      printf("Invalid checkpoint line: %s", line);
+      res = 1;
+      break;
+    }
+
+    int t = type == 'A' ? 0 : 1;
+    cp->key_pos[sector][t] = pos;
+    if (strcmp(key_str, "-") != 0) {
+      if (strlen(key_str) != 12 || read_key(cp->key[sector][t], key_str) == NULL) {
+        printf("Invalid checkpoint key: %s\n", key_str);
+        res = 1;
+        break;
+      }
+      cp->key_found[sector][t] = true;
+    }
+  }
+
+  fclose(cp_file);
+  return res;
+}
+
+int checkpoint_save(const dict_checkpoint_t* cp) {
+
+  const char* fn = checkpoint_file_name(cp->uid, cp->uid_len, cp->dict_hash);
+  char tmp_fn[72];
+  snprintf(tmp_fn, sizeof(tmp_fn), "%s.tmp", fn);
+
+  FILE* cp_file = fopen(tmp_fn, "w");
+  if (cp_file == NULL) {
+    printf("Could not open file: %s\n", tmp_fn);
+    return 1;
+  }
+
+  fprintf(cp_file, "# mfterm dict attack checkpoint\n");
+  fprintf(cp_file, "uid %s\n", sprint_uid(cp->uid, cp->uid_len));
+  fprintf(cp_file, "dict %08x\n", (unsigned int)cp->dict_hash);
+
+  for (unsigned int s = 0; s < CHECKPOINT_MAX_SECTORS; ++s) {
+    for (int t = 0; t < 2; ++t) {
+      // Skip untouched sectors
+      if (cp->key_pos[s][t] == 0 && !cp->key_found[s][t])
+        continue;
+      fprintf(cp_file, "%02x %c %zu %s\n", s, t == 0 ? 'A' : 'B',
+              cp->key_pos[s][t],
+              cp->key_found[s][t] ? sprint_key(cp->key[s][t]) : "-");
+    }
+  }
+
+  if (fclose(cp_file) != 0 || rename(tmp_fn, fn) != 0) {
+    printf("Could not write checkpoint: %s\n", fn);
+    remove(tmp_fn);
+    return 1;
+  }
+
+  return 0;
+}
+
+void checkpoint_remove(const dict_checkpoint_t* cp) {
+  remove(checkpoint_file_name(cp->uid, cp->uid_len, cp->dict_hash));
+}
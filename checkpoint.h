@@ -0,0 +1,75 @@
+#ifndef CHECKPOINT__H
+#define CHECKPOINT__H
+
+/**
+ * Copyright (C) 2011 Anders Sundman <anders@4zm.org>
+ *
+ * This file is part of mfterm.
+ *
+ * mfterm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mfterm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mfterm.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Enough for any Mifare Classic tag (4K has 40 sectors)
+#define CHECKPOINT_MAX_SECTORS 40
+
+/**
+ * The progress of a dictionary attack. For each sector and key type
+ * (0 = A, 1 = B) it holds the index of the next dictionary key to try
+ * and the key, if it has been found. A checkpoint belongs to a tag UID
+ * and to a dictionary (by hash); the key positions are meaningless
+ * with any other dictionary.
+ */
+typedef struct {
+  uint8_t uid[10];
+  size_t uid_len;
+  uint32_t dict_hash;
+  size_t key_pos[CHECKPOINT_MAX_SECTORS][2];
+  bool key_found[CHECKPOINT_MAX_SECTORS][2];
+  uint8_t key[CHECKPOINT_MAX_SECTORS][2][6];
+} dict_checkpoint_t;
+
+// Set up an empty checkpoint (nothing tried) for the tag and dictionary
+void checkpoint_init(dict_checkpoint_t* cp,
+                     const uint8_t* uid, size_t uid_len,
+                     uint32_t dict_hash);
+
+/**
+ * Load the checkpoint for the tag and dictionary from the current
+ * directory. Return 0 on success, != 0 if there isn't any checkpoint
+ * or it could not be read.
+ */
+int checkpoint_load(dict_checkpoint_t* cp,
+                    const uint8_t* uid, size_t uid_len,
+                    uint32_t dict_hash);
+
+/**
+ * Save the checkpoint in the current directory. The file is written
+ * to a temporary name and then renamed, so a crash while saving will
+ * leave the previous checkpoint intact.
+ * Return 0 on success != 0 on failure.
+ */
+int checkpoint_save(const dict_checkpoint_t* cp);
+
+// Remove the checkpoint file (when the attack has completed)
+void checkpoint_remove(const dict_checkpoint_t* cp);
+
+// Return the name of the checkpoint file: mfterm-<uid>-<dict hash>.chk
+const char* checkpoint_file_name(const uint8_t* uid, size_t uid_len,
+                                 uint32_t dict_hash);
+
+#endif
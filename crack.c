@@ -0,0 +1,641 @@
+/**
+ * Copyright (C) 2011 Anders Sundman <anders@4zm.org>
+ *
+ * This file is part of mfterm.
+ *
+ * mfterm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mfterm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mfterm.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+#include "crypto1.h"
+#include "dictionary.h"
+#include "parallel.h"
+#include "crack.h"
+
+// The keys handed to a thread at a time
+#define CRACK_CHUNK (16 * CRYPTO1_BATCH_MAX)
+
+// The state of a search, shared by the threads
+typedef struct {
+  const crack_auth_t* auth;
+  const uint64_t* keys;
+  uint32_t ks2;          // The keystream that encrypts the reader answer
+  pthread_mutex_t mutex;
+  uint64_t* hits;
+  size_t hit_count;
+} crack_search_t;
+
+// The state of a key recovery, shared by the threads
+typedef struct {
+  const crack_auth_t* auths;
+  size_t count;
+  const crypto1_state_t* states;
+  pthread_mutex_t mutex;
+  uint64_t* hits;
+  size_t hit_count;
+} crack_recovery_t;
+
+// The candidates handed to a thread at a time
+#define CRACK_RECOVER_CHUNK 4096
+
+uint64_t crack_key_to_num(const uint8_t* key) {
+  uint64_t num = 0;
+  for (int i = 0; i < 6; ++i)
+    num = num << 8 | key[i];
+  return num;
+}
+
+void crack_num_to_key(uint64_t num, uint8_t* key) {
+  for (int i = 5; i >= 0; --i, num >>= 8)
+    key[i] = (uint8_t)num;
+}
+
+bool crack_check_key(const crack_auth_t* auth, uint64_t key) {
+  crypto1_state_t s;
+  crypto1_init(&s, key);
+  crypto1_word(&s, auth->uid ^ auth->nt, false);
+  crypto1_word(&s, auth->nr_enc, true);
+  if ((auth->ar_enc ^ crypto1_word(&s, 0, false)) !=
+      prng_successor(auth->nt, 64))
+    return false;
+  return !auth->has_at ||
+    (auth->at_enc ^ crypto1_word(&s, 0, false)) == prng_successor(auth->nt, 96);
+}
+
+// Add the keys that pass crack_check_key to the hits. Return false
+// once a key has been confirmed by the tag answer.
+static bool crack_add_hits(crack_search_t* search,
+                           const uint64_t* keys, size_t count) {
+  bool done = false;
+  pthread_mutex_lock(&search->mutex);
+  for (size_t i = 0; i < count; ++i) {
+    if (!crack_check_key(search->auth, keys[i]))
+      continue;
+    if (search->hit_count < CRACK_MAX_HITS)
+      search->hits[search->hit_count++] = keys[i];
+    done = search->auth->has_at;
+  }
+  pthread_mutex_unlock(&search->mutex);
+  return !done;
+}
+
+static bool crack_dictionary_chunk(size_t begin, size_t end, void* arg) {
+  crack_search_t* search = (crack_search_t*)arg;
+  uint64_t hits[CRACK_CHUNK];
+
+  size_t count = crypto1_batch_check(search->keys + begin, end - begin,
+                                     search->auth->uid ^ search->auth->nt,
+                                     search->auth->nr_enc, search->ks2, hits);
+  return count == 0 || crack_add_hits(search, hits, count);
+}
+
+int crack_dictionary(const crack_auth_t* auth, uint64_t* hits) {
+
+  // The batch functions want the keys in an array
+  size_t count = 0;
+  for (key_list_t* it = dictionary_get(); it; it = it->next)
+    ++count;
+  if (count == 0) {
+    printf("The dictionary is empty.\n");
+    return 0;
+  }
+
+  uint64_t* keys = malloc(count * sizeof(uint64_t));
+  if (keys == NULL) {
+    printf("Out of memory.\n");
+    return -1;
+  }
+  size_t i = 0;
+  for (key_list_t* it = dictionary_get(); it; it = it->next)
+    keys[i++] = crack_key_to_num(it->key);
+
+  crack_search_t search;
+  search.auth = auth;
+  search.keys = keys;
+  search.ks2 = auth->ar_enc ^ prng_successor(auth->nt, 64);
+  pthread_mutex_init(&search.mutex, NULL);
+  search.hits = hits;
+  search.hit_count = 0;
+
+  double start = parallel_time();
+  bool all = parallel_for(count, CRACK_CHUNK,
+                          crack_dictionary_chunk, &search) == 0;
+  double elapsed = parallel_time() - start;
+
+  pthread_mutex_destroy(&search.mutex);
+  free(keys);
+
+  // Stopped without a confirmed key: cancelled
+  if (!all && !(auth->has_at && search.hit_count))
+    return -1;
+
+  printf("Checked %zu keys in %.3fs (%.1f Mkeys/s, %zu threads, %s).\n",
+         count, elapsed, elapsed > 0 ? (double)count / elapsed / 1e6 : 0.0,
+         parallel_threads(), crypto1_batch_name());
+
+  return (int)search.hit_count;
+}
+
+static bool crack_recover_chunk(size_t begin, size_t end, void* arg) {
+  crack_recovery_t* rec = (crack_recovery_t*)arg;
+  const crack_auth_t* base = &rec->auths[0];
+
+  for (size_t i = begin; i < end; ++i) {
+    // Back from after the reader answer to the key
+    crypto1_state_t s = rec->states[i];
+    crypto1_rollback_word(&s, 0, false);
+    crypto1_rollback_word(&s, base->nr_enc, true);
+    crypto1_rollback_word(&s, base->uid ^ base->nt, false);
+    uint64_t key = crypto1_get_lfsr(&s);
+
+    size_t a = 0;
+    while (a < rec->count && crack_check_key(&rec->auths[a], key))
+      ++a;
+    if (a < rec->count)
+      continue;
+
+    pthread_mutex_lock(&rec->mutex);
+    if (rec->hit_count < CRACK_MAX_HITS)
+      rec->hits[rec->hit_count++] = key;
+    pthread_mutex_unlock(&rec->mutex);
+  }
+  return true;
+}
+
+int crack_recover(const crack_auth_t* auths, size_t count, uint64_t* hits) {
+
+  if (count == 0 || (count == 1 && !auths[0].has_at)) {
+    printf("Two authentications, or one with the tag answer, are needed.\n");
+    return -1;
+  }
+
+  const crack_auth_t* base = &auths[0];
+  double start = parallel_time();
+  size_t state_count;
+  crypto1_state_t* states =
+    crypto1_recover32(base->ar_enc ^ prng_successor(base->nt, 64), 0,
+                      &state_count);
+  if (states == NULL) {
+    printf("Out of memory.\n");
+    return -1;
+  }
+
+  crack_recovery_t rec;
+  rec.auths = auths;
+  rec.count = count;
+  rec.states = states;
+  pthread_mutex_init(&rec.mutex, NULL);
+  rec.hits = hits;
+  rec.hit_count = 0;
+
+  int res = parallel_for(state_count, CRACK_RECOVER_CHUNK,
+                         crack_recover_chunk, &rec);
+
+  pthread_mutex_destroy(&rec.mutex);
+  free(states);
+
+  if (res)
+    return -1;
+
+  printf("Checked %zu candidate states against %zu authentication(s) "
+         "in %.2fs.\n", state_count, count, parallel_time() - start);
+
+  return (int)rec.hit_count;
+}
+
+// A nonce candidate of the first sample of a nested target
+typedef struct {
+  crack_nested_target_t* target;
+  uint32_t nt;
+} nested_item_t;
+
+// The state of a nested attack, shared by the threads
+typedef struct {
+  nested_item_t* items;
+  uint32_t distance;
+  uint32_t tolerance;
+  pthread_mutex_t mutex;
+  bool failed;           // Out of memory; the threads stop
+} crack_nested_run_t;
+
+// The keystream bit that encrypts bit n (in sending order) of a word
+#define KS_BIT(ks, n) ((ks) >> ((n) ^ 24) & 1)
+
+static uint8_t crack_odd_parity(uint32_t x) {
+  x ^= x >> 4;
+  x ^= x >> 2;
+  x ^= x >> 1;
+  return (uint8_t)(~x & 1);
+}
+
+bool crack_nonce_parity(const crack_nested_t* sample, uint32_t nt) {
+  uint32_t ks = sample->nt_enc ^ nt;
+  for (int i = 0; i < 3; ++i) {
+    uint8_t p = crack_odd_parity(nt >> (24 - 8 * i) & 0xff);
+    if ((p ^ KS_BIT(ks, 8 * (i + 1))) != (sample->parity >> i & 1))
+      return false;
+  }
+  return true;
+}
+
+// Return true if the key encrypts the nonce of the sample as recorded,
+// for one of the nonces the distance allows
+static bool crack_nested_fits(const crack_nested_t* sample, uint64_t key,
+                              uint32_t distance, uint32_t tolerance) {
+  uint32_t nt = prng_successor(sample->nt, distance - tolerance);
+  for (uint32_t d = 0; d <= 2 * tolerance; ++d, nt = prng_successor(nt, 1)) {
+    if (!crack_nonce_parity(sample, nt))
+      continue;
+    crypto1_state_t s;
+    crypto1_init(&s, key);
+    if ((crypto1_word(&s, sample->uid ^ nt, false) ^ nt) == sample->nt_enc)
+      return true;
+  }
+  return false;
+}
+
+static bool crack_nested_item(size_t begin, size_t end, void* arg) {
+  crack_nested_run_t* run = (crack_nested_run_t*)arg;
+
+  for (size_t i = begin; i < end; ++i) {
+    crack_nested_target_t* target = run->items[i].target;
+    const crack_nested_t* first = &target->samples[0];
+    uint32_t nt = run->items[i].nt;
+
+    // The nonce is fed while its keystream is made
+    size_t count;
+    crypto1_state_t* states =
+      crypto1_recover32(first->nt_enc ^ nt, first->uid ^ nt, &count);
+    if (states == NULL) {
+      pthread_mutex_lock(&run->mutex);
+      if (!run->failed)
+        printf("Out of memory.\n");
+      run->failed = true;
+      pthread_mutex_unlock(&run->mutex);
+      return false;
+    }
+
+    for (size_t j = 0; j < count; ++j) {
+      crypto1_rollback_word(&states[j], first->uid ^ nt, false);
+      uint64_t key = crypto1_get_lfsr(&states[j]);
+
+      size_t k = 1;
+      while (k < target->count &&
+             crack_nested_fits(&target->samples[k], key,
+                               run->distance, run->tolerance))
+        ++k;
+      if (k < target->count)
+        continue;
+
+      pthread_mutex_lock(&run->mutex);
+      if (target->hit_count < CRACK_MAX_HITS)
+        target->hits[target->hit_count++] = key;
+      pthread_mutex_unlock(&run->mutex);
+    }
+
+    free(states);
+  }
+  return true;
+}
+
+int crack_nested(crack_nested_target_t* targets, size_t count,
+                 uint32_t distance, uint32_t tolerance) {
+
+  if (tolerance > distance)
+    tolerance = distance;
+
+  // The nonces of the first sample of each target that fit the parity
+  size_t max = count * (2 * tolerance + 1);
+  nested_item_t* items = malloc(max * sizeof(nested_item_t));
+  if (items == NULL) {
+    printf("Out of memory.\n");
+    return -1;
+  }
+
+  size_t item_count = 0;
+  for (size_t t = 0; t < count; ++t) {
+    targets[t].hit_count = 0;
+    if (targets[t].count == 0)
+      continue;
+    const crack_nested_t* first = &targets[t].samples[0];
+    uint32_t nt = prng_successor(first->nt, distance - tolerance);
+    for (uint32_t d = 0; d <= 2 * tolerance; ++d, nt = prng_successor(nt, 1)) {
+      if (crack_nonce_parity(first, nt)) {
+        items[item_count].target = &targets[t];
+        items[item_count].nt = nt;
+        ++item_count;
+      }
+    }
+  }
+
+  printf("Solving %zu nonce candidates for %zu keys on %zu threads.\n",
+         item_count, count, parallel_threads());
+
+  crack_nested_run_t run;
+  run.items = items;
+  run.distance = distance;
+  run.tolerance = tolerance;
+  run.failed = false;
+  pthread_mutex_init(&run.mutex, NULL);
+
+  double start = parallel_time();
+  int res = parallel_for(item_count, 1, crack_nested_item, &run);
+  if (run.failed)
+    res = -2;
+
+  pthread_mutex_destroy(&run.mutex);
+  free(items);
+
+  if (res == 0)
+    printf("Solved in %.1fs.\n", parallel_time() - start);
+  return res;
+}
+
+// The states of the two LFSR halves left by the NACKs: the odd half
+// when the first NACK bit is made, or the even half one clock later,
+// with the new bits that can't be told from the half alone
+#define DARKSIDE_HALF_BITS 21
+#define DARKSIDE_HALF_MASK ((1u << DARKSIDE_HALF_BITS) - 1)
+#define DARKSIDE_CHUNK 4096
+#define DARKSIDE_MAX_HALVES 4096
+
+// The state of a darkside solution, shared by the threads
+typedef struct {
+  const crack_darkside_t* sample;
+  uint32_t odd_diff[CRACK_DARKSIDE_VARIANTS];
+  uint32_t even_diff[CRACK_DARKSIDE_VARIANTS];
+  crypto1_state_t diff[CRACK_DARKSIDE_VARIANTS];
+  uint8_t ks[CRACK_DARKSIDE_VARIANTS];    // The NACK keystream bits
+  pthread_mutex_t mutex;
+  uint32_t halves[2][DARKSIDE_MAX_HALVES];
+  size_t half_count[2];
+  uint64_t* hits;
+  size_t hit_count;
+} crack_darkside_run_t;
+
+uint32_t crack_darkside_nr(const crack_darkside_t* sample, uint32_t variant) {
+  return (sample->nr_enc & ~0xe0u) | variant << 5;
+}
+
+/**
+ * The 21 bit values the NACK keystream of a variant is read from. The
+ * odd value has the odd half when the first NACK bit (0) is made in
+ * bits 1-20 and the bit shifted in by the second clock in bit 0: bits
+ * 1-20 give keystream bit 0, bits 0-19 bit 2. The even value holds the
+ * even half in bits 2-20 and the bits shifted in by the first and the
+ * third clock, for keystream bits 1 and 3 the same way.
+ */
+static void crack_darkside_halves(crypto1_state_t s, uint32_t* odd,
+                                  uint32_t* even) {
+  uint32_t o = s.odd, e = s.even, shifted[3];
+  for (int i = 0; i < 3; ++i) {
+    crypto1_bit(&s, 0, false);
+    shifted[i] = s.odd & 1;
+  }
+  *odd = (o << 1 | shifted[1]) & DARKSIDE_HALF_MASK;
+  *even = (e << 2 | shifted[0] << 1 | shifted[2]) & DARKSIDE_HALF_MASK;
+}
+
+// Find the odd values (items [0, 2^21)) and the even values (the next
+// 2^21) that give the NACK keystream of all the variants
+static bool crack_darkside_half_chunk(size_t begin, size_t end, void* arg) {
+  crack_darkside_run_t* run = (crack_darkside_run_t*)arg;
+
+  for (size_t i = begin; i < end; ++i) {
+    int half = i >> DARKSIDE_HALF_BITS ? 0 : 1;  // 1 for the odd half
+    uint32_t value = (uint32_t)i & DARKSIDE_HALF_MASK;
+    const uint32_t* diff = half ? run->odd_diff : run->even_diff;
+    int c = 0;
+    for (; c < CRACK_DARKSIDE_VARIANTS; ++c) {
+      uint32_t v = value ^ diff[c];
+      if (crypto1_filter(v >> 1) != (run->ks[c] >> (1 - half) & 1) ||
+          crypto1_filter(v) != (run->ks[c] >> (3 - half) & 1))
+        break;
+    }
+    if (c < CRACK_DARKSIDE_VARIANTS)
+      continue;
+
+    pthread_mutex_lock(&run->mutex);
+    if (run->half_count[half] < DARKSIDE_MAX_HALVES)
+      run->halves[half][run->half_count[half]++] = value;
+    pthread_mutex_unlock(&run->mutex);
+  }
+  return true;
+}
+
+// Return true if the state of the first variant when the NACK is made
+// fits the parity bits and NACKs of all the variants
+static bool crack_darkside_fits(const crack_darkside_run_t* run,
+                                crypto1_state_t state) {
+  const crack_darkside_t* sample = run->sample;
+
+  for (uint32_t c = 0; c < CRACK_DARKSIDE_VARIANTS; ++c) {
+    crypto1_state_t s = { state.odd ^ run->diff[c].odd,
+                          state.even ^ run->diff[c].even };
+    crypto1_state_t t = s;
+    uint8_t nack = 0;
+    for (int i = 0; i < 4; ++i)
+      nack |= (uint8_t)(crypto1_bit(&t, 0, false) << i);
+    if (nack != run->ks[c])
+      return false;
+
+    // The parity bit of each byte of {nr}{ar} is encrypted with the
+    // keystream bit of the next one; the last with the first NACK bit
+    uint32_t nr_enc = crack_darkside_nr(sample, c);
+    uint32_t ks_ar = crypto1_rollback_word(&s, 0, false);
+    uint32_t ks_nr = crypto1_rollback_word(&s, nr_enc, true);
+    uint32_t enc[2] = { nr_enc, sample->ar_enc };
+    uint32_t ks[2] = { ks_nr, ks_ar };
+    for (int j = 0; j < 8; ++j) {
+      int shift = 24 - 8 * (j & 3);
+      uint8_t plain = (uint8_t)((enc[j / 4] ^ ks[j / 4]) >> shift);
+      uint8_t next = j < 7 ?
+        (uint8_t)KS_BIT(ks[(j + 1) / 4], 8 * ((j + 1) & 3)) :
+        (uint8_t)(run->ks[c] & 1);
+      if ((crack_odd_parity(plain) ^ next) != (sample->parity[c] >> j & 1))
+        return false;
+    }
+  }
+  return true;
+}
+
+// Join odd values [begin, end) with all the even values and the LFSR
+// bits neither holds, and keep the states that fit the sample
+static bool crack_darkside_join(size_t begin, size_t end, void* arg) {
+  crack_darkside_run_t* run = (crack_darkside_run_t*)arg;
+  const crack_darkside_t* sample = run->sample;
+
+  for (size_t i = begin; i < end; ++i) {
+    uint32_t odd = run->halves[1][i];
+    for (size_t j = 0; j < run->half_count[0]; ++j) {
+      uint32_t even = run->halves[0][j];
+      for (uint32_t top = 0; top < 1u << 9; ++top) {
+        crypto1_state_t s = { odd >> 1 | (top & 0xf) << 20,
+                              even >> 2 | (top >> 4) << 19 };
+
+        // The shifted in bits must be the ones the values assumed
+        crypto1_state_t t = s;
+        crypto1_bit(&t, 0, false);
+        if ((t.odd & 1) != (even >> 1 & 1))
+          continue;
+        crypto1_bit(&t, 0, false);
+        if ((t.odd & 1) != (odd & 1))
+          continue;
+        crypto1_bit(&t, 0, false);
+        if ((t.odd & 1) != (even & 1) || !crack_darkside_fits(run, s))
+          continue;
+
+        crypto1_rollback_word(&s, 0, false);
+        crypto1_rollback_word(&s, crack_darkside_nr(sample, 0), true);
+        crypto1_rollback_word(&s, sample->uid ^ sample->nt, false);
+        uint64_t key = crypto1_get_lfsr(&s);
+
+        pthread_mutex_lock(&run->mutex);
+        if (run->hit_count < CRACK_MAX_HITS)
+          run->hits[run->hit_count++] = key;
+        pthread_mutex_unlock(&run->mutex);
+      }
+    }
+  }
+  return true;
+}
+
+int crack_darkside(const crack_darkside_t* sample, uint64_t* hits) {
+  crack_darkside_run_t* run = malloc(sizeof(crack_darkside_run_t));
+  if (run == NULL) {
+    printf("Out of memory.\n");
+    return -1;
+  }
+
+  // The LFSR is linear: feeding c in the last 3 bits of {nr} changes
+  // the state of the NACK by the state c gives from all zero
+  run->sample = sample;
+  for (uint32_t c = 0; c < CRACK_DARKSIDE_VARIANTS; ++c) {
+    crypto1_state_t d = { 0, 0 };
+    crypto1_word(&d, c << 5, false);
+    crypto1_word(&d, 0, false);
+    run->diff[c] = d;
+    crack_darkside_halves(d, &run->odd_diff[c], &run->even_diff[c]);
+    run->ks[c] = sample->nack[c] ^ 0x5;
+  }
+  pthread_mutex_init(&run->mutex, NULL);
+  run->half_count[0] = run->half_count[1] = 0;
+  run->hits = hits;
+  run->hit_count = 0;
+
+  int res = parallel_for((size_t)2 << DARKSIDE_HALF_BITS, DARKSIDE_CHUNK,
+                         crack_darkside_half_chunk, run);
+  if (res == 0)
+    res = parallel_for(run->half_count[1], 1, crack_darkside_join, run);
+
+  int count = res ? -1 : (int)run->hit_count;
+  pthread_mutex_destroy(&run->mutex);
+  free(run);
+  return count;
+}
+
+// The background darkside solver
+static struct {
+  pthread_t thread;
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  crack_darkside_t queue[CRACK_DARKSIDE_SAMPLES];
+  size_t queued;
+  size_t solved;
+  uint64_t hits[CRACK_MAX_HITS];
+  size_t hit_count;
+  size_t fetched;
+  bool stop;
+} darkside;
+
+static void* crack_darkside_main(void* arg) {
+  (void)arg;
+
+  pthread_mutex_lock(&darkside.mutex);
+  for (;;) {
+    while (!darkside.stop && darkside.solved == darkside.queued)
+      pthread_cond_wait(&darkside.cond, &darkside.mutex);
+    if (darkside.stop)
+      break;
+    const crack_darkside_t* sample = &darkside.queue[darkside.solved];
+    pthread_mutex_unlock(&darkside.mutex);
+
+    uint64_t hits[CRACK_MAX_HITS];
+    int count = crack_darkside(sample, hits);
+
+    pthread_mutex_lock(&darkside.mutex);
+    for (int i = 0; i < count; ++i) {
+      size_t j = 0;
+      while (j < darkside.hit_count && darkside.hits[j] != hits[i])
+        ++j;
+      if (j == darkside.hit_count && j < CRACK_MAX_HITS)
+        darkside.hits[darkside.hit_count++] = hits[i];
+    }
+    ++darkside.solved;
+  }
+  pthread_mutex_unlock(&darkside.mutex);
+  return NULL;
+}
+
+int crack_darkside_start() {
+  pthread_mutex_init(&darkside.mutex, NULL);
+  pthread_cond_init(&darkside.cond, NULL);
+  darkside.queued = darkside.solved = 0;
+  darkside.hit_count = darkside.fetched = 0;
+  darkside.stop = false;
+
+  if (pthread_create(&darkside.thread, NULL, crack_darkside_main, NULL)) {
+    pthread_cond_destroy(&darkside.cond);
+    pthread_mutex_destroy(&darkside.mutex);
+    printf("Could not start the solver thread.\n");
+    return -1;
+  }
+  return 0;
+}
+
+void crack_darkside_add(const crack_darkside_t* sample) {
+  pthread_mutex_lock(&darkside.mutex);
+  if (darkside.queued < CRACK_DARKSIDE_SAMPLES) {
+    darkside.queue[darkside.queued++] = *sample;
+    pthread_cond_signal(&darkside.cond);
+  }
+  pthread_mutex_unlock(&darkside.mutex);
+}
+
+size_t crack_darkside_poll(uint64_t* hits, bool* idle) {
+  pthread_mutex_lock(&darkside.mutex);
+  size_t count = darkside.hit_count - darkside.fetched;
+  for (size_t i = 0; i < count; ++i)
+    hits[i] = darkside.hits[darkside.fetched + i];
+  darkside.fetched = darkside.hit_count;
+  *idle = darkside.solved == darkside.queued;
+  pthread_mutex_unlock(&darkside.mutex);
+  return count;
+}
+
+void crack_darkside_stop() {
+  pthread_mutex_lock(&darkside.mutex);
+  darkside.stop = true;
+  pthread_cond_signal(&darkside.cond);
+  pthread_mutex_unlock(&darkside.mutex);
+
+  pthread_join(darkside.thread, NULL);
+  pthread_cond_destroy(&darkside.cond);
+  pthread_mutex_destroy(&darkside.mutex);
+}
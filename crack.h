@@ -0,0 +1,171 @@
+#ifndef CRACK__H
+#define CRACK__H
+
+/**
+ * Copyright (C) 2011 Anders Sundman <anders@4zm.org>
+ *
+ * This file is part of mfterm.
+ *
+ * mfterm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * mfterm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with mfterm.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "tag.h"
+
+/**
+ * A recorded authentication, e.g. from a sniffer trace: the UID (the
+ * last 4 bytes), the tag nonce and the encrypted reader nonce and
+ * reader answer. If has_at is set, the encrypted tag answer is also
+ * known and is used to weed out false hits.
+ */
+typedef struct {
+  uint32_t uid;
+  uint32_t nt;
+  uint32_t nr_enc;
+  uint32_t ar_enc;
+  uint32_t at_enc;
+  bool has_at;
+} crack_auth_t;
+
+// Max number of candidate keys kept by a search
+#define CRACK_MAX_HITS 16
+
+// Max number of authentications used for a key recovery
+#define CRACK_MAX_AUTHS 64
+
+// Convert between a 6 byte key and the 48 bit number used by crypto1.h
+uint64_t crack_key_to_num(const uint8_t* key);
+void crack_num_to_key(uint64_t num, uint8_t* key);
+
+// Return true if the key gives the recorded reader (and tag) answer
+bool crack_check_key(const crack_auth_t* auth, uint64_t key);
+
+/**
+ * Test the keys of the dictionary against the recorded authentication
+ * on all cores, with the batch Crypto1. The keys that match are
+ * written to hits (room for CRACK_MAX_HITS keys). A 32 bit reader
+ * answer alone lets about one in 2^32 wrong keys through, so there may
+ * be more than one. Return the number of hits, or -1 if cancelled.
+ */
+int crack_dictionary(const crack_auth_t* auth, uint64_t* hits);
+
+/**
+ * Recover the key from recorded authentications with the same key, by
+ * rolling back the LFSR states that give the reader answer of one of
+ * them. The candidates are checked against the others on all cores.
+ * Two authentications, or one with the tag answer, are needed. The
+ * keys that fit them all are written to hits (room for CRACK_MAX_HITS
+ * keys). Return the number of hits, or -1 on error or if cancelled.
+ */
+int crack_recover(const crack_auth_t* auths, size_t count, uint64_t* hits);
+
+/**
+ * A nested authentication: after an authentication with a known key
+ * (tag nonce nt), an auth command for another sector was sent
+ * encrypted. The tag answered with its next nonce, encrypted with the
+ * unknown key. The parity bits of the 4 bytes are kept as received,
+ * the first byte in bit 0; they are encrypted with keystream bits too.
+ */
+typedef struct {
+  uint32_t uid;
+  uint32_t nt;
+  uint32_t nt_enc;
+  uint8_t parity;
+} crack_nested_t;
+
+/**
+ * Check the parity bits of the first three bytes of the encrypted
+ * nonce of the sample against a guess of the nonce. The parity bit of
+ * a byte is encrypted with the keystream bit of the first bit of the
+ * next byte, which the guess gives. The last one can't be checked.
+ */
+bool crack_nonce_parity(const crack_nested_t* sample, uint32_t nt);
+
+// The nested authentications collected per key
+#define CRACK_NESTED_SAMPLES 3
+
+// The key of one sector and key type to recover with the nested attack
+typedef struct {
+  size_t sector;
+  mf_key_type_t key_type;
+  crack_nested_t samples[CRACK_NESTED_SAMPLES];
+  size_t count;
+  uint64_t hits[CRACK_MAX_HITS];
+  size_t hit_count;
+} crack_nested_target_t;
+
+/**
+ * Recover the keys of the targets from their nested authentications,
+ * on all cores. The tag nonce of a nested authentication is the plain
+ * nonce moved about distance (+/- tolerance) PRNG steps, and the parity
+ * bits rule out most of those. Each nonce left gives key candidates
+ * for the first sample; the ones that also fit the other samples are
+ * written to the hits of the target. Return 0, -1 if cancelled or -2
+ * if out of memory (the error is printed).
+ */
+int crack_nested(crack_nested_target_t* targets, size_t count,
+                 uint32_t distance, uint32_t tolerance);
+
+/**
+ * The darkside attack, for a tag with no known key. An authentication
+ * with a wrong reader answer still gets a 4 bit NACK, encrypted, if
+ * the 8 parity bits sent with {nr}{ar} happen to be right; one try in
+ * 256. The same tag nonce is held while the last 3 bits of {nr} take
+ * all 8 values (the variants). The LFSR states of the variants then
+ * differ by known values when the NACKs are encrypted, and the 8 NACKs
+ * leave few states for the two halves of the LFSR to take.
+ */
+#define CRACK_DARKSIDE_VARIANTS 8
+
+typedef struct {
+  uint32_t uid;
+  uint32_t nt;
+  uint32_t nr_enc;   // Variant c has c in bits 5-7 (sent last)
+  uint32_t ar_enc;
+  uint8_t parity[CRACK_DARKSIDE_VARIANTS];  // As sent, the first byte in bit 0
+  uint8_t nack[CRACK_DARKSIDE_VARIANTS];    // The 4 bits as received
+} crack_darkside_t;
+
+// The encrypted reader nonce of a variant
+uint32_t crack_darkside_nr(const crack_darkside_t* sample, uint32_t variant);
+
+/**
+ * Find the keys that fit the NACKs and parity bits of the sample, on
+ * all cores. The variants of a sample give the right states only if
+ * the keystream bits of the last 3 bits of {nr} don't change with
+ * them, so about one sample in five has no solution. The keys found
+ * are written to hits (room for CRACK_MAX_HITS). Return their number,
+ * or -1 if cancelled or on error.
+ */
+int crack_darkside(const crack_darkside_t* sample, uint64_t* hits);
+
+// The most samples one solver takes
+#define CRACK_DARKSIDE_SAMPLES 32
+
+/**
+ * Solve the darkside samples in a background thread while more are
+ * collected. Samples are queued with crack_darkside_add; the keys found
+ * so far are fetched with crack_darkside_poll, which returns the number
+ * of keys not fetched before (written to hits, room for CRACK_MAX_HITS)
+ * and sets idle if all queued samples have been solved. Only one
+ * solver runs at a time. Return 0 on success, -1 on error.
+ */
+int crack_darkside_start();
+void crack_darkside_add(const crack_darkside_t* sample);
+size_t crack_darkside_poll(uint64_t* hits, bool* idle);
+void crack_darkside_stop();
+
+#endif
@@ -0,0 +1,646 @@
+/**
+ * Copyright (C) 2011 Anders Sundman <anders@4zm.org>
+ *
+ * This file is part of mfterm.
+ *
+ * mfterm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mfterm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mfterm.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "crypto1.h"
+
+// The feedback taps of the odd and even halves of the LFSR
+#define LF_POLY_ODD 0x29ce5c
+#define LF_POLY_EVEN 0x870804
+
+// The filter: five 4 bit functions of the odd LFSR bits 0-19 select a
+// bit of the 5 bit output function
+#define FILTER_A 0xf22c
+#define FILTER_B 0xd938
+#define FILTER_C 0xec57e80aU
+
+#define BIT(x, n) ((x) >> (n) & 1)
+
+// Bit n of a word in the order it is sent (bytes MSB first, LSB first)
+#define BEBIT(x, n) BIT(x, (n) ^ 24)
+
+static uint32_t parity32(uint32_t x) {
+  x ^= x >> 16;
+  x ^= x >> 8;
+  x ^= x >> 4;
+  return 0x6996 >> (x & 0xf) & 1;
+}
+
+// The odd parity bit of a byte, as sent after it
+static uint8_t odd_parity8(uint8_t x) {
+  return (uint8_t)(parity32(x) ^ 1);
+}
+
+static uint32_t swap_endian(uint32_t x) {
+  x = (x >> 8 & 0xff00ff) | (x & 0xff00ff) << 8;
+  return x >> 16 | x << 16;
+}
+
+void crypto1_init(crypto1_state_t* s, uint64_t key) {
+  s->odd = s->even = 0;
+  for (int i = 47; i > 0; i -= 2) {
+    s->odd = s->odd << 1 | (uint32_t)BIT(key, (i - 1) ^ 7);
+    s->even = s->even << 1 | (uint32_t)BIT(key, i ^ 7);
+  }
+}
+
+uint64_t crypto1_get_lfsr(const crypto1_state_t* s) {
+  uint64_t key = 0;
+  for (int k = 0; k < 24; ++k) {
+    key |= (uint64_t)BIT(s->odd, k) << ((2 * k) ^ 7);
+    key |= (uint64_t)BIT(s->even, k) << ((2 * k + 1) ^ 7);
+  }
+  return key;
+}
+
+uint8_t crypto1_filter(uint32_t odd) {
+  uint32_t f;
+  f  = BIT(FILTER_A, odd & 0xf) << 4;
+  f |= BIT(FILTER_B, odd >> 4 & 0xf) << 3;
+  f |= BIT(FILTER_A, odd >> 8 & 0xf) << 2;
+  f |= BIT(FILTER_A, odd >> 12 & 0xf) << 1;
+  f |= BIT(FILTER_B, odd >> 16 & 0xf);
+  return (uint8_t)BIT(FILTER_C, f);
+}
+
+uint8_t crypto1_bit(crypto1_state_t* s, uint8_t in, bool encrypted) {
+  uint8_t ret = crypto1_filter(s->odd);
+
+  uint32_t feedin = (uint32_t)((ret & encrypted) ^ (in & 1));
+  feedin ^= LF_POLY_ODD & s->odd;
+  feedin ^= LF_POLY_EVEN & s->even;
+  s->even = (s->even << 1 | parity32(feedin)) & 0xffffff;
+
+  // The new bit is now at an odd position
+  uint32_t t = s->odd;
+  s->odd = s->even;
+  s->even = t;
+
+  return ret;
+}
+
+uint8_t crypto1_byte(crypto1_state_t* s, uint8_t in, bool encrypted) {
+  uint8_t ret = 0;
+  for (int i = 0; i < 8; ++i)
+    ret |= (uint8_t)(crypto1_bit(s, (uint8_t)BIT(in, i), encrypted) << i);
+  return ret;
+}
+
+uint32_t crypto1_word(crypto1_state_t* s, uint32_t in, bool encrypted) {
+  uint32_t ret = 0;
+  for (int i = 0; i < 32; ++i)
+    ret |= (uint32_t)crypto1_bit(s, (uint8_t)BEBIT(in, i), encrypted) << (i ^ 24);
+  return ret;
+}
+
+uint8_t crypto1_rollback_bit(crypto1_state_t* s, uint8_t in, bool encrypted) {
+  uint32_t t = s->odd;
+  s->odd = s->even;
+  s->even = t;
+
+  // The bit shifted out of the even half is the only unknown term of
+  // the feedback that was shifted in
+  uint32_t out = s->even & 1;
+  s->even >>= 1;
+  out ^= LF_POLY_EVEN & s->even;
+  out ^= LF_POLY_ODD & s->odd;
+  out ^= in & 1;
+
+  uint8_t ret = crypto1_filter(s->odd);
+  out ^= (uint32_t)(ret & encrypted);
+
+  s->even |= parity32(out) << 23;
+  return ret;
+}
+
+uint8_t crypto1_rollback_byte(crypto1_state_t* s, uint8_t in, bool encrypted) {
+  uint8_t ret = 0;
+  for (int i = 7; i >= 0; --i)
+    ret |= (uint8_t)(crypto1_rollback_bit(s, (uint8_t)BIT(in, i), encrypted) << i);
+  return ret;
+}
+
+uint32_t crypto1_rollback_word(crypto1_state_t* s, uint32_t in, bool encrypted) {
+  uint32_t ret = 0;
+  for (int i = 31; i >= 0; --i)
+    ret |= (uint32_t)crypto1_rollback_bit(s, (uint8_t)BEBIT(in, i),
+                                          encrypted) << (i ^ 24);
+  return ret;
+}
+
+uint8_t crypto1_peek(const crypto1_state_t* s) {
+  return crypto1_filter(s->odd);
+}
+
+void crypto1_encrypt(crypto1_state_t* s, const uint8_t* in, uint8_t* out,
+                     uint8_t* parity, size_t len) {
+  for (size_t i = 0; i < len; ++i) {
+    uint8_t plain = in[i];
+    out[i] = plain ^ crypto1_byte(s, 0, false);
+    parity[i] = odd_parity8(plain) ^ crypto1_peek(s);
+  }
+}
+
+size_t crypto1_decrypt(crypto1_state_t* s, const uint8_t* in, uint8_t* out,
+                       const uint8_t* parity, size_t len) {
+  size_t errors = 0;
+  for (size_t i = 0; i < len; ++i) {
+    out[i] = in[i] ^ crypto1_byte(s, 0, false);
+    if (parity && (parity[i] ^ crypto1_peek(s)) != odd_parity8(out[i]))
+      ++errors;
+  }
+  return errors;
+}
+
+/**
+ * The weak PRNG is a 16 bit LFSR, and a nonce is 32 of its bits: the
+ * upper half (in shifting order) is the LFSR and the lower half the
+ * state it had 16 steps before. The states are numbered in the order
+ * the LFSR goes through them, so successors and distances are lookups
+ * in two tables made on first use. The all zero state is left alone.
+ */
+#define PRNG_PERIOD 0xffff
+
+static uint16_t prng_states[PRNG_PERIOD];  // The state at each position
+static uint16_t prng_positions[1 << 16];   // The position of each state
+static pthread_once_t prng_once = PTHREAD_ONCE_INIT;
+
+static void prng_setup() {
+  uint32_t h = 1;
+  for (uint32_t i = 0; i < PRNG_PERIOD; ++i) {
+    prng_states[i] = (uint16_t)h;
+    prng_positions[h] = (uint16_t)i;
+    h = h >> 1 | ((h ^ h >> 2 ^ h >> 3 ^ h >> 5) & 1) << 15;
+  }
+}
+
+// The LFSR state n steps after the state h (not 0)
+static uint32_t prng_state(uint32_t h, uint32_t n) {
+  return prng_states[(prng_positions[h] + n % PRNG_PERIOD) % PRNG_PERIOD];
+}
+
+uint32_t prng_successor(uint32_t x, uint32_t n) {
+  x = swap_endian(x);
+  uint32_t high = x >> 16;
+
+  // The LFSR stays at zero; only the bits of x are shifted out
+  if (high == 0)
+    return swap_endian(n < 32 ? x >> n : 0);
+
+  // Some bits of x are still shifted along
+  if (n < 16) {
+    while (n--)
+      x = x >> 1 | (x >> 16 ^ x >> 18 ^ x >> 19 ^ x >> 21) << 31;
+    return swap_endian(x);
+  }
+
+  pthread_once(&prng_once, prng_setup);
+  return swap_endian(prng_state(high, n) << 16 | prng_state(high, n - 16));
+}
+
+bool prng_is_weak(uint32_t x) {
+  x = swap_endian(x);
+  uint32_t high = x >> 16;
+  if (high == 0)
+    return false;
+
+  pthread_once(&prng_once, prng_setup);
+  return (x & 0xffff) == prng_state(high, PRNG_PERIOD - 16);
+}
+
+int32_t prng_distance(uint32_t x, uint32_t y) {
+  for (int32_t n = 0; n < 16; ++n, x = prng_successor(x, 1))
+    if (x == y)
+      return n;
+
+  // Now x is made of two LFSR states, as y must be
+  uint32_t hx = swap_endian(x) >> 16, hy = swap_endian(y) >> 16;
+  if (hx == 0 || hy == 0)
+    return x == y ? 16 : -1;
+
+  pthread_once(&prng_once, prng_setup);
+  uint32_t n = (PRNG_PERIOD + (uint32_t)prng_positions[hy] -
+                prng_positions[hx]) % PRNG_PERIOD;
+  if (16 + n >= PRNG_PERIOD || prng_successor(x, n) != y)
+    return -1;
+  return (int32_t)(16 + n);
+}
+
+/**
+ * State recovery from 32 keystream bits. The keystream bits at even
+ * and odd clocks only depend on one half of the LFSR each, so the two
+ * halves are guessed separately: start with the 20 bit values that
+ * give the first keystream bit and extend them a bit at a time, keeping
+ * those that still give the right keystream. The top 8 bits of each
+ * table entry hold the contribution of the half to the feedback of the
+ * other half (and the input), so that two halves can only be combined
+ * if their contributions match. The tables are then cut into groups by
+ * the contributions and each matching pair of groups is extended
+ * further on its own.
+ */
+
+// The states found so far
+typedef struct {
+  crypto1_state_t* states;
+  size_t count;
+  size_t max;
+} recovery_t;
+
+// Shift the next feedback contribution into the top bits of an entry
+static void update_contribution(uint32_t* item, uint32_t mask1,
+                                uint32_t mask2) {
+  uint32_t p = *item >> 25;
+  p = p << 1 | parity32(*item & mask1);
+  p = p << 1 | parity32(*item & mask2);
+  *item = p << 24 | (*item & 0xffffff);
+}
+
+/**
+ * Extend each entry of the table [tbl, *end] with one more bit, keep
+ * the ones that give the keystream bit and drop the others. An entry
+ * may become two; the extra one is put at the end, so there must be
+ * room after the table. If masks are given, the contributions are
+ * updated and the input bits in are mixed in.
+ */
+static void extend_table(uint32_t* tbl, uint32_t** end, uint32_t bit,
+                         bool contribution, uint32_t m1, uint32_t m2,
+                         uint32_t in) {
+  in <<= 24;
+  for (*tbl <<= 1; tbl <= *end; *++tbl <<= 1) {
+    uint32_t f0 = crypto1_filter(*tbl);
+    uint32_t f1 = crypto1_filter(*tbl | 1);
+    if (f0 != f1) {
+      // Only one value of the new bit gives the keystream bit
+      *tbl |= f0 ^ bit;
+      if (contribution) {
+        update_contribution(tbl, m1, m2);
+        *tbl ^= in;
+      }
+    }
+    else if (f0 == bit) {
+      // Both values do
+      *++*end = tbl[1];
+      tbl[1] = tbl[0] | 1;
+      if (contribution) {
+        update_contribution(tbl, m1, m2);
+        *tbl ^= in;
+        ++tbl;
+        update_contribution(tbl, m1, m2);
+        *tbl ^= in;
+      }
+      else {
+        ++tbl;
+      }
+    }
+    else {
+      // Neither does; replace the entry with the last one
+      *tbl-- = *(*end)--;
+    }
+  }
+}
+
+static int uint32_cmp(const void* a, const void* b) {
+  uint32_t x = *(const uint32_t*)a;
+  uint32_t y = *(const uint32_t*)b;
+  return x < y ? -1 : x > y;
+}
+
+// Return the first entry of the sorted table [start, stop] with the
+// same contribution (top 8 bits) as *stop
+static uint32_t* group_start(uint32_t* start, uint32_t* stop) {
+  uint32_t top = *stop >> 24;
+  while (stop > start && stop[-1] >> 24 == top)
+    --stop;
+  return stop;
+}
+
+static void recover(uint32_t* o_head, uint32_t* o_tail, uint32_t oks,
+                    uint32_t* e_head, uint32_t* e_tail, uint32_t eks,
+                    int rem, uint32_t in, recovery_t* r) {
+
+  if (rem == -1) {
+    for (uint32_t* e = e_head; e <= e_tail; ++e) {
+      *e = *e << 1 ^ parity32(*e & LF_POLY_EVEN) ^ (uint32_t)!!(in & 4);
+      for (uint32_t* o = o_head; o <= o_tail && r->count < r->max; ++o) {
+        crypto1_state_t* s = &r->states[r->count++];
+        s->even = *o & 0xffffff;
+        s->odd = (*e ^ parity32(*o & LF_POLY_ODD)) & 0xffffff;
+      }
+    }
+    return;
+  }
+
+  for (int i = 0; i < 4 && rem--; ++i) {
+    oks >>= 1;
+    eks >>= 1;
+    in >>= 2;
+    extend_table(o_head, &o_tail, oks & 1, true,
+                 LF_POLY_EVEN << 1 | 1, LF_POLY_ODD << 1, 0);
+    if (o_head > o_tail)
+      return;
+    extend_table(e_head, &e_tail, eks & 1, true,
+                 LF_POLY_ODD, LF_POLY_EVEN << 1 | 1, in & 3);
+    if (e_head > e_tail)
+      return;
+  }
+
+  qsort(o_head, (size_t)(o_tail - o_head + 1), sizeof(uint32_t), uint32_cmp);
+  qsort(e_head, (size_t)(e_tail - e_head + 1), sizeof(uint32_t), uint32_cmp);
+
+  // Pair up the groups with the same contribution. Work from the end,
+  // since extending a group overwrites the entries after it.
+  while (o_tail >= o_head && e_tail >= e_head) {
+    uint32_t o_top = *o_tail >> 24;
+    uint32_t e_top = *e_tail >> 24;
+    uint32_t* o = group_start(o_head, o_tail);
+    uint32_t* e = group_start(e_head, e_tail);
+    if (o_top == e_top)
+      recover(o, o_tail, oks, e, e_tail, eks, rem, in, r);
+    if (o_top >= e_top)
+      o_tail = o - 1;
+    if (e_top >= o_top)
+      e_tail = e - 1;
+  }
+}
+
+crypto1_state_t* crypto1_recover32(uint32_t ks2, uint32_t in, size_t* count) {
+  uint32_t oks = 0, eks = 0;
+  for (int i = 31; i >= 0; i -= 2)
+    oks = oks << 1 | BEBIT(ks2, i);
+  for (int i = 30; i >= 0; i -= 2)
+    eks = eks << 1 | BEBIT(ks2, i);
+
+  uint32_t* odd = malloc(sizeof(uint32_t) << 21);
+  uint32_t* even = malloc(sizeof(uint32_t) << 21);
+  recovery_t r;
+  r.max = 1 << 18;
+  r.states = malloc(r.max * sizeof(crypto1_state_t));
+  r.count = 0;
+  if (!odd || !even || !r.states) {
+    free(odd);
+    free(even);
+    free(r.states);
+    return NULL;
+  }
+
+  // The 20 bit values of each half that give the first keystream bit
+  uint32_t* odd_tail = odd - 1;
+  uint32_t* even_tail = even - 1;
+  for (uint32_t i = 1 << 20; i-- > 0; ) {
+    if (crypto1_filter(i) == (oks & 1))
+      *++odd_tail = i;
+    if (crypto1_filter(i) == (eks & 1))
+      *++even_tail = i;
+  }
+
+  // Up to 24 bits, no contributions yet
+  for (int i = 0; i < 4; ++i) {
+    extend_table(odd, &odd_tail, (oks >>= 1) & 1, false, 0, 0, 0);
+    extend_table(even, &even_tail, (eks >>= 1) & 1, false, 0, 0, 0);
+  }
+
+  // The input bits in the order they are used
+  in = (in >> 16 & 0xff) | (in << 16) | (in & 0xff00);
+  recover(odd, odd_tail, oks, even, even_tail, eks, 11, in << 1, &r);
+
+  free(odd);
+  free(even);
+  *count = r.count;
+  return r.states;
+}
+
+
+/**
+ * Transpose a 64x64 bit matrix in place: bit j of word i is moved to
+ * bit i of word j. Used to turn 64 keys into bit slices and back.
+ */
+static void transpose64(uint64_t* a) {
+  uint64_t m = 0x00000000ffffffffULL;
+  for (unsigned int j = 32; j; j >>= 1, m ^= m << j) {
+    for (unsigned int k = 0; k < 64; k = ((k | j) + 1) & ~j) {
+      uint64_t t = (a[k] >> j ^ a[k | j]) & m;
+      a[k] ^= t << j;
+      a[k | j] ^= t;
+    }
+  }
+}
+
+// The bitsliced versions, see crypto1_bs.h
+typedef size_t (*crypto1_bs_fn)(const uint64_t* keys, size_t count,
+                                uint32_t uid_nt, uint32_t nr_enc,
+                                size_t clocks, bool check, uint32_t ks2,
+                                uint32_t* ks_out, uint64_t* hits);
+typedef size_t (*crypto1_bs_nonces_fn)(uint32_t odd, const uint64_t* block,
+                                       size_t count, uint32_t uid,
+                                       const uint32_t* nt_enc,
+                                       const uint8_t* parity, size_t nonces,
+                                       uint32_t* hits);
+
+typedef uint64_t bs64_t;
+#define BS_T bs64_t
+#define BS_WORDS 1
+#define BS_NAME(n) n ## _64
+#define BS_TARGET
+#include "crypto1_bs.h"
+#undef BS_T
+#undef BS_WORDS
+#undef BS_NAME
+#undef BS_TARGET
+
+#if defined(__GNUC__) && defined(__x86_64__)
+typedef uint64_t bs256_t __attribute__((vector_size(32)));
+#define BS_T bs256_t
+#define BS_WORDS 4
+#define BS_NAME(n) n ## _256
+#define BS_TARGET __attribute__((target("avx2")))
+#include "crypto1_bs.h"
+#undef BS_T
+#undef BS_WORDS
+#undef BS_NAME
+#undef BS_TARGET
+
+typedef uint64_t bs512_t __attribute__((vector_size(64)));
+#define BS_T bs512_t
+#define BS_WORDS 8
+#define BS_NAME(n) n ## _512
+#define BS_TARGET __attribute__((target("avx512f")))
+#include "crypto1_bs.h"
+#include "parallel.h"
+#undef BS_T
+#undef BS_WORDS
+#undef BS_NAME
+#undef BS_TARGET
+#endif
+
+// The version in use, picked once for the CPU
+static size_t batch_width = 64;
+static const char* batch_name = "64 bit";
+static crypto1_bs_fn batch_fn = crypto1_bs_64;
+static crypto1_bs_nonces_fn batch_nonces_fn = crypto1_bs_nonces_64;
+static pthread_once_t batch_once = PTHREAD_ONCE_INIT;
+
+static void crypto1_batch_setup() {
+#if defined(__GNUC__) && defined(__x86_64__)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f")) {
+    batch_width = 512;
+    batch_name = "AVX-512";
+    batch_fn = crypto1_bs_512;
+    batch_nonces_fn = crypto1_bs_nonces_512;
+  }
+  else if (__builtin_cpu_supports("avx2")) {
+    batch_width = 256;
+    batch_name = "AVX2";
+    batch_fn = crypto1_bs_256;
+    batch_nonces_fn = crypto1_bs_nonces_256;
+  }
+#endif
+}
+
+size_t crypto1_batch_width() {
+  pthread_once(&batch_once, crypto1_batch_setup);
+  return batch_width;
+}
+
+const char* crypto1_batch_name() {
+  pthread_once(&batch_once, crypto1_batch_setup);
+  return batch_name;
+}
+
+void crypto1_batch_keystream(const uint64_t* keys, size_t count,
+                             uint32_t uid_nt, uint32_t nr_enc,
+                             uint32_t* ks2) {
+  size_t width = crypto1_batch_width();
+  for (size_t i = 0; i < count; i += width) {
+    size_t n = count - i < width ? count - i : width;
+    batch_fn(keys + i, n, uid_nt, nr_enc, 96, false, 0, ks2 + i, NULL);
+  }
+}
+
+void crypto1_batch_nonce_keystream(const uint64_t* keys, size_t count,
+                                   uint32_t uid_nt, uint32_t* ks1) {
+  size_t width = crypto1_batch_width();
+  for (size_t i = 0; i < count; i += width) {
+    size_t n = count - i < width ? count - i : width;
+    batch_fn(keys + i, n, uid_nt, 0, 32, false, 0, ks1 + i, NULL);
+  }
+}
+
+size_t crypto1_batch_check(const uint64_t* keys, size_t count,
+                           uint32_t uid_nt, uint32_t nr_enc, uint32_t ks2,
+                           uint64_t* hits) {
+  size_t width = crypto1_batch_width();
+  size_t hit_count = 0;
+  for (size_t i = 0; i < count; i += width) {
+    size_t n = count - i < width ? count - i : width;
+    hit_count += batch_fn(keys + i, n, uid_nt, nr_enc, 96, true, ks2, NULL,
+                          hits + hit_count);
+  }
+  return hit_count;
+}
+
+void crypto1_batch_slice(const uint32_t* halves, size_t count,
+                         uint64_t* slices) {
+  uint64_t block[64];
+  for (size_t i = 0; i < count; i += 64) {
+    size_t n = count - i < 64 ? count - i : 64;
+    memset(block, 0, sizeof(block));
+    for (size_t l = 0; l < n; ++l)
+      block[l] = halves[i + l];
+    transpose64(block);
+    memcpy(slices + i / 64 * 24, block, 24 * sizeof(uint64_t));
+  }
+}
+
+size_t crypto1_batch_nonces(uint32_t odd, const uint64_t* slices,
+                            size_t count, uint32_t uid,
+                            const uint32_t* nt_enc, const uint8_t* parity,
+                            size_t nonces, uint32_t* hits) {
+  size_t width = crypto1_batch_width();
+  size_t hit_count = 0;
+  for (size_t i = 0; i < count; i += width) {
+    size_t n = count - i < width ? count - i : width;
+    size_t h = batch_nonces_fn(odd, slices + i / 64 * 24, n, uid,
+                               nt_enc, parity, nonces, hits + hit_count);
+    for (size_t j = 0; j < h; ++j)
+      hits[hit_count + j] += (uint32_t)i;
+    hit_count += h;
+  }
+  return hit_count;
+}
+
+// Run the keys through one of the tests. 0: scalar, 1: batch
+// keystream, 2: batch check.
+static void bench_run(int test, const uint64_t* keys, size_t count,
+                      uint32_t* ks2, uint64_t* hits) {
+  const uint32_t uid_nt = 0x9c599b32 ^ 0x82a4166c;
+  const uint32_t nr_enc = 0xa1e458ce;
+
+  if (test == 0) {
+    for (size_t i = 0; i < count; ++i) {
+      crypto1_state_t s;
+      crypto1_init(&s, keys[i]);
+      crypto1_word(&s, uid_nt, false);
+      crypto1_word(&s, nr_enc, true);
+      ks2[i] = crypto1_word(&s, 0, false);
+    }
+  }
+  else if (test == 1)
+    crypto1_batch_keystream(keys, count, uid_nt, nr_enc, ks2);
+  else
+    crypto1_batch_check(keys, count, uid_nt, nr_enc, 0x12345678, hits);
+}
+
+void crypto1_bench() {
+  static const char* names[] = {
+    "Scalar keystream", "Batch keystream", "Batch check" };
+  const size_t count = 64 * CRYPTO1_BATCH_MAX;
+  static uint64_t keys[64 * CRYPTO1_BATCH_MAX];
+  static uint64_t hits[64 * CRYPTO1_BATCH_MAX];
+  static uint32_t ks2[64 * CRYPTO1_BATCH_MAX];
+
+  // Any keys will do; a simple LCG keeps them from being regular
+  uint64_t x = 0x5eed;
+  for (size_t i = 0; i < count; ++i) {
+    x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+    keys[i] = x >> 16;
+  }
+
+  printf("Batch version: %s, %zu keys\n",
+         crypto1_batch_name(), crypto1_batch_width());
+
+  for (int test = 0; test < 3; ++test) {
+    double start = parallel_time();
+    double elapsed;
+    size_t total = 0;
+    do {
+      bench_run(test, keys, count, ks2, hits);
+      total += count;
+      elapsed = parallel_time() - start;
+    } while (elapsed < 0.5);
+    printf("%-18s %8.2f Mkeys/s\n", names[test],
+           (double)total / elapsed / 1e6);
+  }
+}
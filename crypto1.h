@@ -0,0 +1,177 @@
+#ifndef CRYPTO1__H
+#define CRYPTO1__H
+
+/**
+ * Copyright (C) 2011 Anders Sundman <anders@4zm.org>
+ *
+ * This file is part of mfterm.
+ *
+ * mfterm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mfterm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mfterm.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * A software implementation of the Crypto1 cipher used by Mifare
+ * Classic tags, for working with recorded authentications without a
+ * reader.
+ *
+ * The 48 bit LFSR is kept as two 24 bit words with the bits at odd
+ * and even positions; the filter function only takes input from the
+ * odd bits. Keys are 48 bit numbers, with the first key byte as the
+ * most significant one (as read by read_key/bytes). Words (nonces) are
+ * fed and returned in the order they are sent: most significant byte
+ * first, each byte least significant bit first.
+ */
+typedef struct {
+  uint32_t odd;
+  uint32_t even;
+} crypto1_state_t;
+
+// Load a key into the LFSR
+void crypto1_init(crypto1_state_t* s, uint64_t key);
+
+// Return the LFSR contents as a key, i.e. the inverse of crypto1_init
+uint64_t crypto1_get_lfsr(const crypto1_state_t* s);
+
+// The filter function of the odd LFSR bits
+uint8_t crypto1_filter(uint32_t odd);
+
+/**
+ * Clock the cipher once and return the keystream bit. The input bit
+ * is shifted into the LFSR. If 'encrypted' is set, the input is
+ * cipher text and the keystream bit is XORed into the feedback, i.e.
+ * the LFSR is fed the plain text (the tag side of the reader nonce).
+ */
+uint8_t crypto1_bit(crypto1_state_t* s, uint8_t in, bool encrypted);
+uint8_t crypto1_byte(crypto1_state_t* s, uint8_t in, bool encrypted);
+uint32_t crypto1_word(crypto1_state_t* s, uint32_t in, bool encrypted);
+
+// Undo crypto1_bit/byte/word, given the same input. Return the
+// keystream of the clocks that were undone.
+uint8_t crypto1_rollback_bit(crypto1_state_t* s, uint8_t in, bool encrypted);
+uint8_t crypto1_rollback_byte(crypto1_state_t* s, uint8_t in, bool encrypted);
+uint32_t crypto1_rollback_word(crypto1_state_t* s, uint32_t in, bool encrypted);
+
+// The keystream bit that encrypts a parity bit; the LFSR isn't clocked
+uint8_t crypto1_peek(const crypto1_state_t* s);
+
+/**
+ * Encrypt len bytes from in to out, for a command or response after
+ * the authentication. The parity bits (one byte each, 0 or 1) of the
+ * plain text are computed and written encrypted to parity.
+ */
+void crypto1_encrypt(crypto1_state_t* s, const uint8_t* in, uint8_t* out,
+                     uint8_t* parity, size_t len);
+
+/**
+ * Decrypt len bytes from in to out. The parity bits (one byte each) as
+ * received are checked, unless parity is NULL (e.g. a trace without
+ * them). Return the number of bytes with a bad parity.
+ */
+size_t crypto1_decrypt(crypto1_state_t* s, const uint8_t* in, uint8_t* out,
+                       const uint8_t* parity, size_t len);
+
+// The tag nonce n steps of the tag PRNG after x. The reader answer is
+// prng_successor(nt, 64), the tag answer prng_successor(nt, 96).
+uint32_t prng_successor(uint32_t x, uint32_t n);
+
+// The number of PRNG steps from the nonce x to the nonce y, or -1 if
+// y doesn't follow x (e.g. not a nonce of the weak 16 bit PRNG). Both
+// are table lookups.
+int32_t prng_distance(uint32_t x, uint32_t y);
+
+// Return true if x is a nonce of the weak 16 bit PRNG (its lower half
+// follows from the upper one); nonces of a hardened PRNG mostly aren't
+bool prng_is_weak(uint32_t x);
+
+/**
+ * Find the LFSR states that give the 32 keystream bits ks2 while the
+ * word in is fed to the cipher (not encrypted). The states returned
+ * are those after the 32 clocks; roll them back to get to the key.
+ * There are about 2^16 of them. Return a malloc'd array of count
+ * states, or NULL if out of memory.
+ */
+crypto1_state_t* crypto1_recover32(uint32_t ks2, uint32_t in, size_t* count);
+
+/**
+ * The bitsliced batch functions run a whole authentication for many
+ * keys at once. Key i is in bit i of a word (a slice) and each LFSR
+ * bit of all keys is updated with one operation on a vector of
+ * slices: 64 keys per 64 bit word, 256 with AVX2, 512 with AVX-512.
+ * The widest version the CPU supports is used.
+ */
+#define CRYPTO1_BATCH_MAX 512
+
+// The number of keys per batch, and the name of the version in use
+size_t crypto1_batch_width();
+const char* crypto1_batch_name();
+
+/**
+ * For each key, feed uid ^ nt and the encrypted reader nonce nr_enc
+ * and return the following 32 keystream bits in ks2 (what encrypts the
+ * reader answer: {ar} = prng_successor(nt, 64) ^ ks2). Any number of
+ * keys can be given; they are run a batch at a time.
+ */
+void crypto1_batch_keystream(const uint64_t* keys, size_t count,
+                             uint32_t uid_nt, uint32_t nr_enc,
+                             uint32_t* ks2);
+
+/**
+ * For each key, return the 32 keystream bits made while uid ^ nt is
+ * fed in ks1: what encrypts the tag nonce of a nested authentication,
+ * {nt} = nt ^ ks1.
+ */
+void crypto1_batch_nonce_keystream(const uint64_t* keys, size_t count,
+                                   uint32_t uid_nt, uint32_t* ks1);
+
+/**
+ * Like crypto1_batch_keystream, but only keep the keys that give the
+ * keystream ks2. A batch stops as soon as all its keys have a wrong
+ * keystream bit. The keys that match are written to hits (room for
+ * count keys). Return the number of hits.
+ */
+size_t crypto1_batch_check(const uint64_t* keys, size_t count,
+                           uint32_t uid_nt, uint32_t nr_enc, uint32_t ks2,
+                           uint64_t* hits);
+
+/**
+ * The hardened nested attack searches LFSR states rather than keys:
+ * one odd half with many even halves. The even halves are given as
+ * slices, 24 words (bit k of 64 halves in word k) for each 64 halves;
+ * crypto1_batch_slice makes them.
+ */
+void crypto1_batch_slice(const uint32_t* halves, size_t count,
+                         uint64_t* slices);
+
+/**
+ * Take the states (odd, even half i) as the state after the first
+ * byte of the encrypted nonces nt_enc, which all have the same first
+ * byte. Decrypt the rest of each nonce and check the parity bits of
+ * its second and third byte (bit 1 and 2 of the parity, as in
+ * crack_nested_t). Write the index of the even halves that fit all
+ * nonces to hits (room for count) and return their number.
+ */
+size_t crypto1_batch_nonces(uint32_t odd, const uint64_t* slices,
+                            size_t count, uint32_t uid,
+                            const uint32_t* nt_enc, const uint8_t* parity,
+                            size_t nonces, uint32_t* hits);
+
+// Measure and print the keys per second of the scalar and the batch
+// functions for one authentication.
+void crypto1_bench();
+
+#endif
@@ -0,0 +1,243 @@
+/**
+ * Copyright (C) 2011 Anders Sundman <anders@4zm.org>
+ *
+ * This file is part of mfterm.
+ *
+ * mfterm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mfterm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mfterm.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Bitsliced Crypto1 authentication for BS_WORDS * 64 keys at a time.
+ *
+ * This is a template, included by crypto1.c once for each slice type
+ * with these defined:
+ *   BS_T       the slice type, a 64 bit word or a vector of them
+ *   BS_WORDS   the number of 64 bit words in a slice
+ *   BS_NAME(n) the name n with a suffix for the slice type
+ *   BS_TARGET  the function attributes (instruction set)
+ *
+ * The LFSR bits of all the keys are kept over time in x[], so a clock
+ * is one new slice and no shifting: the state after t clocks is
+ * x[t..t+47], where x[t+47-2k] is bit k of the odd half and
+ * x[t+46-2k] bit k of the even half.
+ */
+
+// The filter sub functions as logic: fa = 0xf22c and fb = 0xd938 of 4
+// bits, fc = 0xec57e80a of 5 bits (truth tables, the first input is
+// the least significant index bit).
+BS_TARGET static inline BS_T BS_NAME(bs_fa)(BS_T a, BS_T b, BS_T c, BS_T d) {
+  BS_T t = a & ~b;
+  BS_T lo = b ^ ((b ^ t) & c);
+  BS_T hi = t | c;
+  return lo ^ ((lo ^ hi) & d);
+}
+
+BS_TARGET static inline BS_T BS_NAME(bs_fb)(BS_T a, BS_T b, BS_T c, BS_T d) {
+  BS_T lo = c ^ ((c ^ (a & ~c)) & b);
+  BS_T hi = ~a ^ ((~a ^ (a | c)) & b);
+  return lo ^ ((lo ^ hi) & d);
+}
+
+BS_TARGET static inline BS_T BS_NAME(bs_fc)(BS_T a, BS_T b, BS_T c, BS_T d,
+                                             BS_T e) {
+  BS_T eb = e & b;
+  BS_T lo = e ^ ((e ^ ~(eb | c)) & a);
+  BS_T hi_lo = eb ^ ((eb ^ b) & c);
+  BS_T hi = hi_lo ^ ((hi_lo ^ (b | c)) & a);
+  return lo ^ ((lo ^ hi) & d);
+}
+
+// The keystream bit of the state s = x + t
+BS_TARGET static inline BS_T BS_NAME(bs_filter)(const BS_T* s) {
+  return BS_NAME(bs_fc)(BS_NAME(bs_fb)(s[15], s[13], s[11], s[9]),
+                        BS_NAME(bs_fa)(s[23], s[21], s[19], s[17]),
+                        BS_NAME(bs_fa)(s[31], s[29], s[27], s[25]),
+                        BS_NAME(bs_fb)(s[39], s[37], s[35], s[33]),
+                        BS_NAME(bs_fa)(s[47], s[45], s[43], s[41]));
+}
+
+// The feedback of the state s = x + t
+BS_TARGET static inline BS_T BS_NAME(bs_feedback)(const BS_T* s) {
+  return s[0] ^ s[5] ^ s[9] ^ s[10] ^ s[12] ^ s[14] ^ s[15] ^ s[17] ^
+    s[19] ^ s[24] ^ s[25] ^ s[27] ^ s[29] ^ s[35] ^ s[39] ^ s[41] ^
+    s[42] ^ s[43];
+}
+
+// Return true if all lanes of the slice are set
+BS_TARGET static inline bool BS_NAME(bs_all)(BS_T v) {
+  uint64_t w[BS_WORDS];
+  memcpy(w, &v, sizeof(w));
+  for (size_t i = 0; i < BS_WORDS; ++i)
+    if (~w[i])
+      return false;
+  return true;
+}
+
+/**
+ * Run the authentication for count (<= BS_WORDS * 64) keys. If check
+ * is set, return the keys giving the keystream ks2 in hits and their
+ * number. Otherwise run the first clocks clocks (32 up to the reader
+ * nonce, 96 up to the reader answer) and write the keystream of the
+ * last 32 of them to ks_out, a word per key.
+ */
+BS_TARGET static size_t BS_NAME(crypto1_bs)(const uint64_t* keys, size_t count,
+                                             uint32_t uid_nt, uint32_t nr_enc,
+                                             size_t clocks,
+                                             bool check, uint32_t ks2,
+                                             uint32_t* ks_out, uint64_t* hits) {
+  BS_T x[48 + 96];
+  BS_T zero, ones;
+  memset(&zero, 0, sizeof(zero));
+  memset(&ones, 0xff, sizeof(ones));
+
+  // Load the keys, 64 at a time; key bit j goes to x[47 - (j ^ 7)]
+  uint64_t block[64];
+  uint64_t unused[BS_WORDS];
+  for (size_t w = 0; w < BS_WORDS; ++w) {
+    size_t first = w * 64;
+    size_t n = count > first ? count - first : 0;
+    if (n > 64)
+      n = 64;
+    memset(block, 0, sizeof(block));
+    memcpy(block, keys + first, n * sizeof(uint64_t));
+    transpose64(block);
+    for (size_t j = 0; j < 48; ++j)
+      memcpy((uint64_t*)&x[47 - (j ^ 7)] + w, &block[j], sizeof(uint64_t));
+    unused[w] = n == 64 ? 0 : ~0ULL << n;
+  }
+
+  // Lanes without a key never match
+  BS_T miss;
+  memcpy(&miss, unused, sizeof(miss));
+
+  BS_T ks[32];
+  for (size_t t = 0; t < clocks; ++t) {
+    BS_T* s = x + t;
+    BS_T f = BS_NAME(bs_filter)(s);
+    size_t i = t % 32;
+
+    if (t < 32) {
+      // uid ^ nt, plain
+      s[48] = BS_NAME(bs_feedback)(s) ^ (BEBIT(uid_nt, i) ? ones : zero);
+    }
+    else if (t < 64) {
+      // {nr}, the keystream is fed back too
+      s[48] = BS_NAME(bs_feedback)(s) ^ f ^ (BEBIT(nr_enc, i) ? ones : zero);
+    }
+    else {
+      s[48] = BS_NAME(bs_feedback)(s);
+      if (check) {
+        miss |= f ^ (BEBIT(ks2, i) ? ones : zero);
+        if (BS_NAME(bs_all)(miss))
+          return 0;
+      }
+    }
+    if (!check && t + 32 >= clocks)
+      ks[i] = f;
+  }
+
+  if (check) {
+    uint64_t m[BS_WORDS];
+    memcpy(m, &miss, sizeof(m));
+    size_t hit_count = 0;
+    for (size_t l = 0; l < count; ++l)
+      if (!(m[l / 64] >> (l % 64) & 1))
+        hits[hit_count++] = keys[l];
+    return hit_count;
+  }
+
+  // Transpose the keystream back to a word per key
+  for (size_t w = 0; w * 64 < count; ++w) {
+    memset(block, 0, sizeof(block));
+    for (size_t i = 0; i < 32; ++i)
+      memcpy(&block[i ^ 24], (uint64_t*)&ks[i] + w, sizeof(uint64_t));
+    transpose64(block);
+    for (size_t l = 0; l < 64 && w * 64 + l < count; ++l)
+      ks_out[w * 64 + l] = (uint32_t)block[l];
+  }
+
+  return 0;
+}
+
+/**
+ * Check count (<= BS_WORDS * 64) LFSR states, the odd half and the
+ * even halves of block (24 slices per 64 halves), as the state after
+ * the first byte of the nonces. Return the states that fit the parity
+ * bits of the rest of all nonces in hits, as indexes into the block,
+ * and their number.
+ */
+BS_TARGET static size_t BS_NAME(crypto1_bs_nonces)(uint32_t odd,
+                                                    const uint64_t* block,
+                                                    size_t count, uint32_t uid,
+                                                    const uint32_t* nt_enc,
+                                                    const uint8_t* parity,
+                                                    size_t nonces,
+                                                    uint32_t* hits) {
+  BS_T x0[48], x[48 + 16];
+  BS_T zero, ones;
+  memset(&zero, 0, sizeof(zero));
+  memset(&ones, 0xff, sizeof(ones));
+
+  // The odd half is the same in all lanes
+  uint64_t unused[BS_WORDS];
+  for (size_t k = 0; k < 24; ++k) {
+    x0[47 - 2 * k] = BIT(odd, k) ? ones : zero;
+    x0[46 - 2 * k] = zero;
+  }
+  for (size_t w = 0; w < BS_WORDS; ++w) {
+    size_t first = w * 64;
+    size_t n = count > first ? count - first : 0;
+    if (n > 64)
+      n = 64;
+    if (n)
+      for (size_t k = 0; k < 24; ++k)
+        memcpy((uint64_t*)&x0[46 - 2 * k] + w, &block[w * 24 + k],
+               sizeof(uint64_t));
+    unused[w] = n == 64 ? 0 : ~0ULL << n;
+  }
+
+  BS_T miss;
+  memcpy(&miss, unused, sizeof(miss));
+
+  for (size_t n = 0; n < nonces; ++n) {
+    memcpy(x, x0, sizeof(x0));
+    uint32_t in = uid ^ nt_enc[n];
+    BS_T par = zero;
+
+    // Clock t of the nonce; the parity bit of a byte is encrypted with
+    // the first keystream bit of the next one
+    for (size_t t = 8; ; ++t) {
+      BS_T* s = x + t - 8;
+      BS_T f = BS_NAME(bs_filter)(s);
+      if (t % 8 == 0 && t > 8) {
+        miss |= par ^ f ^ (BIT(parity[n], t / 8 - 1) ? zero : ones);
+        if (BS_NAME(bs_all)(miss))
+          return 0;
+        if (t == 24)
+          break;
+        par = zero;
+      }
+      par ^= f ^ (BEBIT(nt_enc[n], t) ? ones : zero);
+      s[48] = BS_NAME(bs_feedback)(s) ^ f ^ (BEBIT(in, t) ? ones : zero);
+    }
+  }
+
+  uint64_t m[BS_WORDS];
+  memcpy(m, &miss, sizeof(m));
+  size_t hit_count = 0;
+  for (size_t l = 0; l < count; ++l)
+    if (!(m[l / 64] >> (l % 64) & 1))
+      hits[hit_count++] = (uint32_t)l;
+  return hit_count;
+}
@@ -42,6 +42,17 @@ key_list_t* dictionary_get() {
   return key_list;
 }
 
+uint32_t dictionary_hash() {
+  uint32_t hash = 2166136261u;
+  for (key_list_t* it = key_list; it; it = it->next) {
+    for (int i = 0; i < 6; ++i) {
+      hash ^= it->key[i];
+      hash *= 16777619u;
+    }
+  }
+  return hash;
+}
+
 // Append a node to the list. Don't append duplicates, O(n) operation.
 key_list_t* kl_add(key_list_t** list, const uint8_t* key) {
   if (list == NULL)
@@ -55,4 +55,11 @@ int dictionary_add(const uint8_t* key);
  */
 key_list_t* dictionary_get();
 
+/**
+ * Return a hash (32 bit FNV-1a) of the keys in the dictionary. The
+ * hash depends on the order of the keys, since it is used to tell if
+ * a key index is still valid.
+ */
+uint32_t dictionary_hash();
+
 #endif
@@ -0,0 +1,662 @@
+/**
+ * Copyright (C) 2011 Anders Sundman <anders@4zm.org>
+ *
+ * This file is part of mfterm.
+ *
+ * mfterm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * mfterm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with mfterm.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+#include "crypto1.h"
+#include "parallel.h"
+#include "crack.h"
+#include "hardnested.h"
+
+/**
+ * The checkpoint is a text file:
+ *
+ *   # mfterm hardnested checkpoint
+ *   uid 01020304
+ *   key 05 A
+ *   search 2048 31337
+ *   4d2f1a03 5
+ *   ...
+ *
+ * The search line (the nonces used and the tasks done) is there once
+ * the search has started. Then one line per nonce: the encrypted
+ * nonce and its parity bits.
+ */
+
+// The possible values of a half sum: the number of the 16 ways to
+// shift 4 bits into a half that give a 1. Only even ones occur.
+#define HN_HALF_SUMS 9
+
+// The estimated sums are kept unless this unlikely
+#define HN_MISS 1e-4
+
+// The fewest nonces with the same first byte for the second byte sum
+#define HN_MIN_GROUP 6
+
+// The tasks handed to a thread at a time, and the even halves run
+// through the batch functions at a time
+#define HN_CHUNK 4
+#define HN_BATCH 4096
+
+// The half sums of 20 bits of the odd half and 19 bits of the even
+// half, and how many of the 24 bit halves after the first byte have
+// each combination of first and second byte half sums
+static uint8_t* odd_sums;
+static uint8_t* even_sums;
+static uint32_t odd_count[HN_HALF_SUMS][HN_HALF_SUMS];
+static uint32_t even_count[HN_HALF_SUMS][HN_HALF_SUMS];
+
+// The probability of each sum for a random key
+static double sum_prior[257];
+
+static pthread_once_t tables_once = PTHREAD_ONCE_INIT;
+
+// The plan of a search: the sums that are likely enough, the first
+// byte whose nonces give the second byte sum and the states to search
+typedef struct {
+  bool first[257];
+  bool second[257];
+  int group;
+  double states;
+} hn_plan_t;
+
+// A part of the search: an odd half class with an even half class
+typedef struct {
+  uint32_t odd_start;
+  uint32_t odd_count;
+  uint32_t even_start;
+  uint32_t even_count;
+  uint64_t task_start;   // One task per odd half
+} hn_pair_t;
+
+// The state of a search, shared by the threads
+typedef struct {
+  hardnested_t* hn;
+  const uint32_t* odd;
+  const uint32_t* even;
+  const uint64_t* slices;
+  const hn_pair_t* pairs;
+  size_t pair_count;
+  uint64_t tasks;
+  uint64_t offset;       // The tasks done before this run
+  uint32_t group_enc[HARDNESTED_MAX_NONCES];
+  uint8_t group_parity[HARDNESTED_MAX_NONCES];
+  size_t group_count;
+  pthread_mutex_t mutex;
+  parallel_progress_t progress;
+  double states;
+  double states_done;
+  double start;
+  double last_print;
+  double last_save;
+  uint64_t* hits;
+  size_t hit_count;
+} hn_run_t;
+
+static uint8_t hn_parity8(uint32_t x) {
+  x ^= x >> 4;
+  x ^= x >> 2;
+  x ^= x >> 1;
+  return (uint8_t)(x & 1);
+}
+
+// The sum of two half sums (as the number of 1s out of 16)
+static int hn_sum(int p, int q) {
+  return p * (16 - q) + (16 - p) * q;
+}
+
+// Count the ways to shift the remaining of 4 bits into x that give an
+// odd parity of the filter outputs (acc so far)
+static unsigned int hn_half_sum(uint32_t x, unsigned int bits,
+                                unsigned int acc) {
+  if (bits == 4)
+    return acc;
+  unsigned int n = 0;
+  for (uint32_t b = 0; b < 2; ++b) {
+    uint32_t y = x << 1 | b;
+    n += hn_half_sum(y, bits + 1, acc ^ crypto1_filter(y));
+  }
+  return n;
+}
+
+static void hn_tables_setup() {
+  odd_sums = malloc(1 << 20);
+  even_sums = malloc(1 << 19);
+  if (!odd_sums || !even_sums) {
+    free(odd_sums);
+    free(even_sums);
+    odd_sums = even_sums = NULL;
+    return;
+  }
+
+  // The odd half also gives the first keystream bit
+  double odd_p[HN_HALF_SUMS] = { 0 }, even_p[HN_HALF_SUMS] = { 0 };
+  for (uint32_t x = 0; x < 1 << 20; ++x) {
+    odd_sums[x] = (uint8_t)(hn_half_sum(x, 0, crypto1_filter(x)) / 2);
+    odd_p[odd_sums[x]] += 1.0 / (1 << 20);
+  }
+  for (uint32_t x = 0; x < 1 << 19; ++x) {
+    even_sums[x] = (uint8_t)(hn_half_sum(x, 0, 0) / 2);
+    even_p[even_sums[x]] += 1.0 / (1 << 19);
+  }
+
+  for (int p = 0; p < HN_HALF_SUMS; ++p)
+    for (int q = 0; q < HN_HALF_SUMS; ++q)
+      sum_prior[hn_sum(2 * p, 2 * q)] += odd_p[p] * even_p[q];
+
+  // After the first byte, bits 4-23 of a half are bits 0-19 before it
+  for (uint32_t x = 0; x < 1 << 24; ++x) {
+    ++odd_count[odd_sums[x >> 4]][odd_sums[x & 0xfffff]];
+    ++even_count[even_sums[x >> 4 & 0x7ffff]][even_sums[x & 0x7ffff]];
+  }
+}
+
+static bool hn_tables() {
+  pthread_once(&tables_once, hn_tables_setup);
+  if (odd_sums == NULL)
+    printf("Out of memory.\n");
+  return odd_sums != NULL;
+}
+
+// n choose k, as a double
+static double hn_binomial(int n, int k) {
+  double r = 1;
+  for (int i = 1; i <= k; ++i)
+    r = r * (n - k + i) / i;
+  return r;
+}
+
+/**
+ * Pick the sums that are likely enough, given that ones out of seen
+ * of the 256 bytes gave a 1. Without any of them, it is all the sums.
+ */
+static void hn_likely_sums(int seen, int ones, bool* likely) {
+  double post[257];
+  double total = 0;
+  for (int s = 0; s <= 256; ++s) {
+    post[s] = sum_prior[s] == 0 || ones > s || seen - ones > 256 - s ? 0 :
+      sum_prior[s] * hn_binomial(s, ones) * hn_binomial(256 - s, seen - ones);
+    total += post[s];
+  }
+
+  // Drop the least likely sums while the total dropped is small
+  for (int s = 0; s <= 256; ++s)
+    likely[s] = post[s] > 0;
+  double dropped = 0;
+  for (;;) {
+    int min = -1;
+    for (int s = 0; s <= 256; ++s)
+      if (likely[s] && (min < 0 || post[s] < post[min]))
+        min = s;
+    if (min < 0 || dropped + post[min] > HN_MISS * total)
+      break;
+    dropped += post[min];
+    likely[min] = false;
+  }
+}
+
+// The states after the first byte that fit the likely sums
+static double hn_states(const bool* first, const bool* second) {
+  double states = 0;
+  for (int p0 = 0; p0 < HN_HALF_SUMS; ++p0)
+    for (int q0 = 0; q0 < HN_HALF_SUMS; ++q0) {
+      if (!first[hn_sum(2 * p0, 2 * q0)])
+        continue;
+      for (int p8 = 0; p8 < HN_HALF_SUMS; ++p8)
+        for (int q8 = 0; q8 < HN_HALF_SUMS; ++q8)
+          if (second[hn_sum(2 * p8, 2 * q8)])
+            states += (double)odd_count[p0][p8] * even_count[q0][q8];
+    }
+  return states;
+}
+
+// The bit of a nonce that the sums count: the parity of its byte and
+// the parity bit of the byte
+static uint8_t hn_sum_bit(uint32_t nt_enc, uint8_t parity, int byte) {
+  return hn_parity8(nt_enc >> (24 - 8 * byte) & 0xff) ^
+    (parity >> byte & 1) ^ 1;
+}
+
+// Make the plan for the first count nonces
+static void hn_plan(const hardnested_t* hn, size_t count, hn_plan_t* plan) {
+  static uint8_t seen[256][256 / 8];
+  static uint8_t ones[256][256 / 8];
+  int first_seen = 0, first_ones = 0;
+  int group_size[256] = { 0 };
+
+  memset(seen, 0, sizeof(seen));
+  memset(ones, 0, sizeof(ones));
+  bool first_done[256] = { false };
+  for (size_t i = 0; i < count; ++i) {
+    uint32_t b0 = hn->nt_enc[i] >> 24, b1 = hn->nt_enc[i] >> 16 & 0xff;
+    if (!first_done[b0]) {
+      first_done[b0] = true;
+      ++first_seen;
+      first_ones += hn_sum_bit(hn->nt_enc[i], hn->parity[i], 0);
+    }
+    if (!(seen[b0][b1 / 8] >> (b1 % 8) & 1)) {
+      seen[b0][b1 / 8] |= (uint8_t)(1 << (b1 % 8));
+      ones[b0][b1 / 8] |= (uint8_t)(hn_sum_bit(hn->nt_enc[i], hn->parity[i],
+                                               1) << (b1 % 8));
+      ++group_size[b0];
+    }
+  }
+
+  hn_likely_sums(first_seen, first_ones, plan->first);
+
+  // The first byte whose second byte sum leaves the fewest states
+  bool all[257];
+  hn_likely_sums(0, 0, all);
+  memcpy(plan->second, all, sizeof(all));
+  plan->group = -1;
+  plan->states = hn_states(plan->first, all);
+  for (int g = 0; g < 256; ++g) {
+    if (group_size[g] < HN_MIN_GROUP)
+      continue;
+    int group_ones = 0;
+    for (int b = 0; b < 256 / 8; ++b)
+      group_ones += __builtin_popcount(ones[g][b]);
+
+    bool second[257];
+    hn_likely_sums(group_size[g], group_ones, second);
+    double states = hn_states(plan->first, second);
+    if (states < plan->states) {
+      plan->states = states;
+      plan->group = g;
+      memcpy(plan->second, second, sizeof(second));
+    }
+  }
+}
+
+void hardnested_init(hardnested_t* hn, uint32_t uid,
+                     size_t sector, mf_key_type_t key_type) {
+  hn->uid = uid;
+  hn->sector = sector;
+  hn->key_type = key_type;
+  hn->count = 0;
+  hn->used = 0;
+  hn->done = 0;
+}
+
+const char* hardnested_file_name(uint32_t uid, size_t sector,
+                                 mf_key_type_t key_type) {
+  static char fn[64];
+  snprintf(fn, sizeof(fn), "mfterm-%08x-%02zx%c.hn", (unsigned int)uid,
+           sector, key_type == MF_KEY_A ? 'A' : 'B');
+  return fn;
+}
+
+int hardnested_load(hardnested_t* hn, uint32_t uid,
+                    size_t sector, mf_key_type_t key_type) {
+
+  const char* fn = hardnested_file_name(uid, sector, key_type);
+  FILE* hn_file = fopen(fn, "r");
+  if (hn_file == NULL)
+    return 1;
+
+  hardnested_init(hn, uid, sector, key_type);
+
+  char line[128];
+  int res = 0;
+  while (fgets(line, sizeof(line), hn_file)) {
+    unsigned int nt_enc, parity;
+    unsigned long long done;
+
+    // The file name already tells uid and key
+    if (line[0] == '#' || strncmp(line, "uid ", 4) == 0 ||
+        strncmp(line, "key ", 4) == 0)
+      continue;
+
+    if (sscanf(line, "search %zu %llu", &hn->used, &done) == 2) {
+      hn->done = done;
+      continue;
+    }
+
+    if (sscanf(line, "%x %x", &nt_enc, &parity) != 2 || parity > 0xf ||
+        hn->count == HARDNESTED_MAX_NONCES) {
+      printf("Invalid checkpoint line: %s", line);
+      res = 1;
+      break;
+    }
+    hn->nt_enc[hn->count] = nt_enc;
+    hn->parity[hn->count] = (uint8_t)parity;
+    ++hn->count;
+  }
+
+  if (res == 0 && hn->used > hn->count) {
+    printf("Invalid checkpoint: %s\n", fn);
+    res = 1;
+  }
+
+  fclose(hn_file);
+  return res;
+}
+
+int hardnested_save(const hardnested_t* hn) {
+
+  const char* fn = hardnested_file_name(hn->uid, hn->sector, hn->key_type);
+  char tmp_fn[72];
+  snprintf(tmp_fn, sizeof(tmp_fn), "%s.tmp", fn);
+
+  FILE* hn_file = fopen(tmp_fn, "w");
+  if (hn_file == NULL) {
+    printf("Could not open file: %s\n", tmp_fn);
+    return 1;
+  }
+
+  fprintf(hn_file, "# mfterm hardnested checkpoint\n");
+  fprintf(hn_file, "uid %08x\n", (unsigned int)hn->uid);
+  fprintf(hn_file, "key %02zx %c\n", hn->sector,
+          hn->key_type == MF_KEY_A ? 'A' : 'B');
+  if (hn->used)
+    fprintf(hn_file, "search %zu %llu\n", hn->used,
+            (unsigned long long)hn->done);
+  for (size_t i = 0; i < hn->count; ++i)
+    fprintf(hn_file, "%08x %x\n", (unsigned int)hn->nt_enc[i],
+            (unsigned int)hn->parity[i]);
+
+  if (fclose(hn_file) != 0 || rename(tmp_fn, fn) != 0) {
+    printf("Could not write checkpoint: %s\n", fn);
+    remove(tmp_fn);
+    return 1;
+  }
+
+  return 0;
+}
+
+void hardnested_remove(const hardnested_t* hn) {
+  remove(hardnested_file_name(hn->uid, hn->sector, hn->key_type));
+}
+
+void hardnested_add(hardnested_t* hn, const crack_nested_t* sample) {
+  if (hn->count == HARDNESTED_MAX_NONCES)
+    return;
+  hn->nt_enc[hn->count] = sample->nt_enc;
+  hn->parity[hn->count] = sample->parity;
+  ++hn->count;
+}
+
+double hardnested_estimate(const hardnested_t* hn) {
+  if (!hn_tables())
+    return 48;
+  hn_plan_t plan;
+  hn_plan(hn, hn->count, &plan);
+  return plan.states < 1 ? 0 : log2(plan.states);
+}
+
+// Roll a state that fits the nonces of the group back to the key, and
+// check it against all nonces
+static bool hn_check(hn_run_t* run, uint32_t odd, uint32_t even,
+                     uint64_t* key) {
+  const hardnested_t* hn = run->hn;
+  crypto1_state_t s;
+  s.odd = odd;
+  s.even = even;
+  crypto1_rollback_byte(&s, (uint8_t)((hn->uid ^ run->group_enc[0]) >> 24),
+                        true);
+  *key = crypto1_get_lfsr(&s);
+
+  for (size_t i = 0; i < hn->used; ++i) {
+    crack_nested_t sample;
+    sample.uid = hn->uid;
+    sample.nt_enc = hn->nt_enc[i];
+    sample.parity = hn->parity[i];
+    crypto1_init(&s, *key);
+    uint32_t nt = sample.nt_enc ^
+      crypto1_word(&s, hn->uid ^ sample.nt_enc, true);
+    if (!crack_nonce_parity(&sample, nt))
+      return false;
+  }
+  return true;
+}
+
+// Print the progress and save the checkpoint, when it's time
+static void hn_progress(hn_run_t* run, bool force) {
+  if (parallel_progress_print_due(&run->progress, force)) {
+    double part = (double)run->progress.done / (double)run->tasks;
+    double rate = run->states_done / (parallel_time() - run->progress.start);
+    double left = rate > 0 ? run->states * (1 - part) / rate : 0;
+    unsigned long s = (unsigned long)left;
+    printf("Searched %5.1f%% of 2^%.1f states, %.1f Mstates/s, "
+           "%lu:%02lu:%02lu left\n",
+           100.0 * part, log2(run->states), rate / 1e6,
+           s / 3600, s / 60 % 60, s % 60);
+  }
+  if (parallel_progress_save_due(&run->progress, force)) {
+    run->hn->done = run->progress.done;
+    hardnested_save(run->hn);
+  }
+}
+
+static bool hn_chunk(size_t begin, size_t end, void* arg) {
+  hn_run_t* run = (hn_run_t*)arg;
+  uint64_t first = run->offset + begin, last = run->offset + end;
+  uint32_t hits[HN_BATCH];
+  double states = 0;
+  bool found = false;
+
+  // The pair of the first task
+  size_t lo = 0, hi = run->pair_count;
+  while (hi - lo > 1) {
+    size_t mid = (lo + hi) / 2;
+    if (run->pairs[mid].task_start <= first)
+      lo = mid;
+    else
+      hi = mid;
+  }
+
+  for (uint64_t task = first; task < last; ++task) {
+    while (task >= run->pairs[lo].task_start + run->pairs[lo].odd_count)
+      ++lo;
+    const hn_pair_t* pair = &run->pairs[lo];
+    uint32_t odd = run->odd[pair->odd_start + (task - pair->task_start)];
+    const uint32_t* even = run->even + pair->even_start;
+
+    // Even classes start on a block of 64 halves
+    const uint64_t* slices = run->slices + pair->even_start / 64 * 24;
+    for (uint32_t i = 0; i < pair->even_count; i += HN_BATCH) {
+      size_t n = pair->even_count - i < HN_BATCH ?
+        pair->even_count - i : HN_BATCH;
+      size_t count = crypto1_batch_nonces(odd, slices + i / 64 * 24, n,
+                                          run->hn->uid, run->group_enc,
+                                          run->group_parity,
+                                          run->group_count, hits);
+      for (size_t h = 0; h < count; ++h) {
+        uint64_t key;
+        if (!hn_check(run, odd, even[i + hits[h]], &key))
+          continue;
+        pthread_mutex_lock(&run->mutex);
+        if (run->hit_count < CRACK_MAX_HITS)
+          run->hits[run->hit_count++] = key;
+        pthread_mutex_unlock(&run->mutex);
+        found = true;
+      }
+    }
+    states += pair->even_count;
+  }
+
+  pthread_mutex_lock(&run->mutex);
+  run->states_done += states;
+  parallel_progress_add(&run->progress, first, last);
+  hn_progress(run, false);
+  pthread_mutex_unlock(&run->mutex);
+
+  // The nonces leave no doubt about a key
+  return !found;
+}
+
+// Collect the halves of the classes in use, in order of class, each
+// class padded to a multiple of 64. Return the start of each class in
+// start, or NULL if out of memory.
+static uint32_t* hn_halves(bool odd, const bool use[][HN_HALF_SUMS],
+                           uint32_t start[][HN_HALF_SUMS], size_t* total) {
+  const uint32_t (*count)[HN_HALF_SUMS] = odd ? odd_count : even_count;
+  uint32_t next[HN_HALF_SUMS][HN_HALF_SUMS];
+  size_t n = 0;
+  for (int a = 0; a < HN_HALF_SUMS; ++a)
+    for (int b = 0; b < HN_HALF_SUMS; ++b) {
+      start[a][b] = next[a][b] = (uint32_t)n;
+      if (use[a][b])
+        n += (count[a][b] + 63) / 64 * 64;
+    }
+
+  uint32_t* halves = calloc(n ? n : 1, sizeof(uint32_t));
+  if (halves == NULL)
+    return NULL;
+
+  for (uint32_t x = 0; x < 1 << 24; ++x) {
+    int a = odd ? odd_sums[x >> 4] : even_sums[x >> 4 & 0x7ffff];
+    int b = odd ? odd_sums[x & 0xfffff] : even_sums[x & 0x7ffff];
+    if (use[a][b])
+      halves[next[a][b]++] = x;
+  }
+
+  *total = n;
+  return halves;
+}
+
+int hardnested_search(hardnested_t* hn, uint64_t* hits) {
+  if (!hn_tables())
+    return -1;
+
+  if (hn->used == 0) {
+    hn->used = hn->count;
+    hn->done = 0;
+  }
+
+  hn_plan_t plan;
+  hn_plan(hn, hn->used, &plan);
+  if (plan.group < 0) {
+    printf("Too few nonces with the same first byte.\n");
+    return -1;
+  }
+
+  // The classes of the halves that take part
+  bool odd_use[HN_HALF_SUMS][HN_HALF_SUMS] = { { false } };
+  bool even_use[HN_HALF_SUMS][HN_HALF_SUMS] = { { false } };
+  for (int p0 = 0; p0 < HN_HALF_SUMS; ++p0)
+    for (int p8 = 0; p8 < HN_HALF_SUMS; ++p8)
+      for (int q0 = 0; q0 < HN_HALF_SUMS; ++q0)
+        for (int q8 = 0; q8 < HN_HALF_SUMS; ++q8)
+          if (plan.first[hn_sum(2 * p0, 2 * q0)] &&
+              plan.second[hn_sum(2 * p8, 2 * q8)])
+            odd_use[p0][p8] = even_use[q0][q8] = true;
+
+  static hn_run_t run;
+  uint32_t odd_start[HN_HALF_SUMS][HN_HALF_SUMS];
+  uint32_t even_start[HN_HALF_SUMS][HN_HALF_SUMS];
+  size_t odd_total, even_total;
+  uint32_t* odd = hn_halves(true, odd_use, odd_start, &odd_total);
+  uint32_t* even = hn_halves(false, even_use, even_start, &even_total);
+  uint64_t* slices = malloc((even_total / 64 * 24 + 1) * sizeof(uint64_t));
+  hn_pair_t* pairs = malloc(HN_HALF_SUMS * HN_HALF_SUMS *
+                            HN_HALF_SUMS * HN_HALF_SUMS * sizeof(hn_pair_t));
+  if (!odd || !even || !slices || !pairs) {
+    printf("Out of memory.\n");
+    free(odd);
+    free(even);
+    free(slices);
+    free(pairs);
+    return -1;
+  }
+  crypto1_batch_slice(even, even_total, slices);
+
+  // Every odd class with every even class that fits the sums
+  run.pair_count = 0;
+  run.tasks = 0;
+  run.states = 0;
+  for (int p0 = 0; p0 < HN_HALF_SUMS; ++p0)
+    for (int p8 = 0; p8 < HN_HALF_SUMS; ++p8)
+      for (int q0 = 0; q0 < HN_HALF_SUMS; ++q0)
+        for (int q8 = 0; q8 < HN_HALF_SUMS; ++q8) {
+          if (!plan.first[hn_sum(2 * p0, 2 * q0)] ||
+              !plan.second[hn_sum(2 * p8, 2 * q8)] ||
+              odd_count[p0][p8] == 0 || even_count[q0][q8] == 0)
+            continue;
+          hn_pair_t* pair = &pairs[run.pair_count++];
+          pair->odd_start = odd_start[p0][p8];
+          pair->odd_count = odd_count[p0][p8];
+          pair->even_start = even_start[q0][q8];
+          pair->even_count = even_count[q0][q8];
+          pair->task_start = run.tasks;
+          run.tasks += pair->odd_count;
+          run.states += (double)pair->odd_count * pair->even_count;
+        }
+
+  if (run.tasks == 0) {
+    printf("No state fits the nonces.\n");
+    free(odd);
+    free(even);
+    free(slices);
+    free(pairs);
+    return 0;
+  }
+
+  // The nonces that share the first byte picked
+  run.hn = hn;
+  run.group_count = 0;
+  for (size_t i = 0; i < hn->used; ++i) {
+    if ((int)(hn->nt_enc[i] >> 24) != plan.group)
+      continue;
+    run.group_enc[run.group_count] = hn->nt_enc[i];
+    run.group_parity[run.group_count] = hn->parity[i];
+    ++run.group_count;
+  }
+
+  run.odd = odd;
+  run.even = even;
+  run.slices = slices;
+  run.pairs = pairs;
+  run.offset = hn->done < run.tasks ? hn->done : run.tasks;
+  parallel_progress_init(&run.progress, run.offset);
+  run.states_done = 0;
+  run.hits = hits;
+  run.hit_count = 0;
+  pthread_mutex_init(&run.mutex, NULL);
+
+  printf("Searching 2^%.1f states (%zu nonces, first byte %02x) "
+         "on %zu threads, %s.\n", log2(plan.states), hn->used, plan.group,
+         parallel_threads(), crypto1_batch_name());
+  if (run.offset)
+    printf("Resuming at %.1f%%.\n",
+           100.0 * (double)run.offset / (double)run.tasks);
+
+  int res = parallel_for(run.tasks - run.offset, HN_CHUNK, hn_chunk, &run);
+
+  if (res == 0 || run.hit_count == 0) {
+    pthread_mutex_lock(&run.mutex);
+    hn_progress(&run, true);
+    pthread_mutex_unlock(&run.mutex);
+  }
+
+  pthread_mutex_destroy(&run.mutex);
+  free(odd);
+  free(even);
+  free(slices);
+  free(pairs);
+
+  if (run.hit_count)
+    return (int)run.hit_count;
+  return res == 0 ? 0 : -1;
+}
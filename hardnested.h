@@ -0,0 +1,106 @@
+#ifndef HARDNESTED__H
+#define HARDNESTED__H
+
+/**
+ * Copyright (C) 2011 Anders Sundman <anders@4zm.org>
+ *
+ * This file is part of mfterm.
+ *
+ * mfterm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * mfterm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with mfterm.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "tag.h"
+#include "crack.h"
+
+/**
+ * The nested attack for tags with a hardened PRNG, where the nonce of
+ * a nested authentication can't be predicted. Only the encrypted
+ * parity bits tell something about the key.
+ *
+ * For a given key, the parity bit of the first nonce byte XORed with
+ * the parity of the encrypted byte depends only on that byte. The
+ * number of the 256 first bytes that give a 1 (the sum) is made of one
+ * value from 20 bits of the odd half of the LFSR and one from 19 bits
+ * of the even half, and only 19 sums are possible. The same holds for
+ * the second byte of the nonces that share a first byte, with the LFSR
+ * state after that byte. The sums are estimated from the nonces, and
+ * the LFSR states after the first byte that fit them are searched with
+ * the batch Crypto1 on all cores.
+ */
+
+// The most nonces collected for one key
+#define HARDNESTED_MAX_NONCES 16384
+
+/**
+ * The nonces of one key and the progress of the search. This is also
+ * the checkpoint; saved, the collection and the search can continue
+ * after an interruption.
+ */
+typedef struct {
+  uint32_t uid;
+  size_t sector;
+  mf_key_type_t key_type;
+  uint32_t nt_enc[HARDNESTED_MAX_NONCES];
+  uint8_t parity[HARDNESTED_MAX_NONCES];  // As in crack_nested_t
+  size_t count;
+  size_t used;    // The nonces the search is based on; 0 before it starts
+  uint64_t done;  // The search tasks done
+} hardnested_t;
+
+// Set up an empty checkpoint (no nonces) for the key of the tag
+void hardnested_init(hardnested_t* hn, uint32_t uid,
+                     size_t sector, mf_key_type_t key_type);
+
+/**
+ * Load the checkpoint for the key of the tag from the current
+ * directory. Return 0 on success, != 0 if there isn't any checkpoint
+ * or it could not be read.
+ */
+int hardnested_load(hardnested_t* hn, uint32_t uid,
+                    size_t sector, mf_key_type_t key_type);
+
+// Save the checkpoint in the current directory (through a temporary
+// file). Return 0 on success != 0 on failure.
+int hardnested_save(const hardnested_t* hn);
+
+// Remove the checkpoint file (when the attack has completed)
+void hardnested_remove(const hardnested_t* hn);
+
+// Return the name of the checkpoint file: mfterm-<uid>-<sector><A|B>.hn
+const char* hardnested_file_name(uint32_t uid, size_t sector,
+                                 mf_key_type_t key_type);
+
+// Add a nonce of a nested authentication (no more once full)
+void hardnested_add(hardnested_t* hn, const crack_nested_t* sample);
+
+/**
+ * Estimate the number of states the search would have to go through
+ * with the nonces so far. Return its log2, 48 if the nonces don't tell
+ * anything yet.
+ */
+double hardnested_estimate(const hardnested_t* hn);
+
+/**
+ * Search the key on all cores, starting at the progress of the
+ * checkpoint. The progress and an estimate of the time left are
+ * printed as the search goes on, and the checkpoint is saved now and
+ * then. Return the number of keys found (in hits, room for
+ * CRACK_MAX_HITS), or -1 if cancelled or on error.
+ */
+int hardnested_search(hardnested_t* hn, uint64_t* hits);
+
+#endif
@@ -0,0 +1,225 @@
+/**
+ * Copyright (C) 2011 Anders Sundman <anders@4zm.org>
+ *
+ * This file is part of mfterm.
+ *
+ * mfterm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mfterm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mfterm.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+#include <pthread.h>
+#include <time.h>
+#include "job.h"
+
+typedef enum {
+  JOB_NONE,
+  JOB_RUNNING,
+  JOB_DONE,
+  JOB_CANCELLED,
+} job_state_t;
+
+// Job state, protected by the mutex. The flags used by the signal
+// handler are sig_atomic_t.
+static pthread_mutex_t job_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t job_done_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t job_thread;
+static job_state_t job_state = JOB_NONE;
+static volatile sig_atomic_t job_active = 0;
+static volatile sig_atomic_t job_cancel_requested = 0;
+
+static int job_id = 0;
+static int job_background = 0;
+static int job_is_background = 0;
+static int job_result = 0;
+static char job_name[64];
+static struct timespec job_start;
+static double job_seconds = 0.0;
+
+// The job function and a copy of its argument data
+#define JOB_ARG_MAX 16384
+static job_func_t job_func;
+static unsigned char job_arg[JOB_ARG_MAX];
+
+void* job_main(void* unused);
+void job_sigint(int sig);
+double job_elapsed();
+
+void job_init() {
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = job_sigint;
+  sigemptyset(&sa.sa_mask);
+  sigaction(SIGINT, &sa, NULL);
+}
+
+// Cancel the running job. Without a job, Ctrl-C terminates mfterm
+// just like it always has.
+void job_sigint(int sig) {
+  if (job_active) {
+    job_cancel_requested = 1;
+    return;
+  }
+
+  signal(sig, SIG_DFL);
+  raise(sig);
+}
+
+int job_run(const char* name, job_func_t func,
+            const void* arg, size_t arg_size) {
+
+  pthread_mutex_lock(&job_mutex);
+
+  // Nested job, e.g. a command run by another job. Just call it.
+  if (job_state == JOB_RUNNING &&
+      pthread_equal(pthread_self(), job_thread)) {
+    pthread_mutex_unlock(&job_mutex);
+    return func((void*)arg);
+  }
+
+  if (job_state == JOB_RUNNING) {
+    pthread_mutex_unlock(&job_mutex);
+    printf("Job [%d] '%s' is still running. See 'jobs'.\n",
+           job_id, job_name);
+    return -1;
+  }
+
+  if (arg_size > sizeof(job_arg)) {
+    pthread_mutex_unlock(&job_mutex);
+    printf("Internal error: job argument too large.\n");
+    return -1;
+  }
+
+  // Set up the new job
+  ++job_id;
+  strncpy(job_name, name, sizeof(job_name) - 1);
+  job_name[sizeof(job_name) - 1] = '\0';
+  job_func = func;
+  if (arg_size)
+    memcpy(job_arg, arg, arg_size);
+  job_is_background = job_background;
+  job_result = 0;
+  job_cancel_requested = 0;
+  job_state = JOB_RUNNING;
+  job_active = 1;
+  clock_gettime(CLOCK_MONOTONIC, &job_start);
+
+  pthread_attr_t attr;
+  pthread_attr_init(&attr);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+  int err = pthread_create(&job_thread, &attr, job_main, NULL);
+  pthread_attr_destroy(&attr);
+
+  if (err) {
+    job_state = JOB_NONE;
+    job_active = 0;
+    pthread_mutex_unlock(&job_mutex);
+    printf("Could not start a worker thread.\n");
+    return -1;
+  }
+
+  if (job_is_background) {
+    printf("[%d] %s\n", job_id, job_name);
+    pthread_mutex_unlock(&job_mutex);
+    return 0;
+  }
+
+  // Foreground job, wait for it. Ctrl-C will cancel it.
+  while (job_state == JOB_RUNNING)
+    pthread_cond_wait(&job_done_cond, &job_mutex);
+  int res = job_result;
+  pthread_mutex_unlock(&job_mutex);
+
+  return res;
+}
+
+void* job_main(void* unused) {
+  int res = job_func(job_arg);
+
+  pthread_mutex_lock(&job_mutex);
+  job_result = res;
+  job_seconds = job_elapsed();
+  job_state = job_cancel_requested ? JOB_CANCELLED : JOB_DONE;
+  job_active = 0;
+  if (job_is_background)
+    printf("[%d] %s  %s\n", job_id,
+           job_state == JOB_CANCELLED ? "Cancelled" : "Done", job_name);
+  pthread_cond_broadcast(&job_done_cond);
+  pthread_mutex_unlock(&job_mutex);
+
+  return NULL;
+}
+
+void job_set_background(int background) {
+  pthread_mutex_lock(&job_mutex);
+  job_background = background;
+  pthread_mutex_unlock(&job_mutex);
+}
+
+void job_cancel() {
+  if (job_active)
+    job_cancel_requested = 1;
+}
+
+int job_cancelled() {
+  return job_cancel_requested != 0;
+}
+
+int job_busy() {
+  pthread_mutex_lock(&job_mutex);
+  int busy = job_active && !pthread_equal(pthread_self(), job_thread);
+  pthread_mutex_unlock(&job_mutex);
+  return busy;
+}
+
+void job_wait() {
+  pthread_mutex_lock(&job_mutex);
+  while (job_state == JOB_RUNNING)
+    pthread_cond_wait(&job_done_cond, &job_mutex);
+  pthread_mutex_unlock(&job_mutex);
+}
+
+void job_print() {
+  static const char* state_str[] = {
+    "", "Running", "Done", "Cancelled"
+  };
+
+  pthread_mutex_lock(&job_mutex);
+
+  if (job_state == JOB_NONE) {
+    printf("No jobs.\n");
+  }
+  else {
+    double seconds =
+      job_state == JOB_RUNNING ? job_elapsed() : job_seconds;
+    printf("[%d] %-10s %-20s %8.1fs", job_id, state_str[job_state],
+           job_name, seconds);
+    if (job_state != JOB_RUNNING)
+      printf("  (returned %d)", job_result);
+    printf("\n");
+  }
+
+  pthread_mutex_unlock(&job_mutex);
+}
+
+// Seconds since the job was started
+double job_elapsed() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (double)(now.tv_sec - job_start.tv_sec) +
+    (double)(now.tv_nsec - job_start.tv_nsec) / 1e9;
+}
@@ -0,0 +1,71 @@
+#ifndef JOB__H
+#define JOB__H
+
+/**
+ * Copyright (C) 2011 Anders Sundman <anders@4zm.org>
+ *
+ * This file is part of mfterm.
+ *
+ * mfterm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mfterm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mfterm.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stddef.h>
+
+/**
+ * Reader operations run as jobs on a worker thread. There is only
+ * one reader, so there is never more than one job at a time. A job
+ * that checks job_cancelled() at its safe points can be stopped with
+ * 'jobs cancel' or with Ctrl-C.
+ */
+typedef int (*job_func_t)(void* arg);
+
+// Install the SIGINT handler used to cancel jobs
+void job_init();
+
+/**
+ * Run the function as a job on the worker thread. The argument data
+ * (arg_size bytes) is copied, so it may live on the caller's stack.
+ * Unless job_set_background(1) has been called, wait for the job to
+ * finish and return its result. Return 0 if the job was started in
+ * the background and -1 if it could not be started.
+ *
+ * Calling job_run from a running job executes the function directly.
+ */
+int job_run(const char* name, job_func_t func,
+            const void* arg, size_t arg_size);
+
+// Run the jobs started by the current command in the background
+void job_set_background(int background);
+
+// Ask the running job to stop at the next safe point
+void job_cancel();
+
+// Return nonzero if the running job has been asked to stop
+int job_cancelled();
+
+/**
+ * Return nonzero if a job is running on another thread. Commands that
+ * change the tag, the keys, the dictionary or the spec check this, as
+ * the job may be using them. A job (e.g. the trigger job running a
+ * command) is never busy to itself.
+ */
+int job_busy();
+
+// Block until the running job (if any) has finished
+void job_wait();
+
+// Print the state of the current or last job
+void job_print();
+
+#endif
@@ -0,0 +1,274 @@
+/**
+ * Copyright (C) 2011 Anders Sundman <anders@4zm.org>
+ *
+ * This file is part of mfterm.
+ *
+ * mfterm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * mfterm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with mfterm.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "crypto1.h"
+#include "crack.h"
+#include "dictionary.h"
+#include "parallel.h"
+#include "ksindex.h"
+
+// The keys handed to a thread at a time
+#define KSINDEX_CHUNK (16 * CRYPTO1_BATCH_MAX)
+
+#define KSINDEX_ENTRY_SIZE 10
+
+static const uint8_t ksindex_magic[4] = { 'M', 'F', 'T', 'K' };
+
+// The state of an index build, shared by the threads
+typedef struct {
+  const uint64_t* keys;
+  uint32_t uid_nt;
+  ksindex_entry_t* entries;
+} ksindex_build_t;
+
+static void put_be(uint8_t* buf, uint64_t x, int bytes) {
+  for (int i = 0; i < bytes; ++i)
+    buf[i] = (uint8_t)(x >> (8 * (bytes - 1 - i)));
+}
+
+static uint64_t get_be(const uint8_t* buf, int bytes) {
+  uint64_t x = 0;
+  for (int i = 0; i < bytes; ++i)
+    x = x << 8 | buf[i];
+  return x;
+}
+
+const char* ksindex_file_name(uint32_t uid, uint32_t nt) {
+  static char fn[64];
+  snprintf(fn, sizeof(fn), "mfterm-%08x-%08x.ksi", (unsigned int)uid,
+           (unsigned int)nt);
+  return fn;
+}
+
+// Load the index file of the tag. Return 0 on success, 1 if there
+// isn't any, -1 if it could not be read.
+static int ksindex_load(ksindex_t* index, uint32_t uid, uint32_t nt) {
+  const char* fn = ksindex_file_name(uid, nt);
+  FILE* file = fopen(fn, "rb");
+  if (file == NULL)
+    return 1;
+
+  uint8_t header[24];
+  if (fread(header, 1, sizeof(header), file) != sizeof(header) ||
+      memcmp(header, ksindex_magic, 4) != 0 ||
+      header[4] != KSINDEX_FILE_VERSION ||
+      get_be(header + 8, 4) != uid || get_be(header + 12, 4) != nt) {
+    printf("Not a keystream index for the tag: %s\n", fn);
+    fclose(file);
+    return -1;
+  }
+
+  index->uid = uid;
+  index->nt = nt;
+  index->dict_hash = (uint32_t)get_be(header + 16, 4);
+  index->count = (size_t)get_be(header + 20, 4);
+
+  // The entries must fill the rest of the file, before it's allocated
+  long size = -1;
+  if (fseek(file, 0, SEEK_END) == 0)
+    size = ftell(file);
+  if (size < 0 || fseek(file, sizeof(header), SEEK_SET) != 0 ||
+      (uint64_t)size != sizeof(header) +
+      (uint64_t)index->count * KSINDEX_ENTRY_SIZE) {
+    printf("Corrupt keystream index (size doesn't match): %s\n", fn);
+    fclose(file);
+    return -1;
+  }
+
+  index->entries = malloc((index->count ? index->count : 1) *
+                          sizeof(ksindex_entry_t));
+  if (index->entries == NULL) {
+    printf("Out of memory.\n");
+    fclose(file);
+    return -1;
+  }
+
+  for (size_t i = 0; i < index->count; ++i) {
+    uint8_t buf[KSINDEX_ENTRY_SIZE];
+    if (fread(buf, 1, sizeof(buf), file) != sizeof(buf)) {
+      printf("Truncated keystream index: %s\n", fn);
+      ksindex_free(index);
+      fclose(file);
+      return -1;
+    }
+    index->entries[i].ks = (uint32_t)get_be(buf, 4);
+    index->entries[i].key = get_be(buf + 4, 6);
+  }
+
+  fclose(file);
+  return 0;
+}
+
+// Save the index in the current directory (through a temporary file).
+// Return 0 on success != 0 on failure.
+static int ksindex_save(const ksindex_t* index) {
+  const char* fn = ksindex_file_name(index->uid, index->nt);
+  char tmp_fn[72];
+  snprintf(tmp_fn, sizeof(tmp_fn), "%s.tmp", fn);
+
+  FILE* file = fopen(tmp_fn, "wb");
+  if (file == NULL) {
+    printf("Could not open file: %s\n", tmp_fn);
+    return 1;
+  }
+
+  uint8_t header[24] = { 0 };
+  memcpy(header, ksindex_magic, 4);
+  header[4] = KSINDEX_FILE_VERSION;
+  put_be(header + 8, index->uid, 4);
+  put_be(header + 12, index->nt, 4);
+  put_be(header + 16, index->dict_hash, 4);
+  put_be(header + 20, index->count, 4);
+  bool ok = fwrite(header, 1, sizeof(header), file) == sizeof(header);
+
+  for (size_t i = 0; ok && i < index->count; ++i) {
+    uint8_t buf[KSINDEX_ENTRY_SIZE];
+    put_be(buf, index->entries[i].ks, 4);
+    put_be(buf + 4, index->entries[i].key, 6);
+    ok = fwrite(buf, 1, sizeof(buf), file) == sizeof(buf);
+  }
+
+  if (fclose(file) != 0 || !ok || rename(tmp_fn, fn) != 0) {
+    printf("Could not write keystream index: %s\n", fn);
+    remove(tmp_fn);
+    return 1;
+  }
+  return 0;
+}
+
+static bool ksindex_build_chunk(size_t begin, size_t end, void* arg) {
+  ksindex_build_t* build = (ksindex_build_t*)arg;
+  uint32_t ks[KSINDEX_CHUNK];
+
+  crypto1_batch_nonce_keystream(build->keys + begin, end - begin,
+                                build->uid_nt, ks);
+  for (size_t i = begin; i < end; ++i) {
+    build->entries[i].ks = ks[i - begin];
+    build->entries[i].key = build->keys[i];
+  }
+  return true;
+}
+
+static int ksindex_cmp(const void* a, const void* b) {
+  const ksindex_entry_t* x = (const ksindex_entry_t*)a;
+  const ksindex_entry_t* y = (const ksindex_entry_t*)b;
+  if (x->ks != y->ks)
+    return x->ks < y->ks ? -1 : 1;
+  return x->key < y->key ? -1 : x->key > y->key;
+}
+
+// Build the index of the dictionary for the tag on all cores
+static int ksindex_build(ksindex_t* index, uint32_t uid, uint32_t nt) {
+  size_t count = 0;
+  for (key_list_t* it = dictionary_get(); it; it = it->next)
+    ++count;
+
+  uint64_t* keys = malloc((count ? count : 1) * sizeof(uint64_t));
+  index->entries = malloc((count ? count : 1) * sizeof(ksindex_entry_t));
+  if (keys == NULL || index->entries == NULL) {
+    printf("Out of memory.\n");
+    free(keys);
+    free(index->entries);
+    index->entries = NULL;
+    return -1;
+  }
+  size_t i = 0;
+  for (key_list_t* it = dictionary_get(); it; it = it->next)
+    keys[i++] = crack_key_to_num(it->key);
+
+  index->uid = uid;
+  index->nt = nt;
+  index->dict_hash = dictionary_hash();
+  index->count = count;
+
+  ksindex_build_t build;
+  build.keys = keys;
+  build.uid_nt = uid ^ nt;
+  build.entries = index->entries;
+
+  double start = parallel_time();
+  int res = parallel_for(count, KSINDEX_CHUNK, ksindex_build_chunk, &build);
+  free(keys);
+  if (res) {
+    ksindex_free(index);
+    return -1;
+  }
+
+  qsort(index->entries, count, sizeof(ksindex_entry_t), ksindex_cmp);
+  printf("Indexed %zu keys in %.2fs (%zu threads, %s).\n", count,
+         parallel_time() - start, parallel_threads(), crypto1_batch_name());
+  return 0;
+}
+
+int ksindex_get(ksindex_t* index, uint32_t uid, uint32_t nt) {
+  const char* fn = ksindex_file_name(uid, nt);
+  bool have_dict = dictionary_get() != NULL;
+
+  int res = ksindex_load(index, uid, nt);
+  if (res == 0 && (!have_dict || index->dict_hash == dictionary_hash())) {
+    printf("Using the keystream index %s (%zu keys).\n", fn, index->count);
+    return 0;
+  }
+  if (res == 0) {
+    printf("The dictionary has changed since %s was built.\n", fn);
+    ksindex_free(index);
+  }
+
+  if (!have_dict) {
+    printf("The dictionary is empty. Load one with 'dict load'.\n");
+    return -1;
+  }
+
+  if (ksindex_build(index, uid, nt))
+    return -1;
+  if (ksindex_save(index) == 0)
+    printf("Saved the keystream index to %s.\n", fn);
+  return 0;
+}
+
+void ksindex_free(ksindex_t* index) {
+  free(index->entries);
+  index->entries = NULL;
+  index->count = 0;
+}
+
+size_t ksindex_lookup(const ksindex_t* index, uint32_t ks,
+                      uint64_t* keys, size_t max) {
+  // The first entry with a keystream >= ks
+  size_t lo = 0, hi = index->count;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (index->entries[mid].ks < ks)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  size_t count = 0;
+  for (; lo < index->count && index->entries[lo].ks == ks; ++lo, ++count)
+    if (count < max)
+      keys[count] = index->entries[lo].key;
+  return count;
+}
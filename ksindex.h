@@ -0,0 +1,78 @@
+#ifndef KSINDEX__H
+#define KSINDEX__H
+
+/**
+ * Copyright (C) 2011 Anders Sundman <anders@4zm.org>
+ *
+ * This file is part of mfterm.
+ *
+ * mfterm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * mfterm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with mfterm.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * A keystream index for a tag with a static nonce. The tag nonce of a
+ * nested authentication is sent encrypted with the first 32 keystream
+ * bits, and those only depend on the key, the UID and the nonce. With
+ * the nonce always the same, the keystream of every dictionary key can
+ * be computed once per tag; then one nested authentication and a
+ * lookup tell the key, if it's in the dictionary.
+ */
+typedef struct {
+  uint32_t ks;
+  uint64_t key;
+} ksindex_entry_t;
+
+typedef struct {
+  uint32_t uid;
+  uint32_t nt;
+  uint32_t dict_hash;         // The dictionary the index was built for
+  ksindex_entry_t* entries;   // Sorted by keystream
+  size_t count;
+} ksindex_t;
+
+/**
+ * The index files are binary: an 8 byte header, "MFTK" followed by
+ * the format version and three zero bytes, then uid[4] nt[4]
+ * dict_hash[4] count[4] and count 10 byte entries, ks[4] key[6], all
+ * big endian.
+ */
+#define KSINDEX_FILE_VERSION 1
+
+// Return the name of the index file: mfterm-<uid>-<nt>.ksi
+const char* ksindex_file_name(uint32_t uid, uint32_t nt);
+
+/**
+ * Get the index of the loaded dictionary for the tag: load it from
+ * the current directory if it was built for the same dictionary (or
+ * no dictionary is loaded), otherwise build it on all cores with the
+ * batch Crypto1 and save it. Return 0 on success, -1 on failure or if
+ * cancelled.
+ */
+int ksindex_get(ksindex_t* index, uint32_t uid, uint32_t nt);
+
+// Free the entries of the index
+void ksindex_free(ksindex_t* index);
+
+/**
+ * Find the keys that encrypt the nonce with the keystream ks. Return
+ * their number; up to max of them are written to keys.
+ */
+size_t ksindex_lookup(const ksindex_t* index, uint32_t ks,
+                      uint64_t* keys, size_t max);
+
+#endif
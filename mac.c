@@ -62,6 +62,33 @@ int compute_mac(const unsigned char* input,
   return 0;
 }
 
+/**
+ * Compute the MAC of a given block of the tag with the specified 8 byte
+ * key into mac (8 bytes). Only uses its arguments, so it can run on
+ * any thread. Return 0 on success.
+ *
+ * The input to MAC algo [ 4 serial | 14 data | 6 0-pad ]
+ */
+int compute_tag_block_mac(const mf_tag_t* tag,
+                          unsigned int block,
+                          const unsigned char* key,
+                          unsigned char* mac) {
+
+  // Input to MAC algo [ 4 serial | 14 data | 6 0-pad ]
+  unsigned char input[24];
+  memcpy(&input, tag->amb[0].mbm.abtUID, 4);
+  memcpy(&input[4], tag->amb[block].mbd.abtData, 14);
+  memset(&input[18], 0, 6);
+
+  // compute_mac writes the whole CBC output
+  unsigned char output[24];
+  if (compute_mac(input, output, key, 24) != 0)
+    return -1;
+
+  memcpy(mac, output, 8);
+  return 0;
+}
+
 /**
  * Compute the MAC of a given block with the specified 8 byte
  * key. Return a 8 byte MAC value.
@@ -77,17 +104,9 @@ unsigned char* compute_block_mac(unsigned int block,
 
   static unsigned char output[8];
 
-  // Input to MAC algo [ 4 serial | 14 data | 6 0-pad ]
-  unsigned char input[24];
-  memcpy(&input, current_tag.amb[0].mbm.abtUID, 4);
-  memcpy(&input[4], current_tag.amb[block].mbd.abtData, 14);
-  memset(&input[18], 0, 6);
-
-  int res = 0;
-  res = compute_mac(input, output, key, 24);
-
   // Ret null on error
-  if (res != 0) return NULL;
+  if (compute_tag_block_mac(&current_tag, block, key, output) != 0)
+    return NULL;
 
   // Should the new MAC be written back?
   if (update) {
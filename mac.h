@@ -20,6 +20,8 @@
  * along with mfterm.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include "tag.h"
+
 // The DES MAC key in use
 extern unsigned char current_mac_key[];
 
@@ -34,6 +36,16 @@ int compute_mac(const unsigned char* input,
                 const unsigned char* key,
                 long length);
 
+/**
+ * Compute the MAC of a given block of the tag with the specified 8 byte
+ * key into mac (8 bytes). Only uses its arguments, so it can run on
+ * any thread. Return 0 on success.
+ */
+int compute_tag_block_mac(const mf_tag_t* tag,
+                          unsigned int block,
+                          const unsigned char* key,
+                          unsigned char* mac);
+
 /**
  * Compute the MAC of a given block with the specified 8 byte
  * key. Return a 8 byte MAC value.
@@ -20,10 +20,13 @@
  * fileman.c (GPLv3). Copyright (C) 1987-2009 Free Software Foundation, Inc
  */
 
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdlib.h>
 #include <stdio.h>
 #include <stddef.h>
 #include <string.h>
+#include <time.h>
 #include <readline/readline.h>
 #include <readline/history.h>
 #include <getopt.h>
@@ -31,6 +34,7 @@
 #include "mfterm.h"
 #include "util.h"
 #include "spec_syntax.h"
+#include "job.h"
 
 #include "config.h"
 
@@ -47,6 +51,7 @@ char** mft_completion(char* text, int start, int end);
 int execute_line(char* line);
 void initialize_readline();
 void parse_cmdline(int argc, char** argv);
+void seed_random();
 
 void print_help();
 void print_version();
@@ -56,10 +61,29 @@ typedef char** rl_completion_func_t(const char*, int, int);
 int main(int argc, char** argv) {
   parse_cmdline(argc, argv);
   initialize_readline();
+  job_init();
+  seed_random();
   input_loop();
+
+  // Let a background job reach a safe point before exiting
+  job_cancel();
+  job_wait();
   return 0;
 }
 
+// The attacks send reader nonces from rand(); make them differ from
+// run to run
+void seed_random() {
+  unsigned int seed = (unsigned int)time(NULL);
+  FILE* urandom = fopen("/dev/urandom", "r");
+  if (urandom) {
+    if (fread(&seed, sizeof(seed), 1, urandom) != 1)
+      seed = (unsigned int)time(NULL);
+    fclose(urandom);
+  }
+  srand(seed);
+}
+
 void parse_cmdline(int argc, char** argv) {
   static struct option long_options[] = {
     {"help",      no_argument,       0,  'h' },
@@ -146,7 +170,20 @@ int execute_line (char* line) {
   line += strlen(command->name);
   line = trim(line);
 
-  return (*(command->func))(line);
+  // A trailing '&' runs the reader operation of the command as a
+  // background job.
+  size_t len = strlen(line);
+  int background = len > 0 && line[len - 1] == '&';
+  if (background) {
+    line[len - 1] = '\0';
+    line = trim(line);
+  }
+
+  job_set_background(background);
+  int res = (*(command->func))(line);
+  job_set_background(0);
+
+  return res;
 }
 
 void initialize_readline()
@@ -261,8 +298,9 @@ char* completion_sub_cmd_generator(const char* text, int state) {
     // Extract command and sub-command
     char buff[128];
     strncpy(buff, name, sizeof(buff));
-    char* cmd = strtok(buff, " ");
-    char* sub = strtok(NULL, " ");
+    char* tok;
+    char* cmd = strtok_r(buff, " ", &tok);
+    char* sub = strtok_r(NULL, " ", &tok);
 
     // Make sure the command *has* a sub command
     // and that we have the right command.
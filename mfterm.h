@@ -26,4 +26,7 @@ void input_loop();
 // Called to exit the mfterm program
 void stop_input_loop();
 
+// Execute a command line (modified in place). Return the command result.
+int execute_line(char* line);
+
 #endif
@@ -63,9 +63,9 @@ nfc_initiator_mifare_cmd(nfc_device *pnd, const mifare_cmd mc, const uint8_t ui8
   abtCmd[1] = ui8Block;         // The block address (1K=0x00..0x39, 4K=0x00..0xff)
 
   switch (mc) {
-      // Read and store command have no parameter
+      // Read and transfer commands have no parameter
     case MC_READ:
-    case MC_STORE:
+    case MC_TRANSFER:
       szParamLen = 0;
       break;
 
@@ -80,10 +80,10 @@ nfc_initiator_mifare_cmd(nfc_device *pnd, const mifare_cmd mc, const uint8_t ui8
       szParamLen = sizeof(struct mifare_param_data);
       break;
 
-      // Value command
+      // Value command. Restore (store) sends a dummy value.
     case MC_DECREMENT:
     case MC_INCREMENT:
-    case MC_TRANSFER:
+    case MC_STORE:
       szParamLen = sizeof(struct mifare_param_value);
       break;
 
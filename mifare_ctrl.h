@@ -36,6 +36,18 @@
  */
 int mf_read_tag(mf_tag_t* tag, mf_key_type_t key_type);
 
+/**
+ * Connect to an nfc device and read just the given blocks (sorted,
+ * within the tag size) into the tag, authenticating each sector
+ * involved once with the 'current_auth' keys of the specified type.
+ * A trailer gets the keys from 'current_auth' and the access bits from
+ * the tag, like mf_read_tag. Nothing is copied unless all blocks were
+ * read. Finally, disconnect from the device.
+ * Return 0 on success != 0 on failure.
+ */
+int mf_read_blocks(mf_tag_t* tag, const size_t* blocks, size_t count,
+                   mf_key_type_t key_type);
+
 /**
  * Connect to an nfc device. The write the tag data, authenticating with
  * the 'current_auth' keys of specified type. Finally, disconnect from
@@ -47,14 +59,55 @@ int mf_read_tag(mf_tag_t* tag, mf_key_type_t key_type);
  */
 int mf_write_tag(const mf_tag_t* tag, mf_key_type_t key_type);
 
+/**
+ * Connect to an nfc device and write the bits [first_bit, first_bit +
+ * bits) of the tag data, authenticating each sector involved once with
+ * the 'current_auth' keys of the specified type. Blocks the range
+ * covers in part are read first, so the bits around it are kept. A
+ * trailer is only written if the range covers all of it, and block 0
+ * is skipped. Finally, disconnect from the device.
+ * Return 0 on success != 0 on failure.
+ */
+int mf_write_range(const mf_tag_t* tag, size_t first_bit, size_t bits,
+                   mf_key_type_t key_type);
+
+/**
+ * Connect to an nfc device and read an Ultralight or NTAG tag. The
+ * pages are stored in order, 4 bytes each, from the start of the tag
+ * and the number of pages is returned in 'pages'. Finally, disconnect
+ * from the device.
+ * Return 0 on success != 0 on failure.
+ */
+int mf_read_ultralight(mf_tag_t* tag, size_t* pages);
+
+/**
+ * Connect to an nfc device and unlock a backdoored (Gen1a) tag. Then
+ * read all blocks of the tag, including block 0 and the trailers with
+ * their keys, without any authentication. Finally, disconnect from the
+ * device. The size is detected from the tag unless given (not
+ * MF_INVALID_SIZE). mf_read_tag with MF_KEY_UNLOCKED ends up here.
+ * Return 0 on success != 0 on failure.
+ */
+int mf_read_tag_unlocked(mf_tag_t* tag, mf_size_t tag_size);
+
+/**
+ * Like mf_read_tag_unlocked, but write all blocks of the tag,
+ * including block 0 and the trailers.
+ * Return 0 on success != 0 on failure.
+ */
+int mf_write_tag_unlocked(const mf_tag_t* tag, mf_size_t tag_size);
+
 /**
  * Connect to an nfc device.  Then, for each sector in turn, try keys in the
  * dictionary for authentication. Report success or failure. If a key
  * is found, set it in the state variable 'current_auth'. Finally,
  * disconnect from the device.
+ * The progress is saved in a checkpoint file as the attack goes. If
+ * resume is set, continue from the checkpoint of the tag instead of
+ * starting over.
  * Return 0 on success != 0 on failure.
  */
-int mf_dictionary_attack(mf_tag_t* tag);
+int mf_dictionary_attack(mf_tag_t* tag, bool resume);
 
 /**
  * Connect to an nfc device. Then test the keys in the 'current_auth'
@@ -66,4 +119,193 @@ int mf_test_auth(const mf_tag_t* keys,
                  mf_size_t size,
                  mf_key_type_t key_type);
 
+/**
+ * Connect to an nfc device. Then read the listed blocks over and over,
+ * authenticating with the 'current_auth' keys of the specified type,
+ * and print a time stamped line each time a block changes. A sector is
+ * only authenticated again when the next block is in another sector,
+ * or after a failed read. The blocks should be sorted by sector. The
+ * blocks read are also stored in the tag. The watch runs until the job
+ * is cancelled. Finally, disconnect from the device.
+ * Return 0 on success != 0 on failure.
+ */
+int mf_watch(mf_tag_t* tag,
+             const size_t* blocks, size_t count,
+             mf_key_type_t key_type);
+
+/**
+ * Connect to an nfc device. Then repeatedly select the tag, send an
+ * authentication request for the sector and key type, capture the tag
+ * nonce and abandon the authentication. The nonces are streamed to a
+ * nonce file (see nonces.h). Stop after count nonces, or when the job
+ * is cancelled if count is 0. Finally, disconnect from the device.
+ * Return 0 on success != 0 on failure.
+ */
+int mf_collect_nonces(const char* fn, size_t sector,
+                      mf_key_type_t key_type, size_t count);
+
+// Batch operations on all tags in the field
+typedef enum {
+  MF_BATCH_READ,    // Read each tag with the 'current_auth' keys
+  MF_BATCH_ATTACK,  // Dictionary attack, then read with the keys found
+  MF_BATCH_WRITE,   // Write the 'current_tag' data to each tag
+} mf_batch_op_t;
+
+// The most tags handled in one batch
+#define MF_BATCH_MAX_TAGS 16
+
+/**
+ * Connect to an nfc device. Then enumerate all tags in the field
+ * (anticollision), select each one by its UID in turn and perform the
+ * operation on it. Read and attack save a dump of each tag to
+ * <prefix><uid>.mfd; attack also saves the keys found to
+ * <prefix><uid>.keys. Finally, disconnect from the device.
+ * Return 0 if all tags succeeded != 0 otherwise.
+ */
+int mf_batch(mf_batch_op_t op, mf_key_type_t key_type, const char* prefix);
+
+// A change of a value block
+typedef struct {
+  size_t block;
+  int64_t delta;
+} mf_value_op_t;
+
+/**
+ * Connect to an nfc device. Then apply the value changes, with the
+ * 'current_auth' keys of the specified type. The ops must be sorted by
+ * block and hold at most one change per block; each sector is
+ * authenticated once and each block gets a single transfer. Finally,
+ * disconnect from the device.
+ * Return 0 on success != 0 on failure.
+ */
+int mf_value_batch(const mf_value_op_t* ops, size_t count,
+                   mf_key_type_t key_type);
+
+/**
+ * Connect to an nfc device and clone the tag to another tag. The
+ * source is read with the 'current_auth' keys of the specified type.
+ * With a second reader attached, the target tag is put on that one and
+ * each sector is written as soon as it has been read. Otherwise the
+ * source is read to memory and the target is written once it replaces
+ * the source. A backdoored target gets block 0 too. Finally,
+ * disconnect from the device(s).
+ * Return 0 on success != 0 on failure.
+ */
+int mf_clone(mf_key_type_t key_type);
+
+/**
+ * Connect to an nfc device and change the keys of the tag. Only the
+ * trailers are written: the keys A and B come from new_keys, the
+ * access bits are kept. Each sector is authenticated with the
+ * 'current_auth' key of the specified type and the new trailer is
+ * verified by authenticating with the new key. The progress is kept
+ * in a journal (see rekey.h), so an interrupted rekey of a tag is
+ * finished by running it again. Finally, disconnect from the device.
+ * Return 0 on success != 0 on failure.
+ */
+int mf_rekey(const mf_tag_t* new_keys, mf_key_type_t key_type);
+
+/**
+ * Connect to an nfc device. Then run the nested attack, starting from
+ * the 'current_auth' key of the specified type for the sector. The
+ * keys in 'current_auth' that don't work on the tag are recovered:
+ * nested authentications are started from a software authentication
+ * with the known key, the encrypted nonces are solved on all cores and
+ * each candidate key is checked with one authentication. The keys
+ * found are set in 'current_auth'. Finally, disconnect from the device.
+ * Return 0 if all the keys were recovered != 0 otherwise.
+ */
+int mf_nested(size_t sector, mf_key_type_t key_type);
+
+/**
+ * Connect to an nfc device. Then run the hardened nested attack on the
+ * key of the target sector and type, starting from the 'current_auth'
+ * key of the specified type for the sector. Encrypted nonces of nested
+ * authentications are collected, then the key is searched on all
+ * cores. The nonces and the progress of the search are saved to a
+ * checkpoint, so an interrupted attack continues where it stopped. The
+ * key found is checked with one authentication and set in
+ * 'current_auth'. Finally, disconnect from the device.
+ * Return 0 if the key was found != 0 otherwise.
+ */
+int mf_hardnested(size_t sector, mf_key_type_t key_type,
+                  size_t target_sector, mf_key_type_t target_type);
+
+/**
+ * Connect to an nfc device. Then tell the PRNG of the tag (weak,
+ * static or hardened) from the nonces of a few authentications, and
+ * print the PRNG steps between them. No key is needed. Finally,
+ * disconnect from the device.
+ * Return 0 on success != 0 on failure.
+ */
+int mf_classify_prng();
+
+/**
+ * Connect to an nfc device. Then build the keystream index of the
+ * dictionary for the tag (see ksindex.h), which must have a static
+ * nonce, and save it; a saved index for the same dictionary is used
+ * as is. Finally, disconnect from the device.
+ * Return 0 on success != 0 on failure.
+ */
+int mf_dict_index();
+
+/**
+ * Connect to an nfc device. Then recover the keys in 'current_auth'
+ * that don't work on a tag with a static nonce, starting from the key
+ * of the specified type for the sector. Each one takes a nested
+ * authentication and a lookup in the keystream index of the
+ * dictionary, which is built first if needed. The candidates are
+ * checked with one authentication and the keys found are set in
+ * 'current_auth'. Finally, disconnect from the device.
+ * Return 0 if all the keys were recovered != 0 otherwise.
+ */
+int mf_static_nested(size_t sector, mf_key_type_t key_type);
+
+/**
+ * Connect to an nfc device. Then run the darkside attack on the key of
+ * the specified type for the sector, with no known key. Tries with
+ * random parity bits are sent until the tag answers a wrong reader
+ * answer with an encrypted NACK; the NACKs are solved on all cores in
+ * the background while more are collected. Each candidate key is
+ * checked with one authentication and the key found is set in
+ * 'current_auth'. Finally, disconnect from the device.
+ * Return 0 if the key was found != 0 otherwise.
+ */
+int mf_darkside(size_t sector, mf_key_type_t key_type);
+
+/**
+ * Connect to an nfc device. Then try the candidate keys (6 bytes each)
+ * for the sector, one authentication each, until one works. The tag
+ * must have the UID the keys were recovered for (the last 4 bytes, as
+ * a big endian number). The key found is set in 'current_auth'.
+ * Finally, disconnect from the device.
+ * Return 0 if a key works != 0 otherwise.
+ */
+int mf_verify_keys(uint32_t uid, size_t sector,
+                   const uint8_t* keys, size_t count,
+                   mf_key_type_t key_type);
+
+/**
+ * Keep the nfc device open between commands. Until
+ * mf_release_device is called, the commands above use the open
+ * device instead of connecting to a device each time. Used when
+ * commands are run as soon as a tag shows up.
+ * Return 0 on success != 0 on failure.
+ */
+int mf_hold_device();
+void mf_release_device();
+
+/**
+ * Wait, on the held device, for a tag to enter the field and write its
+ * UID in hex to uid_str (at least 21 chars). Return 0 when a tag has
+ * arrived and != 0 if the job was cancelled first.
+ */
+int mf_wait_for_arrival(char* uid_str);
+
+/**
+ * Wait, on the held device, for the tag to leave the field.
+ * Return 0 when it has left and != 0 if the job was cancelled first.
+ */
+int mf_wait_for_removal();
+
 #endif
@@ -0,0 +1,115 @@
+/**
+ * Copyright (C) 2011 Anders Sundman <anders@4zm.org>
+ *
+ * This file is part of mfterm.
+ *
+ * mfterm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mfterm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mfterm.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "nonces.h"
+
+// Size of the write buffer; the collection loop should never wait on disk
+#define NONCE_FILE_BUFFER (256 * 1024)
+
+static const uint8_t nonce_file_magic[4] = { 'M', 'F', 'T', 'N' };
+
+FILE* nonce_file_create(const char* fn) {
+  FILE* file = fopen(fn, "wb");
+  if (file == NULL) {
+    printf("Could not open file: %s\n", fn);
+    return NULL;
+  }
+
+  setvbuf(file, NULL, _IOFBF, NONCE_FILE_BUFFER);
+
+  uint8_t header[8] = { 0 };
+  memcpy(header, nonce_file_magic, 4);
+  header[4] = NONCE_FILE_VERSION;
+  if (fwrite(header, 1, sizeof(header), file) != sizeof(header)) {
+    printf("Could not write file: %s\n", fn);
+    fclose(file);
+    return NULL;
+  }
+
+  return file;
+}
+
+FILE* nonce_file_open(const char* fn) {
+  FILE* file = fopen(fn, "rb");
+  if (file == NULL) {
+    printf("Could not open file: %s\n", fn);
+    return NULL;
+  }
+
+  uint8_t header[8];
+  if (fread(header, 1, sizeof(header), file) != sizeof(header) ||
+      memcmp(header, nonce_file_magic, 4) != 0) {
+    printf("Not a nonce file: %s\n", fn);
+    fclose(file);
+    return NULL;
+  }
+
+  if (header[4] != NONCE_FILE_VERSION) {
+    printf("Unsupported nonce file version: %d\n", header[4]);
+    fclose(file);
+    return NULL;
+  }
+
+  return file;
+}
+
+int nonce_file_write(FILE* file, const nonce_record_t* rec) {
+  uint8_t buf[NONCE_RECORD_SIZE] = { 0 };
+
+  for (int i = 0; i < 4; ++i) {
+    buf[i] = (uint8_t)(rec->uid >> (24 - 8 * i));
+    buf[8 + i] = (uint8_t)(rec->nt >> (24 - 8 * i));
+  }
+  buf[4] = rec->sector;
+  buf[5] = rec->key_type;
+  for (int i = 0; i < 8; ++i)
+    buf[12 + i] = (uint8_t)(rec->time_us >> (56 - 8 * i));
+
+  return fwrite(buf, 1, sizeof(buf), file) != sizeof(buf);
+}
+
+int nonce_file_read(FILE* file, nonce_record_t* rec) {
+  uint8_t buf[NONCE_RECORD_SIZE];
+
+  size_t len = fread(buf, 1, sizeof(buf), file);
+  if (len == 0 && feof(file))
+    return 0;
+  if (len != sizeof(buf))
+    return -1;
+
+  rec->uid = 0;
+  rec->nt = 0;
+  for (int i = 0; i < 4; ++i) {
+    rec->uid = rec->uid << 8 | buf[i];
+    rec->nt = rec->nt << 8 | buf[8 + i];
+  }
+  rec->sector = buf[4];
+  rec->key_type = buf[5];
+  rec->time_us = 0;
+  for (int i = 0; i < 8; ++i)
+    rec->time_us = rec->time_us << 8 | buf[12 + i];
+
+  return 1;
+}
+
+int nonce_file_close(FILE* file) {
+  return fclose(file);
+}
@@ -0,0 +1,72 @@
+#ifndef NONCES__H
+#define NONCES__H
+
+/**
+ * Copyright (C) 2011 Anders Sundman <anders@4zm.org>
+ *
+ * This file is part of mfterm.
+ *
+ * mfterm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mfterm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mfterm.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+
+/**
+ * A tag nonce captured by 'nonces collect'. The UID is the 4 byte UID
+ * used in the authentication, and nt is stored as sent by the tag
+ * (first byte received in the most significant position).
+ */
+typedef struct {
+  uint32_t uid;
+  uint8_t sector;
+  uint8_t key_type;   // 'a' or 'b'
+  uint32_t nt;
+  uint64_t time_us;   // Wall clock time, micro seconds since the epoch
+} nonce_record_t;
+
+/**
+ * The nonce files are binary: an 8 byte header, "MFTN" followed by
+ * the format version and three zero bytes, then a sequence of 20 byte
+ * records:
+ *
+ *   uid[4] sector[1] key_type[1] zero[2] nt[4] time_us[8]
+ *
+ * All the fields are big endian, like the other files of mfterm (uid
+ * and nt in wire order). Version 1 files had time_us little endian.
+ */
+#define NONCE_FILE_VERSION 2
+#define NONCE_RECORD_SIZE 20
+
+/**
+ * Create a nonce file, write the header and return it. The file is
+ * fully buffered, records are written in large chunks.
+ * Return NULL on failure.
+ */
+FILE* nonce_file_create(const char* fn);
+
+// Open a nonce file for reading and check the header. NULL on failure.
+FILE* nonce_file_open(const char* fn);
+
+// Append a record. Return 0 on success != 0 on failure.
+int nonce_file_write(FILE* file, const nonce_record_t* rec);
+
+// Read the next record. Return 1 if a record was read, 0 at the end
+// of the file and -1 on a short or failed read.
+int nonce_file_read(FILE* file, nonce_record_t* rec);
+
+// Flush and close the file. Return 0 on success != 0 on failure.
+int nonce_file_close(FILE* file);
+
+#endif
@@ -0,0 +1,159 @@
+/**
+ * Copyright (C) 2011 Anders Sundman <anders@4zm.org>
+ *
+ * This file is part of mfterm.
+ *
+ * mfterm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mfterm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mfterm.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "job.h"
+#include "parallel.h"
+
+#define PARALLEL_MAX_THREADS 256
+
+// The state shared by the threads of one parallel_for
+typedef struct {
+  pthread_mutex_t mutex;
+  size_t next;    // The first item not handed out yet
+  size_t count;
+  size_t chunk;
+  bool stopped;
+  parallel_func_t func;
+  void* arg;
+} parallel_t;
+
+size_t parallel_threads() {
+  long n = sysconf(_SC_NPROCESSORS_ONLN);
+  if (n < 1)
+    return 1;
+  return n > PARALLEL_MAX_THREADS ? PARALLEL_MAX_THREADS : (size_t)n;
+}
+
+static void* parallel_main(void* arg) {
+  parallel_t* p = (parallel_t*)arg;
+
+  for (;;) {
+    pthread_mutex_lock(&p->mutex);
+    if (!p->stopped && job_cancelled())
+      p->stopped = true;
+    if (p->stopped || p->next >= p->count) {
+      pthread_mutex_unlock(&p->mutex);
+      return NULL;
+    }
+    size_t begin = p->next;
+    size_t end = p->count - begin < p->chunk ? p->count : begin + p->chunk;
+    p->next = end;
+    pthread_mutex_unlock(&p->mutex);
+
+    if (!p->func(begin, end, p->arg)) {
+      pthread_mutex_lock(&p->mutex);
+      p->stopped = true;
+      pthread_mutex_unlock(&p->mutex);
+    }
+  }
+}
+
+int parallel_for(size_t count, size_t chunk,
+                 parallel_func_t func, void* arg) {
+  parallel_t p;
+  pthread_mutex_init(&p.mutex, NULL);
+  p.next = 0;
+  p.count = count;
+  p.chunk = chunk ? chunk : 1;
+  p.stopped = false;
+  p.func = func;
+  p.arg = arg;
+
+  // No point in more threads than chunks
+  size_t n = parallel_threads();
+  if (n > (count + p.chunk - 1) / p.chunk)
+    n = (count + p.chunk - 1) / p.chunk;
+
+  // The calling thread is one of the workers
+  pthread_t threads[PARALLEL_MAX_THREADS];
+  size_t started = 0;
+  while (started + 1 < n &&
+         pthread_create(&threads[started], NULL, parallel_main, &p) == 0)
+    ++started;
+
+  parallel_main(&p);
+
+  for (size_t i = 0; i < started; ++i)
+    pthread_join(threads[i], NULL);
+
+  pthread_mutex_destroy(&p.mutex);
+  return p.stopped ? -1 : 0;
+}
+
+void parallel_progress_init(parallel_progress_t* progress, uint64_t done) {
+  progress->done = done;
+  progress->pending_count = 0;
+  progress->start = progress->last_print = progress->last_save =
+    parallel_time();
+}
+
+void parallel_progress_add(parallel_progress_t* progress,
+                           uint64_t begin, uint64_t end) {
+  if (begin != progress->done) {
+    if (progress->pending_count < PARALLEL_PENDING) {
+      progress->pending[progress->pending_count][0] = begin;
+      progress->pending[progress->pending_count][1] = end;
+      ++progress->pending_count;
+    }
+    return;
+  }
+
+  progress->done = end;
+  for (size_t i = 0; i < progress->pending_count; ) {
+    if (progress->pending[i][0] == progress->done) {
+      progress->done = progress->pending[i][1];
+      --progress->pending_count;
+      progress->pending[i][0] = progress->pending[progress->pending_count][0];
+      progress->pending[i][1] = progress->pending[progress->pending_count][1];
+      i = 0;
+    }
+    else {
+      ++i;
+    }
+  }
+}
+
+bool parallel_progress_print_due(parallel_progress_t* progress,
+                                 bool force) {
+  double now = parallel_time();
+  if (!force && now - progress->last_print < PARALLEL_PRINT_INTERVAL)
+    return false;
+  progress->last_print = now;
+  return true;
+}
+
+bool parallel_progress_save_due(parallel_progress_t* progress, bool force) {
+  double now = parallel_time();
+  if (!force && now - progress->last_save < PARALLEL_SAVE_INTERVAL)
+    return false;
+  progress->last_save = now;
+  return true;
+}
+
+double parallel_time() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
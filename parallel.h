@@ -0,0 +1,88 @@
+#ifndef PARALLEL__H
+#define PARALLEL__H
+
+/**
+ * Copyright (C) 2011 Anders Sundman <anders@4zm.org>
+ *
+ * This file is part of mfterm.
+ *
+ * mfterm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * mfterm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with mfterm.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * Run CPU heavy work (the offline attacks) on all cores. The work is
+ * a range of items [0, count) cut into chunks. Each thread takes the
+ * next free chunk when it is done with the last one, so a slow thread
+ * doesn't hold the others up.
+ *
+ * The function handles the items [begin, end) and returns false to
+ * stop all the threads (e.g. when the key is found).
+ */
+typedef bool (*parallel_func_t)(size_t begin, size_t end, void* arg);
+
+// The number of worker threads; one per online core
+size_t parallel_threads();
+
+/**
+ * Run func over [0, count) in chunks of chunk items on all threads and
+ * wait for it. The threads also stop if the running job is cancelled.
+ * Return 0 if all the items were handled, -1 if stopped before that.
+ */
+int parallel_for(size_t count, size_t chunk,
+                 parallel_func_t func, void* arg);
+
+// The most chunks that can be finished out of order (> threads)
+#define PARALLEL_PENDING 512
+
+// Seconds between progress lines and between checkpoints
+#define PARALLEL_PRINT_INTERVAL 10
+#define PARALLEL_SAVE_INTERVAL 60
+
+/**
+ * The progress of a long parallel_for, as saved in a checkpoint: all
+ * the items before done are handled. The threads finish chunks out of
+ * order; those past done wait in pending until the gap is filled.
+ * The functions aren't thread safe; call them under the lock of the
+ * work.
+ */
+typedef struct {
+  uint64_t done;
+  uint64_t pending[PARALLEL_PENDING][2];
+  size_t pending_count;
+  double start;
+  double last_print;
+  double last_save;
+} parallel_progress_t;
+
+// Start the progress with the items before done already handled
+void parallel_progress_init(parallel_progress_t* progress, uint64_t done);
+
+// Mark the items [begin, end) handled
+void parallel_progress_add(parallel_progress_t* progress,
+                           uint64_t begin, uint64_t end);
+
+// Return true if the progress should be printed now, or saved now:
+// when forced or once the interval has passed since the last time
+bool parallel_progress_print_due(parallel_progress_t* progress,
+                                 bool force);
+bool parallel_progress_save_due(parallel_progress_t* progress, bool force);
+
+// Seconds on the monotonic clock, to time work and rates
+double parallel_time();
+
+#endif
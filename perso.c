@@ -0,0 +1,353 @@
+/**
+ * Copyright (C) 2011 Anders Sundman <anders@4zm.org>
+ *
+ * This file is part of mfterm.
+ *
+ * mfterm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mfterm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mfterm.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include "perso.h"
+#include "tag.h"
+#include "mac.h"
+#include "mifare_ctrl.h"
+#include "spec_syntax.h"
+#include "util.h"
+#include "job.h"
+#include "parallel.h"
+
+#define PERSO_LINE_MAX 4096
+
+// A CSV column: where its values go in the tag
+typedef struct {
+  size_t offset;  // Byte offset in the tag
+  size_t length;  // Byte length, 0 if given by the value
+} perso_field_t;
+
+// A tag to write, prepared from one CSV line
+typedef struct {
+  mf_tag_t tag;
+  size_t line;        // CSV line number
+  int status;         // 1 ready, 0 end of file, -1 error
+  char error[128];
+} perso_card_t;
+
+// The batch. The worker thread only reads it, except for the CSV file,
+// which only the worker uses while it runs.
+typedef struct {
+  FILE* csv;
+  size_t line;
+  const mf_tag_t* template_tag;
+  perso_field_t fields[PERSO_MAX_FIELDS];
+  size_t field_count;
+  unsigned int mac_blocks[PERSO_MAX_MACS];
+  size_t mac_count;
+  unsigned char mac_key[8];
+  perso_card_t* card;  // The card being prepared
+} perso_t;
+
+static int perso_parse_header(perso_t* p);
+static int perso_parse_field(char* name, perso_field_t* field);
+static void perso_prepare(perso_t* p, perso_card_t* card);
+static void* perso_prepare_main(void* arg);
+static int perso_write_card(const perso_card_t* card, mf_key_type_t key_type,
+                            bool check_uid);
+
+int perso_run(const char* template_fn, const char* csv_fn,
+              mf_key_type_t key_type,
+              const unsigned int* mac_blocks, size_t mac_count) {
+
+  static mf_tag_t template_tag;
+  static perso_t p;
+  static perso_card_t cards[2];
+
+  if (mac_count > PERSO_MAX_MACS) {
+    printf("Too many MAC blocks, the max is %d\n", PERSO_MAX_MACS);
+    return -1;
+  }
+
+  if (load_mfd(template_fn, &template_tag))
+    return -1;
+
+  memset(&p, 0, sizeof(p));
+  p.template_tag = &template_tag;
+  memcpy(p.mac_blocks, mac_blocks, mac_count * sizeof(unsigned int));
+  p.mac_count = mac_count;
+  memcpy(p.mac_key, current_mac_key, 8);
+
+  p.csv = fopen(csv_fn, "r");
+  if (p.csv == NULL) {
+    printf("Could not open file: %s\n", csv_fn);
+    return -1;
+  }
+
+  if (perso_parse_header(&p)) {
+    fclose(p.csv);
+    return -1;
+  }
+
+  // The first card is prepared up front
+  perso_card_t* card = &cards[0];
+  perso_card_t* next = &cards[1];
+  perso_prepare(&p, card);
+  if (card->status <= 0) {
+    printf("%s\n", card->status ? card->error : "No tags in the file.");
+    fclose(p.csv);
+    return -1;
+  }
+
+  if (mf_hold_device()) {
+    fclose(p.csv);
+    return -1;
+  }
+
+  // The MACs include the UID; on a tag with a fixed block 0 they are
+  // only right if the UID in the data is the tag's.
+  bool check_uid = key_type != MF_KEY_UNLOCKED && mac_count > 0;
+
+  size_t done = 0;
+  double start = parallel_time();
+
+  while (card->status > 0) {
+
+    // Prepare the next tag while this one is written
+    pthread_t worker;
+    p.card = next;
+    if (pthread_create(&worker, NULL, perso_prepare_main, &p)) {
+      printf("Could not start a worker thread.\n");
+      break;
+    }
+
+    printf("Tag %zu (line %zu): put it on the reader.\n",
+           done + 1, card->line);
+
+    // Until the tag is written or the job is cancelled
+    int res = -1;
+    while (res != 0 && !job_cancelled()) {
+      res = perso_write_card(card, key_type, check_uid);
+      if (mf_wait_for_removal())
+        break;
+      if (res != 0)
+        printf("Try again with the same or another tag.\n");
+    }
+
+    pthread_join(worker, NULL);
+
+    if (res != 0)
+      break;
+    ++done;
+
+    if (next->status < 0)
+      printf("%s\n", next->error);
+
+    perso_card_t* t = card;
+    card = next;
+    next = t;
+  }
+
+  mf_release_device();
+  fclose(p.csv);
+
+  printf("Personalized %zu tags in %.2fs.\n", done, parallel_time() - start);
+
+  return card->status == 0 ? 0 : -1;
+}
+
+// Wait for a tag and write the card to it. Return 0 on success.
+static int perso_write_card(const perso_card_t* card, mf_key_type_t key_type,
+                            bool check_uid) {
+  char uid_str[21];
+
+  if (mf_wait_for_arrival(uid_str))
+    return -1;
+
+  if (check_uid) {
+    char data_uid[9];
+    const uint8_t* uid = card->tag.amb[0].mbm.abtUID;
+    sprintf(data_uid, "%02x%02x%02x%02x", uid[0], uid[1], uid[2], uid[3]);
+    if (strncmp(uid_str, data_uid, 8) != 0) {
+      printf("Tag %s doesn't have the UID of the data (%s); "
+             "the MACs would be wrong.\n", uid_str, data_uid);
+      return -1;
+    }
+  }
+
+  printf("Writing to tag %s\n", uid_str);
+
+  if (key_type == MF_KEY_UNLOCKED)
+    return mf_write_tag_unlocked(&card->tag, MF_INVALID_SIZE);
+  return mf_write_tag(&card->tag, key_type);
+}
+
+static void* perso_prepare_main(void* arg) {
+  perso_t* p = (perso_t*)arg;
+  perso_prepare(p, p->card);
+  return NULL;
+}
+
+/**
+ * Read the next CSV line and build its tag: the template, the fields
+ * and the MACs. Errors are kept in the card; this runs on the worker.
+ */
+static void perso_prepare(perso_t* p, perso_card_t* card) {
+  char line[PERSO_LINE_MAX];
+  char* s;
+
+  // Next non empty line
+  do {
+    if (fgets(line, sizeof(line), p->csv) == NULL) {
+      card->status = 0;
+      return;
+    }
+    ++p->line;
+    line[strcspn(line, "\r\n")] = '\0';
+    s = trim(line);
+  } while (*s == '\0');
+
+  card->line = p->line;
+  card->status = -1;
+  memcpy(&card->tag, p->template_tag, sizeof(mf_tag_t));
+
+  size_t i = 0;
+  for (char *value = s, *end; value; value = end, ++i) {
+    end = strchr(value, ',');
+    if (end)
+      *end++ = '\0';
+    value = trim(value);
+
+    if (i >= p->field_count) {
+      snprintf(card->error, sizeof(card->error),
+               "Line %zu: too many values", card->line);
+      return;
+    }
+
+    // Empty, keep the template data
+    size_t len = strlen(value);
+    if (len == 0)
+      continue;
+
+    const perso_field_t* field = &p->fields[i];
+    size_t bytes = len / 2;
+    if (len % 2 || (field->length && bytes != field->length) ||
+        field->offset + bytes > sizeof(mf_tag_t)) {
+      snprintf(card->error, sizeof(card->error),
+               "Line %zu: value %zu has the wrong length", card->line, i + 1);
+      return;
+    }
+
+    uint8_t* data = (uint8_t*)&card->tag + field->offset;
+    for (size_t j = 0; j < bytes; ++j) {
+      char hex[3] = { value[2 * j], value[2 * j + 1], '\0' };
+      char* hex_end;
+      data[j] = (uint8_t)strtoul(hex, &hex_end, 16);
+      if (*hex_end != '\0') {
+        snprintf(card->error, sizeof(card->error),
+                 "Line %zu: value %zu is not hex", card->line, i + 1);
+        return;
+      }
+    }
+  }
+
+  if (i != p->field_count) {
+    snprintf(card->error, sizeof(card->error),
+             "Line %zu: too few values", card->line);
+    return;
+  }
+
+  // The MACs go in the last two bytes of the blocks
+  for (size_t m = 0; m < p->mac_count; ++m) {
+    unsigned char mac[8];
+    unsigned int block = p->mac_blocks[m];
+    if (compute_tag_block_mac(&card->tag, block, p->mac_key, mac)) {
+      snprintf(card->error, sizeof(card->error),
+               "Line %zu: MAC computation failed", card->line);
+      return;
+    }
+    memcpy(&card->tag.amb[block].mbd.abtData[14], mac, 2);
+  }
+
+  card->status = 1;
+}
+
+// Parse the first CSV line, the field names. Return 0 on success.
+static int perso_parse_header(perso_t* p) {
+  char line[PERSO_LINE_MAX];
+
+  if (fgets(line, sizeof(line), p->csv) == NULL) {
+    printf("The CSV file is empty.\n");
+    return -1;
+  }
+  ++p->line;
+  line[strcspn(line, "\r\n")] = '\0';
+
+  for (char *name = trim(line), *end; name; name = end) {
+    end = strchr(name, ',');
+    if (end)
+      *end++ = '\0';
+
+    if (p->field_count == PERSO_MAX_FIELDS) {
+      printf("Too many fields, the max is %d\n", PERSO_MAX_FIELDS);
+      return -1;
+    }
+
+    if (perso_parse_field(trim(name), &p->fields[p->field_count++]))
+      return -1;
+  }
+
+  return 0;
+}
+
+// Parse a field name: a spec path or block:offset in hex
+static int perso_parse_field(char* name, perso_field_t* field) {
+
+  if (name[0] == '.') {
+    instance_t* inst = parse_spec_path(name);
+    if (inst == NULL) {
+      printf("Invalid path: %s\n", name);
+      return -1;
+    }
+    if (inst->offset_bits || inst->size_bits) {
+      printf("Not whole bytes: %s\n", name);
+      return -1;
+    }
+    field->offset = inst->offset_bytes;
+    field->length = inst->size_bytes;
+    return 0;
+  }
+
+  char* end;
+  unsigned long block = strtoul(name, &end, 16);
+  if (end == name || *end != ':' || block > 0xff) {
+    printf("Invalid field (path or #block:#offset): %s\n", name);
+    return -1;
+  }
+
+  char* offset_str = end + 1;
+  unsigned long offset = strtoul(offset_str, &end, 16);
+  if (end == offset_str || *end != '\0' || offset > 0x0f) {
+    printf("Invalid field (path or #block:#offset): %s\n", name);
+    return -1;
+  }
+
+  field->offset = block * sizeof(mf_block_t) + offset;
+  field->length = 0;
+  return 0;
+}
+
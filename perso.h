@@ -0,0 +1,48 @@
+#ifndef PERSO__H
+#define PERSO__H
+
+/**
+ * Copyright (C) 2011 Anders Sundman <anders@4zm.org>
+ *
+ * This file is part of mfterm.
+ *
+ * mfterm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mfterm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mfterm.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stddef.h>
+#include "tag.h"
+
+// Max number of CSV columns and MAC blocks
+#define PERSO_MAX_FIELDS 32
+#define PERSO_MAX_MACS 64
+
+/**
+ * Personalize tags in a batch. Each line of the CSV file is one tag: a
+ * copy of the template with the fields patched, and the MACs of the
+ * given blocks updated with the 'current_mac_key'. The tags are written
+ * one by one as they are put on the reader, with the 'current_auth'
+ * keys of the key type, or to backdoored tags if MF_KEY_UNLOCKED.
+ *
+ * The first line of the CSV file names the fields: a spec path
+ * (.sector_1.block_4.serial) or a hex block:offset (04:00). The other
+ * lines hold the values in hex; an empty value keeps the template.
+ *
+ * The next tag is prepared on a worker thread while the current one is
+ * written. Return 0 on success != 0 on failure.
+ */
+int perso_run(const char* template_fn, const char* csv_fn,
+              mf_key_type_t key_type,
+              const unsigned int* mac_blocks, size_t mac_count);
+
+#endif
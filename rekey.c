@@ -0,0 +1,173 @@
+/**
+ * Copyright (C) 2011 Anders Sundman <anders@4zm.org>
+ *
+ * This file is part of mfterm.
+ *
+ * mfterm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mfterm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mfterm.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "rekey.h"
+
+/**
+ * The journal is a small text file that is only appended to:
+ *
+ *   # mfterm rekey journal
+ *   uid 0a1b2c3d
+ *   keys 8c2b4f11
+ *   00 writing
+ *   00 done
+ *   01 writing
+ *   ...
+ *
+ * The last line of a sector holds its state. Sectors that aren't in
+ * the file still have the old keys. A sector left 'writing' may have
+ * either key; the rekey tries the new key first.
+ */
+
+static const char* state_names[] = { "old", "writing", "done" };
+
+static const char* sprint_uid(const uint8_t* uid, size_t uid_len) {
+  static char str_buff[21];
+  if (uid_len > 10)
+    uid_len = 10;
+  str_buff[0] = '\0';
+  for (size_t i = 0; i < uid_len; ++i)
+    sprintf(str_buff + 2 * i, "%02x", (unsigned int)uid[i]);
+  return str_buff;
+}
+
+const char* rekey_journal_file_name(const uint8_t* uid, size_t uid_len) {
+  static char fn[64];
+  snprintf(fn, sizeof(fn), "mfterm-%s.rekey", sprint_uid(uid, uid_len));
+  return fn;
+}
+
+uint32_t rekey_keys_hash(const mf_tag_t* keys) {
+  uint32_t hash = 2166136261u;
+  for (size_t s = 0; s < REKEY_MAX_SECTORS; ++s) {
+    const mf_block_t* trailer = &keys->amb[sector_to_trailer(s)];
+    for (int i = 0; i < 6; ++i) {
+      hash ^= trailer->mbt.abtKeyA[i];
+      hash *= 16777619u;
+    }
+    for (int i = 0; i < 6; ++i) {
+      hash ^= trailer->mbt.abtKeyB[i];
+      hash *= 16777619u;
+    }
+  }
+  return hash;
+}
+
+// Flush the journal all the way to the disk. Return false on failure.
+static bool rekey_journal_sync(FILE* file) {
+  return fflush(file) == 0 && fsync(fileno(file)) == 0;
+}
+
+int rekey_journal_open(rekey_journal_t* j,
+                       const uint8_t* uid, size_t uid_len,
+                       uint32_t keys_hash) {
+
+  memset(j, 0, sizeof(rekey_journal_t));
+  if (uid_len > sizeof(j->uid))
+    uid_len = sizeof(j->uid);
+  memcpy(j->uid, uid, uid_len);
+  j->uid_len = uid_len;
+  j->keys_hash = keys_hash;
+
+  const char* fn = rekey_journal_file_name(uid, uid_len);
+
+  // Load the states of an earlier rekey of the tag
+  FILE* file = fopen(fn, "r");
+  bool resumed = file != NULL;
+  if (file) {
+    char line[128];
+    while (fgets(line, sizeof(line), file)) {
+      unsigned int sector, hash;
+      char state_str[16];
+
+      if (line[0] == '#' || strncmp(line, "uid ", 4) == 0)
+        continue;
+
+      if (sscanf(line, "keys %x", &hash) == 1) {
+        if (hash != keys_hash) {
+          printf("The journal %s was made with other keys (%08x).\n"
+                 "Finish it with those keys, or remove it.\n", fn, hash);
+          fclose(file);
+          return 1;
+        }
+        continue;
+      }
+
+      // A torn last line (crash while appending) is ignored
+      if (sscanf(line, "%x %15s", &sector, state_str) != 2 ||
+          sector >= REKEY_MAX_SECTORS)
+        continue;
+      for (int s = REKEY_OLD; s <= REKEY_DONE; ++s)
+        if (strcmp(state_str, state_names[s]) == 0)
+          j->state[sector] = (rekey_state_t)s;
+    }
+    fclose(file);
+  }
+
+  j->file = fopen(fn, "a");
+  if (j->file == NULL) {
+    printf("Could not open file: %s\n", fn);
+    return 1;
+  }
+
+  if (!resumed) {
+    fprintf(j->file, "# mfterm rekey journal\n");
+    fprintf(j->file, "uid %s\n", sprint_uid(uid, uid_len));
+    fprintf(j->file, "keys %08x\n", (unsigned int)keys_hash);
+  }
+  else {
+    // Start the new run on a line of its own
+    fprintf(j->file, "\n");
+  }
+
+  if (!rekey_journal_sync(j->file)) {
+    printf("Could not write file: %s\n", fn);
+    fclose(j->file);
+    j->file = NULL;
+    return 1;
+  }
+
+  return 0;
+}
+
+int rekey_journal_mark(rekey_journal_t* j, size_t sector,
+                       rekey_state_t state) {
+  j->state[sector] = state;
+  fprintf(j->file, "%02zx %s\n", sector, state_names[state]);
+  if (!rekey_journal_sync(j->file)) {
+    printf("Could not write journal: %s\n",
+           rekey_journal_file_name(j->uid, j->uid_len));
+    return 1;
+  }
+  return 0;
+}
+
+void rekey_journal_close(rekey_journal_t* j, bool complete) {
+  if (j->file == NULL)
+    return;
+  fclose(j->file);
+  j->file = NULL;
+  if (complete)
+    remove(rekey_journal_file_name(j->uid, j->uid_len));
+}
@@ -0,0 +1,83 @@
+#ifndef REKEY__H
+#define REKEY__H
+
+/**
+ * Copyright (C) 2011 Anders Sundman <anders@4zm.org>
+ *
+ * This file is part of mfterm.
+ *
+ * mfterm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mfterm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mfterm.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "tag.h"
+
+// Enough for any Mifare Classic tag (4K has 40 sectors)
+#define REKEY_MAX_SECTORS 40
+
+// The state of a sector in the rekey journal
+typedef enum {
+  REKEY_OLD = 0,   // Nothing written, the old keys are in place
+  REKEY_WRITING,   // The trailer write has started
+  REKEY_DONE,      // The new trailer is written and verified
+} rekey_state_t;
+
+/**
+ * The rekey journal of a tag. It belongs to a tag UID and to a new key
+ * file (by hash). The file is append only; a line is written before
+ * and after each trailer write. If the card is pulled, or mfterm
+ * stops, the next rekey of the card picks up where this one stopped.
+ */
+typedef struct {
+  uint8_t uid[10];
+  size_t uid_len;
+  uint32_t keys_hash;
+  rekey_state_t state[REKEY_MAX_SECTORS];
+  FILE* file;
+} rekey_journal_t;
+
+/**
+ * Return a hash (32 bit FNV-1a) of the keys A and B of all trailers in
+ * the key file tag.
+ */
+uint32_t rekey_keys_hash(const mf_tag_t* keys);
+
+/**
+ * Open the journal of the tag in the current directory, load the
+ * sector states of a previous, unfinished, rekey and open the file for
+ * appending. A journal made with another key file is refused.
+ * Return 0 on success != 0 on failure.
+ */
+int rekey_journal_open(rekey_journal_t* j,
+                       const uint8_t* uid, size_t uid_len,
+                       uint32_t keys_hash);
+
+/**
+ * Set the state of a sector and append it to the journal. The line is
+ * synced to the disk before returning, so it survives a power loss
+ * once the card has been written. Return 0 on success != 0 on failure.
+ */
+int rekey_journal_mark(rekey_journal_t* j, size_t sector,
+                       rekey_state_t state);
+
+// Close the journal. If the rekey is complete, the file is removed.
+void rekey_journal_close(rekey_journal_t* j, bool complete);
+
+// Return the name of the journal file: mfterm-<uid>.rekey
+const char* rekey_journal_file_name(const uint8_t* uid, size_t uid_len);
+
+#endif
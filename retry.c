@@ -0,0 +1,134 @@
+/**
+ * Copyright (C) 2011 Anders Sundman <anders@4zm.org>
+ *
+ * This file is part of mfterm.
+ *
+ * mfterm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mfterm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mfterm.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include "retry.h"
+
+retry_policy_t retry_policy = {
+  .budget = { 2, 3, 3 },
+  .backoff_ms = 10,
+  .backoff_max_ms = 200,
+};
+
+static const char* retry_op_names[RETRY_OP_COUNT] = {
+  "auth", "read", "write"
+};
+
+// Per block statistics of the last operation
+typedef struct {
+  unsigned int errors[RETRY_OP_COUNT];
+  unsigned int failed;
+  unsigned int denied;
+} retry_block_stats_t;
+
+static retry_block_stats_t retry_stats[256];
+
+const char* retry_op_name(retry_op_t op) {
+  return op < RETRY_OP_COUNT ? retry_op_names[op] : "?";
+}
+
+retry_op_t retry_op_parse(const char* name) {
+  for (int op = 0; op < RETRY_OP_COUNT; ++op) {
+    if (strcasecmp(name, retry_op_names[op]) == 0)
+      return (retry_op_t)op;
+  }
+  return RETRY_OP_COUNT;
+}
+
+void retry_backoff(int attempt) {
+  long ms = retry_policy.backoff_ms;
+  for (int i = 0; i < attempt && ms < retry_policy.backoff_max_ms; ++i)
+    ms *= 2;
+  if (ms > retry_policy.backoff_max_ms)
+    ms = retry_policy.backoff_max_ms;
+  if (ms <= 0)
+    return;
+
+  struct timespec delay = {
+    .tv_sec = ms / 1000,
+    .tv_nsec = (ms % 1000) * 1000000L
+  };
+  nanosleep(&delay, NULL);
+}
+
+void retry_stats_clear() {
+  memset(retry_stats, 0, sizeof(retry_stats));
+}
+
+void retry_stats_add(size_t block, retry_op_t op,
+                     int errors, retry_outcome_t outcome) {
+  if (block > 0xff || op >= RETRY_OP_COUNT)
+    return;
+
+  retry_stats[block].errors[op] += (unsigned int)errors;
+  if (outcome == RETRY_FAILED)
+    ++retry_stats[block].failed;
+  else if (outcome == RETRY_DENIED)
+    ++retry_stats[block].denied;
+}
+
+void retry_stats_print_summary() {
+  unsigned int blocks = 0, errors = 0, failed = 0;
+  for (int b = 0; b < 256; ++b) {
+    const retry_block_stats_t* s = retry_stats + b;
+    unsigned int e = s->errors[RETRY_AUTH] + s->errors[RETRY_READ] +
+      s->errors[RETRY_WRITE];
+    if (e || s->failed) {
+      ++blocks;
+      errors += e;
+      failed += s->failed;
+    }
+  }
+
+  if (blocks)
+    printf("RF errors on %u blocks: %u retries, %u failed. See 'retry stats'.\n",
+           blocks, errors, failed);
+}
+
+void retry_stats_print() {
+  printf("xB  Auth  Read  Write  Failed  Denied\n");
+  printf("--------------------------------------\n");
+
+  int count = 0;
+  for (int b = 0; b < 256; ++b) {
+    const retry_block_stats_t* s = retry_stats + b;
+    if (!s->errors[RETRY_AUTH] && !s->errors[RETRY_READ] &&
+        !s->errors[RETRY_WRITE] && !s->failed && !s->denied)
+      continue;
+    printf("%02x  %4u  %4u  %5u  %6u  %6u\n", b,
+           s->errors[RETRY_AUTH], s->errors[RETRY_READ],
+           s->errors[RETRY_WRITE], s->failed, s->denied);
+    ++count;
+  }
+
+  if (count == 0)
+    printf("No errors in the last operation.\n");
+}
+
+void retry_policy_print() {
+  for (int op = 0; op < RETRY_OP_COUNT; ++op)
+    printf("%-8s %d retries\n", retry_op_names[op], retry_policy.budget[op]);
+  printf("backoff  %d ms, doubling up to %d ms\n",
+         retry_policy.backoff_ms, retry_policy.backoff_max_ms);
+}
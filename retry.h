@@ -0,0 +1,80 @@
+#ifndef RETRY__H
+#define RETRY__H
+
+/**
+ * Copyright (C) 2011 Anders Sundman <anders@4zm.org>
+ *
+ * This file is part of mfterm.
+ *
+ * mfterm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mfterm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mfterm.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stddef.h>
+
+/**
+ * Retry policy for tag operations. RF errors (timeouts, broken
+ * frames) are transient; the operation is retried after a back off,
+ * selecting and authenticating the tag again first. Permission errors
+ * (the tag refused the command, NFC_ERFTRANS) and wrong keys are not
+ * retried.
+ */
+typedef enum {
+  RETRY_AUTH,
+  RETRY_READ,
+  RETRY_WRITE,
+  RETRY_OP_COUNT
+} retry_op_t;
+
+typedef struct {
+  int budget[RETRY_OP_COUNT]; // Retries per operation (after the first try)
+  int backoff_ms;             // Delay before the first retry
+  int backoff_max_ms;         // The delay doubles up to this value
+} retry_policy_t;
+
+// The policy used by the reader operations
+extern retry_policy_t retry_policy;
+
+// How an operation on a block ended
+typedef enum {
+  RETRY_OK,      // Succeeded, possibly after retries
+  RETRY_FAILED,  // Retry budget used up
+  RETRY_DENIED,  // Permission error, not retried
+} retry_outcome_t;
+
+// Return the operation name (auth|read|write), or the operation for
+// a name. retry_op_parse returns RETRY_OP_COUNT on an unknown name.
+const char* retry_op_name(retry_op_t op);
+retry_op_t retry_op_parse(const char* name);
+
+// Sleep before retry number 'attempt' (0 based)
+void retry_backoff(int attempt);
+
+// Clear the per block error statistics. Done before each tag operation.
+void retry_stats_clear();
+
+// Count an operation on the block that needed 'errors' retries or
+// did not succeed.
+void retry_stats_add(size_t block, retry_op_t op,
+                     int errors, retry_outcome_t outcome);
+
+// Print a one line summary of the statistics (nothing if no errors)
+void retry_stats_print_summary();
+
+// Print the statistics of each block that had errors
+void retry_stats_print();
+
+// Print the policy
+void retry_policy_print();
+
+#endif
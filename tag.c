@@ -26,10 +26,9 @@
 
 mf_tag_t current_tag;
 mf_tag_t current_auth;
+size_t current_tag_pages = 0;
 
 void strip_non_auth_data(mf_tag_t* tag);
-int load_mfd(const char* fn, mf_tag_t* tag);
-int save_mfd(const char* fn, const mf_tag_t* tag);
 
 int load_mfd(const char* fn, mf_tag_t* tag) {
   FILE* mfd_file = fopen(fn, "rb");
@@ -67,11 +66,78 @@ int save_mfd(const char* fn, const mf_tag_t* tag) {
   return 0;
 }
 
+int load_ul(const char* fn, mf_tag_t* tag, size_t* pages) {
+  FILE* ul_file = fopen(fn, "rb");
+
+  if (ul_file == NULL) {
+    printf("Could not open file: %s\n", fn);
+    return 1;
+  }
+
+  clear_tag(tag);
+  size_t len = fread(tag, 1, MF_UL_MAX_PAGES * MF_UL_PAGE_SIZE + 1, ul_file);
+  fclose(ul_file);
+
+  if (len == 0 || len % MF_UL_PAGE_SIZE != 0 ||
+      len > MF_UL_MAX_PAGES * MF_UL_PAGE_SIZE) {
+    printf("Could not read file: %s (not an Ultralight dump)\n", fn);
+    return 1;
+  }
+
+  *pages = len / MF_UL_PAGE_SIZE;
+  return 0;
+}
+
+int save_ul(const char* fn, const mf_tag_t* tag, size_t pages) {
+  FILE* ul_file = fopen(fn, "w");
+
+  if (ul_file == NULL) {
+    printf("Could not open file for writing: %s\n", fn);
+    return 1;
+  }
+
+  size_t len = pages * MF_UL_PAGE_SIZE;
+  if (fwrite(tag, 1, len, ul_file) != len) {
+    printf("Could not write file: %s\n", fn);
+    fclose(ul_file);
+    return 1;
+  }
+
+  fclose(ul_file);
+  return 0;
+}
+
+// A 4k file is a Classic dump (a 1k tag is padded), anything shorter
+// is taken to be an Ultralight dump.
 int load_tag(const char* fn) {
-  return load_mfd(fn, &current_tag);
+  FILE* tag_file = fopen(fn, "rb");
+
+  if (tag_file == NULL) {
+    printf("Could not open file: %s\n", fn);
+    return 1;
+  }
+
+  fseek(tag_file, 0, SEEK_END);
+  long len = ftell(tag_file);
+  fclose(tag_file);
+
+  if (len >= (long)sizeof(mf_tag_t)) {
+    if (load_mfd(fn, &current_tag))
+      return 1;
+    current_tag_pages = 0;
+    return 0;
+  }
+
+  size_t pages;
+  if (load_ul(fn, &current_tag, &pages))
+    return 1;
+  current_tag_pages = pages;
+  return 0;
 }
 
 int save_tag(const char* fn) {
+  if (current_tag_pages)
+    return save_ul(fn, &current_tag, current_tag_pages);
   return save_mfd(fn, &current_tag);
 }
 
@@ -211,6 +277,35 @@ void print_tag_data_range(size_t byte_offset, size_t bit_offset,
 }
 
 
+void print_ul_pages(size_t pages) {
+
+  // Print header
+  printf("xP  00       03  ASCII\n");
+  printf("----------------------\n");
+
+  for (size_t page = 0; page < pages; ++page) {
+    const uint8_t* data =
+      current_tag.amb[page / 4].mbd.abtData + (page % 4) * MF_UL_PAGE_SIZE;
+
+    printf("%02zx  ", page);
+    print_hex_array_sep(data, MF_UL_PAGE_SIZE, " ");
+    printf("  [");
+    print_ascii_rendering(data, MF_UL_PAGE_SIZE, '.');
+    printf("]");
+
+    // Name the fixed pages
+    if (page < 2)
+      printf("  UID");
+    else if (page == 2)
+      printf("  UID/Lock");
+    else if (page == 3)
+      printf("  OTP/CC");
+
+    printf("\n");
+  }
+}
+
+
 void print_tag_block_range(size_t first, size_t last) {
 
   // Print header
@@ -487,12 +582,52 @@ void key_to_tag(mf_tag_t* tag, const uint8_t* key,
     memcpy(tag->amb[trailer_block].mbt.abtKeyB, key, 6);
 }
 
+int value_block_decode(const mf_block_t* block, int32_t* value, uint8_t* addr) {
+  const uint8_t* d = block->mbd.abtData;
+
+  for (int i = 0; i < 4; ++i) {
+    if (d[i] != d[i + 8] || d[i] != (uint8_t)~d[i + 4])
+      return 1;
+  }
+  if (d[12] != d[14] || d[13] != d[15] || d[12] != (uint8_t)~d[13])
+    return 1;
+
+  uint32_t v = (uint32_t)d[0] | (uint32_t)d[1] << 8 |
+    (uint32_t)d[2] << 16 | (uint32_t)d[3] << 24;
+  if (value)
+    *value = (int32_t)v;
+  if (addr)
+    *addr = d[12];
+
+  return 0;
+}
+
+void value_block_encode(mf_block_t* block, int32_t value, uint8_t addr) {
+  uint8_t* d = block->mbd.abtData;
+  uint32_t v = (uint32_t)value;
+
+  for (int i = 0; i < 4; ++i) {
+    d[i] = d[i + 8] = (uint8_t)(v >> (8 * i));
+    d[i + 4] = (uint8_t)~d[i];
+  }
+  d[12] = d[14] = addr;
+  d[13] = d[15] = (uint8_t)~addr;
+}
+
 /**
  * Return block index of the first block in every sector in turn on
  * repeated calls. Initialize the iterator by calling with state
  * 0. Subsequent calls should use the tag size as state. The iterator
  * returns -1 as an end marker.
  */
+int access_bits_valid(const uint8_t* ac) {
+  // Byte 6: ~C2 ~C1, byte 7: C1 ~C3, byte 8: C3 C2 (high, low nibble)
+  uint8_t c1 = ac[1] >> 4, c2 = ac[2] & 0x0f, c3 = ac[2] >> 4;
+  return (ac[0] & 0x0f) == (~c1 & 0x0f) &&
+    (ac[0] >> 4) == (~c2 & 0x0f) &&
+    (ac[1] & 0x0f) == (~c3 & 0x0f);
+}
+
 int sector_header_iterator(int state) {
   static int block;
 
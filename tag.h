@@ -48,12 +48,28 @@ extern mf_tag_t current_tag;
 // The ACL + keys used
 extern mf_tag_t current_auth;
 
+// Ultralight/NTAG tags are kept in the same buffer as Classic tags;
+// page n at byte offset 4n. This is the number of pages of the
+// Ultralight tag in 'current_tag', or 0 for a Classic tag.
+#define MF_UL_PAGE_SIZE 4
+#define MF_UL_MAX_PAGES 0x100
+extern size_t current_tag_pages;
+
 // Load/Save tag or keys from file
 int load_tag(const char* fn);
 int load_auth(const char* fn);
 int save_tag(const char* fn);
 int save_auth(const char* fn);
 
+// Load/Save a tag from/to a file (.mfd format)
+int load_mfd(const char* fn, mf_tag_t* tag);
+int save_mfd(const char* fn, const mf_tag_t* tag);
+
+// Load/Save an Ultralight/NTAG dump; the pages in order, nothing
+// else. The page count is given by the file size.
+int load_ul(const char* fn, mf_tag_t* tag, size_t* pages);
+int save_ul(const char* fn, const mf_tag_t* tag, size_t pages);
+
 // Copy key data from the 'current_tag' to the 'current_auth'
 int import_auth();
 
@@ -64,6 +80,7 @@ void print_tag_block_range(size_t first, size_t last);
 void print_tag_data_range(size_t byte_offset, size_t bit_offset,
                           size_t byte_len, size_t bit_len);
 void print_tag_bytes(size_t first_byte, size_t last_byte);
+void print_ul_pages(size_t pages);
 
 void print_keys(const mf_tag_t* tag, mf_size_t size);
 void print_ac(const mf_tag_t* tag);
@@ -114,6 +131,24 @@ uint8_t* key_from_tag(const mf_tag_t* tag,
 void key_to_tag(mf_tag_t* tag, const uint8_t* key,
                 mf_key_type_t key_type, size_t block);
 
+/**
+ * Check the access bits (bytes 6-8 of a trailer). Each bit is stored
+ * both inverted and not; a tag treats a trailer where they don't match
+ * as invalid and the sector is lost for good. Return > 0 if valid.
+ */
+int access_bits_valid(const uint8_t* ac);
+
+/**
+ * Decode a value block: 4 byte value, its inverse, the value again
+ * and then the address byte as addr, ~addr, addr, ~addr. The value is
+ * a little endian two's complement number. Return 0 if the block is a
+ * valid value block, != 0 otherwise.
+ */
+int value_block_decode(const mf_block_t* block, int32_t* value, uint8_t* addr);
+
+// Format the block as a value block
+void value_block_encode(mf_block_t* block, int32_t value, uint8_t addr);
+
 /**
  * Return block index of the first block in every sector in turn on
  * repeated calls. Initialize the iterator by calling with state
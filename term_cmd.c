@@ -20,18 +20,30 @@
  * fileman.c (GPLv3). Copyright (C) 1987-2009 Free Software Foundation, Inc
  */
 
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdio.h>
 #include <string.h>
 #include <strings.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include "mfterm.h"
 #include "tag.h"
 #include "term_cmd.h"
 #include "mifare_ctrl.h"
 #include "dictionary.h"
+#include "ksindex.h"
+#include "bruteforce.h"
+#include "nonces.h"
+#include "retry.h"
 #include "spec_syntax.h"
 #include "util.h"
 #include "mac.h"
+#include "job.h"
+#include "perso.h"
+#include "crypto1.h"
+#include "crack.h"
+#include "trace.h"
 
 command_t commands[] = {
   { "help",  com_help, 0, 0, "Display this text" },
@@ -45,10 +57,17 @@ command_t commands[] = {
   { "save",  com_save_tag,  1, 1, "Save tag data to a file" },
   { "clear", com_clear_tag, 0, 1, "Clear the current tag data" },
 
-  { "read",           com_read_tag,           0, 1, "A|B : Read tag data from a physical tag" },
-  { "read unlocked",  com_read_tag_unlocked,  0, 1, "On pirate cards, read card without keys" },
-  { "write",          com_write_tag,          0, 1, "A|B : Write tag data to a physical tag" },
-  { "write unlocked", com_write_tag_unlocked, 0, 1, "On pirate cards, write 1k tag with block 0" },
+  { "read",           com_read_tag,           0, 1, "[.path] A|B : Read tag data, or one field, from a physical tag" },
+  { "read unlocked",  com_read_tag_unlocked,  0, 1, "1k|4k : On pirate cards, read card without keys" },
+  { "read ul",        com_read_ultralight,    0, 1, "Read an Ultralight/NTAG tag" },
+  { "write",          com_write_tag,          0, 1, "[.path] A|B : Write tag data, or one field, to a physical tag" },
+  { "write unlocked", com_write_tag_unlocked, 0, 1, "1k|4k : On pirate cards, write tag with block 0" },
+  { "watch",          com_watch,              0, 1, "A|B #block .. : Show block changes on a physical tag" },
+  { "clone",          com_clone,              0, 1, "A|B : Copy a physical tag to another tag" },
+  { "rekey",          com_rekey,              0, 1, "A|B file : Change the keys of a physical tag to those in file" },
+
+  { "value",       com_value,       0, 1, "A|B #block+n #block-n .. : Change value blocks on a physical tag" },
+  { "value print", com_value_print, 0, 1, "1k|4k : Print the value blocks of the tag" },
 
   { "print",      com_print,      0, 1, "1k|4k : Print tag data" },
   { "p",          com_print,      0, 0, "1k|4k : Print tag data" },
@@ -65,12 +84,26 @@ command_t commands[] = {
   { "keys set",    com_keys_set,    0, 1, "A|B #S key : Set a key value" },
   { "keys import", com_keys_import, 0, 1, "Import keys from the current tag" },
   { "keys test",   com_keys_test,   0, 1, "Try to authenticate with the keys" },
+  { "keys recover", com_keys_recover, 0, 1, "A|B #S trace|uid nt nr ar .. : Recover a key from recorded auths" },
+  { "keys brute",  com_keys_brute,  0, 1, "A|B #S pattern trace|uid nt nr ar .. : Search the ? nibbles of a key" },
+  { "keys nested", com_keys_nested, 0, 1, "A|B #S : Recover the other keys from a known key" },
+  { "keys hardnested", com_keys_hardnested, 0, 1, "A|B #S A|B #T : Recover key T from key S (hardened PRNG)" },
+  { "keys darkside", com_keys_darkside, 0, 1, "A|B #S : Recover a key with no known key (NACK leaks)" },
+  { "keys static", com_keys_static, 0, 1, "A|B #S : Recover the other keys of a static nonce tag (dict index)" },
   { "keys",        com_keys_print,  0, 1, "1k|4k : Print the keys" },
 
   { "dict load",   com_dict_load,   1, 1, "Load a dictionary key file" },
   { "dict clear",  com_dict_clear,  0, 1, "Clear the key dictionary" },
   { "dict attack", com_dict_attack, 0, 1, "Find keys of a physical tag"},
+  { "dict attack resume", com_dict_attack_resume, 0, 1,
+    "Continue an interrupted dictionary attack" },
   { "dict",        com_dict_print,  0, 1, "Print the key dictionary" },
+  { "dict check",  com_dict_check,  0, 1, "A|B #S uid nt nr ar [at] : Find the key of a recorded auth offline" },
+  { "dict index",  com_dict_index,  0, 1, "[uid nt] : Index the dictionary keystreams of a static nonce tag" },
+
+  { "batch read",   com_batch_read,   0, 1, "A|B [prefix] : Read all tags in the field to files" },
+  { "batch attack", com_batch_attack, 0, 1, "[prefix] : Dict attack and read all tags in the field" },
+  { "batch write",  com_batch_write,  0, 1, "A|B : Write the tag data to all tags in the field" },
 
   { "spec load",   com_spec_load,   1, 1, "Load a specification file" },
   { "spec clear",  com_spec_clear,  0, 1, "Unload the specification" },
@@ -81,6 +114,28 @@ command_t commands[] = {
   { "mac update",   com_mac_block_update,  0, 1, "#block : Compute block MAC" },
   { "mac validate", com_mac_validate,      0, 1, "1k|4k : Validates block MAC of the whole tag" },
 
+  { "perso", com_perso, 0, 1, "A|B|unlocked template csv [#block ..] : Personalize tags in a batch" },
+
+  { "nonces collect", com_nonces_collect, 0, 1, "A|B #S file [#count] : Collect tag nonces" },
+  { "nonces print",   com_nonces_print,   1, 1, "Print a nonce file" },
+  { "nonces prng",    com_nonces_prng,    0, 1, "Tell the tag PRNG: weak, static or hardened" },
+
+  { "crypto1 bench", com_crypto1_bench, 0, 1, "Measure the offline Crypto1 key rate" },
+
+  { "trace decode", com_trace_decode, 1, 1, "trace [keys|-] [out] : Decrypt a trace with the (current) keys" },
+
+  { "retry",       com_retry_print, 0, 1, "Print the RF error retry policy" },
+  { "retry set",   com_retry_set,   0, 1, "auth|read|write|backoff #n : Set retries or back off (ms)" },
+  { "retry stats", com_retry_stats, 0, 1, "Print the RF errors per block of the last read/write" },
+
+  { "trigger",       com_trigger_print, 0, 1, "Print the commands run when a tag arrives" },
+  { "trigger set",   com_trigger_set,   0, 1, "cmd; cmd; .. : Set the commands run when a tag arrives" },
+  { "trigger clear", com_trigger_clear, 0, 1, "Clear the tag arrival commands" },
+  { "trigger run",   com_trigger_run,   0, 1, "Wait for tags and run the commands on each" },
+
+  { "jobs",        com_jobs_print,  0, 1, "Show the running or last reader job" },
+  { "jobs cancel", com_jobs_cancel, 0, 1, "Stop the running reader job" },
+
   { (char *)NULL, (cmd_func_t)NULL, 0, 0, (char *)NULL }
 };
 
@@ -104,6 +159,154 @@ mf_key_type_t parse_key_type_default(const char* str,
 // printed.
 int com_mac_block_compute_impl(char* arg, int update);
 
+// Arguments of the reader operations run as jobs
+typedef struct {
+  mf_key_type_t key_type;
+  mf_size_t size;
+  bool resume;
+  size_t blocks[256];
+  size_t block_count;
+  size_t sector;
+  size_t count;
+  char file_name[256];
+  char path[256];
+  mf_batch_op_t batch_op;
+} job_args_t;
+
+// The reader operations. They are run on the worker thread.
+int job_read_tag(void* arg);
+int job_read_blocks(void* arg);
+int job_write_range(void* arg);
+int job_write_tag(void* arg);
+int job_read_ultralight(void* arg);
+int job_test_auth(void* arg);
+int job_dict_attack(void* arg);
+int job_watch(void* arg);
+int job_collect_nonces(void* arg);
+int job_classify_prng(void* arg);
+int job_batch(void* arg);
+int job_value_batch(void* arg);
+int job_trigger(void* arg);
+int job_clone(void* arg);
+int job_rekey(void* arg);
+int job_perso(void* arg);
+int job_dict_check(void* arg);
+int job_keys_recover(void* arg);
+int job_keys_brute(void* arg);
+int job_keys_nested(void* arg);
+int job_keys_hardnested(void* arg);
+int job_keys_darkside(void* arg);
+int job_keys_static(void* arg);
+int job_dict_index(void* arg);
+int job_trace_decode(void* arg);
+
+// Arguments of the personalization job
+typedef struct {
+  mf_key_type_t key_type;
+  char template_fn[256];
+  char csv_fn[256];
+  unsigned int mac_blocks[PERSO_MAX_MACS];
+  size_t mac_count;
+} perso_args_t;
+
+// The commands run on each tag by 'trigger run', separated by ';'
+#define TRIGGER_MAX 512
+static char trigger_cmds[TRIGGER_MAX] = "";
+
+// Arguments of the offline key search jobs
+typedef struct {
+  mf_key_type_t key_type;
+  size_t sector;
+  crack_auth_t auths[CRACK_MAX_AUTHS];
+  size_t count;
+  char file_name[256];  // A trace to take the authentications from
+  uint64_t value;       // The known and unknown bits of 'keys brute'
+  uint64_t mask;
+} crack_args_t;
+
+// Take the authentications of the job from its trace file, if it has
+// one. Return 0 on success, -1 on failure.
+int crack_args_trace(crack_args_t* args);
+
+// Set the key found by an offline search in the current keys, or list
+// the candidates if there is more than one. Return 0 if set.
+int crack_args_result(const crack_args_t* args, const uint64_t* hits,
+                      int count);
+
+// Arguments of the hardened nested attack: the known key and the target
+typedef struct {
+  mf_key_type_t key_type;
+  size_t sector;
+  mf_key_type_t target_type;
+  size_t target_sector;
+} hardnested_args_t;
+
+// Arguments of the dictionary index job. Without a UID and nonce they
+// are taken from the tag.
+typedef struct {
+  bool offline;
+  uint32_t uid;
+  uint32_t nt;
+} ksindex_args_t;
+
+// Arguments of the trace decoder. Without a key file the current keys
+// are used; without an output file the trace is printed.
+typedef struct {
+  char trace_fn[256];
+  char keys_fn[256];
+  char out_fn[256];
+} trace_args_t;
+
+// Arguments of the value batch job
+typedef struct {
+  mf_key_type_t key_type;
+  size_t count;
+  mf_value_op_t ops[256];
+} value_args_t;
+
+// Parse the arguments (A|B [prefix]) of the batch commands and start
+// the batch job. The key type is optional if default_type is valid.
+int com_batch_impl(char* arg, mf_batch_op_t op, mf_key_type_t default_type,
+                   int max_args);
+
+// Parse a hex sector number. Print an error and return -1 if it isn't
+// a valid sector.
+long parse_sector(const char* str);
+
+// Parse a 32 bit hex word (e.g. a nonce). Print an error and return
+// -1 if it isn't valid.
+int parse_word(const char* str, uint32_t* word);
+
+// Parse the rest of the strtok_r line (tok is its save pointer) as a
+// recorded authentication: uid nt {nr} {ar} [{at}]. Print an error and
+// return -1 on failure.
+int parse_auth(crack_auth_t* auth, char** tok);
+
+// Parse recorded authentications with the same UID: uid nt {nr} {ar}
+// [{at}] or uid nt {nr} {ar} nt {nr} {ar} ... Print an error and return
+// -1 on failure.
+int parse_auths(char* str, crack_auth_t* auths, size_t* count);
+
+// Parse the authentications of an offline key search: a trace file
+// name or the authentications. Print an error and return -1 on failure.
+int parse_trace_or_auths(char* str, crack_args_t* args);
+
+// Order blocks for qsort
+int block_cmp(const void* a, const void* b);
+
+// Print an error and return -1 if a job is running. Commands that
+// change the tag, the keys, the dictionary or the spec check this
+// first, as the job may be using them.
+int check_no_job();
+
+// Set the bit range of the data of a spec path. Print an error and
+// return -1 if the path is invalid.
+int parse_path_range(const char* path, size_t* first_bit, size_t* bits);
+
+// Set the blocks (in order) that hold the data of a spec path. Print
+// an error and return -1 if the path is invalid.
+int parse_path_blocks(const char* path, size_t* blocks, size_t* count);
+
 /* Look up NAME as the name of a command, and return a pointer to that
    command.  Return a NULL pointer if NAME isn't a command name. */
 command_t* find_command(const char *name) {
@@ -171,6 +374,9 @@ int com_quit(char *arg) {
 }
 
 int com_load_tag(char *arg) {
+  if (check_no_job())
+    return -1;
+
   int res = load_tag(arg);
   if (res == 0)
     printf("Successfully loaded tag from: %s\n", arg);
@@ -185,15 +391,27 @@ int com_save_tag(char* arg) {
 }
 
 int com_clear_tag(char* arg) {
+  if (check_no_job())
+    return -1;
+
   clear_tag(&current_tag);
+  current_tag_pages = 0;
   return 0;
 }
 
 int com_read_tag(char* arg) {
+  char* tok;
   // Add option to choose key
-  char* ab = strtok(arg, " ");
+  char* ab = strtok_r(arg, " ", &tok);
+
+  // Read just the blocks of a spec path
+  char* path = NULL;
+  if (ab && ab[0] == '.') {
+    path = ab;
+    ab = strtok_r(NULL, " ", &tok);
+  }
 
-  if (ab && strtok(NULL, " ") != (char*)NULL) {
+  if (ab && strtok_r(NULL, " ", &tok) != (char*)NULL) {
     printf("Too many arguments\n");
     return -1;
   }
@@ -208,32 +426,74 @@ int com_read_tag(char* arg) {
   }
 
   // Issue the read request
-  mf_read_tag(&current_tag, key_type);
+  job_args_t args = { .key_type = key_type };
+  if (path) {
+    if (strlen(path) >= sizeof(args.path)) {
+      printf("Path too long\n");
+      return -1;
+    }
+    if (parse_path_blocks(path, args.blocks, &args.block_count))
+      return -1;
+    strcpy(args.path, path);
+    job_run("read", job_read_blocks, &args, sizeof(args));
+    return 0;
+  }
+  job_run("read", job_read_tag, &args, sizeof(args));
   return 0;
 }
 
-int com_read_tag_unlocked(char* arg) {
-  char* ab = strtok(arg, " ");
-  if (ab) {
+int com_read_ultralight(char* arg) {
+  char* tok;
+  char* a = strtok_r(arg, " ", &tok);
+  if (a) {
     printf("This command doesn't take any arguments\n");
     return -1;
   }
 
+  job_run("read ul", job_read_ultralight, NULL, 0);
+  return 0;
+}
+
+int com_read_tag_unlocked(char* arg) {
+  char* tok;
+  char* a = strtok_r(arg, " ", &tok);
+
+  if (a && strtok_r(NULL, " ", &tok) != (char*)NULL) {
+    printf("Too many arguments\n");
+    return -1;
+  }
+
+  // Without a size, it is taken from the tag
+  mf_size_t size = parse_size_default(a, MF_INVALID_SIZE);
+  if (a && size == MF_INVALID_SIZE) {
+    printf("Unknown argument: %s\n", a);
+    return -1;
+  }
+
   // Issue the read request
-  mf_read_tag(&current_tag, MF_KEY_UNLOCKED);
+  job_args_t args = { .key_type = MF_KEY_UNLOCKED, .size = size };
+  job_run("read unlocked", job_read_tag, &args, sizeof(args));
   return 0;
 }
 
 int com_write_tag(char* arg) {
+  char* tok;
   // Add option to choose key
-  char* ab = strtok(arg, " ");
+  char* ab = strtok_r(arg, " ", &tok);
+
+  // Write just the blocks of a spec path
+  char* path = NULL;
+  if (ab && ab[0] == '.') {
+    path = ab;
+    ab = strtok_r(NULL, " ", &tok);
+  }
 
   if (!ab) {
     printf("Too few arguments: (A|B)\n");
     return -1;
   }
 
-  if (strtok(NULL, " ") != (char*)NULL) {
+  if (strtok_r(NULL, " ", &tok) != (char*)NULL) {
     printf("Too many arguments\n");
     return -1;
   }
@@ -245,32 +505,274 @@ int com_write_tag(char* arg) {
     return -1;
   }
 
-  // Issue the read request
-  mf_write_tag(&current_tag, key_type);
+  // Issue the write request
+  job_args_t args = { .key_type = key_type };
+  if (path) {
+    size_t first_bit, bits;
+    if (strlen(path) >= sizeof(args.path)) {
+      printf("Path too long\n");
+      return -1;
+    }
+    if (parse_path_range(path, &first_bit, &bits))
+      return -1;
+    strcpy(args.path, path);
+    job_run("write", job_write_range, &args, sizeof(args));
+    return 0;
+  }
+  job_run("write", job_write_tag, &args, sizeof(args));
+  return 0;
+}
+
+int com_clone(char* arg) {
+  char* tok;
+  char* ab = strtok_r(arg, " ", &tok);
+
+  if (!ab) {
+    printf("Too few arguments: (A|B)\n");
+    return -1;
+  }
+
+  if (strtok_r(NULL, " ", &tok) != (char*)NULL) {
+    printf("Too many arguments\n");
+    return -1;
+  }
+
+  mf_key_type_t key_type = parse_key_type(ab);
+  if (key_type == MF_INVALID_KEY_TYPE) {
+    printf("Invalid argument (A|B): %s\n", ab);
+    return -1;
+  }
+
+  job_args_t args = { .key_type = key_type };
+  job_run("clone", job_clone, &args, sizeof(args));
+  return 0;
+}
+
+int com_rekey(char* arg) {
+  // Arg format: A|B file
+
+  char* tok;
+  char* ab = strtok_r(arg, " ", &tok);
+  char* file_str = strtok_r(NULL, " ", &tok);
+
+  if (!ab || !file_str) {
+    printf("Too few arguments: (A|B) file\n");
+    return -1;
+  }
+
+  if (strtok_r(NULL, " ", &tok) != (char*)NULL) {
+    printf("Too many arguments\n");
+    return -1;
+  }
+
+  mf_key_type_t key_type = parse_key_type(ab);
+  if (key_type == MF_INVALID_KEY_TYPE) {
+    printf("Invalid argument (A|B): %s\n", ab);
+    return -1;
+  }
+
+  job_args_t args = { .key_type = key_type };
+  if (strlen(file_str) >= sizeof(args.file_name)) {
+    printf("File name too long\n");
+    return -1;
+  }
+  strcpy(args.file_name, file_str);
+
+  job_run("rekey", job_rekey, &args, sizeof(args));
   return 0;
 }
 
 int com_write_tag_unlocked(char* arg) {
-  char* ab = strtok(arg, " ");
-  if (ab) {
-    printf("This command doesn't take any arguments\n");
+  char* tok;
+  char* a = strtok_r(arg, " ", &tok);
+
+  if (a && strtok_r(NULL, " ", &tok) != (char*)NULL) {
+    printf("Too many arguments\n");
+    return -1;
+  }
+
+  // Without a size, it is taken from the tag
+  mf_size_t size = parse_size_default(a, MF_INVALID_SIZE);
+  if (a && size == MF_INVALID_SIZE) {
+    printf("Unknown argument: %s\n", a);
     return -1;
   }
 
   // Issue the write request
-  mf_write_tag(&current_tag, MF_KEY_UNLOCKED);
+  job_args_t args = { .key_type = MF_KEY_UNLOCKED, .size = size };
+  job_run("write unlocked", job_write_tag, &args, sizeof(args));
+  return 0;
+}
+
+int com_watch(char* arg) {
+  char* tok;
+  char* ab = strtok_r(arg, " ", &tok);
+  char* block_str = strtok_r(NULL, " ", &tok);
+
+  if (!ab || !block_str) {
+    printf("Too few arguments: (A|B) #block .. #block\n");
+    return -1;
+  }
+
+  mf_key_type_t key_type = parse_key_type(ab);
+  if (key_type == MF_INVALID_KEY_TYPE) {
+    printf("Invalid argument (A|B): %s\n", ab);
+    return -1;
+  }
+
+  static job_args_t args;
+  args.key_type = key_type;
+  args.block_count = 0;
+
+  // Consume the block tokens
+  do {
+    unsigned int block = (unsigned int) strtoul(block_str, &block_str, 16);
+    if (*block_str != '\0') {
+      printf("Invalid block character (non hex): %s\n", block_str);
+      return -1;
+    }
+    if (block > 0xff) {
+      printf("Invalid block [0,ff]: %x\n", block);
+      return -1;
+    }
+    if (args.block_count == 256) {
+      printf("Too many blocks specified.\n");
+      return -1;
+    }
+    args.blocks[args.block_count++] = block;
+  } while((block_str = strtok_r(NULL, " ", &tok)) != (char*)NULL);
+
+  // Sorted blocks are grouped by sector; one authentication per sector
+  qsort(args.blocks, args.block_count, sizeof(size_t), block_cmp);
+
+  job_run("watch", job_watch, &args, sizeof(args));
+  return 0;
+}
+
+int com_value(char* arg) {
+  char* tok;
+  char* ab = strtok_r(arg, " ", &tok);
+  char* op_str = strtok_r(NULL, " ", &tok);
+
+  if (!ab || !op_str) {
+    printf("Too few arguments: (A|B) #block+n|#block-n ..\n");
+    return -1;
+  }
+
+  static value_args_t args;
+  args.key_type = parse_key_type(ab);
+  if (args.key_type == MF_INVALID_KEY_TYPE) {
+    printf("Invalid argument (A|B): %s\n", ab);
+    return -1;
+  }
+
+  // Sum up the changes per block
+  static int64_t deltas[256];
+  static int changed[256];
+  memset(deltas, 0, sizeof(deltas));
+  memset(changed, 0, sizeof(changed));
+  size_t changes = 0;
+
+  do {
+    char* end;
+    unsigned long block = strtoul(op_str, &end, 16);
+    if (end == op_str || (*end != '+' && *end != '-')) {
+      printf("Invalid value change (#block+n|#block-n): %s\n", op_str);
+      return -1;
+    }
+    if (block > 0xff || is_trailer_block(block)) {
+      printf("Invalid block (not a data block): %lx\n", block);
+      return -1;
+    }
+
+    char* amount_str = end;
+    long long amount = strtoll(amount_str, &end, 10);
+    if (*end != '\0' || amount < -0xffffffffLL || amount > 0xffffffffLL) {
+      printf("Invalid amount: %s\n", amount_str);
+      return -1;
+    }
+
+    deltas[block] += amount;
+    changed[block] = 1;
+    ++changes;
+  } while((op_str = strtok_r(NULL, " ", &tok)) != (char*)NULL);
+
+  // One op per block, in block order; net zero changes are dropped
+  args.count = 0;
+  for (size_t block = 0; block < 256; ++block) {
+    if (!changed[block])
+      continue;
+    if (deltas[block] < INT32_MIN || deltas[block] > INT32_MAX) {
+      printf("Total change of block %02zx is out of range: %lld\n",
+             block, (long long)deltas[block]);
+      return -1;
+    }
+    if (deltas[block] == 0)
+      continue;
+    args.ops[args.count].block = block;
+    args.ops[args.count].delta = deltas[block];
+    ++args.count;
+  }
+
+  printf("%zu changes on %zu blocks.\n", changes, args.count);
+  if (args.count == 0)
+    return 0;
+
+  job_run("value", job_value_batch, &args, sizeof(args));
+  return 0;
+}
+
+int com_value_print(char* arg) {
+  char* tok;
+  char* a = strtok_r(arg, " ", &tok);
+
+  if (a && strtok_r(NULL, " ", &tok) != (char*)NULL) {
+    printf("Too many arguments\n");
+    return -1;
+  }
+
+  mf_size_t size = parse_size_default(a, MF_1K);
+  if (size == MF_INVALID_SIZE) {
+    printf("Unknown argument: %s\n", a);
+    return -1;
+  }
+
+  printf("xB  Value        Addr\n");
+  printf("----------------------\n");
+
+  int count = 0;
+  for (size_t block = 1; block < block_count(size); ++block) {
+    int32_t value;
+    uint8_t addr;
+    if (is_trailer_block(block) ||
+        value_block_decode(&current_tag.amb[block], &value, &addr))
+      continue;
+    printf("%02zx  %-11d  %02x\n", block, value, addr);
+    ++count;
+  }
+
+  if (count == 0)
+    printf("No value blocks.\n");
+
   return 0;
 }
 
 int com_print(char* arg) {
+  char* tok;
 
-  char* a = strtok(arg, " ");
+  char* a = strtok_r(arg, " ", &tok);
 
-  if (a && strtok(NULL, " ") != (char*)NULL) {
+  if (a && strtok_r(NULL, " ", &tok) != (char*)NULL) {
     printf("Too many arguments\n");
     return -1;
   }
 
+  // Ultralight tags are printed by page, unless a size is given
+  if (!a && current_tag_pages) {
+    print_ul_pages(current_tag_pages);
+    return 0;
+  }
+
   mf_size_t size = parse_size_default(a, MF_1K);
 
   if (size == MF_INVALID_SIZE) {
@@ -289,9 +791,13 @@ int com_print_head(char* arg) {
 }
 
 int com_set(char* arg) {
-  char* block_str = strtok(arg, " ");
-  char* offset_str = strtok(NULL, " ");
-  char* byte_str = strtok(NULL, " ");
+  if (check_no_job())
+    return -1;
+
+  char* tok;
+  char* block_str = strtok_r(arg, " ", &tok);
+  char* offset_str = strtok_r(NULL, " ", &tok);
+  char* byte_str = strtok_r(NULL, " ", &tok);
 
   if (!block_str || !offset_str || !byte_str) {
     printf("Too few arguments: #block #offset xx xx xx .. xx\n");
@@ -338,13 +844,17 @@ int com_set(char* arg) {
     // Write the data
     current_tag.amb[block].mbd.abtData[offset++] = (uint8_t)byte;
 
-  } while((byte_str = strtok(NULL, " ")) != (char*)NULL);
+  } while((byte_str = strtok_r(NULL, " ", &tok)) != (char*)NULL);
 
   return 0;
 }
 
 int com_setuid(char* arg) {
-  char* byte_str = strtok(arg, " ");
+  if (check_no_job())
+    return -1;
+
+  char* tok;
+  char* byte_str = strtok_r(arg, " ", &tok);
   int block = 0;
 
   /// TODO : Check arg size (display warning if < 4)
@@ -365,7 +875,8 @@ int com_setuid(char* arg) {
     // Write the data
     current_tag.amb[0].mbd.abtData[block++] = (uint8_t)byte;
 
-  } while(((byte_str = strtok(NULL, " ")) != (char*)NULL) && (block < 4));
+  } while(((byte_str = strtok_r(NULL, " ", &tok)) != (char*)NULL) &&
+          (block < 4));
   // Compute and write BCC
   current_tag.amb[0].mbd.abtData[4] = (uint8_t)current_tag.amb[0].mbd.abtData[0] ^
     (uint8_t)current_tag.amb[0].mbd.abtData[1] ^
@@ -376,9 +887,10 @@ int com_setuid(char* arg) {
 }
 
 int com_print_keys(char* arg) {
-  char* a = strtok(arg, " ");
+  char* tok;
+  char* a = strtok_r(arg, " ", &tok);
 
-  if (a && strtok(NULL, " ") != (char*)NULL) {
+  if (a && strtok_r(NULL, " ", &tok) != (char*)NULL) {
     printf("Too many arguments\n");
     return -1;
   }
@@ -396,7 +908,8 @@ int com_print_keys(char* arg) {
 }
 
 int com_print_ac(char* arg) {
-  if (strtok(arg, " ") != (char*)NULL) {
+  char* tok;
+  if (strtok_r(arg, " ", &tok) != (char*)NULL) {
     printf("Too many arguments\n");
     return -1;
   }
@@ -407,6 +920,9 @@ int com_print_ac(char* arg) {
 }
 
 int com_keys_load(char* arg) {
+  if (check_no_job())
+    return -1;
+
   int res = load_auth(arg);
   if (res == 0)
     printf("Successfully loaded keys from: %s\n", arg);
@@ -421,18 +937,25 @@ int com_keys_save(char* arg) {
 }
 
 int com_keys_clear(char* arg) {
+  if (check_no_job())
+    return -1;
+
   clear_tag(&current_auth);
   return 0;
 }
 
 int com_keys_set(char* arg) {
+  if (check_no_job())
+    return -1;
+
   // Arg format: A|B #S key
 
-  char* ab = strtok(arg, " ");
-  char* sector_str = strtok(NULL, " ");
-  char* key_str = strtok(NULL, " ");
+  char* tok;
+  char* ab = strtok_r(arg, " ", &tok);
+  char* sector_str = strtok_r(NULL, " ", &tok);
+  char* key_str = strtok_r(NULL, " ", &tok);
 
-  if (strtok(NULL, " ") != (char*)NULL) {
+  if (strtok_r(NULL, " ", &tok) != (char*)NULL) {
     printf("Too many arguments\n");
     return -1;
   }
@@ -487,107 +1010,476 @@ int com_keys_set(char* arg) {
   return 0;
 }
 
-int com_keys_import(char* arg) {
-  import_auth();
-  return 0;
-}
-
-int com_keys_test(char* arg) {
-  // Arg format: 1k|4k A|B
+int com_keys_nested(char* arg) {
+  char* tok;
+  char* ab = strtok_r(arg, " ", &tok);
+  char* sector_str = strtok_r(NULL, " ", &tok);
 
-  char* s = strtok(arg, " ");
-  char* ab = strtok(NULL, " ");
-
-  if (s && ab && strtok(NULL, " ") != NULL) {
-    printf("Too many arguments\n");
+  if (!ab || !sector_str) {
+    printf("Too few arguments: (A|B) #sector\n");
     return -1;
   }
-
-  if (!s || !ab) {
-    printf("Too few arguments: (1k|4k) (A|B)\n");
+  if (strtok_r(NULL, " ", &tok)) {
+    printf("Too many arguments\n");
     return -1;
   }
 
-  // Parse arguments
-  mf_size_t size = parse_size(s);
-  if (size == MF_INVALID_SIZE) {
-    printf("Unknown size argument (1k|4k): %s\n", s);
+  static job_args_t args;
+  args.key_type = parse_key_type(ab);
+  if (args.key_type == MF_INVALID_KEY_TYPE) {
+    printf("Invalid argument (A|B): %s\n", ab);
     return -1;
   }
 
-  mf_key_type_t key_type = parse_key_type(ab);
-  if (key_type == MF_INVALID_KEY_TYPE) {
-    printf("Unknown key type argument (A|B): %s\n", ab);
+  long sector = parse_sector(sector_str);
+  if (sector < 0)
     return -1;
-  }
+  args.sector = (size_t)sector;
 
-  // Run the auth test
-  mf_test_auth(&current_auth, size, key_type);
+  job_run("keys nested", job_keys_nested, &args, sizeof(args));
   return 0;
 }
 
-int com_keys_print(char* arg) {
-  char* a = strtok(arg, " ");
+int com_keys_hardnested(char* arg) {
+  char* tok;
+  char* ab = strtok_r(arg, " ", &tok);
+  char* sector_str = strtok_r(NULL, " ", &tok);
+  char* target_ab = strtok_r(NULL, " ", &tok);
+  char* target_str = strtok_r(NULL, " ", &tok);
 
-  if (a && strtok(NULL, " ") != (char*)NULL) {
+  if (!ab || !sector_str || !target_ab || !target_str) {
+    printf("Too few arguments: (A|B) #sector (A|B) #target\n");
+    return -1;
+  }
+  if (strtok_r(NULL, " ", &tok)) {
     printf("Too many arguments\n");
     return -1;
   }
 
-  mf_size_t size = parse_size_default(a, MF_1K);
-
-  if (size == MF_INVALID_SIZE) {
-    printf("Unknown argument: %s\n", a);
+  static hardnested_args_t args;
+  args.key_type = parse_key_type(ab);
+  if (args.key_type == MF_INVALID_KEY_TYPE) {
+    printf("Invalid argument (A|B): %s\n", ab);
+    return -1;
+  }
+  args.target_type = parse_key_type(target_ab);
+  if (args.target_type == MF_INVALID_KEY_TYPE) {
+    printf("Invalid argument (A|B): %s\n", target_ab);
     return -1;
   }
 
-  print_keys(&current_auth, size);
+  long sector = parse_sector(sector_str);
+  if (sector < 0)
+    return -1;
+  args.sector = (size_t)sector;
+  sector = parse_sector(target_str);
+  if (sector < 0)
+    return -1;
+  args.target_sector = (size_t)sector;
 
+  job_run("keys hardnested", job_keys_hardnested, &args, sizeof(args));
   return 0;
 }
 
-int com_dict_load(char* arg) {
-  FILE* dict_file = fopen(arg, "r");
+int com_keys_darkside(char* arg) {
+  char* tok;
+  char* ab = strtok_r(arg, " ", &tok);
+  char* sector_str = strtok_r(NULL, " ", &tok);
 
-  if (dict_file == NULL) {
-    printf("Could not open file: %s\n", arg);
-    return 1;
+  if (!ab || !sector_str) {
+    printf("Too few arguments: (A|B) #sector\n");
+    return -1;
+  }
+  if (strtok_r(NULL, " ", &tok)) {
+    printf("Too many arguments\n");
+    return -1;
   }
 
-  dictionary_import(dict_file);
+  static job_args_t args;
+  args.key_type = parse_key_type(ab);
+  if (args.key_type == MF_INVALID_KEY_TYPE) {
+    printf("Invalid argument (A|B): %s\n", ab);
+    return -1;
+  }
 
-  fclose(dict_file);
-  return 0;
-}
+  long sector = parse_sector(sector_str);
+  if (sector < 0)
+    return -1;
+  args.sector = (size_t)sector;
 
-int com_dict_clear(char* arg) {
-  dictionary_clear();
+  job_run("keys darkside", job_keys_darkside, &args, sizeof(args));
   return 0;
 }
 
-int com_dict_attack(char* arg) {
+int com_keys_static(char* arg) {
+  char* tok;
+  char* ab = strtok_r(arg, " ", &tok);
+  char* sector_str = strtok_r(NULL, " ", &tok);
 
-  // Not much point if we don't have any keys
-  if (!dictionary_get()) {
-    printf("Dictionary is empty!\n");
+  if (!ab || !sector_str) {
+    printf("Too few arguments: (A|B) #sector\n");
+    return -1;
+  }
+  if (strtok_r(NULL, " ", &tok)) {
+    printf("Too many arguments\n");
     return -1;
   }
 
-  mf_dictionary_attack(&current_auth);
-  return 0;
-}
-
-int com_dict_print(char* arg) {
-  key_list_t* kl = dictionary_get();
-
-  int count = 0;
-  while(kl) {
-    printf("%s\n", sprint_key(kl->key));
-    kl = kl->next;
-    ++count;
+  static job_args_t args;
+  args.key_type = parse_key_type(ab);
+  if (args.key_type == MF_INVALID_KEY_TYPE) {
+    printf("Invalid argument (A|B): %s\n", ab);
+    return -1;
   }
 
-  printf("Dictionary contains: %d keys\n", count);
+  long sector = parse_sector(sector_str);
+  if (sector < 0)
+    return -1;
+  args.sector = (size_t)sector;
+
+  // No dictionary is needed once the tag has an index; the job checks
+  job_run("keys static", job_keys_static, &args, sizeof(args));
+  return 0;
+}
+
+int com_keys_recover(char* arg) {
+  // Arg format: A|B #S trace | uid nt nr ar at | uid nt nr ar nt nr ar ..
+
+  char* tok;
+  char* ab = strtok_r(arg, " ", &tok);
+  char* sector_str = strtok_r(NULL, " ", &tok);
+  char* rest = strtok_r(NULL, "", &tok);
+
+  if (!ab || !sector_str || !rest || *(rest = trim(rest)) == '\0') {
+    printf("Too few arguments: (A|B) #sector (trace | uid nt nr ar ..)\n");
+    return -1;
+  }
+
+  static crack_args_t args;
+  args.key_type = parse_key_type(ab);
+  if (args.key_type == MF_INVALID_KEY_TYPE) {
+    printf("Invalid argument (A|B): %s\n", ab);
+    return -1;
+  }
+
+  long sector = parse_sector(sector_str);
+  if (sector < 0)
+    return -1;
+  args.sector = (size_t)sector;
+
+  if (parse_trace_or_auths(rest, &args))
+    return -1;
+
+  job_run("keys recover", job_keys_recover, &args, sizeof(args));
+  return 0;
+}
+
+int com_keys_brute(char* arg) {
+  // Arg format: A|B #S pattern trace | uid nt nr ar [at] | uid nt nr ar nt ..
+
+  char* tok;
+  char* ab = strtok_r(arg, " ", &tok);
+  char* sector_str = strtok_r(NULL, " ", &tok);
+  char* pattern = strtok_r(NULL, " ", &tok);
+  char* rest = strtok_r(NULL, "", &tok);
+
+  if (!ab || !sector_str || !pattern || !rest ||
+      *(rest = trim(rest)) == '\0') {
+    printf("Too few arguments: (A|B) #sector pattern (trace | uid nt nr ar ..)\n");
+    return -1;
+  }
+
+  static crack_args_t args;
+  args.key_type = parse_key_type(ab);
+  if (args.key_type == MF_INVALID_KEY_TYPE) {
+    printf("Invalid argument (A|B): %s\n", ab);
+    return -1;
+  }
+
+  long sector = parse_sector(sector_str);
+  if (sector < 0)
+    return -1;
+  args.sector = (size_t)sector;
+
+  if (bruteforce_pattern(pattern, &args.value, &args.mask))
+    return -1;
+
+  if (parse_trace_or_auths(rest, &args))
+    return -1;
+
+  job_run("keys brute", job_keys_brute, &args, sizeof(args));
+  return 0;
+}
+
+int com_keys_import(char* arg) {
+  if (check_no_job())
+    return -1;
+
+  import_auth();
+  return 0;
+}
+
+int com_keys_test(char* arg) {
+  // Arg format: 1k|4k A|B
+
+  char* tok;
+  char* s = strtok_r(arg, " ", &tok);
+  char* ab = strtok_r(NULL, " ", &tok);
+
+  if (s && ab && strtok_r(NULL, " ", &tok) != NULL) {
+    printf("Too many arguments\n");
+    return -1;
+  }
+
+  if (!s || !ab) {
+    printf("Too few arguments: (1k|4k) (A|B)\n");
+    return -1;
+  }
+
+  // Parse arguments
+  mf_size_t size = parse_size(s);
+  if (size == MF_INVALID_SIZE) {
+    printf("Unknown size argument (1k|4k): %s\n", s);
+    return -1;
+  }
+
+  mf_key_type_t key_type = parse_key_type(ab);
+  if (key_type == MF_INVALID_KEY_TYPE) {
+    printf("Unknown key type argument (A|B): %s\n", ab);
+    return -1;
+  }
+
+  // Run the auth test
+  job_args_t args = { .key_type = key_type, .size = size };
+  job_run("keys test", job_test_auth, &args, sizeof(args));
+  return 0;
+}
+
+int com_keys_print(char* arg) {
+  char* tok;
+  char* a = strtok_r(arg, " ", &tok);
+
+  if (a && strtok_r(NULL, " ", &tok) != (char*)NULL) {
+    printf("Too many arguments\n");
+    return -1;
+  }
+
+  mf_size_t size = parse_size_default(a, MF_1K);
+
+  if (size == MF_INVALID_SIZE) {
+    printf("Unknown argument: %s\n", a);
+    return -1;
+  }
+
+  print_keys(&current_auth, size);
+
+  return 0;
+}
+
+int com_dict_load(char* arg) {
+  if (check_no_job())
+    return -1;
+
+  FILE* dict_file = fopen(arg, "r");
+
+  if (dict_file == NULL) {
+    printf("Could not open file: %s\n", arg);
+    return 1;
+  }
+
+  dictionary_import(dict_file);
+
+  fclose(dict_file);
+  return 0;
+}
+
+int com_dict_clear(char* arg) {
+  if (check_no_job())
+    return -1;
+
+  dictionary_clear();
+  return 0;
+}
+
+int com_dict_attack(char* arg) {
+
+  // Not much point if we don't have any keys
+  if (!dictionary_get()) {
+    printf("Dictionary is empty!\n");
+    return -1;
+  }
+
+  job_args_t args = { .resume = false };
+  job_run("dict attack", job_dict_attack, &args, sizeof(args));
+  return 0;
+}
+
+int com_dict_attack_resume(char* arg) {
+
+  // The checkpoint is only valid with the same dictionary
+  if (!dictionary_get()) {
+    printf("Dictionary is empty!\n");
+    return -1;
+  }
+
+  job_args_t args = { .resume = true };
+  job_run("dict attack", job_dict_attack, &args, sizeof(args));
+  return 0;
+}
+
+int com_dict_check(char* arg) {
+  // Arg format: A|B #S uid nt nr ar [at]
+
+  char* tok;
+  char* ab = strtok_r(arg, " ", &tok);
+  char* sector_str = strtok_r(NULL, " ", &tok);
+
+  if (!ab || !sector_str) {
+    printf("Too few arguments: (A|B) #sector uid nt nr ar [at]\n");
+    return -1;
+  }
+
+  static crack_args_t args;
+  args.key_type = parse_key_type(ab);
+  if (args.key_type == MF_INVALID_KEY_TYPE) {
+    printf("Invalid argument (A|B): %s\n", ab);
+    return -1;
+  }
+
+  long sector = parse_sector(sector_str);
+  if (sector < 0)
+    return -1;
+  args.sector = (size_t)sector;
+
+  if (parse_auth(&args.auths[0], &tok))
+    return -1;
+  args.count = 1;
+
+  if (!dictionary_get()) {
+    printf("Dictionary is empty!\n");
+    return -1;
+  }
+
+  job_run("dict check", job_dict_check, &args, sizeof(args));
+  return 0;
+}
+
+int com_dict_index(char* arg) {
+  // Arg format: [uid nt]
+
+  char* tok;
+  char* uid_str = strtok_r(arg, " ", &tok);
+  char* nt_str = strtok_r(NULL, " ", &tok);
+
+  static ksindex_args_t args;
+  args.offline = uid_str != NULL;
+  if (args.offline) {
+    if (!nt_str) {
+      printf("Too few arguments: [uid nt]\n");
+      return -1;
+    }
+    if (strtok_r(NULL, " ", &tok)) {
+      printf("Too many arguments\n");
+      return -1;
+    }
+    if (parse_word(uid_str, &args.uid) || parse_word(nt_str, &args.nt))
+      return -1;
+  }
+
+  if (!dictionary_get()) {
+    printf("Dictionary is empty!\n");
+    return -1;
+  }
+
+  job_run("dict index", job_dict_index, &args, sizeof(args));
+  return 0;
+}
+
+int com_batch_read(char* arg) {
+  return com_batch_impl(arg, MF_BATCH_READ, MF_INVALID_KEY_TYPE, 2);
+}
+
+int com_batch_attack(char* arg) {
+
+  // Not much point if we don't have any keys
+  if (!dictionary_get()) {
+    printf("Dictionary is empty!\n");
+    return -1;
+  }
+
+  return com_batch_impl(arg, MF_BATCH_ATTACK, MF_KEY_A, 1);
+}
+
+int com_batch_write(char* arg) {
+  return com_batch_impl(arg, MF_BATCH_WRITE, MF_INVALID_KEY_TYPE, 1);
+}
+
+int com_batch_impl(char* arg, mf_batch_op_t op, mf_key_type_t default_type,
+                   int max_args) {
+  static job_args_t args;
+  args.batch_op = op;
+  args.key_type = default_type;
+  args.file_name[0] = '\0';
+
+  char* tok;
+  char* tokens[2] = { strtok_r(arg, " ", &tok), NULL };
+  if (tokens[0])
+    tokens[1] = strtok_r(NULL, " ", &tok);
+  int n = tokens[0] ? (tokens[1] ? 2 : 1) : 0;
+
+  if (n && strtok_r(NULL, " ", &tok) != (char*)NULL) {
+    printf("Too many arguments\n");
+    return -1;
+  }
+
+  // The key type comes first, unless the command doesn't take one
+  char* prefix = NULL;
+  if (default_type == MF_INVALID_KEY_TYPE) {
+    if (n == 0) {
+      printf("Too few arguments: (A|B)%s\n", max_args > 1 ? " [prefix]" : "");
+      return -1;
+    }
+    args.key_type = parse_key_type(tokens[0]);
+    if (args.key_type == MF_INVALID_KEY_TYPE) {
+      printf("Invalid argument (A|B): %s\n", tokens[0]);
+      return -1;
+    }
+    prefix = tokens[1];
+  }
+  else {
+    prefix = tokens[0];
+    if (n > 1)
+      max_args = 0; // Force the error below
+  }
+
+  if (n > max_args) {
+    printf("Too many arguments\n");
+    return -1;
+  }
+
+  if (prefix) {
+    if (strlen(prefix) >= sizeof(args.file_name) - 32) {
+      printf("Prefix too long: %s\n", prefix);
+      return -1;
+    }
+    strcpy(args.file_name, prefix);
+  }
+
+  job_run("batch", job_batch, &args, sizeof(args));
+  return 0;
+}
+
+int com_dict_print(char* arg) {
+  key_list_t* kl = dictionary_get();
+
+  int count = 0;
+  while(kl) {
+    printf("%s\n", sprint_key(kl->key));
+    kl = kl->next;
+    ++count;
+  }
+
+  printf("Dictionary contains: %d keys\n", count);
 
   return 0;
 }
@@ -600,6 +1492,9 @@ int com_spec_print(char* arg) {
 }
 
 int com_spec_load(char* arg) {
+  if (check_no_job())
+    return -1;
+
   // Start by clearing the current hierarcy
   clear_instance_tree();
   tt_clear();
@@ -620,6 +1515,8 @@ int com_spec_load(char* arg) {
 }
 
 int com_spec_clear(char* arg) {
+  if (check_no_job())
+    return -1;
 
   clear_instance_tree();
   tt_clear();
@@ -628,7 +1525,8 @@ int com_spec_clear(char* arg) {
 }
 
 int com_mac_key_get_set(char* arg) {
-  char* key_str = strtok(arg, " ");
+  char* tok;
+  char* key_str = strtok_r(arg, " ", &tok);
 
   if (key_str == 0) {
     printf("Current MAC key: \n");
@@ -660,7 +1558,7 @@ int com_mac_key_get_set(char* arg) {
     // Accept the byte and add it to the key
     key[key_ptr++] = (uint8_t)byte;
 
-  } while((key_str = strtok(NULL, " ")) != (char*)NULL);
+  } while((key_str = strtok_r(NULL, " ", &tok)) != (char*)NULL);
 
   if (key_ptr != sizeof(key)) {
     printf("Too few bytes specified in key (should be 8).\n");
@@ -677,11 +1575,15 @@ int com_mac_block_compute(char* arg) {
 }
 
 int com_mac_block_update(char* arg) {
+  if (check_no_job())
+    return -1;
+
   return com_mac_block_compute_impl(arg, 1);
 }
 
 int com_mac_block_compute_impl(char* arg, int update) {
-  char* block_str = strtok(arg, " ");
+  char* tok;
+  char* block_str = strtok_r(arg, " ", &tok);
 
   if (!block_str) {
     printf("Too few arguments: #block\n");
@@ -714,9 +1616,10 @@ int com_mac_block_compute_impl(char* arg, int update) {
 }
 
 int com_mac_validate(char* arg) {
-  char* a = strtok(arg, " ");
+  char* tok;
+  char* a = strtok_r(arg, " ", &tok);
 
-  if (a && strtok(NULL, " ") != (char*)NULL) {
+  if (a && strtok_r(NULL, " ", &tok) != (char*)NULL) {
     printf("Too many arguments\n");
     return -1;
   }
@@ -750,29 +1653,809 @@ int com_mac_validate(char* arg) {
   return 0;
 }
 
-mf_size_t parse_size(const char* str) {
+int com_perso(char* arg) {
+  // Arg format: A|B|unlocked template csv [#block ..]
 
-  if (str == NULL)
-    return MF_INVALID_SIZE;
+  char* tok;
+  char* ab = strtok_r(arg, " ", &tok);
+  char* template_str = strtok_r(NULL, " ", &tok);
+  char* csv_str = strtok_r(NULL, " ", &tok);
 
-  if (strcasecmp(str, "1k") == 0)
-    return MF_1K;
+  if (!ab || !template_str || !csv_str) {
+    printf("Too few arguments: (A|B|unlocked) template csv [#block ..]\n");
+    return -1;
+  }
 
-  if (strcasecmp(str, "4k") == 0)
-    return MF_4K;
+  static perso_args_t args;
+  memset(&args, 0, sizeof(args));
 
-  return MF_INVALID_SIZE;
-}
+  args.key_type = strcasecmp(ab, "unlocked") == 0 ?
+    MF_KEY_UNLOCKED : parse_key_type(ab);
+  if (args.key_type == MF_INVALID_KEY_TYPE) {
+    printf("Invalid argument (A|B|unlocked): %s\n", ab);
+    return -1;
+  }
 
-mf_size_t parse_size_default(const char* str, mf_size_t default_size) {
-  if (str == NULL)
-    return default_size;
-  return parse_size(str);
+  if (strlen(template_str) >= sizeof(args.template_fn) ||
+      strlen(csv_str) >= sizeof(args.csv_fn)) {
+    printf("File name too long\n");
+    return -1;
+  }
+  strcpy(args.template_fn, template_str);
+  strcpy(args.csv_fn, csv_str);
+
+  // The blocks to update the MAC of
+  for (char* block_str = strtok_r(NULL, " ", &tok); block_str;
+       block_str = strtok_r(NULL, " ", &tok)) {
+    char* end;
+    unsigned long block = strtoul(block_str, &end, 16);
+    if (*end != '\0' || block == 0 || block > 0xff ||
+        is_trailer_block(block)) {
+      printf("Invalid data block [1,ff]: %s\n", block_str);
+      return -1;
+    }
+    if (args.mac_count == PERSO_MAX_MACS) {
+      printf("Too many blocks, the max is %d\n", PERSO_MAX_MACS);
+      return -1;
+    }
+    args.mac_blocks[args.mac_count++] = (unsigned int)block;
+  }
+
+  job_run("perso", job_perso, &args, sizeof(args));
+  return 0;
 }
 
-mf_key_type_t parse_key_type(const char* str) {
+int com_nonces_collect(char* arg) {
+  // Arg format: A|B #S file [#count]
 
-  if (str == NULL)
+  char* tok;
+  char* ab = strtok_r(arg, " ", &tok);
+  char* sector_str = strtok_r(NULL, " ", &tok);
+  char* file_str = strtok_r(NULL, " ", &tok);
+  char* count_str = strtok_r(NULL, " ", &tok);
+
+  if (!ab || !sector_str || !file_str) {
+    printf("Too few arguments: (A|B) #sector file [#count]\n");
+    return -1;
+  }
+
+  if (count_str && strtok_r(NULL, " ", &tok) != (char*)NULL) {
+    printf("Too many arguments\n");
+    return -1;
+  }
+
+  static job_args_t args;
+  args.key_type = parse_key_type(ab);
+  if (args.key_type == MF_INVALID_KEY_TYPE) {
+    printf("Invalid argument (A|B): %s\n", ab);
+    return -1;
+  }
+
+  long sector = parse_sector(sector_str);
+  if (sector < 0)
+    return -1;
+  args.sector = (size_t)sector;
+
+  if (strlen(file_str) >= sizeof(args.file_name)) {
+    printf("File name too long: %s\n", file_str);
+    return -1;
+  }
+  strcpy(args.file_name, file_str);
+
+  // Without a count, collect until cancelled
+  args.count = 0;
+  if (count_str) {
+    char* end;
+    args.count = strtoul(count_str, &end, 10);
+    if (*end != '\0' || args.count == 0) {
+      printf("Invalid count: %s\n", count_str);
+      return -1;
+    }
+  }
+
+  job_run("nonces collect", job_collect_nonces, &args, sizeof(args));
+  return 0;
+}
+
+int com_nonces_prng(char* arg) {
+  char* tok;
+  char* a = strtok_r(arg, " ", &tok);
+  if (a) {
+    printf("This command doesn't take any arguments\n");
+    return -1;
+  }
+
+  job_run("nonces prng", job_classify_prng, NULL, 0);
+  return 0;
+}
+
+int com_nonces_print(char* arg) {
+  FILE* file = nonce_file_open(arg);
+  if (file == NULL)
+    return -1;
+
+  printf("UID       xS  T  Nonce     Time (us)\n");
+  printf("----------------------------------------------\n");
+
+  nonce_record_t rec;
+  int res;
+  size_t count = 0;
+  while ((res = nonce_file_read(file, &rec)) == 1) {
+    printf("%08x  %02x  %c  %08x  %llu\n",
+           (unsigned int)rec.uid, (unsigned int)rec.sector, rec.key_type,
+           (unsigned int)rec.nt, (unsigned long long)rec.time_us);
+    ++count;
+  }
+
+  nonce_file_close(file);
+
+  if (res < 0)
+    printf("Truncated nonce file: %s\n", arg);
+  printf("%zu nonces\n", count);
+
+  return res < 0 ? -1 : 0;
+}
+
+int com_trace_decode(char* arg) {
+  // Arg format: trace [keys|-] [out]
+
+  char* tok;
+  char* fns[3] = { strtok_r(arg, " ", &tok), NULL, NULL };
+  if (fns[0])
+    fns[1] = strtok_r(NULL, " ", &tok);
+  if (fns[1])
+    fns[2] = strtok_r(NULL, " ", &tok);
+
+  if (!fns[0]) {
+    printf("Too few arguments: trace [keys|-] [out]\n");
+    return -1;
+  }
+  if (fns[2] && strtok_r(NULL, " ", &tok)) {
+    printf("Too many arguments\n");
+    return -1;
+  }
+
+  static trace_args_t args;
+  char* dst[3] = { args.trace_fn, args.keys_fn, args.out_fn };
+  for (int i = 0; i < 3; ++i) {
+    dst[i][0] = '\0';
+    if (!fns[i] || (i == 1 && strcmp(fns[i], "-") == 0))
+      continue;
+    if (strlen(fns[i]) >= sizeof(args.trace_fn)) {
+      printf("File name too long: %s\n", fns[i]);
+      return -1;
+    }
+    strcpy(dst[i], fns[i]);
+  }
+
+  job_run("trace decode", job_trace_decode, &args, sizeof(args));
+  return 0;
+}
+
+int com_crypto1_bench(char* arg) {
+  char* tok;
+  char* a = strtok_r(arg, " ", &tok);
+  if (a) {
+    printf("This command doesn't take any arguments\n");
+    return -1;
+  }
+
+  crypto1_bench();
+  return 0;
+}
+
+int com_retry_print(char* arg) {
+  retry_policy_print();
+  return 0;
+}
+
+int com_retry_set(char* arg) {
+  char* tok;
+  char* op_str = strtok_r(arg, " ", &tok);
+  char* n_str = strtok_r(NULL, " ", &tok);
+
+  if (!op_str || !n_str) {
+    printf("Too few arguments: (auth|read|write|backoff) #n\n");
+    return -1;
+  }
+
+  if (strtok_r(NULL, " ", &tok) != (char*)NULL) {
+    printf("Too many arguments\n");
+    return -1;
+  }
+
+  char* end;
+  long n = strtol(n_str, &end, 10);
+  if (*end != '\0' || n < 0 || n > 10000) {
+    printf("Invalid number [0,10000]: %s\n", n_str);
+    return -1;
+  }
+
+  if (strcasecmp(op_str, "backoff") == 0) {
+    retry_policy.backoff_ms = (int)n;
+    if (retry_policy.backoff_max_ms < retry_policy.backoff_ms)
+      retry_policy.backoff_max_ms = retry_policy.backoff_ms;
+    return 0;
+  }
+
+  retry_op_t op = retry_op_parse(op_str);
+  if (op == RETRY_OP_COUNT) {
+    printf("Invalid argument (auth|read|write|backoff): %s\n", op_str);
+    return -1;
+  }
+  retry_policy.budget[op] = (int)n;
+
+  return 0;
+}
+
+int com_retry_stats(char* arg) {
+  retry_stats_print();
+  return 0;
+}
+
+int com_trigger_print(char* arg) {
+  if (trigger_cmds[0] == '\0')
+    printf("No trigger commands set.\n");
+  else
+    printf("%s\n", trigger_cmds);
+  return 0;
+}
+
+int com_trigger_set(char* arg) {
+  if (check_no_job())
+    return -1;
+
+  if (!arg || *arg == '\0') {
+    printf("Too few arguments: cmd; cmd; ..\n");
+    return -1;
+  }
+
+  if (strlen(arg) >= TRIGGER_MAX) {
+    printf("Too long, the max is %d characters\n", TRIGGER_MAX - 1);
+    return -1;
+  }
+
+  // Check the commands now, rather than on the first tag
+  char cmds[TRIGGER_MAX];
+  char* tok;
+  strcpy(cmds, arg);
+  for (char* cmd = strtok_r(cmds, ";", &tok); cmd;
+       cmd = strtok_r(NULL, ";", &tok)) {
+    cmd = trim(cmd);
+    if (*cmd == '\0' || *cmd == '.')
+      continue;
+
+    command_t* command = find_command(cmd);
+    if (!command) {
+      printf("%s: No such command.\n", cmd);
+      return -1;
+    }
+    if (command->func == com_quit ||
+        strncmp(command->name, "trigger", 7) == 0) {
+      printf("%s: Can't be run on tag arrival.\n", command->name);
+      return -1;
+    }
+  }
+
+  strcpy(trigger_cmds, arg);
+  return 0;
+}
+
+int com_trigger_clear(char* arg) {
+  if (check_no_job())
+    return -1;
+
+  trigger_cmds[0] = '\0';
+  return 0;
+}
+
+int com_trigger_run(char* arg) {
+  char* tok;
+  char* a = strtok_r(arg, " ", &tok);
+  if (a) {
+    printf("This command doesn't take any arguments\n");
+    return -1;
+  }
+
+  if (trigger_cmds[0] == '\0') {
+    printf("No trigger commands set. See 'trigger set'.\n");
+    return -1;
+  }
+
+  job_run("trigger", job_trigger, NULL, 0);
+  return 0;
+}
+
+int com_jobs_print(char* arg) {
+  job_print();
+  return 0;
+}
+
+int com_jobs_cancel(char* arg) {
+  job_cancel();
+  return 0;
+}
+
+int job_read_tag(void* arg) {
+  job_args_t* args = (job_args_t*)arg;
+  int res = args->key_type == MF_KEY_UNLOCKED ?
+    mf_read_tag_unlocked(&current_tag, args->size) :
+    mf_read_tag(&current_tag, args->key_type);
+  if (res == 0)
+    current_tag_pages = 0;
+  return res;
+}
+
+int job_read_blocks(void* arg) {
+  job_args_t* args = (job_args_t*)arg;
+  int res = mf_read_blocks(&current_tag, args->blocks, args->block_count,
+                           args->key_type);
+  if (res)
+    return res;
+
+  current_tag_pages = 0;
+
+  // Show the field that was read
+  return exec_path_command(args->path);
+}
+
+int job_perso(void* arg) {
+  perso_args_t* args = (perso_args_t*)arg;
+  return perso_run(args->template_fn, args->csv_fn, args->key_type,
+                   args->mac_blocks, args->mac_count);
+}
+
+int job_clone(void* arg) {
+  job_args_t* args = (job_args_t*)arg;
+  return mf_clone(args->key_type);
+}
+
+int job_rekey(void* arg) {
+  job_args_t* args = (job_args_t*)arg;
+
+  // Loaded for each run, the file may change between tags
+  static mf_tag_t new_keys;
+  if (load_mfd(args->file_name, &new_keys))
+    return -1;
+
+  return mf_rekey(&new_keys, args->key_type);
+}
+
+int job_read_ultralight(void* arg) {
+  size_t pages;
+  int res = mf_read_ultralight(&current_tag, &pages);
+  if (res == 0)
+    current_tag_pages = pages;
+  return res;
+}
+
+int job_write_tag(void* arg) {
+  job_args_t* args = (job_args_t*)arg;
+  if (current_tag_pages) {
+    printf("The current tag is an Ultralight tag, not a Classic tag.\n");
+    return -1;
+  }
+  if (args->key_type == MF_KEY_UNLOCKED)
+    return mf_write_tag_unlocked(&current_tag, args->size);
+  return mf_write_tag(&current_tag, args->key_type);
+}
+
+int job_write_range(void* arg) {
+  job_args_t* args = (job_args_t*)arg;
+  if (current_tag_pages) {
+    printf("The current tag is an Ultralight tag, not a Classic tag.\n");
+    return -1;
+  }
+
+  size_t first_bit, bits;
+  if (parse_path_range(args->path, &first_bit, &bits))
+    return -1;
+  return mf_write_range(&current_tag, first_bit, bits, args->key_type);
+}
+
+int job_test_auth(void* arg) {
+  job_args_t* args = (job_args_t*)arg;
+  return mf_test_auth(&current_auth, args->size, args->key_type);
+}
+
+int job_dict_check(void* arg) {
+  crack_args_t* args = (crack_args_t*)arg;
+
+  uint64_t hits[CRACK_MAX_HITS];
+  int count = crack_dictionary(&args->auths[0], hits);
+  if (count < 0) {
+    printf("Dictionary check cancelled.\n");
+    return -1;
+  }
+  if (count == 0) {
+    printf("No dictionary key matches the authentication.\n");
+    return -1;
+  }
+
+  // Only the candidates are tried on the tag
+  uint8_t keys[CRACK_MAX_HITS][6];
+  for (int i = 0; i < count; ++i) {
+    crack_num_to_key(hits[i], keys[i]);
+    printf("Candidate key: %s\n", sprint_key(keys[i]));
+  }
+
+  return mf_verify_keys(args->auths[0].uid, args->sector, keys[0],
+                        (size_t)count, args->key_type);
+}
+
+int job_keys_nested(void* arg) {
+  job_args_t* args = (job_args_t*)arg;
+  return mf_nested(args->sector, args->key_type);
+}
+
+int job_keys_hardnested(void* arg) {
+  hardnested_args_t* args = (hardnested_args_t*)arg;
+  return mf_hardnested(args->sector, args->key_type,
+                       args->target_sector, args->target_type);
+}
+
+int job_keys_darkside(void* arg) {
+  job_args_t* args = (job_args_t*)arg;
+  return mf_darkside(args->sector, args->key_type);
+}
+
+int job_keys_static(void* arg) {
+  job_args_t* args = (job_args_t*)arg;
+  return mf_static_nested(args->sector, args->key_type);
+}
+
+int job_dict_index(void* arg) {
+  ksindex_args_t* args = (ksindex_args_t*)arg;
+  if (!args->offline)
+    return mf_dict_index();
+
+  ksindex_t index;
+  if (ksindex_get(&index, args->uid, args->nt))
+    return -1;
+  ksindex_free(&index);
+  return 0;
+}
+
+int job_trace_decode(void* arg) {
+  trace_args_t* args = (trace_args_t*)arg;
+
+  static mf_tag_t keys;
+  const mf_tag_t* tag = &current_auth;
+  if (args->keys_fn[0]) {
+    if (load_mfd(args->keys_fn, &keys))
+      return -1;
+    tag = &keys;
+  }
+
+  FILE* out = stdout;
+  if (args->out_fn[0] && (out = trace_file_create(args->out_fn)) == NULL)
+    return -1;
+
+  int res = trace_decode(args->trace_fn, tag, out);
+  if (out != stdout)
+    trace_file_close(out);
+  if (res && job_cancelled())
+    printf("Trace decoding cancelled.\n");
+  return res;
+}
+
+int job_keys_recover(void* arg) {
+  crack_args_t* args = (crack_args_t*)arg;
+  if (crack_args_trace(args))
+    return -1;
+
+  uint64_t hits[CRACK_MAX_HITS];
+  int count = crack_recover(args->auths, args->count, hits);
+  if (count < 0) {
+    printf(job_cancelled() ? "Key recovery cancelled.\n" :
+           "Key recovery failed!\n");
+    return -1;
+  }
+  return crack_args_result(args, hits, count);
+}
+
+int job_keys_brute(void* arg) {
+  crack_args_t* args = (crack_args_t*)arg;
+  if (crack_args_trace(args))
+    return -1;
+
+  bruteforce_t* bf = malloc(sizeof(bruteforce_t));
+  if (bf == NULL) {
+    printf("Out of memory.\n");
+    return -1;
+  }
+  bf->sector = args->sector;
+  bf->key_type = args->key_type;
+  bf->value = args->value;
+  bf->mask = args->mask;
+  memcpy(bf->auths, args->auths, sizeof(bf->auths));
+  bf->count = args->count;
+
+  uint64_t hits[CRACK_MAX_HITS];
+  int count = bruteforce_search(bf, hits);
+  free(bf);
+  if (count < 0) {
+    printf(job_cancelled() ? "Brute force cancelled.\n" :
+           "Brute force failed!\n");
+    return -1;
+  }
+  return crack_args_result(args, hits, count);
+}
+
+int crack_args_trace(crack_args_t* args) {
+  if (args->file_name[0] == '\0')
+    return 0;
+
+  int n = trace_find_auths(args->file_name, args->key_type, args->sector,
+                           args->auths, CRACK_MAX_AUTHS);
+  if (n < 0)
+    return -1;
+
+  // Only the authentications to the same tag as the first one
+  args->count = 0;
+  for (int i = 0; i < n; ++i)
+    if (args->auths[i].uid == args->auths[0].uid)
+      args->auths[args->count++] = args->auths[i];
+  printf("Found %zu authentication(s) to sector 0x%02zx in the trace.\n",
+         args->count, args->sector);
+  return 0;
+}
+
+int crack_args_result(const crack_args_t* args, const uint64_t* hits,
+                      int count) {
+  if (count == 0) {
+    printf("No key fits the authentications.\n");
+    return -1;
+  }
+
+  uint8_t key[6];
+  if (count > 1) {
+    for (int i = 0; i < count; ++i) {
+      crack_num_to_key(hits[i], key);
+      printf("Candidate key: %s\n", sprint_key(key));
+    }
+    printf("More authentications are needed to tell the keys apart.\n");
+    return -1;
+  }
+
+  crack_num_to_key(hits[0], key);
+  key_to_tag(&current_auth, key, args->key_type,
+             sector_to_trailer(args->sector));
+  printf("Sector 0x%02zx key %c: %s (set in the current keys)\n",
+         args->sector, args->key_type == MF_KEY_A ? 'A' : 'B',
+         sprint_key(key));
+  return 0;
+}
+
+int job_dict_attack(void* arg) {
+  job_args_t* args = (job_args_t*)arg;
+  return mf_dictionary_attack(&current_auth, args->resume);
+}
+
+int job_value_batch(void* arg) {
+  value_args_t* args = (value_args_t*)arg;
+  return mf_value_batch(args->ops, args->count, args->key_type);
+}
+
+int job_batch(void* arg) {
+  job_args_t* args = (job_args_t*)arg;
+  return mf_batch(args->batch_op, args->key_type, args->file_name);
+}
+
+int job_collect_nonces(void* arg) {
+  job_args_t* args = (job_args_t*)arg;
+  return mf_collect_nonces(args->file_name, args->sector,
+                           args->key_type, args->count);
+}
+
+int job_classify_prng(void* arg) {
+  (void)arg;
+  return mf_classify_prng();
+}
+
+// Run the trigger commands each time a tag arrives. The device is
+// kept open, so the commands don't have to connect. In the commands,
+// %u is replaced by the tag UID, e.g. 'save %u.mfd'.
+int job_trigger(void* arg) {
+  char uid[21];
+  char cmds[TRIGGER_MAX];
+  char line[TRIGGER_MAX + 32];
+  size_t count = 0;
+
+  if (mf_hold_device())
+    return -1;
+
+  printf("Waiting for tags. Stop with Ctrl-C or 'jobs cancel'.\n");
+
+  while (mf_wait_for_arrival(uid) == 0) {
+    printf("Tag %s arrived (%zu)\n", uid, ++count);
+
+    // Split by hand; the commands use strtok_r themselves
+    strcpy(cmds, trigger_cmds);
+    for (char *cmd = cmds, *next; cmd; cmd = next) {
+      next = strchr(cmd, ';');
+      if (next)
+        *next++ = '\0';
+
+      // Expand %u to the UID
+      size_t len = 0;
+      for (const char* c = trim(cmd); *c && len < sizeof(line) - 21; ++c) {
+        if (c[0] == '%' && c[1] == 'u') {
+          len += (size_t)sprintf(line + len, "%s", uid);
+          ++c;
+        }
+        else
+          line[len++] = *c;
+      }
+      line[len] = '\0';
+
+      if (len == 0)
+        continue;
+      printf("$ %s\n", line);
+      execute_line(line);
+
+      if (job_cancelled())
+        break;
+    }
+
+    if (job_cancelled() || mf_wait_for_removal() != 0)
+      break;
+    printf("Tag removed.\n");
+  }
+
+  printf("Handled %zu tags.\n", count);
+  mf_release_device();
+  return 0;
+}
+
+int job_watch(void* arg) {
+  job_args_t* args = (job_args_t*)arg;
+  return mf_watch(&current_tag, args->blocks, args->block_count, args->key_type);
+}
+
+int check_no_job() {
+  if (job_busy()) {
+    printf("Not while a job is running. See 'jobs'.\n");
+    return -1;
+  }
+  return 0;
+}
+
+int block_cmp(const void* a, const void* b) {
+  size_t x = *(const size_t*)a;
+  size_t y = *(const size_t*)b;
+  return x < y ? -1 : x > y;
+}
+
+long parse_sector(const char* str) {
+  char* end;
+  long int sector = strtol(str, &end, 16);
+  if (*end != '\0') {
+    printf("Invalid sector character (non hex): %s\n", end);
+    return -1;
+  }
+  if (sector < 0 || sector > 0x27) {
+    printf("Invalid sector [0,27]: %lx\n", sector);
+    return -1;
+  }
+  return sector;
+}
+
+int parse_word(const char* str, uint32_t* word) {
+  char* end;
+  unsigned long value = strtoul(str, &end, 16);
+  if (*end != '\0' || end - str > 8 || end == str) {
+    printf("Invalid 32 bit hex word: %s\n", str);
+    return -1;
+  }
+  *word = (uint32_t)value;
+  return 0;
+}
+
+int parse_auth(crack_auth_t* auth, char** tok) {
+  uint32_t* words[] = {
+    &auth->uid, &auth->nt, &auth->nr_enc, &auth->ar_enc, &auth->at_enc };
+
+  int count = 0;
+  char* str;
+  while ((str = strtok_r(NULL, " ", tok)) != NULL) {
+    if (count == 5) {
+      printf("Too many arguments\n");
+      return -1;
+    }
+    if (parse_word(str, words[count]))
+      return -1;
+    ++count;
+  }
+
+  if (count < 4) {
+    printf("Too few arguments: uid nt nr ar [at]\n");
+    return -1;
+  }
+  auth->has_at = count == 5;
+  return 0;
+}
+
+int parse_trace_or_auths(char* str, crack_args_t* args) {
+  // A single argument is a trace file
+  args->file_name[0] = '\0';
+  args->count = 0;
+  if (strchr(str, ' ') == NULL) {
+    if (strlen(str) >= sizeof(args->file_name)) {
+      printf("File name too long: %s\n", str);
+      return -1;
+    }
+    strcpy(args->file_name, str);
+    return 0;
+  }
+  return parse_auths(str, args->auths, &args->count);
+}
+
+int parse_auths(char* str, crack_auth_t* auths, size_t* count) {
+  char* tok;
+  uint32_t words[1 + 4 * CRACK_MAX_AUTHS];
+  size_t n = 0;
+  for (char* w = strtok_r(str, " ", &tok); w; w = strtok_r(NULL, " ", &tok)) {
+    if (n == sizeof(words) / sizeof(words[0])) {
+      printf("Too many arguments\n");
+      return -1;
+    }
+    if (parse_word(w, &words[n]))
+      return -1;
+    ++n;
+  }
+
+  memset(auths, 0, CRACK_MAX_AUTHS * sizeof(crack_auth_t));
+  if (n == 4 || n == 5) {
+    // One authentication, with or without the tag answer
+    auths[0].uid = words[0];
+    auths[0].nt = words[1];
+    auths[0].nr_enc = words[2];
+    auths[0].ar_enc = words[3];
+    auths[0].at_enc = n == 5 ? words[4] : 0;
+    auths[0].has_at = n == 5;
+    *count = 1;
+    return 0;
+  }
+
+  if (n < 7 || (n - 1) % 3 != 0 || (n - 1) / 3 > CRACK_MAX_AUTHS) {
+    printf("Expected: uid nt nr ar [at] | uid nt nr ar nt nr ar ..\n");
+    return -1;
+  }
+
+  *count = (n - 1) / 3;
+  for (size_t i = 0; i < *count; ++i) {
+    auths[i].uid = words[0];
+    auths[i].nt = words[1 + 3 * i];
+    auths[i].nr_enc = words[2 + 3 * i];
+    auths[i].ar_enc = words[3 + 3 * i];
+  }
+  return 0;
+}
+
+mf_size_t parse_size(const char* str) {
+
+  if (str == NULL)
+    return MF_INVALID_SIZE;
+
+  if (strcasecmp(str, "1k") == 0)
+    return MF_1K;
+
+  if (strcasecmp(str, "4k") == 0)
+    return MF_4K;
+
+  return MF_INVALID_SIZE;
+}
+
+mf_size_t parse_size_default(const char* str, mf_size_t default_size) {
+  if (str == NULL)
+    return default_size;
+  return parse_size(str);
+}
+
+mf_key_type_t parse_key_type(const char* str) {
+
+  if (str == NULL)
     return MF_INVALID_KEY_TYPE;
 
   if (strcasecmp(str, "a") == 0)
@@ -791,6 +2474,45 @@ mf_key_type_t parse_key_type_default(const char* str,
   return parse_key_type(str);
 }
 
+int parse_path_range(const char* path, size_t* first_bit, size_t* bits) {
+
+  instance_t* inst = parse_spec_path(path);
+  if (inst == NULL) {
+    printf("Invalid Path\n");
+    return -1;
+  }
+
+  *first_bit = inst->offset_bytes * 8 + inst->offset_bits;
+  *bits = inst->size_bytes * 8 + inst->size_bits;
+  if (*bits == 0) {
+    printf("Empty field: %s\n", path);
+    return -1;
+  }
+
+  if (*first_bit + *bits > MF_4K * 8) {
+    printf("The field is outside the tag: %s\n", path);
+    return -1;
+  }
+
+  return 0;
+}
+
+int parse_path_blocks(const char* path, size_t* blocks, size_t* count) {
+
+  size_t first_bit, bits;
+  if (parse_path_range(path, &first_bit, &bits))
+    return -1;
+
+  size_t first_block = first_bit / 8 / sizeof(mf_block_t);
+  size_t last_block = (first_bit + bits - 1) / 8 / sizeof(mf_block_t);
+
+  *count = 0;
+  for (size_t block = first_block; block <= last_block; ++block)
+    blocks[(*count)++] = block;
+
+  return 0;
+}
+
 // Any command starting with '.' - path spec
 int exec_path_command(const char *line) {
 
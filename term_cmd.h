@@ -38,8 +38,16 @@ int com_clear_tag(char* arg);
 // Read/Write tag NFC operations
 int com_read_tag(char* arg);
 int com_read_tag_unlocked(char* arg);
+int com_read_ultralight(char* arg);
+int com_clone(char* arg);
+int com_rekey(char* arg);
 int com_write_tag(char* arg);
 int com_write_tag_unlocked(char* arg);
+int com_watch(char* arg);
+
+// Value block operations
+int com_value(char* arg);
+int com_value_print(char* arg);
 
 // Tag print commands
 int com_print(char* arg);
@@ -59,12 +67,26 @@ int com_keys_set(char* arg);
 int com_keys_import(char* arg);
 int com_keys_print(char* arg);
 int com_keys_test(char* arg);
+int com_keys_recover(char* arg);
+int com_keys_brute(char* arg);
+int com_keys_nested(char* arg);
+int com_keys_hardnested(char* arg);
+int com_keys_darkside(char* arg);
+int com_keys_static(char* arg);
 
 // Dictionary operations
 int com_dict_load(char* arg);
 int com_dict_clear(char* arg);
 int com_dict_attack(char* arg);
+int com_dict_attack_resume(char* arg);
 int com_dict_print(char* arg);
+int com_dict_check(char* arg);
+int com_dict_index(char* arg);
+
+// Batch operations on all tags in the field
+int com_batch_read(char* arg);
+int com_batch_attack(char* arg);
+int com_batch_write(char* arg);
 
 // Specification operations
 int com_spec_load(char* arg);
@@ -77,6 +99,33 @@ int com_mac_block_compute(char* arg);
 int com_mac_block_update(char* arg);
 int com_mac_validate(char* arg);
 
+// Batch personalization
+int com_perso(char* arg);
+
+// Nonce collection
+int com_nonces_collect(char* arg);
+int com_nonces_print(char* arg);
+int com_nonces_prng(char* arg);
+
+// Offline Crypto1
+int com_crypto1_bench(char* arg);
+int com_trace_decode(char* arg);
+
+// RF error retry policy
+int com_retry_print(char* arg);
+int com_retry_set(char* arg);
+int com_retry_stats(char* arg);
+
+// Commands run on tag arrival
+int com_trigger_print(char* arg);
+int com_trigger_set(char* arg);
+int com_trigger_clear(char* arg);
+int com_trigger_run(char* arg);
+
+// Job operations
+int com_jobs_print(char* arg);
+int com_jobs_cancel(char* arg);
+
 typedef struct {
   char *name;       // The command
   cmd_func_t func;  // Function to call on command
@@ -0,0 +1,678 @@
+/**
+ * Copyright (C) 2011 Anders Sundman <anders@4zm.org>
+ *
+ * This file is part of mfterm.
+ *
+ * mfterm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mfterm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mfterm.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <ctype.h>
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+#include "crypto1.h"
+#include "parallel.h"
+#include "trace.h"
+
+// Size of the read buffer, to stream through large traces
+#define TRACE_FILE_BUFFER (1024 * 1024)
+
+// Longest line: R/T and a frame with spaces
+#define TRACE_MAX_LINE (4 + 3 * TRACE_MAX_FRAME)
+
+FILE* trace_file_open(const char* fn) {
+  FILE* file = fopen(fn, "r");
+  if (file == NULL) {
+    printf("Could not open file: %s\n", fn);
+    return NULL;
+  }
+  setvbuf(file, NULL, _IOFBF, TRACE_FILE_BUFFER);
+  return file;
+}
+
+FILE* trace_file_create(const char* fn) {
+  FILE* file = fopen(fn, "w");
+  if (file == NULL) {
+    printf("Could not open file: %s\n", fn);
+    return NULL;
+  }
+  setvbuf(file, NULL, _IOFBF, TRACE_FILE_BUFFER);
+  return file;
+}
+
+static int hex_value(char c) {
+  if (c >= '0' && c <= '9')
+    return c - '0';
+  c = (char)tolower(c);
+  if (c >= 'a' && c <= 'f')
+    return c - 'a' + 10;
+  return -1;
+}
+
+// Parse the hex bytes after R/T. Return false if there is anything else.
+static bool trace_parse_bytes(const char* str, trace_frame_t* frame) {
+  frame->len = 0;
+  while (*str) {
+    if (isspace((unsigned char)*str)) {
+      ++str;
+      continue;
+    }
+    int high = hex_value(str[0]);
+    int low = str[1] ? hex_value(str[1]) : -1;
+    if (high < 0 || low < 0 || frame->len == TRACE_MAX_FRAME)
+      return false;
+    frame->data[frame->len++] = (uint8_t)(high << 4 | low);
+    str += 2;
+  }
+  return frame->len > 0;
+}
+
+int trace_file_read(FILE* file, trace_frame_t* frame) {
+  char line[TRACE_MAX_LINE + 2];
+
+  while (fgets(line, sizeof(line), file)) {
+    size_t len = strlen(line);
+    if (len == sizeof(line) - 1 && line[len - 1] != '\n') {
+      printf("Trace line too long: %.20s...\n", line);
+      return -1;
+    }
+
+    char* str = line;
+    while (isspace((unsigned char)*str))
+      ++str;
+    if (*str == '\0' || *str == '#')
+      continue;
+
+    char dir = (char)toupper(*str);
+    if ((dir != 'R' && dir != 'T') ||
+        !trace_parse_bytes(str + 1, frame)) {
+      printf("Invalid trace line: %s", str);
+      return -1;
+    }
+    frame->reader = dir == 'R';
+    return 1;
+  }
+
+  return ferror(file) ? -1 : 0;
+}
+
+void trace_file_close(FILE* file) {
+  fclose(file);
+}
+
+static uint32_t trace_word(const uint8_t* data) {
+  return (uint32_t)data[0] << 24 | (uint32_t)data[1] << 16 |
+    (uint32_t)data[2] << 8 | data[3];
+}
+
+static bool trace_is_select(const trace_frame_t* frame) {
+  const uint8_t* d = frame->data;
+  return frame->reader && frame->len == 9 &&
+    (d[0] == 0x93 || d[0] == 0x95 || d[0] == 0x97) && d[1] == 0x70;
+}
+
+// A REQA/WUPA or select starts over
+static bool trace_is_reset(const trace_frame_t* frame) {
+  return (frame->reader && frame->len == 1 &&
+          (frame->data[0] == 0x26 || frame->data[0] == 0x52)) ||
+    trace_is_select(frame);
+}
+
+// Where trace_find_auths is in an authentication
+typedef enum {
+  AUTH_IDLE,     // Waiting for an auth command
+  AUTH_CMD,      // Got the command, waiting for the tag nonce
+  AUTH_NT,       // Waiting for the reader nonce and answer
+  AUTH_AR,       // Waiting for the tag answer
+  AUTH_SESSION   // Encrypted, until the tag is selected again
+} auth_state_t;
+
+int trace_find_auths(const char* fn, mf_key_type_t key_type, size_t sector,
+                     crack_auth_t* auths, size_t max) {
+  FILE* file = trace_file_open(fn);
+  if (file == NULL)
+    return -1;
+
+  auth_state_t state = AUTH_IDLE;
+  uint32_t uid = 0;
+  crack_auth_t cur;
+  bool wanted = false;  // The key type and sector asked for
+  size_t count = 0;
+  trace_frame_t frame;
+  int res = 0;
+
+  while (count < max && (res = trace_file_read(file, &frame)) == 1) {
+    const uint8_t* d = frame.data;
+
+    // A REQA/WUPA or select starts over; the select has the UID
+    if (trace_is_reset(&frame)) {
+      if (trace_is_select(&frame))
+        uid = trace_word(d + 2);
+      if (state == AUTH_AR && wanted)
+        auths[count++] = cur;
+      state = AUTH_IDLE;
+      continue;
+    }
+
+    switch (state) {
+    case AUTH_IDLE:
+      if (frame.reader && frame.len == 4 &&
+          (d[0] == MC_AUTH_A || d[0] == MC_AUTH_B)) {
+        memset(&cur, 0, sizeof(cur));
+        cur.uid = uid;
+        wanted = (d[0] == MC_AUTH_A ? MF_KEY_A : MF_KEY_B) == key_type &&
+          block_to_sector(d[1]) == sector;
+        state = AUTH_CMD;
+      }
+      break;
+
+    case AUTH_CMD:
+      state = AUTH_IDLE;
+      if (!frame.reader && frame.len == 4) {
+        cur.nt = trace_word(d);
+        state = AUTH_NT;
+      }
+      break;
+
+    case AUTH_NT:
+      state = AUTH_IDLE;
+      if (frame.reader && frame.len == 8) {
+        cur.nr_enc = trace_word(d);
+        cur.ar_enc = trace_word(d + 4);
+        state = AUTH_AR;
+      }
+      break;
+
+    case AUTH_AR:
+      if (!frame.reader && frame.len == 4) {
+        cur.at_enc = trace_word(d);
+        cur.has_at = true;
+      }
+      if (wanted)
+        auths[count++] = cur;
+      state = AUTH_SESSION;
+      break;
+
+    case AUTH_SESSION:
+      break;
+    }
+  }
+
+  if (count < max && state == AUTH_AR && wanted)
+    auths[count++] = cur;
+
+  trace_file_close(file);
+  return res < 0 ? -1 : (int)count;
+}
+
+// Where trace_decode is in a session
+typedef enum {
+  DECODE_PLAIN,    // Not authenticated
+  DECODE_CMD,      // Got an auth command, waiting for the tag nonce
+  DECODE_NT,       // Waiting for the reader nonce and answer
+  DECODE_AR,       // Waiting for the tag answer
+  DECODE_SESSION,  // Encrypted
+  DECODE_LOST      // Encrypted with a key that doesn't fit
+} decode_state_t;
+
+// The frames read at a time. The sessions in them (from one REQA,
+// WUPA or select to the next) are decoded on all cores.
+#define DECODE_BLOCK (1 << 16)
+
+// The sessions handed to a thread at a time
+#define DECODE_CHUNK 64
+
+// The column of the notes; the longest usual frame is a block and CRC
+#define DECODE_NOTE_COLUMN (2 + 3 * 18)
+
+typedef struct {
+  FILE* out;
+  const mf_tag_t* keys;
+  decode_state_t state;
+  uint32_t uid;
+  crypto1_state_t cipher;
+  uint32_t nt;
+  bool nested;           // The auth command was sent encrypted
+  uint8_t cmd;           // The last reader command and its block
+  uint8_t block;
+  bool expect_operand;   // The command is followed by data after an ACK
+  bool operand;          // The next reader frame is that data
+  size_t auths;
+  size_t wrong_keys;
+} trace_decoder_t;
+
+// The CRC_A of ISO 14443-3, low byte first after the data
+static bool trace_crc_ok(const uint8_t* data, size_t len) {
+  if (len < 3)
+    return false;
+  uint16_t crc = 0x6363;
+  for (size_t i = 0; i < len - 2; ++i) {
+    uint8_t b = (uint8_t)(data[i] ^ crc);
+    b = (uint8_t)(b ^ b << 4);
+    crc = (uint16_t)(crc >> 8 ^ b << 8 ^ b << 3 ^ b >> 4);
+  }
+  return data[len - 2] == (crc & 0xff) && data[len - 1] == crc >> 8;
+}
+
+static const char* trace_cmd_name(uint8_t cmd) {
+  switch (cmd) {
+  case MC_AUTH_A: return "AUTH-A";
+  case MC_AUTH_B: return "AUTH-B";
+  case MC_READ: return "READ";
+  case MC_WRITE: return "WRITE";
+  case MC_TRANSFER: return "TRANSFER";
+  case MC_DECREMENT: return "DECREMENT";
+  case MC_INCREMENT: return "INCREMENT";
+  case MC_STORE: return "STORE";
+  case 0x50: return "HALT";
+  default: return NULL;
+  }
+}
+
+// Write a frame and a note after it. The line is put together in a
+// buffer; a decoded trace can be large.
+static void decode_write(trace_decoder_t* d, bool reader, const uint8_t* data,
+                         size_t len, const char* fmt, ...) {
+  static const char hex[] = "0123456789abcdef";
+  char line[TRACE_MAX_LINE + 128];
+  size_t n = 0;
+  line[n++] = reader ? 'R' : 'T';
+  for (size_t i = 0; i < len; ++i) {
+    line[n++] = ' ';
+    line[n++] = hex[data[i] >> 4];
+    line[n++] = hex[data[i] & 0xf];
+  }
+  if (fmt) {
+    do
+      line[n++] = ' ';
+    while (n < DECODE_NOTE_COLUMN);
+    line[n++] = '#';
+    line[n++] = ' ';
+    va_list ap;
+    va_start(ap, fmt);
+    int note = vsnprintf(line + n, sizeof(line) - n - 1, fmt, ap);
+    va_end(ap);
+    if (note > 0)
+      n += (size_t)note < sizeof(line) - n - 1 ? (size_t)note :
+        sizeof(line) - n - 2;
+  }
+  line[n++] = '\n';
+  fwrite(line, 1, n, d->out);
+}
+
+// Start an authentication; the command is in plain text
+static void decode_auth_cmd(trace_decoder_t* d, const uint8_t* cmd,
+                            bool nested) {
+  d->nested = nested;
+  d->cmd = cmd[0];
+  d->block = cmd[1];
+  d->state = DECODE_CMD;
+}
+
+static void decode_frame(trace_decoder_t* d, const trace_frame_t* frame);
+
+static void decode_auth(trace_decoder_t* d, const trace_frame_t* frame) {
+  const uint8_t* data = frame->data;
+  mf_key_type_t key_type = d->cmd == MC_AUTH_A ? MF_KEY_A : MF_KEY_B;
+  char ab = key_type == MF_KEY_A ? 'A' : 'B';
+  // Not key_from_tag; the sessions are decoded on several threads
+  const mifare_classic_block_trailer* trailer =
+    &d->keys->amb[block_to_trailer(d->block)].mbt;
+  uint64_t key = crack_key_to_num(key_type == MF_KEY_A ? trailer->abtKeyA :
+                                  trailer->abtKeyB);
+
+  switch (d->state) {
+  case DECODE_CMD:
+    if (frame->reader || frame->len != 4)
+      break;
+    d->nt = trace_word(data);
+    crypto1_init(&d->cipher, key);
+    if (d->nested) {
+      d->nt ^= crypto1_word(&d->cipher, d->uid ^ d->nt, true);
+      decode_write(d, false, data, 4, "{nt}, nt %08x", (unsigned int)d->nt);
+    }
+    else {
+      crypto1_word(&d->cipher, d->uid ^ d->nt, false);
+      decode_write(d, false, data, 4, "nt %08x", (unsigned int)d->nt);
+    }
+    d->state = DECODE_NT;
+    return;
+
+  case DECODE_NT: {
+    if (!frame->reader || frame->len != 8)
+      break;
+    uint32_t nr_enc = trace_word(data);
+    uint32_t nr = nr_enc ^ crypto1_word(&d->cipher, nr_enc, true);
+    uint32_t ar = trace_word(data + 4) ^ crypto1_word(&d->cipher, 0, false);
+    ++d->auths;
+    if (ar != prng_successor(d->nt, 64)) {
+      ++d->wrong_keys;
+      decode_write(d, true, data, 8, "{nr}{ar}, wrong key %c of sector "
+                   "%02zx (%012llx)", ab, block_to_sector(d->block),
+                   (unsigned long long)key);
+      d->state = DECODE_LOST;
+      return;
+    }
+    decode_write(d, true, data, 8, "{nr}{ar}, nr %08x, ar ok",
+                 (unsigned int)nr);
+    d->state = DECODE_AR;
+    return;
+  }
+
+  case DECODE_AR: {
+    d->state = DECODE_SESSION;
+    d->operand = d->expect_operand = false;
+    if (frame->reader || frame->len != 4) {
+      // No tag answer recorded
+      decode_frame(d, frame);
+      return;
+    }
+    uint32_t at = trace_word(data) ^ crypto1_word(&d->cipher, 0, false);
+    decode_write(d, false, data, 4, "{at}, %s, key %c of sector %02zx "
+                 "(%012llx)", at == prng_successor(d->nt, 96) ? "at ok" :
+                 "at wrong", ab, block_to_sector(d->block),
+                 (unsigned long long)key);
+    return;
+  }
+
+  default:
+    break;
+  }
+
+  // Not the frame the authentication needs: the tag didn't go along
+  decode_write(d, frame->reader, data, frame->len, "%s",
+               d->nested ? "not decrypted, nested auth broken off" :
+               "auth broken off");
+  d->state = d->nested ? DECODE_LOST : DECODE_PLAIN;
+}
+
+static void decode_session(trace_decoder_t* d, const trace_frame_t* frame) {
+  uint8_t plain[TRACE_MAX_FRAME];
+
+  if (!frame->reader && frame->len == 1) {
+    // A 4 bit answer
+    uint8_t ks = 0;
+    for (int i = 0; i < 4; ++i)
+      ks |= (uint8_t)(crypto1_bit(&d->cipher, 0, false) << i);
+    plain[0] = (frame->data[0] ^ ks) & 0xf;
+    if (plain[0] == 0xa) {
+      d->operand = d->expect_operand;
+      d->expect_operand = false;
+      decode_write(d, false, plain, 1, "ACK");
+    }
+    else {
+      d->expect_operand = d->operand = false;
+      decode_write(d, false, plain, 1, "NACK");
+    }
+    return;
+  }
+
+  crypto1_decrypt(&d->cipher, frame->data, plain, NULL, frame->len);
+  const char* crc = trace_crc_ok(plain, frame->len) ? "" : ", bad CRC";
+
+  if (!frame->reader) {
+    if (d->cmd == MC_READ && frame->len == 18)
+      decode_write(d, false, plain, frame->len, "block %02x data%s",
+                   d->block, crc);
+    else if (crc[0])
+      decode_write(d, false, plain, frame->len, "bad CRC");
+    else
+      decode_write(d, false, plain, frame->len, NULL);
+    return;
+  }
+
+  if (d->operand) {
+    d->operand = false;
+    decode_write(d, true, plain, frame->len, "%s data, block %02x%s",
+                 trace_cmd_name(d->cmd), d->block, crc);
+    return;
+  }
+
+  const char* name = frame->len == 4 ? trace_cmd_name(plain[0]) : NULL;
+  if (name == NULL) {
+    decode_write(d, true, plain, frame->len, "unknown command%s", crc);
+    return;
+  }
+
+  if (plain[0] == MC_AUTH_A || plain[0] == MC_AUTH_B) {
+    decode_write(d, true, plain, 4, "%s block %02x, sector %02zx, nested%s",
+                 name, plain[1], block_to_sector(plain[1]), crc);
+    decode_auth_cmd(d, plain, true);
+    return;
+  }
+
+  if (plain[0] == 0x50) {
+    decode_write(d, true, plain, 4, "%s%s", name, crc);
+    return;
+  }
+
+  d->cmd = plain[0];
+  d->block = plain[1];
+  d->expect_operand = plain[0] == MC_WRITE || plain[0] == MC_INCREMENT ||
+    plain[0] == MC_DECREMENT || plain[0] == MC_STORE;
+  decode_write(d, true, plain, 4, "%s block %02x%s", name, plain[1], crc);
+}
+
+static void decode_frame(trace_decoder_t* d, const trace_frame_t* frame) {
+  const uint8_t* data = frame->data;
+
+  if (trace_is_select(frame)) {
+    d->uid = trace_word(data + 2);
+    decode_write(d, true, data, 9, "SELECT %08x", (unsigned int)d->uid);
+    d->state = DECODE_PLAIN;
+    return;
+  }
+  if (trace_is_reset(frame)) {
+    decode_write(d, true, data, 1, data[0] == 0x26 ? "REQA" : "WUPA");
+    d->state = DECODE_PLAIN;
+    return;
+  }
+
+  switch (d->state) {
+  case DECODE_PLAIN: {
+    const char* name = frame->reader && frame->len == 4 ?
+      trace_cmd_name(data[0]) : NULL;
+    if (name == NULL) {
+      decode_write(d, frame->reader, data, frame->len, NULL);
+      return;
+    }
+    if (data[0] == MC_AUTH_A || data[0] == MC_AUTH_B) {
+      decode_write(d, true, data, 4, "%s block %02x, sector %02zx", name,
+                   data[1], block_to_sector(data[1]));
+      decode_auth_cmd(d, data, false);
+      return;
+    }
+    decode_write(d, true, data, 4, "%s", name);
+    return;
+  }
+
+  case DECODE_CMD:
+  case DECODE_NT:
+  case DECODE_AR:
+    decode_auth(d, frame);
+    return;
+
+  case DECODE_SESSION:
+    decode_session(d, frame);
+    return;
+
+  case DECODE_LOST:
+    decode_write(d, frame->reader, data, frame->len, "not decrypted");
+    return;
+  }
+}
+
+// A session of a block of frames
+typedef struct {
+  size_t begin;
+  size_t end;
+  uint32_t uid;   // From the last select before it
+} decode_session_t;
+
+// The decoding of a block, shared by the threads. The first session
+// goes on from the end of the last block.
+typedef struct {
+  const mf_tag_t* keys;
+  const trace_frame_t* frames;
+  const decode_session_t* sessions;
+  size_t count;
+  const trace_decoder_t* carry;
+  trace_decoder_t next_carry;
+  char* text[DECODE_BLOCK / DECODE_CHUNK + 1];  // The output of each chunk
+  size_t text_len[DECODE_BLOCK / DECODE_CHUNK + 1];
+  pthread_mutex_t mutex;
+  size_t auths;
+  size_t wrong_keys;
+} decode_run_t;
+
+static bool decode_chunk(size_t begin, size_t end, void* arg) {
+  decode_run_t* run = (decode_run_t*)arg;
+  size_t slot = begin / DECODE_CHUNK;
+  FILE* out = open_memstream(&run->text[slot], &run->text_len[slot]);
+  if (out == NULL) {
+    printf("Out of memory.\n");
+    return false;
+  }
+
+  size_t auths = 0, wrong_keys = 0;
+  for (size_t i = begin; i < end; ++i) {
+    const decode_session_t* session = &run->sessions[i];
+    trace_decoder_t d;
+    if (i == 0) {
+      d = *run->carry;
+    }
+    else {
+      memset(&d, 0, sizeof(d));
+      d.keys = run->keys;
+      d.state = DECODE_PLAIN;
+      d.uid = session->uid;
+    }
+    d.out = out;
+    d.auths = d.wrong_keys = 0;
+
+    for (size_t f = session->begin; f < session->end; ++f)
+      decode_frame(&d, &run->frames[f]);
+
+    auths += d.auths;
+    wrong_keys += d.wrong_keys;
+    if (i == run->count - 1)
+      run->next_carry = d;
+  }
+
+  bool ok = fclose(out) == 0;
+  pthread_mutex_lock(&run->mutex);
+  run->auths += auths;
+  run->wrong_keys += wrong_keys;
+  pthread_mutex_unlock(&run->mutex);
+  return ok;
+}
+
+int trace_decode(const char* fn, const mf_tag_t* keys, FILE* out) {
+  trace_frame_t* frames = malloc(DECODE_BLOCK * sizeof(trace_frame_t));
+  decode_session_t* sessions = malloc(DECODE_BLOCK * sizeof(decode_session_t));
+  decode_run_t* run = calloc(1, sizeof(decode_run_t));
+  if (frames == NULL || sessions == NULL || run == NULL) {
+    printf("Out of memory.\n");
+    free(frames);
+    free(sessions);
+    free(run);
+    return -1;
+  }
+
+  FILE* file = trace_file_open(fn);
+  if (file == NULL) {
+    free(frames);
+    free(sessions);
+    free(run);
+    return -1;
+  }
+
+  trace_decoder_t carry;
+  memset(&carry, 0, sizeof(carry));
+  carry.keys = keys;
+  carry.state = DECODE_PLAIN;
+  run->keys = keys;
+  run->frames = frames;
+  run->sessions = sessions;
+  run->carry = &carry;
+  pthread_mutex_init(&run->mutex, NULL);
+
+  double start = parallel_time();
+  size_t total = 0;
+  uint32_t uid = 0;
+  int res = 1;
+  while (res == 1) {
+    size_t n = 0;
+    while (n < DECODE_BLOCK && (res = trace_file_read(file, &frames[n])) == 1)
+      ++n;
+    if (res < 0 || n == 0)
+      break;
+    total += n;
+
+    // Cut the block at each REQA/WUPA or select
+    run->count = 1;
+    sessions[0].begin = 0;
+    sessions[0].uid = carry.uid;
+    for (size_t i = 0; i < n; ++i) {
+      if (i > 0 && trace_is_reset(&frames[i])) {
+        sessions[run->count - 1].end = i;
+        sessions[run->count].begin = i;
+        sessions[run->count].uid = uid;
+        ++run->count;
+      }
+      if (trace_is_select(&frames[i]))
+        uid = trace_word(frames[i].data + 2);
+    }
+    sessions[run->count - 1].end = n;
+
+    memset(run->text, 0, sizeof(run->text));
+    memset(run->text_len, 0, sizeof(run->text_len));
+    if (parallel_for(run->count, DECODE_CHUNK, decode_chunk, run))
+      res = -1;
+
+    // Written in order
+    for (size_t i = 0; i <= (run->count - 1) / DECODE_CHUNK; ++i) {
+      if (res >= 0)
+        fwrite(run->text[i], 1, run->text_len[i], out);
+      free(run->text[i]);
+    }
+    carry = run->next_carry;
+  }
+
+  double elapsed = parallel_time() - start;
+  double bytes = (double)ftello(file);
+  trace_file_close(file);
+  pthread_mutex_destroy(&run->mutex);
+  size_t auths = run->auths, wrong_keys = run->wrong_keys;
+  free(frames);
+  free(sessions);
+  free(run);
+
+  if (fflush(out) != 0 || ferror(out)) {
+    printf("Could not write the decoded trace.\n");
+    return -1;
+  }
+  if (res < 0)
+    return -1;
+
+  printf("Decoded %zu frames, %zu authentications (%zu with a wrong key) "
+         "in %.2fs, %.1f MB/s (%zu threads).\n", total, auths, wrong_keys,
+         elapsed, elapsed > 0 ? bytes / elapsed / 1e6 : 0.0,
+         parallel_threads());
+  return 0;
+}
@@ -0,0 +1,83 @@
+#ifndef TRACE__H
+#define TRACE__H
+
+/**
+ * Copyright (C) 2011 Anders Sundman <anders@4zm.org>
+ *
+ * This file is part of mfterm.
+ *
+ * mfterm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * mfterm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with mfterm.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "tag.h"
+#include "crack.h"
+
+/**
+ * A trace is a sniffed reader/tag session in a text file, one frame
+ * per line: R (sent by the reader) or T (sent by the tag), then the
+ * bytes in hex, optionally separated by spaces. The CRC bytes are kept
+ * as sent. Empty lines and lines starting with # are skipped.
+ *
+ *   R 93 70 01 02 03 04 04 b3 3c
+ *   R 60 14 50 2d
+ *   T 4d 2f 1a 03
+ *   R 15d4ff0d 654cb922
+ *   T f9cb4e70
+ */
+#define TRACE_MAX_FRAME 64
+
+typedef struct {
+  bool reader;    // Sent by the reader, else by the tag
+  size_t len;
+  uint8_t data[TRACE_MAX_FRAME];
+} trace_frame_t;
+
+// Open a trace file for reading. NULL on failure.
+FILE* trace_file_open(const char* fn);
+
+// Create a trace file for writing, e.g. a decoded trace. NULL on failure.
+FILE* trace_file_create(const char* fn);
+
+// Read the next frame. Return 1 if a frame was read, 0 at the end of
+// the file and -1 on a line that isn't a frame.
+int trace_file_read(FILE* file, trace_frame_t* frame);
+
+// Close the file
+void trace_file_close(FILE* file);
+
+/**
+ * Find the plain (not nested) authentications with the key type to the
+ * sector in a trace: the auth command, the tag nonce, the reader nonce
+ * and answer and, if there is one, the tag answer. The UID is taken
+ * from the last select. Up to max of them are stored in auths.
+ * Return the number found, or -1 on error.
+ */
+int trace_find_auths(const char* fn, mf_key_type_t key_type, size_t sector,
+                     crack_auth_t* auths, size_t max);
+
+/**
+ * Decrypt a trace with the keys (trailers of a tag or key dump) and
+ * write it to out, in the same format with the plain bytes. Each frame
+ * is annotated: the command name and block, the nonces and answers of
+ * the authentications (also nested ones) and whether they fit the key.
+ * A 4 bit answer (ACK/NACK) is a frame of one byte. The frames after an
+ * authentication with a wrong key are written as they are, up to the
+ * next select. Return 0 on success, -1 on error or if cancelled.
+ */
+int trace_decode(const char* fn, const mf_tag_t* keys, FILE* out);
+
+#endif